@@ -62,7 +62,9 @@ CREATE TABLE device_%deviceid_songs (
   lyrics TEXT,
 
   originalyear INTEGER,
-  effective_originalyear INTEGER
+  effective_originalyear INTEGER,
+
+  file_fingerprint TEXT
 );
 
 CREATE INDEX idx_device_%deviceid_songs_album ON device_%deviceid_songs (album);
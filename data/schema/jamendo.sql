@@ -49,7 +49,9 @@ CREATE TABLE jamendo.songs (
   lyrics TEXT,
 
   originalyear INTEGER,
-  effective_originalyear INTEGER
+  effective_originalyear INTEGER,
+
+  file_fingerprint TEXT
 );
 
 CREATE VIRTUAL TABLE jamendo.songs_fts USING fts3(
@@ -0,0 +1,14 @@
+CREATE TABLE scan_journal (
+  songs_table TEXT NOT NULL,
+  directory INTEGER NOT NULL,
+  path TEXT NOT NULL,
+  mtime INTEGER NOT NULL,
+  is_new INTEGER NOT NULL DEFAULT 0,
+  force_noincremental INTEGER NOT NULL DEFAULT 0,
+  ignores_mtime INTEGER NOT NULL DEFAULT 0,
+  incremental INTEGER NOT NULL DEFAULT 1
+);
+
+CREATE UNIQUE INDEX idx_scan_journal ON scan_journal (songs_table, directory, path);
+
+UPDATE schema_version SET version=52;
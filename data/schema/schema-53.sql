@@ -0,0 +1,3 @@
+ALTER TABLE %allsongstables ADD COLUMN file_fingerprint TEXT;
+
+UPDATE schema_version SET version=53;
@@ -0,0 +1,32 @@
+CREATE TABLE songs_revisions (
+  song_id INTEGER PRIMARY KEY,
+  revision INTEGER NOT NULL,
+  deleted INTEGER NOT NULL DEFAULT 0
+);
+
+CREATE INDEX idx_songs_revisions_revision ON songs_revisions (revision);
+
+INSERT INTO songs_revisions (song_id, revision, deleted)
+  SELECT ROWID, 1, unavailable != 0 FROM songs;
+
+CREATE TRIGGER songs_revisions_insert AFTER INSERT ON songs BEGIN
+  INSERT OR REPLACE INTO songs_revisions (song_id, revision, deleted)
+    VALUES (new.ROWID,
+            (SELECT IFNULL(MAX(revision), 0) + 1 FROM songs_revisions),
+            new.unavailable != 0);
+END;
+
+CREATE TRIGGER songs_revisions_update AFTER UPDATE ON songs BEGIN
+  INSERT OR REPLACE INTO songs_revisions (song_id, revision, deleted)
+    VALUES (new.ROWID,
+            (SELECT IFNULL(MAX(revision), 0) + 1 FROM songs_revisions),
+            new.unavailable != 0);
+END;
+
+CREATE TRIGGER songs_revisions_delete AFTER DELETE ON songs BEGIN
+  INSERT OR REPLACE INTO songs_revisions (song_id, revision, deleted)
+    VALUES (old.ROWID,
+            (SELECT IFNULL(MAX(revision), 0) + 1 FROM songs_revisions), 1);
+END;
+
+UPDATE schema_version SET version=55;
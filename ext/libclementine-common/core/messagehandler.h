@@ -108,6 +108,15 @@ class AbstractMessageHandler : public _MessageHandlerBase {
   // reply on the socket.  Used on the worker side.
   void SendReply(const MessageType& request, MessageType* reply);
 
+  // The number of requests sent with SendRequest that haven't been replied to
+  // yet.
+  int pending_count() const { return pending_replies_.count(); }
+
+  // Forgets about all the requests that haven't been replied to yet and
+  // returns them in the order they were sent, without aborting them.  The
+  // caller takes ownership of the replies.
+  QList<ReplyType*> TakePendingReplies();
+
  protected:
   // Called when a message is received from the socket.
   virtual void MessageArrived(const MessageType& message) {}
@@ -173,6 +182,15 @@ bool AbstractMessageHandler<MT>::RawMessageArrived(const QByteArray& data) {
   return true;
 }
 
+template <typename MT>
+QList<typename AbstractMessageHandler<MT>::ReplyType*>
+AbstractMessageHandler<MT>::TakePendingReplies() {
+  // IDs are sequential, so the map is already in the order they were sent.
+  QList<ReplyType*> ret = pending_replies_.values();
+  pending_replies_.clear();
+  return ret;
+}
+
 template <typename MT>
 void AbstractMessageHandler<MT>::AbortAll() {
   for (ReplyType* reply : pending_replies_) {
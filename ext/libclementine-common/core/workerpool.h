@@ -20,6 +20,7 @@
 
 #include <QAtomicInt>
 #include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QLocalServer>
 #include <QLocalSocket>
@@ -27,7 +28,9 @@
 #include <QObject>
 #include <QProcess>
 #include <QQueue>
+#include <QSet>
 #include <QThread>
+#include <QTimer>
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
 #include <QRandomGenerator>
@@ -55,6 +58,8 @@ signals:
   virtual void NewConnection() {}
   virtual void ProcessError(QProcess::ProcessError) {}
   virtual void SendQueuedMessages() {}
+  virtual void ReplyFinished() {}
+  virtual void CheckDeadlines() {}
 };
 
 // Manages a pool of one or more external processes.  A local socket server is
@@ -62,6 +67,12 @@ signals:
 // argv[1].  The process is expected to connect back to the socket server, and
 // when it does a HandlerType is created for it.
 // Instances of HandlerType are created in the WorkerPool's thread.
+//
+// Requests are queued in the pool and handed to the connected worker with the
+// fewest requests in flight, up to SetMaxRequestsPerWorker() at a time, so a
+// worker that is stuck on one request doesn't collect a backlog while the
+// others are idle.  A worker that doesn't answer a request before its
+// deadline is killed and restarted.
 template <typename HandlerType>
 class WorkerPool : public _WorkerPoolBase {
  public:
@@ -85,13 +96,42 @@ class WorkerPool : public _WorkerPoolBase {
   // is appended to this name when creating each server.
   void SetLocalServerName(const QString& local_server_name);
 
+  // Sets how many requests may be sent to one worker before it has replied to
+  // the first.  More than one keeps the worker busy while the reply to the
+  // previous request is on its way back.  Defaults to
+  // kDefaultMaxRequestsPerWorker.
+  void SetMaxRequestsPerWorker(int count);
+
+  // Sets the deadline used for requests that don't give their own, in
+  // milliseconds after the request is sent to a worker.  0 means requests
+  // don't have a deadline, which is the default.
+  void SetRequestTimeout(int msec);
+
   // Starts all workers.
   void Start();
 
   // Fills in the message's "id" field and creates a reply future.  The message
-  // is queued and the WorkerPool's thread will send it to the next available
-  // worker.  Can be called from any thread.
-  ReplyType* SendMessageWithReply(MessageType* message);
+  // is queued and the WorkerPool's thread will send it to the least busy
+  // worker.  If the worker hasn't replied timeout_msec after that, the reply
+  // is aborted and the worker is restarted.  A timeout of -1 uses the default
+  // set with SetRequestTimeout(), 0 means no deadline.  Can be called from any
+  // thread.
+  ReplyType* SendMessageWithReply(MessageType* message, int timeout_msec = -1);
+
+  // Number of requests waiting for a free worker.  Can be called from any
+  // thread.
+  int queued_count() const { return queued_count_.load(); }
+
+  // Number of requests sent to a worker that haven't been replied to yet.  Can
+  // be called from any thread.
+  int in_flight_count() const { return in_flight_count_.load(); }
+
+  // Number of requests that were aborted because they missed their deadline.
+  // Can be called from any thread.
+  int timed_out_count() const { return timed_out_count_.load(); }
+
+  static const int kDefaultMaxRequestsPerWorker;
+  static const int kDeadlineCheckIntervalMsec;
 
  protected:
   // These are all reimplemented slots, they are called on the WorkerPool's
@@ -100,6 +140,8 @@ class WorkerPool : public _WorkerPoolBase {
   void NewConnection();
   void ProcessError(QProcess::ProcessError error);
   void SendQueuedMessages();
+  void ReplyFinished();
+  void CheckDeadlines();
 
  private:
   struct Worker {
@@ -115,6 +157,21 @@ class WorkerPool : public _WorkerPoolBase {
     HandlerType* handler_;
   };
 
+  struct Request {
+    Request(ReplyType* reply = NULL, int timeout_msec = 0)
+        : reply_(reply), timeout_msec_(timeout_msec) {}
+
+    ReplyType* reply_;
+    int timeout_msec_;
+  };
+
+  struct InFlight {
+    HandlerType* handler_;
+    int timeout_msec_;
+    // Time on clock_ when the request times out, or 0 if it doesn't.
+    qint64 deadline_;
+  };
+
   // Must only ever be called on my thread.
   void StartOneWorker(Worker* worker);
 
@@ -142,32 +199,69 @@ class WorkerPool : public _WorkerPoolBase {
   // thread
   ReplyType* NewReply(MessageType* message);
 
-  // Returns the next handler, or NULL if there isn't one.  Must be called from
-  // my thread.
+  // Returns the connected handler with the fewest requests in flight, or NULL
+  // if there isn't one that can take another request.  Must be called from my
+  // thread.
   HandlerType* NextHandler() const;
 
+  // Sends the request to the handler and starts its deadline.  Must be called
+  // from my thread with message_queue_mutex_ held.
+  void SendRequest(HandlerType* handler, const Request& request);
+
+  // Aborts the worker's requests that have missed their deadline, queues the
+  // rest again and restarts the worker.  Must be called from my thread.
+  void RestartHungWorker(Worker* worker, qint64 now);
+
  private:
   QString local_server_name_;
   QString executable_name_;
   QString executable_path_;
 
   int worker_count_;
+  int max_requests_per_worker_;
+  int request_timeout_msec_;
   mutable int next_worker_;
   QList<Worker> workers_;
 
   QAtomicInt next_id_;
 
   QMutex message_queue_mutex_;
-  QQueue<ReplyType*> message_queue_;
+  QQueue<Request> message_queue_;
+
+  QHash<ReplyType*, InFlight> in_flight_;
+  QElapsedTimer clock_;
+  QTimer* deadline_timer_;
+
+  QAtomicInt queued_count_;
+  QAtomicInt in_flight_count_;
+  QAtomicInt timed_out_count_;
 };
 
+template <typename HandlerType>
+const int WorkerPool<HandlerType>::kDefaultMaxRequestsPerWorker = 2;
+
+template <typename HandlerType>
+const int WorkerPool<HandlerType>::kDeadlineCheckIntervalMsec = 1000;
+
 template <typename HandlerType>
 WorkerPool<HandlerType>::WorkerPool(QObject* parent)
-    : _WorkerPoolBase(parent), next_worker_(0), next_id_(0) {
+    : _WorkerPoolBase(parent),
+      max_requests_per_worker_(kDefaultMaxRequestsPerWorker),
+      request_timeout_msec_(0),
+      next_worker_(0),
+      next_id_(0),
+      deadline_timer_(new QTimer(this)),
+      queued_count_(0),
+      in_flight_count_(0),
+      timed_out_count_(0) {
   worker_count_ = qBound(1, QThread::idealThreadCount() / 2, 2);
   local_server_name_ = qApp->applicationName().toLower();
 
   if (local_server_name_.isEmpty()) local_server_name_ = "workerpool";
+
+  clock_.start();
+  deadline_timer_->setInterval(kDeadlineCheckIntervalMsec);
+  connect(deadline_timer_, SIGNAL(timeout()), SLOT(CheckDeadlines()));
 }
 
 template <typename HandlerType>
@@ -193,8 +287,8 @@ WorkerPool<HandlerType>::~WorkerPool() {
     }
   }
 
-  for (ReplyType* reply : message_queue_) {
-    reply->Abort();
+  for (const Request& request : message_queue_) {
+    request.reply_->Abort();
   }
 }
 
@@ -218,6 +312,18 @@ void WorkerPool<HandlerType>::SetExecutableName(
   executable_name_ = executable_name;
 }
 
+template <typename HandlerType>
+void WorkerPool<HandlerType>::SetMaxRequestsPerWorker(int count) {
+  Q_ASSERT(workers_.isEmpty());
+  max_requests_per_worker_ = qMax(1, count);
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::SetRequestTimeout(int msec) {
+  Q_ASSERT(workers_.isEmpty());
+  request_timeout_msec_ = qMax(0, msec);
+}
+
 template <typename HandlerType>
 void WorkerPool<HandlerType>::Start() {
   metaObject()->invokeMethod(this, "DoStart");
@@ -364,13 +470,16 @@ typename WorkerPool<HandlerType>::ReplyType* WorkerPool<HandlerType>::NewReply(
 
 template <typename HandlerType>
 typename WorkerPool<HandlerType>::ReplyType*
-WorkerPool<HandlerType>::SendMessageWithReply(MessageType* message) {
+WorkerPool<HandlerType>::SendMessageWithReply(MessageType* message,
+                                              int timeout_msec) {
   ReplyType* reply = NewReply(message);
+  if (timeout_msec < 0) timeout_msec = request_timeout_msec_;
 
   // Add the pending reply to the queue
   {
     QMutexLocker l(&message_queue_mutex_);
-    message_queue_.enqueue(reply);
+    message_queue_.enqueue(Request(reply, timeout_msec));
+    queued_count_.store(message_queue_.count());
   }
 
   // Wake up the main thread
@@ -384,34 +493,148 @@ void WorkerPool<HandlerType>::SendQueuedMessages() {
   QMutexLocker l(&message_queue_mutex_);
 
   while (!message_queue_.isEmpty()) {
-    ReplyType* reply = message_queue_.dequeue();
-
     // Find a worker for this message
     HandlerType* handler = NextHandler();
     if (!handler) {
-      // No available handlers - put the message on the front of the queue.
-      message_queue_.prepend(reply);
-      qLog(Debug) << "No available handlers to process request";
+      // Either no worker is connected yet, or they are all busy.  The message
+      // stays on the queue until one connects or replies.
+      if (in_flight_.isEmpty()) {
+        qLog(Debug) << "No available handlers to process request";
+      }
       break;
     }
 
-    handler->SendRequest(reply);
+    SendRequest(handler, message_queue_.dequeue());
+  }
+  queued_count_.store(message_queue_.count());
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::SendRequest(HandlerType* handler,
+                                          const Request& request) {
+  InFlight flight;
+  flight.handler_ = handler;
+  flight.timeout_msec_ = request.timeout_msec_;
+  flight.deadline_ =
+      request.timeout_msec_ ? clock_.elapsed() + request.timeout_msec_ : 0;
+
+  in_flight_[request.reply_] = flight;
+  in_flight_count_.store(in_flight_.count());
+
+  connect(request.reply_, SIGNAL(Finished(bool)), SLOT(ReplyFinished()),
+          Qt::UniqueConnection);
+  if (flight.deadline_ && !deadline_timer_->isActive()) {
+    deadline_timer_->start();
+  }
+
+  handler->SendRequest(request.reply_);
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::ReplyFinished() {
+  Q_ASSERT(QThread::currentThread() == thread());
+
+  // The reply is still alive: whoever owns it can only delete it after it
+  // has finished, which is when this is called.
+  ReplyType* reply = static_cast<ReplyType*>(sender());
+  if (!in_flight_.remove(reply)) return;
+  in_flight_count_.store(in_flight_.count());
+
+  // The worker that sent this reply can take another request.
+  SendQueuedMessages();
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::CheckDeadlines() {
+  Q_ASSERT(QThread::currentThread() == thread());
+
+  const qint64 now = clock_.elapsed();
+  bool has_deadlines = false;
+  QSet<HandlerType*> hung_handlers;
+
+  for (typename QHash<ReplyType*, InFlight>::const_iterator it =
+           in_flight_.constBegin();
+       it != in_flight_.constEnd(); ++it) {
+    if (!it->deadline_) continue;
+    has_deadlines = true;
+    if (it->deadline_ <= now) hung_handlers << it->handler_;
+  }
+
+  if (!has_deadlines) {
+    deadline_timer_->stop();
+    return;
+  }
+
+  for (HandlerType* handler : hung_handlers) {
+    // The handler might belong to a worker that has already been restarted,
+    // in which case its requests are aborted when it's deleted.
+    Worker* worker = FindWorker(&Worker::handler_, handler);
+    if (worker) RestartHungWorker(worker, now);
+  }
+
+  if (!hung_handlers.isEmpty()) SendQueuedMessages();
+}
+
+template <typename HandlerType>
+void WorkerPool<HandlerType>::RestartHungWorker(Worker* worker, qint64 now) {
+  QList<Request> requeue;
+
+  for (ReplyType* reply : worker->handler_->TakePendingReplies()) {
+    const InFlight flight = in_flight_.take(reply);
+    disconnect(reply, SIGNAL(Finished(bool)), this, SLOT(ReplyFinished()));
+
+    if (flight.deadline_ && flight.deadline_ <= now) {
+      qLog(Warning) << "Worker" << worker << "didn't reply to request"
+                    << reply->id() << "within" << flight.timeout_msec_
+                    << "ms - restarting";
+      timed_out_count_.ref();
+      reply->Abort();
+    } else {
+      requeue << Request(reply, flight.timeout_msec_);
+    }
+  }
+  in_flight_count_.store(in_flight_.count());
+
+  // Put the other requests back at the front of the queue, in the order they
+  // were sent.
+  {
+    QMutexLocker l(&message_queue_mutex_);
+    for (int i = requeue.count() - 1; i >= 0; --i) {
+      message_queue_.prepend(requeue[i]);
+    }
+    queued_count_.store(message_queue_.count());
   }
+
+  // Kill the process ourselves so its exit isn't reported as an error.
+  disconnect(worker->process_, SIGNAL(error(QProcess::ProcessError)), this,
+             SLOT(ProcessError(QProcess::ProcessError)));
+  worker->process_->kill();
+
+  StartOneWorker(worker);
 }
 
 template <typename HandlerType>
 HandlerType* WorkerPool<HandlerType>::NextHandler() const {
+  HandlerType* ret = NULL;
+  int ret_index = -1;
+  int ret_load = max_requests_per_worker_;
+
+  // Start after the last worker used, so that idle workers are used in turn.
   for (int i = 0; i < workers_.count(); ++i) {
     const int worker_index = (next_worker_ + i) % workers_.count();
-
-    if (workers_[worker_index].handler_ &&
-        !workers_[worker_index].handler_->is_device_closed()) {
-      next_worker_ = (worker_index + 1) % workers_.count();
-      return workers_[worker_index].handler_;
+    HandlerType* handler = workers_[worker_index].handler_;
+    if (!handler || handler->is_device_closed()) continue;
+
+    const int load = handler->pending_count();
+    if (load < ret_load) {
+      ret = handler;
+      ret_index = worker_index;
+      ret_load = load;
     }
   }
 
-  return NULL;
+  if (ret) next_worker_ = (ret_index + 1) % workers_.count();
+  return ret;
 }
 
 #endif  // WORKERPOOL_H
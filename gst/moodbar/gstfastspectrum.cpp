@@ -113,6 +113,7 @@ gst_fastspectrum_class_init (GstFastSpectrumClass * klass)
   gst_caps_unref (caps);
 
   klass->fftw_lock = new QMutex;
+  klass->fftw_plans = new std::map<guint, fftw_plan>;
 }
 
 static void
@@ -126,6 +127,26 @@ gst_fastspectrum_init (GstFastSpectrum * spectrum)
   g_mutex_init (&spectrum->lock);
 }
 
+static fftw_plan
+gst_fastspectrum_get_plan (GstFastSpectrumClass * klass, guint nfft)
+{
+  QMutexLocker l(klass->fftw_lock);
+
+  fftw_plan& plan = (*klass->fftw_plans)[nfft];
+  if (!plan) {
+    // The plan is only used with fftw_execute_dft_r2c, so these buffers just
+    // have to have the same alignment as the ones it will be executed on.
+    double* input = reinterpret_cast<double*>(
+        fftw_malloc(sizeof(double) * nfft));
+    fftw_complex* output = reinterpret_cast<fftw_complex*>(
+        fftw_malloc(sizeof(fftw_complex) * (nfft/2+1)));
+    plan = fftw_plan_dft_r2c_1d(nfft, input, output, FFTW_ESTIMATE);
+    fftw_free(input);
+    fftw_free(output);
+  }
+  return plan;
+}
+
 static void
 gst_fastspectrum_alloc_channel_data (GstFastSpectrum * spectrum)
 {
@@ -142,27 +163,14 @@ gst_fastspectrum_alloc_channel_data (GstFastSpectrum * spectrum)
 
   GstFastSpectrumClass* klass = reinterpret_cast<GstFastSpectrumClass*>(
       G_OBJECT_GET_CLASS(spectrum));
-  {
-    QMutexLocker l(klass->fftw_lock);
-    spectrum->plan = fftw_plan_dft_r2c_1d(
-        nfft,
-        spectrum->fft_input,
-        spectrum->fft_output,
-        FFTW_ESTIMATE);
-  }
+  spectrum->plan = gst_fastspectrum_get_plan(klass, nfft);
   spectrum->channel_data_initialised = true;
 }
 
 static void
 gst_fastspectrum_free_channel_data (GstFastSpectrum * spectrum)
 {
-  GstFastSpectrumClass* klass = reinterpret_cast<GstFastSpectrumClass*>(
-      G_OBJECT_GET_CLASS(spectrum));
   if (spectrum->channel_data_initialised) {
-    {
-      QMutexLocker l(klass->fftw_lock);
-      fftw_destroy_plan(spectrum->plan);
-    }
     fftw_free(spectrum->fft_input);
     fftw_free(spectrum->fft_output);
     delete[] spectrum->input_ring_buffer;
@@ -394,8 +402,9 @@ gst_fastspectrum_run_fft (GstFastSpectrum * spectrum, guint input_pos)
     spectrum->fft_input[i] =
         spectrum->input_ring_buffer[(input_pos + i) % nfft];
 
-  // Should be safe to execute the same plan multiple times in parallel.
-  fftw_execute(spectrum->plan);
+  // The plan is shared with other instances, so run it on our own buffers.
+  fftw_execute_dft_r2c(spectrum->plan, spectrum->fft_input,
+      spectrum->fft_output);
 
   gdouble val;
   /* Calculate magnitude in db */
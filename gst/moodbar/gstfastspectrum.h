@@ -30,6 +30,7 @@
 #define GST_MOODBAR_FASTSPECTRUM_H_
 
 #include <functional>
+#include <map>
 
 #include <gst/gst.h>
 #include <gst/audio/gstaudiofilter.h>
@@ -71,7 +72,7 @@ struct GstFastSpectrum {
   double* fft_input;
   fftw_complex* fft_output;
   double* spect_magnitude;
-  fftw_plan plan;
+  fftw_plan plan;               /* shared, owned by the class */
 
   guint input_pos;
   guint64 error_per_interval;
@@ -87,8 +88,13 @@ struct GstFastSpectrum {
 struct GstFastSpectrumClass {
   GstAudioFilterClass parent_class;
 
-  // Static lock for creating & destroying FFTW plans.
+  // Static lock for creating FFTW plans and accessing fftw_plans.
   QMutex* fftw_lock;
+
+  // FFTW plans shared by every instance, keyed by FFT size.  Plans are never
+  // destroyed, and are executed on each instance's own buffers with
+  // fftw_execute_dft_r2c, which is safe to do from several threads at once.
+  std::map<guint, fftw_plan>* fftw_plans;
 };
 
 GType gst_fastspectrum_get_type (void);
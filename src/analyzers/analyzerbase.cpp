@@ -63,7 +63,7 @@ static const int sBarkBandCount = arraysize(sBarkBands);
 Analyzer::Base::Base(QWidget* parent, uint scopeSize)
     : QWidget(parent),
       timeout_(40),  // msec
-      fht_(new FHT(scopeSize)),
+      fht_(new VectorFHT(scopeSize)),
       engine_(nullptr),
       lastScope_(512),
       new_frame_(false),
@@ -144,7 +144,7 @@ int Analyzer::Base::resizeExponent(int exp) {
 
   if (exp != fht_->sizeExp()) {
     delete fht_;
-    fht_ = new FHT(exp);
+    fht_ = new VectorFHT(exp);
   }
   return exp;
 }
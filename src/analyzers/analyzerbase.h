@@ -39,7 +39,7 @@
 
 #include "engines/engine_fwd.h"
 #include "engines/enginebase.h"
-#include "fht.h"
+#include "vectorfht.h"
 
 #ifdef HAVE_OPENGL
 #include <QGLWidget>
@@ -107,7 +107,7 @@ class Base : public QWidget {
 
   QBasicTimer timer_;
   uint timeout_;
-  FHT* fht_;
+  VectorFHT* fht_;
   EngineBase* engine_;
   Scope lastScope_;
 
@@ -0,0 +1,276 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vectorfht.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __GNUC__
+#define VECTORFHT_INLINE inline __attribute__((always_inline))
+#else
+#define VECTORFHT_INLINE inline
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTORFHT_X86
+#endif
+
+struct VectorFHT::Kernels {
+  const char* name;
+  void (*butterflies)(const float* src, float* dst, int n, int half,
+                      const float* cos_table, const float* sin_table);
+  void (*power2)(const float* h, float* p, int n);
+  void (*magnitude)(float* p, int count);
+  void (*decibels)(float* p, int count);
+};
+
+namespace {
+
+// The kernel bodies.  These are written as plain loops without
+// loop-carried dependencies so the compiler can vectorize them, and are
+// force-inlined into one wrapper per instruction set below.
+
+// One radix-2 stage: combines pairs of Hartley transforms of length half
+// from src into transforms of length 2 * half in dst.
+VECTORFHT_INLINE void Butterflies(const float* __restrict src,
+                                  float* __restrict dst, int n, int half,
+                                  const float* __restrict cos_table,
+                                  const float* __restrict sin_table) {
+  for (int start = 0; start < n; start += 2 * half) {
+    const float* e = src + start;
+    const float* o = e + half;
+    float* lo = dst + start;
+    float* hi = lo + half;
+
+    lo[0] = e[0] + o[0];
+    hi[0] = e[0] - o[0];
+    for (int k = 1; k < half; ++k) {
+      const float t = o[k] * cos_table[k] + o[half - k] * sin_table[k];
+      lo[k] = e[k] + t;
+      hi[k] = e[k] - t;
+    }
+  }
+}
+
+VECTORFHT_INLINE void Power2(const float* __restrict h, float* __restrict p,
+                             int n) {
+  p[0] = 2 * h[0] * h[0];
+  for (int i = 1; i < n / 2; ++i) p[i] = h[i] * h[i] + h[n - i] * h[n - i];
+}
+
+VECTORFHT_INLINE void Magnitude(float* __restrict p, int count) {
+  for (int i = 0; i < count; ++i) p[i] = std::sqrt(p[i] * 0.5f);
+}
+
+// log2(x) for x >= 0, accurate to about 1e-6.  Splits x into exponent and
+// mantissa and evaluates the atanh series for the mantissa.  Zero and
+// denormals give large negative values, which the callers clamp.
+VECTORFHT_INLINE float FastLog2(float x) {
+  uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  const float exponent = static_cast<int>((bits >> 23) & 0xff) - 127;
+  bits = (bits & 0x007fffff) | 0x3f800000;
+  float m;
+  std::memcpy(&m, &bits, sizeof(m));
+
+  const float t = (m - 1.0f) / (m + 1.0f);
+  const float t2 = t * t;
+  const float series =
+      t * (2.0f +
+           t2 * (2.0f / 3 + t2 * (2.0f / 5 + t2 * (2.0f / 7 + t2 * 2.0f / 9))));
+  return exponent + series * static_cast<float>(M_LOG2E);
+}
+
+// 10 * log10(sqrt(p / 2)), clamped at 0.
+VECTORFHT_INLINE void Decibels(float* __restrict p, int count) {
+  const float kScale = 5.0f * static_cast<float>(M_LN2 / M_LN10);
+  for (int i = 0; i < count; ++i) {
+    const float e = kScale * FastLog2(p[i] * 0.5f);
+    p[i] = e < 0 ? 0 : e;
+  }
+}
+
+#define VECTORFHT_DEFINE_KERNELS(suffix, attributes)                       \
+  attributes void Butterflies##suffix(const float* src, float* dst, int n, \
+                                      int half, const float* cos_table,    \
+                                      const float* sin_table) {            \
+    Butterflies(src, dst, n, half, cos_table, sin_table);                  \
+  }                                                                        \
+  attributes void Power2##suffix(const float* h, float* p, int n) {        \
+    Power2(h, p, n);                                                       \
+  }                                                                        \
+  attributes void Magnitude##suffix(float* p, int count) {                 \
+    Magnitude(p, count);                                                   \
+  }                                                                        \
+  attributes void Decibels##suffix(float* p, int count) {                  \
+    Decibels(p, count);                                                    \
+  }
+
+#define VECTORFHT_KERNELS(suffix, name)                              \
+  {                                                                  \
+    name, &Butterflies##suffix, &Power2##suffix, &Magnitude##suffix, \
+        &Decibels##suffix                                            \
+  }
+
+VECTORFHT_DEFINE_KERNELS(Generic, )
+
+#ifdef VECTORFHT_X86
+VECTORFHT_DEFINE_KERNELS(SSE2, __attribute__((target("sse2"))))
+VECTORFHT_DEFINE_KERNELS(AVX2, __attribute__((target("avx2,fma"))))
+#endif
+
+const VectorFHT::Kernels* SelectKernels() {
+#ifdef VECTORFHT_X86
+  static const VectorFHT::Kernels kAVX2 = VECTORFHT_KERNELS(AVX2, "avx2");
+  static const VectorFHT::Kernels kSSE2 = VECTORFHT_KERNELS(SSE2, "sse2");
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return &kAVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return &kSSE2;
+  }
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  static const VectorFHT::Kernels kGeneric =
+      VECTORFHT_KERNELS(Generic, "neon");
+#else
+  static const VectorFHT::Kernels kGeneric =
+      VECTORFHT_KERNELS(Generic, "generic");
+#endif
+  return &kGeneric;
+}
+
+const VectorFHT::Kernels* ActiveKernels() {
+  static const VectorFHT::Kernels* kernels = SelectKernels();
+  return kernels;
+}
+
+}  // namespace
+
+VectorFHT::VectorFHT(int n)
+    : num_((n < 3) ? 0 : 1 << n),
+      exp2_((n < 3) ? -1 : n),
+      kernels_(ActiveKernels()) {
+  if (num_ == 0) return;
+
+  bitrev_.resize(num_);
+  for (int i = 0; i < num_; ++i) {
+    int reversed = 0;
+    for (int bit = 0; bit < exp2_; ++bit) {
+      reversed |= ((i >> bit) & 1) << (exp2_ - 1 - bit);
+    }
+    bitrev_[i] = reversed;
+  }
+
+  // The twiddle factors of the stage combining transforms of length half
+  // start at index half - 2.  The first stage (half == 1) needs none.
+  cos_.resize(num_ - 2);
+  sin_.resize(num_ - 2);
+  for (int half = 2; half < num_; half *= 2) {
+    for (int k = 0; k < half; ++k) {
+      const double angle = M_PI * k / half;
+      cos_[half - 2 + k] = std::cos(angle);
+      sin_[half - 2 + k] = std::sin(angle);
+    }
+  }
+
+  buf_a_.resize(num_);
+  buf_b_.resize(num_);
+}
+
+const char* VectorFHT::InstructionSet() { return ActiveKernels()->name; }
+
+const float* VectorFHT::hartley(const float* p) {
+  float* src = buf_a_.data();
+  float* dst = buf_b_.data();
+
+  const int* bitrev = bitrev_.constData();
+  for (int i = 0; i < num_; ++i) src[i] = p[bitrev[i]];
+
+  for (int half = 1; half < num_; half *= 2) {
+    const int offset = std::max(0, half - 2);
+    kernels_->butterflies(src, dst, num_, half, cos_.constData() + offset,
+                          sin_.constData() + offset);
+    std::swap(src, dst);
+  }
+  return src;
+}
+
+void VectorFHT::scale(float* p, float d) {
+  for (int i = 0; i < num_ / 2; ++i) p[i] *= d;
+}
+
+void VectorFHT::ewma(float* d, float* s, float w) {
+  for (int i = 0; i < num_ / 2; ++i) d[i] = d[i] * w + s[i] * (1 - w);
+}
+
+void VectorFHT::logSpectrum(float* out, float* p) {
+  const int n = num_ / 2;
+  if (log_.size() < n) {
+    log_.resize(n);
+    const float f = n / log10(static_cast<double>(n));
+    for (int i = 0; i < n; ++i) {
+      const int j = static_cast<int>(rint(log10(i + 1.0) * f));
+      log_[i] = j >= n ? n - 1 : j;
+    }
+  }
+  semiLogSpectrum(p);
+
+  *out++ = *p = *p / 100;
+  const int* r = log_.constData();
+  for (int k = 1, i = 1; i < n; ++i) {
+    const int j = *r++;
+    if (i == j) {
+      *out++ = p[i];
+    } else {
+      const float base = p[k - 1];
+      const float step = (p[j] - base) / (j - (k - 1));
+      for (float corr = 0; k <= j; k++, corr += step) *out++ = base + corr;
+    }
+  }
+}
+
+void VectorFHT::semiLogSpectrum(float* p) {
+  power2(p);
+  kernels_->decibels(p, num_ / 2);
+}
+
+void VectorFHT::spectrum(float* p) {
+  power2(p);
+  kernels_->magnitude(p, num_ / 2);
+}
+
+void VectorFHT::power(float* p) {
+  power2(p);
+  for (int i = 0; i < num_ / 2; ++i) p[i] /= 2;
+}
+
+void VectorFHT::power2(float* p) {
+  if (num_ == 0) return;
+  kernels_->power2(hartley(p), p, num_);
+}
+
+void VectorFHT::transform(float* p) {
+  if (num_ == 0) return;
+  const float* result = hartley(p);
+  std::copy(result, result + num_, p);
+}
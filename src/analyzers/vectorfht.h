@@ -0,0 +1,107 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ANALYZERS_VECTORFHT_H_
+#define ANALYZERS_VECTORFHT_H_
+
+#include <QVector>
+
+/**
+ * Drop-in replacement for FHT that the analyzers use on every repaint.
+ *
+ * The transform is computed iteratively (bit-reversal followed by one pass
+ * per stage) instead of recursively, so each stage is a flat loop over
+ * contiguous memory.  The stage butterflies and the power, magnitude and
+ * decibel loops are compiled once per instruction set (generic, SSE2,
+ * AVX2+FMA on x86) and the best one the CPU supports is picked at runtime.
+ * On ARM the compiler's NEON baseline is used.
+ *
+ * The results match FHT to within float rounding, except for the decibel
+ * scale which uses a polynomial log approximation (error < 0.001 dB).
+ */
+class VectorFHT {
+ public:
+  struct Kernels;
+
+  /**
+   * Prepare transform for data sets with @f$2^n@f$ numbers, whereby @f$n@f$
+   * should be at least 3.
+   */
+  explicit VectorFHT(int n);
+
+  int sizeExp() const { return exp2_; }
+  int size() const { return num_; }
+
+  // Name of the instruction set the kernels were selected for.
+  static const char* InstructionSet();
+
+  void scale(float*, float);
+
+  /**
+   * Exponentially Weighted Moving Average (EWMA) filter.
+   * @param d is the filtered data.
+   * @param s is fresh input.
+   * @param w is the weighting factor.
+   */
+  void ewma(float* d, float* s, float w);
+
+  /**
+   * Logarithmic audio spectrum.  @see FHT::logSpectrum()
+   */
+  void logSpectrum(float* out, float* p);
+
+  /**
+   * Semi-logarithmic audio spectrum.
+   */
+  void semiLogSpectrum(float*);
+
+  /**
+   * Fourier spectrum.
+   */
+  void spectrum(float*);
+
+  /**
+   * Mathematically correct FFT power spectrum.  @see FHT::power()
+   */
+  void power(float*);
+
+  /**
+   * FFT power spectrum with doubled values.  @see FHT::power2()
+   */
+  void power2(float*);
+
+  /**
+   * In-place discrete Hartley transform.
+   */
+  void transform(float*);
+
+ private:
+  // Runs the transform on p and returns the buffer holding the result.
+  const float* hartley(const float* p);
+
+  const int num_;
+  const int exp2_;
+  const Kernels* kernels_;
+
+  QVector<int> bitrev_;
+  QVector<float> cos_;
+  QVector<float> sin_;
+  QVector<float> buf_a_;
+  QVector<float> buf_b_;
+  QVector<int> log_;
+};
+
+#endif  // ANALYZERS_VECTORFHT_H_
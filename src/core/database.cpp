@@ -47,8 +47,9 @@
 #include "utilities.h"
 
 const char* Database::kDatabaseFilename = "clementine.db";
-const int Database::kSchemaVersion = 51;
+const int Database::kSchemaVersion = 55;
 const char* Database::kMagicAllSongsTables = "%allsongstables";
+const int Database::kBusyTimeoutMsec = 30000;
 
 int Database::sNextConnectionId = 1;
 QMutex Database::sNextConnectionIdMutex;
@@ -196,6 +197,46 @@ int Database::FTSNext(sqlite3_tokenizer_cursor* cursor, const char** token,
   return SQLITE_OK;
 }
 
+void Database::FTSRank(sqlite3_context* context, int argc,
+                       sqlite3_value** argv) {
+  // Weights of the columns of the songs FTS tables, in the order they're
+  // declared: title, album, artist and albumartist first.
+  static const double kColumnWeights[] = {4.0, 2.0, 3.0, 3.0};
+  static const int kWeightedColumns =
+      sizeof(kColumnWeights) / sizeof(kColumnWeights[0]);
+
+  // matchinfo() with the default "pcx" format: the number of phrases and
+  // columns, then for every phrase and column the hits in this row, the
+  // hits in all rows and the number of rows with a hit.
+  const unsigned int* info =
+      static_cast<const unsigned int*>(sqlite3_value_blob(argv[0]));
+  const int bytes = sqlite3_value_bytes(argv[0]);
+  if (!info || bytes < int(2 * sizeof(unsigned int))) {
+    sqlite3_result_error(context, "fts_rank expects matchinfo()", -1);
+    return;
+  }
+
+  const unsigned int phrases = info[0];
+  const unsigned int columns = info[1];
+  if (bytes < int((2 + 3 * phrases * columns) * sizeof(unsigned int))) {
+    sqlite3_result_error(context, "fts_rank expects matchinfo()", -1);
+    return;
+  }
+
+  double score = 0.0;
+  for (unsigned int phrase = 0; phrase < phrases; ++phrase) {
+    for (unsigned int column = 0; column < columns; ++column) {
+      const unsigned int* hits = info + 2 + 3 * (phrase * columns + column);
+      if (hits[0] == 0) continue;
+
+      const double weight =
+          int(column) < kWeightedColumns ? kColumnWeights[column] : 1.0;
+      score += weight * hits[0] / hits[1];
+    }
+  }
+  sqlite3_result_double(context, score);
+}
+
 void Database::StaticInit() {
   sFTSTokenizer = new sqlite3_tokenizer_module;
   sFTSTokenizer->iVersion = 0;
@@ -241,10 +282,7 @@ QSqlDatabase Database::Connect() {
     }
   }
 
-  const QString connection_id =
-      QString("%1_thread_%2")
-          .arg(connection_id_)
-          .arg(reinterpret_cast<quint64>(QThread::currentThread()));
+  const QString connection_id = ConnectionName(QString());
 
   // Try to find an existing connection for this thread
   QSqlDatabase db = QSqlDatabase::database(connection_id);
@@ -259,47 +297,21 @@ QSqlDatabase Database::Connect() {
   else
     db.setDatabaseName(directory_ + "/" + kDatabaseFilename);
 
+  // Connections on other threads may be writing at the same time.
+  db.setConnectOptions(
+      QString("QSQLITE_BUSY_TIMEOUT=%1").arg(kBusyTimeoutMsec));
+
   if (!db.open()) {
     app_->AddError("Database: " + db.lastError().text());
     return db;
   }
 
-  // Find Sqlite3 functions in the Qt plugin.
-  if (!sFTSTokenizer) StaticInit();
+  RegisterFtsTokenizer(db);
+  RegisterFtsRank(db);
 
-  {
-#ifdef SQLITE_DBCONFIG_ENABLE_FTS3_TOKENIZER
-    // In case sqlite>=3.12 is compiled without -DSQLITE_ENABLE_FTS3_TOKENIZER
-    // (generally a good idea due to security reasons) the fts3 support should
-    // be enabled explicitly. see
-    // https://github.com/clementine-player/Clementine/issues/5297
-    //
-    // See
-    // https://www.sqlite.org/fts3.html#custom_application_defined_tokenizers
-    QVariant v = db.driver()->handle();
-    if (v.isValid() && qstrcmp(v.typeName(), "sqlite3*") == 0) {
-      sqlite3* handle = *static_cast<sqlite3**>(v.data());
-      if (!handle ||
-          sqlite3_db_config(handle, SQLITE_DBCONFIG_ENABLE_FTS3_TOKENIZER, 1,
-                            nullptr) != SQLITE_OK) {
-        qLog(Fatal) << "Failed to enable FTS3 tokenizer";
-      }
-    }
-#endif
-
-    QSqlQuery set_fts_tokenizer(db);
-    set_fts_tokenizer.prepare("SELECT fts3_tokenizer(:name, :pointer)");
-    set_fts_tokenizer.bindValue(":name", "unicode");
-    set_fts_tokenizer.bindValue(
-        ":pointer", QByteArray(reinterpret_cast<const char*>(&sFTSTokenizer),
-                               sizeof(&sFTSTokenizer)));
-    if (!set_fts_tokenizer.exec()) {
-      qLog(Warning) << "Couldn't register FTS3 tokenizer : "
-                    << set_fts_tokenizer.lastError();
-    }
-    // Implicit invocation of ~QSqlQuery() when leaving the scope
-    // to release any remaining database locks!
-  }
+  // Readers use their own connections (see ConnectReadOnly), WAL lets them
+  // carry on while this one is writing.
+  if (injected_database_name_.isNull()) EnableWal(db, "main");
 
   if (db.tables().count() == 0) {
     // Set up initial schema
@@ -322,6 +334,11 @@ QSqlDatabase Database::Connect() {
       qFatal("Couldn't attach external database '%s'",
              key.toLatin1().constData());
     }
+
+    if (injected_database_name_.isNull() &&
+        !attached_databases_[key].is_temporary_) {
+      EnableWal(db, key);
+    }
   }
 
   if (startup_schema_version_ == -1) {
@@ -348,6 +365,126 @@ QSqlDatabase Database::Connect() {
   return db;
 }
 
+QSqlDatabase Database::ConnectReadOnly() {
+  // Each connection to an injected (test) database may well be a separate
+  // in-memory database, so only the read-write connection is any use there.
+  if (!injected_database_name_.isNull()) return Connect();
+
+  // This makes sure the schema is up to date and the attached databases
+  // exist before we try to open them read-only.
+  Connect();
+
+  QMutexLocker l(&connect_mutex_);
+
+  const QString connection_id = ConnectionName("_readonly");
+  QSqlDatabase db = QSqlDatabase::database(connection_id);
+  if (db.isOpen()) {
+    return db;
+  }
+
+  db = QSqlDatabase::addDatabase("QSQLITE", connection_id);
+  db.setDatabaseName(directory_ + "/" + kDatabaseFilename);
+  db.setConnectOptions(QString("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=%1")
+                           .arg(kBusyTimeoutMsec));
+
+  if (!db.open()) {
+    app_->AddError("Database: " + db.lastError().text());
+    return db;
+  }
+
+  RegisterFtsTokenizer(db);
+  RegisterFtsRank(db);
+
+  // Temporary databases are only attached to the connection that uses them.
+  for (const QString& key : attached_databases_.keys()) {
+    if (attached_databases_[key].is_temporary_) continue;
+
+    QSqlQuery q(db);
+    q.prepare("ATTACH DATABASE :filename AS :alias");
+    q.bindValue(":filename", attached_databases_[key].filename_);
+    q.bindValue(":alias", key);
+    if (!q.exec()) {
+      qLog(Warning) << "Couldn't attach external database" << key
+                    << "read-only:" << q.lastError();
+    }
+  }
+
+  return db;
+}
+
+QString Database::ConnectionName(const QString& suffix) const {
+  return QString("%1_thread_%2%3")
+      .arg(connection_id_)
+      .arg(reinterpret_cast<quint64>(QThread::currentThread()))
+      .arg(suffix);
+}
+
+void Database::EnableWal(QSqlDatabase& db, const QString& schema) {
+  QSqlQuery q(db);
+  if (!q.exec(QString("PRAGMA %1.journal_mode = WAL").arg(schema)) ||
+      !q.next() || q.value(0).toString().toLower() != "wal") {
+    qLog(Warning) << "Couldn't enable write-ahead logging for" << schema
+                  << "- readers will wait for writers";
+    return;
+  }
+
+  // In WAL mode this is still safe against application crashes, and avoids
+  // an fsync on every commit.
+  q.exec(QString("PRAGMA %1.synchronous = NORMAL").arg(schema));
+}
+
+void Database::RegisterFtsTokenizer(QSqlDatabase& db) {
+  // Find Sqlite3 functions in the Qt plugin.
+  if (!sFTSTokenizer) StaticInit();
+
+  {
+#ifdef SQLITE_DBCONFIG_ENABLE_FTS3_TOKENIZER
+    // In case sqlite>=3.12 is compiled without -DSQLITE_ENABLE_FTS3_TOKENIZER
+    // (generally a good idea due to security reasons) the fts3 support should
+    // be enabled explicitly. see
+    // https://github.com/clementine-player/Clementine/issues/5297
+    //
+    // See
+    // https://www.sqlite.org/fts3.html#custom_application_defined_tokenizers
+    QVariant v = db.driver()->handle();
+    if (v.isValid() && qstrcmp(v.typeName(), "sqlite3*") == 0) {
+      sqlite3* handle = *static_cast<sqlite3**>(v.data());
+      if (!handle ||
+          sqlite3_db_config(handle, SQLITE_DBCONFIG_ENABLE_FTS3_TOKENIZER, 1,
+                            nullptr) != SQLITE_OK) {
+        qLog(Fatal) << "Failed to enable FTS3 tokenizer";
+      }
+    }
+#endif
+
+    QSqlQuery set_fts_tokenizer(db);
+    set_fts_tokenizer.prepare("SELECT fts3_tokenizer(:name, :pointer)");
+    set_fts_tokenizer.bindValue(":name", "unicode");
+    set_fts_tokenizer.bindValue(
+        ":pointer", QByteArray(reinterpret_cast<const char*>(&sFTSTokenizer),
+                               sizeof(&sFTSTokenizer)));
+    if (!set_fts_tokenizer.exec()) {
+      qLog(Warning) << "Couldn't register FTS3 tokenizer : "
+                    << set_fts_tokenizer.lastError();
+    }
+    // Implicit invocation of ~QSqlQuery() when leaving the scope
+    // to release any remaining database locks!
+  }
+}
+
+void Database::RegisterFtsRank(QSqlDatabase& db) {
+  QVariant v = db.driver()->handle();
+  if (!v.isValid() || qstrcmp(v.typeName(), "sqlite3*") != 0) return;
+
+  sqlite3* handle = *static_cast<sqlite3**>(v.data());
+  if (!handle ||
+      sqlite3_create_function(handle, "fts_rank", 1, SQLITE_UTF8, nullptr,
+                              &Database::FTSRank, nullptr,
+                              nullptr) != SQLITE_OK) {
+    qLog(Warning) << "Couldn't register fts_rank function";
+  }
+}
+
 void Database::UpdateMainSchema(QSqlDatabase* db) {
   // Get the database's schema version
   int schema_version = 0;
@@ -396,6 +533,8 @@ void Database::RecreateAttachedDb(const QString& database_name) {
     if (!QFile::remove(filename)) {
       qLog(Warning) << "Failed to remove file" << filename;
     }
+    QFile::remove(filename + "-wal");
+    QFile::remove(filename + "-shm");
   }
 
   // We can't just re-attach the database now because it needs to be done for
@@ -64,8 +64,17 @@ class Database : public QObject {
   static const int kSchemaVersion;
   static const char* kDatabaseFilename;
   static const char* kMagicAllSongsTables;
+  static const int kBusyTimeoutMsec;
 
+  // Returns this thread's read-write connection.  Writers must hold Mutex()
+  // while they use it, so only one of them writes at a time.
   QSqlDatabase Connect();
+
+  // Returns this thread's read-only connection.  The database is in WAL mode,
+  // so reads on this connection don't need Mutex(): they see the last
+  // committed state and don't wait for a writer to finish.
+  QSqlDatabase ConnectReadOnly();
+
   bool CheckErrors(const QSqlQuery& query);
   QMutex* Mutex() { return &mutex_; }
 
@@ -104,6 +113,13 @@ class Database : public QObject {
   bool IntegrityCheck(QSqlDatabase db);
   void BackupFile(const QString& filename);
   bool OpenDatabase(const QString& filename, sqlite3** connection) const;
+  QString ConnectionName(const QString& suffix) const;
+  void EnableWal(QSqlDatabase& db, const QString& schema);
+  void RegisterFtsTokenizer(QSqlDatabase& db);
+  // Both kinds of connection get an fts_rank(matchinfo(fts_table)) SQL
+  // function that scores a full-text match.  Higher is better; hits in the
+  // title, artist and album count for more than hits in other columns.
+  void RegisterFtsRank(QSqlDatabase& db);
 
   Application* app_;
 
@@ -148,6 +164,9 @@ class Database : public QObject {
 
   static sqlite3_tokenizer_module* sFTSTokenizer;
 
+  static void FTSRank(sqlite3_context* context, int argc,
+                      sqlite3_value** argv);
+
   static int FTSCreate(int argc, const char* const* argv,
                        sqlite3_tokenizer** tokenizer);
   static int FTSDestroy(sqlite3_tokenizer* tokenizer);
@@ -21,6 +21,7 @@
 #define CORE_FILESYSTEMWATCHERINTERFACE_H_
 
 #include <QObject>
+#include <QStringList>
 
 class FileSystemWatcherInterface : public QObject {
   Q_OBJECT
@@ -31,10 +32,17 @@ class FileSystemWatcherInterface : public QObject {
   virtual void RemovePath(const QString& path) = 0;
   virtual void Clear() = 0;
 
+  // True if this implementation emits FilesChanged when only some files in a
+  // directory changed, rather than PathChanged for the whole directory.
+  virtual bool ReportsChangedFiles() const { return false; }
+
   static FileSystemWatcherInterface* Create(QObject* parent = nullptr);
 
  signals:
   void PathChanged(const QString& path);
+  // The given files inside the watched directory path were created, modified,
+  // moved or deleted, and nothing else in the directory changed.
+  void FilesChanged(const QString& path, const QStringList& files);
 };
 
 #endif  // CORE_FILESYSTEMWATCHERINTERFACE_H_
@@ -0,0 +1,159 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "inotifyfslistener.h"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <QFile>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include "core/logging.h"
+
+const int InotifyFSListener::kCoalesceDelayMsec = 200;
+
+namespace {
+// IN_CREATE is only interesting for directories - new files are picked up
+// when they are closed after writing.
+const uint32_t kWatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                            IN_MOVE_SELF | IN_ONLYDIR;
+}  // namespace
+
+InotifyFSListener::InotifyFSListener(QObject* parent)
+    : FileSystemWatcherInterface(parent),
+      fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+      notifier_(nullptr),
+      coalesce_timer_(new QTimer(this)) {
+  coalesce_timer_->setSingleShot(true);
+  coalesce_timer_->setInterval(kCoalesceDelayMsec);
+  connect(coalesce_timer_, SIGNAL(timeout()), SLOT(EmitChanges()));
+
+  if (fd_ == -1) {
+    qLog(Warning) << "Failed to initialise inotify";
+    return;
+  }
+
+  notifier_ = new QSocketNotifier(fd_, QSocketNotifier::Read, this);
+  connect(notifier_, SIGNAL(activated(int)), SLOT(ReadEvents()));
+}
+
+InotifyFSListener::~InotifyFSListener() {
+  if (fd_ != -1) close(fd_);
+}
+
+bool InotifyFSListener::AddPath(const QString& path) {
+  if (fd_ == -1) return false;
+  if (watches_by_path_.contains(path)) return true;
+
+  const int wd =
+      inotify_add_watch(fd_, QFile::encodeName(path).constData(), kWatchMask);
+  if (wd == -1) {
+    qLog(Warning) << "Failed to watch" << path << "-" << strerror(errno);
+    return false;
+  }
+
+  paths_by_watch_[wd] = path;
+  watches_by_path_[path] = wd;
+  return true;
+}
+
+void InotifyFSListener::RemovePath(const QString& path) {
+  if (!watches_by_path_.contains(path)) return;
+
+  const int wd = watches_by_path_.take(path);
+  paths_by_watch_.remove(wd);
+  inotify_rm_watch(fd_, wd);
+}
+
+void InotifyFSListener::Clear() {
+  for (int wd : paths_by_watch_.keys()) {
+    inotify_rm_watch(fd_, wd);
+  }
+  paths_by_watch_.clear();
+  watches_by_path_.clear();
+  changed_paths_.clear();
+  changed_files_.clear();
+}
+
+void InotifyFSListener::ReadEvents() {
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  forever {
+    const ssize_t length = read(fd_, buffer, sizeof(buffer));
+    if (length <= 0) break;
+
+    for (char* ptr = buffer; ptr < buffer + length;) {
+      const inotify_event* event = reinterpret_cast<inotify_event*>(ptr);
+      ptr += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        // We've lost track of what changed, so everything has to be rescanned.
+        qLog(Warning) << "inotify event queue overflowed";
+        for (const QString& path : watches_by_path_.keys()) {
+          changed_paths_ << path;
+        }
+        continue;
+      }
+
+      const QString path = paths_by_watch_.value(event->wd);
+      if (path.isEmpty()) continue;
+
+      if (event->mask & IN_IGNORED) {
+        // The kernel removed the watch, probably because the directory has
+        // gone.
+        paths_by_watch_.remove(event->wd);
+        watches_by_path_.remove(path);
+        continue;
+      }
+
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_ISDIR)) {
+        changed_paths_ << path;
+      } else if (event->len && !(event->mask & IN_CREATE)) {
+        changed_files_[path] << path + "/" + QFile::decodeName(event->name);
+      }
+    }
+  }
+
+  if (!changed_paths_.isEmpty() || !changed_files_.isEmpty()) {
+    coalesce_timer_->start();
+  }
+}
+
+void InotifyFSListener::EmitChanges() {
+  const QSet<QString> changed_paths = changed_paths_;
+  const QHash<QString, QSet<QString>> changed_files = changed_files_;
+  changed_paths_.clear();
+  changed_files_.clear();
+
+  for (const QString& path : changed_paths) {
+    emit PathChanged(path);
+  }
+
+  for (auto it = changed_files.constBegin(); it != changed_files.constEnd();
+       ++it) {
+    // The whole directory is going to be rescanned anyway.
+    if (changed_paths.contains(it.key())) continue;
+
+    emit FilesChanged(it.key(), it.value().toList());
+  }
+}
@@ -0,0 +1,71 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CORE_INOTIFYFSLISTENER_H_
+#define CORE_INOTIFYFSLISTENER_H_
+
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+#include "filesystemwatcherinterface.h"
+
+class QSocketNotifier;
+class QTimer;
+
+// Watches directories with inotify directly instead of going through
+// QFileSystemWatcher.  As well as saving the per-path bookkeeping that
+// QFileSystemWatcher does, this can tell which files inside a directory
+// changed, so they are reported with FilesChanged.  Only changes to the
+// directory structure itself (subdirectories created, removed or moved, or the
+// kernel's event queue overflowing) are reported with PathChanged.
+// Events are collected for a short while before being emitted, so a file that
+// is written several times only gets reported once.
+class InotifyFSListener : public FileSystemWatcherInterface {
+  Q_OBJECT
+
+ public:
+  explicit InotifyFSListener(QObject* parent = nullptr);
+  ~InotifyFSListener();
+
+  static const int kCoalesceDelayMsec;
+
+  // False if inotify couldn't be initialised, in which case another
+  // implementation should be used instead.
+  bool is_valid() const { return fd_ != -1; }
+
+  bool AddPath(const QString& path);
+  void RemovePath(const QString& path);
+  void Clear();
+  bool ReportsChangedFiles() const { return true; }
+
+ private slots:
+  void ReadEvents();
+  void EmitChanges();
+
+ private:
+  int fd_;
+  QSocketNotifier* notifier_;
+  QTimer* coalesce_timer_;
+
+  QHash<int, QString> paths_by_watch_;
+  QHash<QString, int> watches_by_path_;
+
+  QSet<QString> changed_paths_;
+  QHash<QString, QSet<QString>> changed_files_;
+};
+
+#endif  // CORE_INOTIFYFSLISTENER_H_
@@ -111,6 +111,7 @@ void RegisterMetaTypes() {
       "IntergalacticFMService::Stream");
   qRegisterMetaType<SubdirectoryList>("SubdirectoryList");
   qRegisterMetaType<Subdirectory>("Subdirectory");
+  qRegisterMetaType<ScanJournal>("ScanJournal");
   qRegisterMetaType<QList<QUrl>>("QList<QUrl>");
   qRegisterMetaType<QAbstractSocket::SocketState>();
   qRegisterMetaType<QFileInfo>("QFileInfo");
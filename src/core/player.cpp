@@ -115,6 +115,27 @@ void Player::HandleLoadResult(const UrlHandler::LoadResult& result) {
   // Might've been an async load, so check we're still on the same item
   shared_ptr<PlaylistItem> item =
       app_->playlist_manager()->active()->current_item();
+
+  // TrackAboutToEnd might have been waiting for this to preload the next
+  // item.  If the current track has finished already, it's played below.
+  if (preload_item_ && preload_item_->Url() == result.original_url_) {
+    PlaylistItemPtr next_item = preload_item_;
+    preload_item_.reset();
+
+    if (item && item->Url() != result.original_url_) {
+      loading_async_ = QUrl();
+      if (result.type_ == UrlHandler::LoadResult::TrackAvailable) {
+        MediaPlaybackRequest req(result.original_url_, result.media_url_);
+        if (!result.auth_header_.isEmpty())
+          req.headers_["Authorization"] = result.auth_header_;
+        engine_->StartPreloading(req, next_item->Metadata().has_cue(),
+                                 next_item->Metadata().beginning_nanosec(),
+                                 next_item->Metadata().end_nanosec());
+      }
+      return;
+    }
+  }
+
   if (!item) {
     loading_async_ = QUrl();
     return;
@@ -369,6 +390,7 @@ void Player::Stop(bool stop_after) {
   engine_->Stop(stop_after);
   app_->playlist_manager()->active()->set_current_row(-1);
   current_item_.reset();
+  preload_item_.reset();
 }
 
 void Player::StopAfterCurrent() {
@@ -476,6 +498,9 @@ void Player::PlayAt(int index, Engine::TrackChangeFlags change,
   current_item_ = app_->playlist_manager()->active()->current_item();
   const QUrl url = current_item_->Url();
 
+  // Whatever was being loaded to follow the old item doesn't follow this one.
+  preload_item_.reset();
+
   if (url_handlers_.contains(url.scheme())) {
     // It's already loading
     if (url == loading_async_) return;
@@ -662,7 +687,9 @@ void Player::TrackAboutToEnd() {
         return;
 
       case UrlHandler::LoadResult::WillLoadAsynchronously:
+        // HandleLoadResult preloads it when it's loaded.
         loading_async_ = req.RequestUrl();
+        preload_item_ = next_item;
         return;
 
       case UrlHandler::LoadResult::TrackAvailable:
@@ -219,6 +219,9 @@ class Player : public PlayerInterface {
   QMap<QString, UrlHandler*> url_handlers_;
 
   QUrl loading_async_;
+  // The next item, if TrackAboutToEnd is waiting for its URL handler so it
+  // can be preloaded.
+  PlaylistItemPtr preload_item_;
 
   int volume_before_mute_;
 
@@ -115,7 +115,8 @@ const QStringList Song::kColumns = QStringList() << "title"
                                                  << "grouping"
                                                  << "lyrics"
                                                  << "originalyear"
-                                                 << "effective_originalyear";
+                                                 << "effective_originalyear"
+                                                 << "file_fingerprint";
 
 const QStringList Song::kIntColumns = QStringList() << "track"
                                                     << "disc"
@@ -243,6 +244,10 @@ struct Song::Private : public QSharedData {
   bool unavailable_;
 
   QString etag_;
+
+  // Identifies the file's contents, so the library scanner can recognise it
+  // after it's been moved or renamed.
+  QString file_fingerprint_;
 };
 
 Song::Private::Private()
@@ -350,6 +355,7 @@ bool Song::is_library_song() const {
 const QString& Song::art_automatic() const { return d->art_automatic_; }
 const QString& Song::art_manual() const { return d->art_manual_; }
 const QString& Song::etag() const { return d->etag_; }
+const QString& Song::file_fingerprint() const { return d->file_fingerprint_; }
 bool Song::has_manually_unset_cover() const {
   return d->art_manual_ == kManuallyUnsetCover;
 }
@@ -403,6 +409,7 @@ void Song::set_score(int v) { d->score_ = qBound(0, v, 100); }
 void Song::set_cue_path(const QString& v) { d->cue_path_ = v; }
 void Song::set_unavailable(bool v) { d->unavailable_ = v; }
 void Song::set_etag(const QString& etag) { d->etag_ = etag; }
+void Song::set_file_fingerprint(const QString& v) { d->file_fingerprint_ = v; }
 
 void Song::set_url(const QUrl& v) {
   if (Application::kIsPortable && v.isRelative()) {
@@ -417,6 +424,18 @@ void Song::set_url(const QUrl& v) {
 void Song::set_basefilename(const QString& v) { d->basefilename_ = v; }
 void Song::set_directory_id(int v) { d->directory_id_ = v; }
 
+QString Song::BindSpec(const QString& suffix) {
+  QStringList ret = Utilities::Prepend(":", kColumns);
+  for (int i = 0; i < ret.count(); ++i) ret[i].append(suffix);
+  return ret.join(", ");
+}
+
+QString Song::FtsBindSpec(const QString& suffix) {
+  QStringList ret = Utilities::Prepend(":", kFtsColumns);
+  for (int i = 0; i < ret.count(); ++i) ret[i].append(suffix);
+  return ret.join(", ");
+}
+
 QString Song::JoinSpec(const QString& table) {
   return Utilities::Prepend(table + ".", kColumns).join(", ");
 }
@@ -681,6 +700,11 @@ void Song::InitFromQuery(const SqlRow& q, bool reliable_metadata, int col) {
   d->grouping_ = tostr(col + 39);
   d->lyrics_ = tostr(col + 40);
 
+  // originalyear = 41
+  // effective_originalyear = 42
+
+  d->file_fingerprint_ = tostr(col + 43);
+
   InitArtManual();
 
 #undef tostr
@@ -936,76 +960,85 @@ void Song::MergeFromSimpleMetaBundle(const Engine::SimpleMetaBundle& bundle) {
 }
 
 void Song::BindToQuery(QSqlQuery* query) const {
+  BindToQuery(query, QString());
+}
+
+void Song::BindToQuery(QSqlQuery* query, const QString& suffix) const {
 #define strval(x) (x.isNull() ? "" : x)
 #define intval(x) (x <= 0 ? -1 : x)
 #define notnullintval(x) (x == -1 ? QVariant() : x)
 
   // Remember to bind these in the same order as kBindSpec
 
-  query->bindValue(":title", strval(d->title_));
-  query->bindValue(":album", strval(d->album_));
-  query->bindValue(":artist", strval(d->artist_));
-  query->bindValue(":albumartist", strval(d->albumartist_));
-  query->bindValue(":composer", strval(d->composer_));
-  query->bindValue(":track", intval(d->track_));
-  query->bindValue(":disc", intval(d->disc_));
-  query->bindValue(":bpm", intval(d->bpm_));
-  query->bindValue(":year", intval(d->year_));
-  query->bindValue(":genre", strval(d->genre_));
-  query->bindValue(":comment", strval(d->comment_));
-  query->bindValue(":compilation", d->compilation_ ? 1 : 0);
+  query->bindValue(":title" + suffix, strval(d->title_));
+  query->bindValue(":album" + suffix, strval(d->album_));
+  query->bindValue(":artist" + suffix, strval(d->artist_));
+  query->bindValue(":albumartist" + suffix, strval(d->albumartist_));
+  query->bindValue(":composer" + suffix, strval(d->composer_));
+  query->bindValue(":track" + suffix, intval(d->track_));
+  query->bindValue(":disc" + suffix, intval(d->disc_));
+  query->bindValue(":bpm" + suffix, intval(d->bpm_));
+  query->bindValue(":year" + suffix, intval(d->year_));
+  query->bindValue(":genre" + suffix, strval(d->genre_));
+  query->bindValue(":comment" + suffix, strval(d->comment_));
+  query->bindValue(":compilation" + suffix, d->compilation_ ? 1 : 0);
 
-  query->bindValue(":bitrate", intval(d->bitrate_));
-  query->bindValue(":samplerate", intval(d->samplerate_));
+  query->bindValue(":bitrate" + suffix, intval(d->bitrate_));
+  query->bindValue(":samplerate" + suffix, intval(d->samplerate_));
 
-  query->bindValue(":directory", notnullintval(d->directory_id_));
+  query->bindValue(":directory" + suffix, notnullintval(d->directory_id_));
 
   if (Application::kIsPortable &&
       Utilities::UrlOnSameDriveAsClementine(d->url_)) {
     query->bindValue(
-        ":filename",
+        ":filename" + suffix,
         Utilities::GetRelativePathToClementineBin(d->url_).toEncoded());
   } else {
-    query->bindValue(":filename", d->url_.toEncoded());
+    query->bindValue(":filename" + suffix, d->url_.toEncoded());
   }
 
-  query->bindValue(":mtime", notnullintval(d->mtime_));
-  query->bindValue(":ctime", notnullintval(d->ctime_));
-  query->bindValue(":filesize", notnullintval(d->filesize_));
+  query->bindValue(":mtime" + suffix, notnullintval(d->mtime_));
+  query->bindValue(":ctime" + suffix, notnullintval(d->ctime_));
+  query->bindValue(":filesize" + suffix, notnullintval(d->filesize_));
 
-  query->bindValue(":sampler", d->sampler_ ? 1 : 0);
-  query->bindValue(":art_automatic", d->art_automatic_);
-  query->bindValue(":art_manual", d->art_manual_);
+  query->bindValue(":sampler" + suffix, d->sampler_ ? 1 : 0);
+  query->bindValue(":art_automatic" + suffix, d->art_automatic_);
+  query->bindValue(":art_manual" + suffix, d->art_manual_);
 
-  query->bindValue(":filetype", d->filetype_);
-  query->bindValue(":playcount", d->playcount_);
-  query->bindValue(":lastplayed", intval(d->lastplayed_));
-  query->bindValue(":rating", intval(d->rating_));
+  query->bindValue(":filetype" + suffix, d->filetype_);
+  query->bindValue(":playcount" + suffix, d->playcount_);
+  query->bindValue(":lastplayed" + suffix, intval(d->lastplayed_));
+  query->bindValue(":rating" + suffix, intval(d->rating_));
 
-  query->bindValue(":forced_compilation_on", d->forced_compilation_on_ ? 1 : 0);
-  query->bindValue(":forced_compilation_off",
+  query->bindValue(":forced_compilation_on" + suffix,
+                   d->forced_compilation_on_ ? 1 : 0);
+  query->bindValue(":forced_compilation_off" + suffix,
                    d->forced_compilation_off_ ? 1 : 0);
 
-  query->bindValue(":effective_compilation", is_compilation() ? 1 : 0);
+  query->bindValue(":effective_compilation" + suffix,
+                   is_compilation() ? 1 : 0);
 
-  query->bindValue(":skipcount", d->skipcount_);
-  query->bindValue(":score", d->score_);
+  query->bindValue(":skipcount" + suffix, d->skipcount_);
+  query->bindValue(":score" + suffix, d->score_);
 
-  query->bindValue(":beginning", d->beginning_);
-  query->bindValue(":length", intval(length_nanosec()));
+  query->bindValue(":beginning" + suffix, d->beginning_);
+  query->bindValue(":length" + suffix, intval(length_nanosec()));
 
-  query->bindValue(":cue_path", d->cue_path_);
-  query->bindValue(":unavailable", d->unavailable_ ? 1 : 0);
-  query->bindValue(":effective_albumartist", this->effective_albumartist());
+  query->bindValue(":cue_path" + suffix, d->cue_path_);
+  query->bindValue(":unavailable" + suffix, d->unavailable_ ? 1 : 0);
+  query->bindValue(":effective_albumartist" + suffix,
+                   this->effective_albumartist());
 
-  query->bindValue(":etag", strval(d->etag_));
+  query->bindValue(":etag" + suffix, strval(d->etag_));
 
-  query->bindValue(":performer", strval(d->performer_));
-  query->bindValue(":grouping", strval(d->grouping_));
-  query->bindValue(":lyrics", strval(d->lyrics_));
-  query->bindValue(":originalyear", intval(d->originalyear_));
-  query->bindValue(":effective_originalyear",
+  query->bindValue(":performer" + suffix, strval(d->performer_));
+  query->bindValue(":grouping" + suffix, strval(d->grouping_));
+  query->bindValue(":lyrics" + suffix, strval(d->lyrics_));
+  query->bindValue(":originalyear" + suffix, intval(d->originalyear_));
+  query->bindValue(":effective_originalyear" + suffix,
                    intval(this->effective_originalyear()));
+  query->bindValue(":file_fingerprint" + suffix,
+                   strval(d->file_fingerprint_));
 
 #undef intval
 #undef notnullintval
@@ -1013,16 +1046,20 @@ void Song::BindToQuery(QSqlQuery* query) const {
 }
 
 void Song::BindToFtsQuery(QSqlQuery* query) const {
-  query->bindValue(":ftstitle", d->title_);
-  query->bindValue(":ftsalbum", d->album_);
-  query->bindValue(":ftsartist", d->artist_);
-  query->bindValue(":ftsalbumartist", d->albumartist_);
-  query->bindValue(":ftscomposer", d->composer_);
-  query->bindValue(":ftsperformer", d->performer_);
-  query->bindValue(":ftsgrouping", d->grouping_);
-  query->bindValue(":ftsgenre", d->genre_);
-  query->bindValue(":ftscomment", d->comment_);
-  query->bindValue(":ftsyear", d->year_);
+  BindToFtsQuery(query, QString());
+}
+
+void Song::BindToFtsQuery(QSqlQuery* query, const QString& suffix) const {
+  query->bindValue(":ftstitle" + suffix, d->title_);
+  query->bindValue(":ftsalbum" + suffix, d->album_);
+  query->bindValue(":ftsartist" + suffix, d->artist_);
+  query->bindValue(":ftsalbumartist" + suffix, d->albumartist_);
+  query->bindValue(":ftscomposer" + suffix, d->composer_);
+  query->bindValue(":ftsperformer" + suffix, d->performer_);
+  query->bindValue(":ftsgrouping" + suffix, d->grouping_);
+  query->bindValue(":ftsgenre" + suffix, d->genre_);
+  query->bindValue(":ftscomment" + suffix, d->comment_);
+  query->bindValue(":ftsyear" + suffix, d->year_);
 }
 
 #ifdef HAVE_LIBLASTFM
@@ -1132,6 +1169,10 @@ bool Song::operator==(const Song& other) const {
          beginning_nanosec() == other.beginning_nanosec();
 }
 
+bool Song::SharesDataWith(const Song& other) const {
+  return d.constData() == other.d.constData();
+}
+
 uint qHash(const Song& song) {
   // Should compare the same fields as operator==
   return qHash(song.url().toString()) ^ qHash(song.beginning_nanosec());
@@ -86,6 +86,10 @@ class Song {
   static const QString kEmbeddedCover;
 
   static QString JoinSpec(const QString& table);
+  // Like kBindSpec, but with suffix appended to every placeholder so several
+  // songs can be bound to the same statement.
+  static QString BindSpec(const QString& suffix);
+  static QString FtsBindSpec(const QString& suffix);
 
   // Don't change these values - they're stored in the database, and defined
   // in the tag reader protobuf.
@@ -154,7 +158,9 @@ class Song {
 
   // Save
   void BindToQuery(QSqlQuery* query) const;
+  void BindToQuery(QSqlQuery* query, const QString& suffix) const;
   void BindToFtsQuery(QSqlQuery* query) const;
+  void BindToFtsQuery(QSqlQuery* query, const QString& suffix) const;
 #ifdef HAVE_LIBLASTFM
   void ToLastFM(lastfm::Track* track, bool prefer_album_artist) const;
 #endif
@@ -223,6 +229,7 @@ class Song {
   const QString& art_manual() const;
 
   const QString& etag() const;
+  const QString& file_fingerprint() const;
 
   // Returns true if this Song had it's cover manually unset by user.
   bool has_manually_unset_cover() const;
@@ -294,6 +301,7 @@ class Song {
   void set_cue_path(const QString& v);
   void set_unavailable(bool v);
   void set_etag(const QString& etag);
+  void set_file_fingerprint(const QString& v);
 
   // Setters that should only be used by tests
   void set_url(const QUrl& v);
@@ -307,6 +315,11 @@ class Song {
 
   bool operator==(const Song& other) const;
 
+  // True if this and other are unmodified copies of the same song.  This is
+  // much cheaper than comparing fields, but songs that were set up separately
+  // never share data even if all their fields are equal.
+  bool SharesDataWith(const Song& other) const;
+
   // Two songs that are on the same album will have the same AlbumKey.  It is
   // more efficient to use IsOnSameAlbum, but this function can be used when
   // you need to hash the key to do fast lookups.
@@ -33,6 +33,9 @@
 #include "songpathparser.h"
 
 const char* TagReaderClient::kWorkerExecutableName = "clementine-tagreader";
+const int TagReaderClient::kMaxFilesPerReadRequest = 64;
+const int TagReaderClient::kRequestTimeoutMsec = 60000;
+const int TagReaderClient::kReadFileTimeoutMsec = 20000;
 TagReaderClient* TagReaderClient::sInstance = nullptr;
 
 TagReaderClient::TagReaderClient(QObject* parent)
@@ -50,6 +53,7 @@ TagReaderClient::TagReaderClient(QObject* parent)
 
   worker_pool_->SetExecutableName(kWorkerExecutableName);
   worker_pool_->SetWorkerCount(num_workers);
+  worker_pool_->SetRequestTimeout(kRequestTimeoutMsec);
   connect(worker_pool_, SIGNAL(WorkerFailedToStart()),
           SLOT(WorkerFailedToStart()));
 }
@@ -72,7 +76,20 @@ TagReaderReply* TagReaderClient::ReadFile(const QString& filename) {
 
   req->set_filename(DataCommaSizeFromQString(filename));
 
-  return worker_pool_->SendMessageWithReply(&message);
+  return worker_pool_->SendMessageWithReply(&message, kReadFileTimeoutMsec);
+}
+
+TagReaderReply* TagReaderClient::ReadFiles(const QStringList& filenames) {
+  cpb::tagreader::Message message;
+  cpb::tagreader::ReadFilesRequest* req = message.mutable_read_files_request();
+
+  for (const QString& filename : filenames) {
+    req->add_filenames(DataCommaSizeFromQString(filename));
+  }
+
+  // Give every file in the batch as long as a single ReadFile request gets.
+  return worker_pool_->SendMessageWithReply(
+      &message, qMax(1, filenames.count()) * kReadFileTimeoutMsec);
 }
 
 TagReaderReply* TagReaderClient::SaveFile(const QString& filename,
@@ -156,7 +173,8 @@ TagReaderReply* TagReaderClient::ReadCloudFile(
   req->set_mime_type(DataCommaSizeFromQString(mime_type));
   req->set_authorisation_header(DataCommaSizeFromQString(authorisation_header));
 
-  return worker_pool_->SendMessageWithReply(&message);
+  // This downloads the file, which can take any amount of time.
+  return worker_pool_->SendMessageWithReply(&message, 0);
 }
 
 void TagReaderClient::ReadFileBlocking(const QString& filename, Song* song) {
@@ -170,6 +188,35 @@ void TagReaderClient::ReadFileBlocking(const QString& filename, Song* song) {
   reply->deleteLater();
 }
 
+void TagReaderClient::ReadFilesBlocking(const QStringList& filenames,
+                                        SongList* songs) {
+  Q_ASSERT(QThread::currentThread() != thread());
+
+  QList<TagReaderReply*> replies;
+  for (int i = 0; i < filenames.count(); i += kMaxFilesPerReadRequest) {
+    replies << ReadFiles(filenames.mid(i, kMaxFilesPerReadRequest));
+  }
+
+  int filename_index = 0;
+  for (TagReaderReply* reply : replies) {
+    const int batch_size =
+        qMin(kMaxFilesPerReadRequest, filenames.count() - filename_index);
+    const bool success = reply->WaitForFinished();
+    const cpb::tagreader::ReadFilesResponse& response =
+        reply->message().read_files_response();
+
+    for (int i = 0; i < batch_size; ++i, ++filename_index) {
+      Song song;
+      if (success && i < response.metadata_size()) {
+        song.InitFromProtobuf(response.metadata(i));
+        path_parser_->GuessMissingFields(&song, filenames[filename_index]);
+      }
+      *songs << song;
+    }
+    reply->deleteLater();
+  }
+}
+
 bool TagReaderClient::SaveFileBlocking(const QString& filename,
                                        const Song& metadata) {
   Q_ASSERT(QThread::currentThread() != thread());
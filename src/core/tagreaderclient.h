@@ -45,11 +45,17 @@ class TagReaderClient : public QObject {
   typedef HandlerType::ReplyType ReplyType;
 
   static const char* kWorkerExecutableName;
+  static const int kMaxFilesPerReadRequest;
+  // How long a worker has to reply before it's considered hung and restarted.
+  // Reads get kReadFileTimeoutMsec per file instead.
+  static const int kRequestTimeoutMsec;
+  static const int kReadFileTimeoutMsec;
 
   void Start();
   void ReloadSettings();
 
   ReplyType* ReadFile(const QString& filename);
+  ReplyType* ReadFiles(const QStringList& filenames);
   ReplyType* SaveFile(const QString& filename, const Song& metadata);
   ReplyType* UpdateSongStatistics(const Song& metadata);
   ReplyType* UpdateSongRating(const Song& metadata);
@@ -63,6 +69,11 @@ class TagReaderClient : public QObject {
   // response.  These block the calling thread with a semaphore, and must NOT
   // be called from the TagReaderClient's thread.
   void ReadFileBlocking(const QString& filename, Song* song);
+  // Reads many files with one request per kMaxFilesPerReadRequest files.  The
+  // requests are all sent before waiting for any of them, so they are spread
+  // over the workers.  One song is appended for each filename, in order;
+  // files that couldn't be read give an invalid song.
+  void ReadFilesBlocking(const QStringList& filenames, SongList* songs);
   bool SaveFileBlocking(const QString& filename, const Song& metadata);
   bool UpdateSongStatisticsBlocking(const Song& metadata);
   bool UpdateSongRatingBlocking(const Song& metadata);
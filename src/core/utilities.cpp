@@ -390,6 +390,9 @@ QString GetConfigPath(ConfigPath config) {
     case Path_PixmapCache:
       return GetConfigPath(Path_CacheRoot) + "/pixmapcache";
 
+    case Path_ThumbnailCache:
+      return GetConfigPath(Path_CacheRoot) + "/thumbnails";
+
     case Path_GstreamerRegistry:
       return GetConfigPath(Path_Root) +
              QString("/gst-registry-%1-bin")
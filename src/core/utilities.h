@@ -139,6 +139,7 @@ enum ConfigPath {
   Path_MoodbarCache,
   Path_PixmapCache,
   Path_CacheRoot,
+  Path_ThumbnailCache,
 };
 QString GetConfigPath(ConfigPath config);
 
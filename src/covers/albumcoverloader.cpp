@@ -22,10 +22,20 @@
 #include "albumcoverloader.h"
 
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
 #include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
 #include <QNetworkReply>
 #include <QPainter>
+#include <QThread>
 #include <QUrl>
+#include <QtConcurrentRun>
+
+#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
+#include <utime.h>
+#endif
 
 #include "config.h"
 #include "core/closure.h"
@@ -41,10 +51,23 @@
 AlbumCoverLoader::AlbumCoverLoader(QObject* parent)
     : QObject(parent),
       stop_requested_(false),
+      running_tasks_(0),
+      image_cache_(kMaxImageCacheSizeKb),
       next_id_(1),
       network_(new NetworkAccessManager(this)),
       connected_spotify_(false) {
   setObjectName("Album cover loader");
+
+  // Loading embedded art blocks on the tag reader, so use a few threads even
+  // on a single core machine.
+  thread_pool_.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+
+  QtConcurrent::run(&thread_pool_, &AlbumCoverLoader::PruneThumbnailCache);
+}
+
+AlbumCoverLoader::~AlbumCoverLoader() {
+  stop_requested_ = true;
+  thread_pool_.waitForDone();
 }
 
 QString AlbumCoverLoader::ImageCacheDir() {
@@ -52,19 +75,55 @@ QString AlbumCoverLoader::ImageCacheDir() {
 }
 
 void AlbumCoverLoader::CancelTask(quint64 id) {
+  CancelTasks(QSet<quint64>() << id);
+}
+
+void AlbumCoverLoader::CancelTasks(const QSet<quint64>& ids) {
   QMutexLocker l(&mutex_);
-  for (QQueue<Task>::iterator it = tasks_.begin(); it != tasks_.end(); ++it) {
-    if (it->id == id) {
-      tasks_.erase(it);
-      break;
+
+  // Other requests might be waiting for the same image, so only forget about
+  // these ones.  Tasks that are already running carry on, but nobody is told
+  // about the result if everyone waiting for it has gone.
+  for (QList<quint64>& waiting : waiting_ids_) {
+    for (QList<quint64>::iterator it = waiting.begin(); it != waiting.end();) {
+      if (ids.contains(*it)) {
+        it = waiting.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  for (QQueue<Task>* queue : {&priority_tasks_, &tasks_}) {
+    for (QQueue<Task>::iterator it = queue->begin(); it != queue->end();) {
+      const bool cancelled = it->key.isEmpty()
+                                 ? ids.contains(it->id)
+                                 : waiting_ids_.value(it->key).isEmpty();
+      if (cancelled) {
+        waiting_ids_.remove(it->key);
+        it = queue->erase(it);
+      } else {
+        ++it;
+      }
     }
   }
 }
 
-void AlbumCoverLoader::CancelTasks(const QSet<quint64>& ids) {
+void AlbumCoverLoader::PrioritiseTasks(const QSet<quint64>& ids) {
   QMutexLocker l(&mutex_);
   for (QQueue<Task>::iterator it = tasks_.begin(); it != tasks_.end();) {
-    if (ids.contains(it->id)) {
+    bool wanted = ids.contains(it->id);
+    if (!wanted && !it->key.isEmpty()) {
+      for (quint64 id : waiting_ids_.value(it->key)) {
+        if (ids.contains(id)) {
+          wanted = true;
+          break;
+        }
+      }
+    }
+
+    if (wanted) {
+      priority_tasks_.enqueue(*it);
       it = tasks_.erase(it);
     } else {
       ++it;
@@ -84,10 +143,19 @@ quint64 AlbumCoverLoader::LoadImageAsync(const AlbumCoverLoaderOptions& options,
   task.song_filename = song_filename;
   task.embedded_image = embedded_image;
   task.state = State_TryingManual;
+  task.key = TaskKey(task);
 
   {
     QMutexLocker l(&mutex_);
     task.id = next_id_++;
+
+    if (!task.key.isEmpty()) {
+      // If the same image is already being loaded just wait for that.
+      const bool already_loading = waiting_ids_.contains(task.key);
+      waiting_ids_[task.key] << task.id;
+      if (already_loading) return task.id;
+    }
+
     tasks_.enqueue(task);
   }
 
@@ -98,16 +166,61 @@ quint64 AlbumCoverLoader::LoadImageAsync(const AlbumCoverLoaderOptions& options,
 
 void AlbumCoverLoader::ProcessTasks() {
   while (!stop_requested_) {
-    // Get the next task
+    // Get the next task.  Only hand out as many as there are threads, so
+    // tasks that are prioritised later still jump the queue.
     Task task;
     {
       QMutexLocker l(&mutex_);
-      if (tasks_.isEmpty()) return;
-      task = tasks_.dequeue();
+      if (running_tasks_ >= thread_pool_.maxThreadCount()) return;
+
+      if (!priority_tasks_.isEmpty()) {
+        task = priority_tasks_.dequeue();
+      } else if (!tasks_.isEmpty()) {
+        task = tasks_.dequeue();
+      } else {
+        return;
+      }
+      running_tasks_++;
     }
 
+    QtConcurrent::run(&thread_pool_, this, &AlbumCoverLoader::RunTask, task);
+  }
+}
+
+void AlbumCoverLoader::RunTask(Task task) {
+  if (!task.key.isEmpty()) {
+    const QString version = ImageVersion(task);
+    task.image_cache_key = task.key + "\n" + version;
+    task.thumbnail_path = ThumbnailPath(task, version);
+  }
+
+  bool cached = false;
+  QImage scaled;
+  QImage original;
+  if (!task.image_cache_key.isEmpty()) {
+    QMutexLocker l(&image_cache_mutex_);
+    if (CachedImage* image = image_cache_.object(task.image_cache_key)) {
+      cached = true;
+      scaled = image->scaled;
+      original = image->original;
+    }
+  }
+
+  if (cached) {
+    TaskFinished(task, scaled, original, false);
+  } else if (!task.thumbnail_path.isEmpty() &&
+             scaled.load(task.thumbnail_path)) {
+    TouchThumbnail(task.thumbnail_path);
+    TaskFinished(task, scaled, scaled);
+  } else if (!stop_requested_) {
     ProcessTask(&task);
   }
+
+  {
+    QMutexLocker l(&mutex_);
+    running_tasks_--;
+  }
+  metaObject()->invokeMethod(this, "ProcessTasks", Qt::QueuedConnection);
 }
 
 void AlbumCoverLoader::ProcessTask(Task* task) {
@@ -120,14 +233,162 @@ void AlbumCoverLoader::ProcessTask(Task* task) {
 
   if (result.loaded_success) {
     QImage scaled = ScaleAndPad(task->options, result.image);
-    emit ImageLoaded(task->id, scaled);
-    emit ImageLoaded(task->id, scaled, result.image);
+    TaskFinished(*task, scaled, result.image);
     return;
   }
 
   NextState(task);
 }
 
+void AlbumCoverLoader::TaskFinished(const Task& task, const QImage& scaled,
+                                    const QImage& original, bool cache) {
+  QList<quint64> ids;
+  {
+    QMutexLocker l(&mutex_);
+    if (task.key.isEmpty()) {
+      ids << task.id;
+    } else {
+      ids = waiting_ids_.take(task.key);
+    }
+  }
+
+  if (cache && !task.image_cache_key.isEmpty() && !scaled.isNull()) {
+    // The original is often the same image as the scaled one, in which case
+    // it doesn't take up any more memory.
+    int cost = scaled.byteCount();
+    if (original.cacheKey() != scaled.cacheKey()) cost += original.byteCount();
+
+    {
+      QMutexLocker l(&image_cache_mutex_);
+      image_cache_.insert(task.image_cache_key,
+                          new CachedImage(scaled, original),
+                          qMax(1, cost / 1024));
+    }
+
+    if (!task.thumbnail_path.isEmpty() && !QFile::exists(task.thumbnail_path)) {
+      QDir().mkpath(QFileInfo(task.thumbnail_path).path());
+      // Write to a temporary file first so another thread never reads half a
+      // thumbnail.
+      const QString temp_path = task.thumbnail_path + ".tmp";
+      if (scaled.save(temp_path, "PNG")) {
+        QFile::rename(temp_path, task.thumbnail_path);
+      } else {
+        QFile::remove(temp_path);
+      }
+    }
+  }
+
+  for (quint64 id : ids) {
+    emit ImageLoaded(id, scaled);
+    emit ImageLoaded(id, scaled, original);
+  }
+}
+
+QString AlbumCoverLoader::TaskKey(const Task& task) {
+  // Images that were passed in directly can't be looked up again.
+  if (!task.embedded_image.isNull()) return QString();
+
+  QStringList key;
+  key << QString::number(task.options.desired_height_)
+      << QString::number(task.options.scale_output_image_)
+      << QString::number(task.options.pad_output_image_)
+      << QString::number(task.options.default_output_image_.cacheKey())
+      << task.art_manual << task.art_automatic;
+  if (task.art_manual == Song::kEmbeddedCover ||
+      task.art_automatic == Song::kEmbeddedCover) {
+    key << task.song_filename;
+  }
+  return key.join('\n');
+}
+
+QString AlbumCoverLoader::ImageVersion(const Task& task) {
+  QStringList files;
+  for (const QString& filename : {task.art_manual, task.art_automatic}) {
+    if (filename == Song::kEmbeddedCover) {
+      files << task.song_filename;
+    } else if (!filename.isEmpty() && filename != Song::kManuallyUnsetCover &&
+               !filename.contains("://")) {
+      files << filename;
+    }
+  }
+
+  QStringList ret;
+  for (const QString& filename : files) {
+    ret << QString::number(
+        QFileInfo(filename).lastModified().toMSecsSinceEpoch());
+  }
+  return ret.join('\n');
+}
+
+QString AlbumCoverLoader::ThumbnailPath(const Task& task,
+                                        const QString& version) {
+  if (!task.options.use_thumbnail_cache_ || !task.options.scale_output_image_)
+    return QString();
+
+  // Unlike the task key this mustn't depend on the default image, which is
+  // different every time Clementine runs.  It's never cached anyway.
+  QStringList key;
+  key << QString::number(task.options.pad_output_image_) << task.art_manual
+      << task.art_automatic << version;
+  if (task.art_manual == Song::kEmbeddedCover ||
+      task.art_automatic == Song::kEmbeddedCover) {
+    key << task.song_filename;
+  }
+
+  const QByteArray hash =
+      QCryptographicHash::hash(key.join('\n').toUtf8(),
+                               QCryptographicHash::Sha1)
+          .toHex();
+
+  // Thumbnails are kept in a directory for each size.
+  return QString("%1/%2/%3.png")
+      .arg(Utilities::GetConfigPath(Utilities::Path_ThumbnailCache))
+      .arg(task.options.desired_height_)
+      .arg(QString::fromLatin1(hash));
+}
+
+void AlbumCoverLoader::TouchThumbnail(const QString& path) {
+  // The modification time is what the cache is pruned by.  Only update it
+  // now and then so scrolling through the library doesn't write to the disk
+  // for every cover.
+  const QDateTime now = QDateTime::currentDateTime();
+  if (QFileInfo(path).lastModified().secsTo(now) < kThumbnailTouchIntervalSecs)
+    return;
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+  QFile file(path);
+  if (file.open(QIODevice::ReadWrite)) {
+    file.setFileTime(now, QFileDevice::FileModificationTime);
+  }
+#else
+  utime(QFile::encodeName(path).constData(), nullptr);
+#endif
+}
+
+void AlbumCoverLoader::PruneThumbnailCache() {
+  QMultiMap<QDateTime, QString> thumbnails;
+  qint64 total_size = 0;
+
+  QDirIterator it(Utilities::GetConfigPath(Utilities::Path_ThumbnailCache),
+                  QDir::Files, QDirIterator::Subdirectories);
+  while (it.hasNext()) {
+    it.next();
+    const QFileInfo info = it.fileInfo();
+    thumbnails.insert(info.lastModified(), info.filePath());
+    total_size += info.size();
+  }
+
+  if (total_size <= kMaxThumbnailCacheSize) return;
+
+  // Leave some room so this doesn't have to happen again straight away.
+  const qint64 target_size = kMaxThumbnailCacheSize * 3 / 4;
+  for (auto it = thumbnails.constBegin();
+       it != thumbnails.constEnd() && total_size > target_size; ++it) {
+    const qint64 size = QFileInfo(it.value()).size();
+    if (QFile::remove(it.value())) total_size -= size;
+  }
+}
+
 void AlbumCoverLoader::NextState(Task* task) {
   if (task->state == State_TryingManual) {
     // Try the automatic one next
@@ -135,9 +396,8 @@ void AlbumCoverLoader::NextState(Task* task) {
     ProcessTask(task);
   } else {
     // Give up
-    emit ImageLoaded(task->id, task->options.default_output_image_);
-    emit ImageLoaded(task->id, task->options.default_output_image_,
-                     task->options.default_output_image_);
+    TaskFinished(*task, task->options.default_output_image_,
+                 task->options.default_output_image_, false);
   }
 }
 
@@ -173,12 +433,14 @@ AlbumCoverLoader::TryLoadResult AlbumCoverLoader::TryLoadImage(
 
   if (filename.toLower().startsWith("http://") ||
       filename.toLower().startsWith("https://")) {
-    QUrl url(filename);
-    QNetworkReply* reply = network_->get(QNetworkRequest(url));
-    NewClosure(reply, SIGNAL(finished()), this,
-               SLOT(RemoteFetchFinished(QNetworkReply*)), reply);
-
-    remote_tasks_.insert(reply, task);
+    // The network access manager lives in our own thread, not in the worker
+    // thread we're running on.
+    {
+      QMutexLocker l(&mutex_);
+      pending_remote_tasks_.enqueue(task);
+    }
+    metaObject()->invokeMethod(this, "StartRemoteFetches",
+                               Qt::QueuedConnection);
     return TryLoadResult(true, false, QImage());
   }
 #ifdef HAVE_SPOTIFY
@@ -186,17 +448,20 @@ AlbumCoverLoader::TryLoadResult AlbumCoverLoader::TryLoadImage(
     // HACK: we should add generic image URL handlers
     SpotifyService* spotify = InternetModel::Service<SpotifyService>();
 
-    if (!connected_spotify_) {
-      connect(spotify, SIGNAL(ImageLoaded(QString, QImage)),
-              SLOT(SpotifyImageLoaded(QString, QImage)));
-      connected_spotify_ = true;
-    }
-
     QString id = QUrl(filename).path();
     if (id.startsWith('/')) {
       id.remove(0, 1);
     }
-    remote_spotify_tasks_.insert(id, task);
+
+    {
+      QMutexLocker l(&mutex_);
+      if (!connected_spotify_) {
+        connect(spotify, SIGNAL(ImageLoaded(QString, QImage)), this,
+                SLOT(SpotifyImageLoaded(QString, QImage)));
+        connected_spotify_ = true;
+      }
+      remote_spotify_tasks_.insert(id, task);
+    }
 
     // Need to schedule this in the spotify service's thread
     QMetaObject::invokeMethod(spotify, "LoadImage", Qt::QueuedConnection,
@@ -219,15 +484,37 @@ AlbumCoverLoader::TryLoadResult AlbumCoverLoader::TryLoadImage(
 #ifdef HAVE_SPOTIFY
 void AlbumCoverLoader::SpotifyImageLoaded(const QString& id,
                                           const QImage& image) {
-  if (!remote_spotify_tasks_.contains(id)) return;
+  Task task;
+  {
+    QMutexLocker l(&mutex_);
+    if (!remote_spotify_tasks_.contains(id)) return;
+    task = remote_spotify_tasks_.take(id);
+  }
 
-  Task task = remote_spotify_tasks_.take(id);
   QImage scaled = ScaleAndPad(task.options, image);
-  emit ImageLoaded(task.id, scaled);
-  emit ImageLoaded(task.id, scaled, image);
+  TaskFinished(task, scaled, image);
 }
 #endif
 
+void AlbumCoverLoader::StartRemoteFetches() {
+  forever {
+    Task task;
+    {
+      QMutexLocker l(&mutex_);
+      if (pending_remote_tasks_.isEmpty()) return;
+      task = pending_remote_tasks_.dequeue();
+    }
+
+    const QString filename =
+        task.state == State_TryingAuto ? task.art_automatic : task.art_manual;
+    QNetworkReply* reply = network_->get(QNetworkRequest(QUrl(filename)));
+    NewClosure(reply, SIGNAL(finished()), this,
+               SLOT(RemoteFetchFinished(QNetworkReply*)), reply);
+
+    remote_tasks_.insert(reply, task);
+  }
+}
+
 void AlbumCoverLoader::RemoteFetchFinished(QNetworkReply* reply) {
   reply->deleteLater();
 
@@ -238,7 +525,9 @@ void AlbumCoverLoader::RemoteFetchFinished(QNetworkReply* reply) {
       reply->attribute(QNetworkRequest::RedirectionTargetAttribute);
   if (redirect.isValid()) {
     if (++task.redirects > kMaxRedirects) {
-      return;  // Give up.
+      // Give up on this URL.
+      NextState(&task);
+      return;
     }
     QNetworkRequest request = reply->request();
     request.setUrl(redirect.toUrl());
@@ -255,8 +544,7 @@ void AlbumCoverLoader::RemoteFetchFinished(QNetworkReply* reply) {
     QImage image;
     if (image.load(reply, 0)) {
       QImage scaled = ScaleAndPad(task.options, image);
-      emit ImageLoaded(task.id, scaled);
-      emit ImageLoaded(task.id, scaled, image);
+      TaskFinished(task, scaled, image);
       return;
     }
   }
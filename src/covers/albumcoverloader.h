@@ -21,10 +21,12 @@
 #ifndef COVERS_ALBUMCOVERLOADER_H_
 #define COVERS_ALBUMCOVERLOADER_H_
 
+#include <QCache>
 #include <QImage>
 #include <QMutex>
 #include <QObject>
 #include <QQueue>
+#include <QThreadPool>
 #include <QUrl>
 
 #include "albumcoverloaderoptions.h"
@@ -39,6 +41,7 @@ class AlbumCoverLoader : public QObject {
 
  public:
   explicit AlbumCoverLoader(QObject* parent = nullptr);
+  ~AlbumCoverLoader();
 
   void Stop() { stop_requested_ = true; }
 
@@ -54,6 +57,9 @@ class AlbumCoverLoader : public QObject {
 
   void CancelTask(quint64 id);
   void CancelTasks(const QSet<quint64>& ids);
+  // Moves the given tasks to the front of the queue, e.g. because their
+  // covers are now visible on screen.
+  void PrioritiseTasks(const QSet<quint64>& ids);
 
   static QPixmap TryLoadPixmap(const QString& automatic, const QString& manual,
                                const QString& filename = QString());
@@ -66,6 +72,7 @@ class AlbumCoverLoader : public QObject {
 
  protected slots:
   void ProcessTasks();
+  void StartRemoteFetches();
   void RemoteFetchFinished(QNetworkReply* reply);
 #ifdef HAVE_SPOTIFY
   void SpotifyImageLoaded(const QString& url, const QImage& image);
@@ -89,6 +96,23 @@ class AlbumCoverLoader : public QObject {
     QImage embedded_image;
     State state;
     int redirects;
+
+    // Identifies requests for the same image with the same options.  Empty
+    // if the image was given to us directly, so it can't be shared.
+    QString key;
+    // key plus the modification times of the files involved, so the decoded
+    // image cache notices when a cover is changed.
+    QString image_cache_key;
+    // Where the scaled image is kept on disk, if the options allow it.
+    QString thumbnail_path;
+  };
+
+  struct CachedImage {
+    CachedImage(const QImage& scaled, const QImage& original)
+        : scaled(scaled), original(original) {}
+
+    QImage scaled;
+    QImage original;
   };
 
   struct TryLoadResult {
@@ -100,14 +124,41 @@ class AlbumCoverLoader : public QObject {
     QImage image;
   };
 
+  // Runs on one of the threads in thread_pool_.
+  void RunTask(Task task);
   void ProcessTask(Task* task);
   void NextState(Task* task);
   TryLoadResult TryLoadImage(const Task& task);
+  // Sends the image to everyone that asked for it, and caches it.
+  void TaskFinished(const Task& task, const QImage& scaled,
+                    const QImage& original, bool cache = true);
+  static QString TaskKey(const Task& task);
+  // Returns the modification times of the files the image is loaded from.
+  static QString ImageVersion(const Task& task);
+  static QString ThumbnailPath(const Task& task, const QString& version);
+  // Marks a thumbnail as used, so it's among the last to be pruned.
+  static void TouchThumbnail(const QString& path);
+  // Deletes the least recently used thumbnails if the cache has grown too
+  // big.
+  static void PruneThumbnailCache();
 
   bool stop_requested_;
 
   QMutex mutex_;
+  // Tasks for covers that are visible are taken from priority_tasks_ first.
+  QQueue<Task> priority_tasks_;
   QQueue<Task> tasks_;
+  // Task key -> IDs of all the requests waiting for that task.
+  QHash<QString, QList<quint64>> waiting_ids_;
+  int running_tasks_;
+  QQueue<Task> pending_remote_tasks_;
+
+  QThreadPool thread_pool_;
+
+  // Decoded and scaled images, most recently used first.
+  QMutex image_cache_mutex_;
+  QCache<QString, CachedImage> image_cache_;
+
   QMap<QNetworkReply*, Task> remote_tasks_;
   QMap<QString, Task> remote_spotify_tasks_;
   quint64 next_id_;
@@ -117,6 +168,9 @@ class AlbumCoverLoader : public QObject {
   bool connected_spotify_;
 
   static const int kMaxRedirects = 3;
+  static const int kMaxImageCacheSizeKb = 64 * 1024;
+  static const qint64 kMaxThumbnailCacheSize = 256 * 1024 * 1024;
+  static const int kThumbnailTouchIntervalSecs = 60 * 60;
 };
 
 #endif  // COVERS_ALBUMCOVERLOADER_H_
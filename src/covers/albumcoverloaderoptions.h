@@ -26,11 +26,17 @@ struct AlbumCoverLoaderOptions {
   AlbumCoverLoaderOptions()
       : desired_height_(120),
         scale_output_image_(true),
-        pad_output_image_(true) {}
+        pad_output_image_(true),
+        use_thumbnail_cache_(false) {}
 
   int desired_height_;
   bool scale_output_image_;
   bool pad_output_image_;
+  // Keep the scaled image on disk so it doesn't have to be decoded and scaled
+  // again next time.  Only used if scale_output_image_ is set.  When an image
+  // comes from this cache the original isn't available, and the scaled image
+  // is sent in its place.
+  bool use_thumbnail_cache_;
   QImage default_output_image_;
 };
 
@@ -57,6 +57,8 @@ FilesystemDevice::FilesystemDevice(const QUrl& url, DeviceLister* lister,
           SLOT(AddOrUpdateSongs(SongList)));
   connect(watcher_, SIGNAL(SongsMTimeUpdated(SongList)), backend_.get(),
           SLOT(UpdateMTimesOnly(SongList)));
+  connect(watcher_, SIGNAL(SongsFingerprinted(SongList)), backend_.get(),
+          SLOT(UpdateFileFingerprintsOnly(SongList)));
   connect(watcher_, SIGNAL(SongsDeleted(SongList)), backend_.get(),
           SLOT(DeleteSongs(SongList)));
   connect(watcher_, SIGNAL(SubdirsDiscovered(SubdirectoryList)), backend_.get(),
@@ -65,6 +67,12 @@ FilesystemDevice::FilesystemDevice(const QUrl& url, DeviceLister* lister,
           backend_.get(), SLOT(AddOrUpdateSubdirs(SubdirectoryList)));
   connect(watcher_, SIGNAL(CompilationsNeedUpdating()), backend_.get(),
           SLOT(UpdateCompilations()));
+  connect(watcher_,
+          SIGNAL(ScanJournalUpdated(int, ScanJournal, QStringList)),
+          backend_.get(),
+          SLOT(UpdateScanJournal(int, ScanJournal, QStringList)));
+  connect(watcher_, SIGNAL(ScanJournalCleared(int)), backend_.get(),
+          SLOT(ClearScanJournal(int)));
   connect(watcher_, SIGNAL(ScanStarted(int)), SIGNAL(TaskStarted(int)));
   connect(watcher_, &LibraryWatcher::Error, app, &Application::AddError);
 }
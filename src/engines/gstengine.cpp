@@ -105,7 +105,6 @@ GstEngine::GstEngine(Application* app)
     : Engine::Base(),
       task_manager_(app->task_manager()),
       buffering_task_id_(-1),
-      latest_buffer_(nullptr),
       equalizer_enabled_(false),
       stereo_balance_(0.0f),
       rg_enabled_(false),
@@ -113,6 +112,8 @@ GstEngine::GstEngine(Application* app)
       rg_preamp_(0.0),
       rg_compression_(true),
       buffer_duration_nanosec_(1 * kNsecPerSec),  // 1s
+      prebuffer_duration_nanosec_(kDefaultPrebufferDurationMsec *
+                                  kNsecPerMsec),
       buffer_min_fill_(33),
       mono_playback_(false),
       sample_rate_(kAutoSampleRate),
@@ -120,9 +121,7 @@ GstEngine::GstEngine(Application* app)
       timer_id_(-1),
       next_element_id_(0),
       is_fading_out_to_pause_(false),
-      has_faded_out_(false),
-      scope_chunk_(0),
-      have_new_buffer_(false) {
+      has_faded_out_(false) {
   seek_timer_->setSingleShot(true);
   seek_timer_->setInterval(kSeekDelayNanosec / kNsecPerMsec);
   connect(seek_timer_, SIGNAL(timeout()), SLOT(SeekNow()));
@@ -241,10 +240,21 @@ void GstEngine::ReloadSettings() {
 
   buffer_min_fill_ = s.value("bufferminfill", 33).toInt();
 
+  prebuffer_duration_nanosec_ =
+      s.value("prebufferduration", kDefaultPrebufferDurationMsec)
+          .toLongLong() *
+      kNsecPerMsec;
+
   mono_playback_ = s.value("monoplayback", false).toBool();
   sample_rate_ = s.value("samplerate", kAutoSampleRate).toInt();
   format_ = s.value(GstEngine::kSettingFormat, GstEngine::kOutFormatDetect)
                 .toString();
+
+  // Existing pipelines were set up with the old output settings.
+  spare_pipeline_.reset();
+  readying_pipeline_.reset();
+  if (current_pipeline_) current_pipeline_->set_reusable(false);
+  if (fadeout_pipeline_) fadeout_pipeline_->set_reusable(false);
 }
 
 qint64 GstEngine::position_nanosec() const {
@@ -285,109 +295,21 @@ Engine::State GstEngine::state() const {
   }
 }
 
-void GstEngine::ConsumeBuffer(GstBuffer* buffer, int pipeline_id) {
-  // Schedule this to run in the GUI thread.  The buffer gets added to the
-  // queue and unreffed by UpdateScope.
-  if (!QMetaObject::invokeMethod(this, "AddBufferToScope",
-                                 Q_ARG(GstBuffer*, buffer),
-                                 Q_ARG(int, pipeline_id))) {
-    qLog(Warning) << "Failed to invoke AddBufferToScope on GstEngine";
-    gst_buffer_unref(buffer);
-  }
-}
-
 bool GstEngine::IsCurrentPipeline(int id) {
   return current_pipeline_.get() && current_pipeline_->id() == id;
 }
 
-void GstEngine::AddBufferToScope(GstBuffer* buf, int pipeline_id) {
-  if (!IsCurrentPipeline(pipeline_id)) {
-    gst_buffer_unref(buf);
-    return;
-  }
-
-  if (latest_buffer_ != nullptr) {
-    gst_buffer_unref(latest_buffer_);
-  }
-
-  latest_buffer_ = buf;
-  have_new_buffer_ = true;
-}
-
-const Engine::Scope& GstEngine::scope(int chunk_length) {
-  // the new buffer could have a different size
-  if (have_new_buffer_) {
-    if (latest_buffer_ != nullptr) {
-      scope_chunks_ = ceil(((double)GST_BUFFER_DURATION(latest_buffer_) /
-                            (double)(chunk_length * kNsecPerMsec)));
-    }
-
-    // if the buffer is shorter than the chunk length
-    if (scope_chunks_ <= 0) {
-      scope_chunks_ = 1;
-    }
-
-    scope_chunk_ = 0;
-    have_new_buffer_ = false;
-  }
-
-  if (latest_buffer_ != nullptr) {
-    UpdateScope(chunk_length);
+const Engine::Scope& GstEngine::scope(int) {
+  // The pipeline keeps the samples it has played in a ring buffer, so just
+  // copy out the ones that are playing right now.  If there aren't enough
+  // yet, keep showing the last scope.
+  if (current_pipeline_) {
+    current_pipeline_->scope_buffer().Read(scope_.data(), scope_.size());
   }
 
   return scope_;
 }
 
-void GstEngine::UpdateScope(int chunk_length) {
-  typedef Engine::Scope::value_type sample_type;
-
-  // prevent dbz or invalid chunk size
-  if (!GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DURATION(latest_buffer_))) return;
-  if (GST_BUFFER_DURATION(latest_buffer_) == 0) return;
-
-  GstMapInfo map;
-  gst_buffer_map(latest_buffer_, &map, GST_MAP_READ);
-
-  // determine where to split the buffer
-  int chunk_density =
-      (map.size * kNsecPerMsec) / GST_BUFFER_DURATION(latest_buffer_);
-
-  int chunk_size = chunk_length * chunk_density;
-
-  // in case a buffer doesn't arrive in time
-  if (scope_chunk_ >= scope_chunks_) {
-    scope_chunk_ = 0;
-    gst_buffer_unmap(latest_buffer_, &map);
-    return;
-  }
-
-  const sample_type* source = reinterpret_cast<sample_type*>(map.data);
-  sample_type* dest = scope_.data();
-  source += (chunk_size / sizeof(sample_type)) * scope_chunk_;
-
-  int bytes = 0;
-
-  // make sure we don't go beyond the end of the buffer
-  if (scope_chunk_ == scope_chunks_ - 1) {
-    bytes = qMin(static_cast<Engine::Scope::size_type>(
-                     map.size - (chunk_size * scope_chunk_)),
-                 scope_.size() * sizeof(sample_type));
-  } else {
-    bytes = qMin(static_cast<Engine::Scope::size_type>(chunk_size),
-                 scope_.size() * sizeof(sample_type));
-  }
-
-  scope_chunk_++;
-  memcpy(dest, source, bytes);
-
-  gst_buffer_unmap(latest_buffer_, &map);
-
-  if (scope_chunk_ == scope_chunks_) {
-    gst_buffer_unref(latest_buffer_);
-    latest_buffer_ = nullptr;
-  }
-}
-
 void GstEngine::StartPreloading(const MediaPlaybackRequest& req,
                                 bool force_stop_at_end,
                                 qint64 beginning_nanosec, qint64 end_nanosec) {
@@ -425,8 +347,24 @@ bool GstEngine::Load(const MediaPlaybackRequest& req,
     return true;
   }
 
-  shared_ptr<GstEnginePipeline> pipeline =
-      CreatePipeline(req, force_stop_at_end ? end_nanosec : 0);
+  const qint64 pipeline_end_nanosec = force_stop_at_end ? end_nanosec : 0;
+  const bool special_pipeline =
+      req.url_.scheme() == "hypnotoad" || req.url_.scheme() == "enterprise";
+
+  // Opening the audio sink is the slowest part of starting a pipeline, so
+  // keep the output of the current one and just swap its decoder when we
+  // can.  A crossfade needs a second output, which the spare pipeline left
+  // over from the last crossfade can provide.
+  shared_ptr<GstEnginePipeline> pipeline;
+  if (!special_pipeline) {
+    if (!crossfade && !is_fading_out_to_pause_ && current_pipeline_ &&
+        current_pipeline_->ReloadFromReq(req, pipeline_end_nanosec)) {
+      pipeline = current_pipeline_;
+    } else {
+      pipeline = TakeSparePipeline(req, pipeline_end_nanosec);
+    }
+  }
+  if (!pipeline) pipeline = CreatePipeline(req, pipeline_end_nanosec);
   if (!pipeline) return false;
 
   if (crossfade) StartFadeout();
@@ -553,15 +491,42 @@ void GstEngine::Stop(bool stop_after) {
   if (fadeout_enabled_ && current_pipeline_ && !stop_after) StartFadeout();
 
   current_pipeline_.reset();
+  spare_pipeline_.reset();
+  readying_pipeline_.reset();
   BufferingFinished();
   emit StateChanged(Engine::Empty);
 }
 
 void GstEngine::FadeoutFinished() {
+  // Keep the output open for the next crossfade, but not once playback has
+  // stopped, so the device is released.
+  if (current_pipeline_ && fadeout_pipeline_ &&
+      fadeout_pipeline_->is_reusable()) {
+    // It's only offered for reuse once it has stopped, so it can't race with
+    // the state changes made when it's reused.
+    readying_pipeline_ = fadeout_pipeline_;
+    QFuture<GstStateChangeReturn> future =
+        readying_pipeline_->SetState(GST_STATE_READY);
+    NewClosure(future, this,
+               SLOT(FadeoutReady(QFuture<GstStateChangeReturn>, int)),
+               future, readying_pipeline_->id());
+  }
   fadeout_pipeline_.reset();
   emit FadeoutFinishedSignal();
 }
 
+void GstEngine::FadeoutReady(QFuture<GstStateChangeReturn> future,
+                             int pipeline_id) {
+  // Playback stopped or the settings changed in the meantime.
+  if (!readying_pipeline_ || readying_pipeline_->id() != pipeline_id) return;
+
+  shared_ptr<GstEnginePipeline> pipeline;
+  pipeline.swap(readying_pipeline_);
+  if (future.result() == GST_STATE_CHANGE_FAILURE) return;
+
+  spare_pipeline_ = pipeline;
+}
+
 void GstEngine::FadeoutPauseFinished() {
   fadeout_pause_pipeline_->SetState(GST_STATE_PAUSED);
   current_pipeline_->SetState(GST_STATE_PAUSED);
@@ -698,9 +663,12 @@ void GstEngine::timerEvent(QTimerEvent* e) {
 
     const qint64 fudge =
         kTimerIntervalNanosec + 100 * kNsecPerMsec;  // Mmm fudge
+    // When the next track is prebuffered, ask for it early enough that the
+    // prebuffer can fill even if it only decodes in real time.
     const qint64 gap = buffer_duration_nanosec_ +
-                       (autocrossfade_enabled_ ? fadeout_duration_nanosec_
-                                               : kPreloadGapNanosec);
+                       (autocrossfade_enabled_
+                            ? fadeout_duration_nanosec_
+                            : kPreloadGapNanosec + prebuffer_duration_nanosec_);
 
     // only if we know the length of the current stream...
     if (current_length > 0) {
@@ -718,6 +686,9 @@ void GstEngine::HandlePipelineError(int pipeline_id, const QString& message,
 
   qLog(Warning) << "Gstreamer error:" << message;
 
+  // The error might have come from the output, so don't keep it.
+  current_pipeline_->set_reusable(false);
+
   // try to reload the URL in case of a drop of the connection
   if (domain == GST_RESOURCE_ERROR && error_code == GST_RESOURCE_ERROR_SEEK) {
     if (Load(playback_req_, 0, false, 0, 0)) {
@@ -757,6 +728,8 @@ void GstEngine::EndOfStreamReached(int pipeline_id, bool has_next_track) {
 
   if (!has_next_track) {
     current_pipeline_.reset();
+    spare_pipeline_.reset();
+    readying_pipeline_.reset();
     BufferingFinished();
   }
   emit TrackEnded();
@@ -823,26 +796,44 @@ shared_ptr<GstEnginePipeline> GstEngine::CreatePipeline() {
   ret->set_replaygain(rg_enabled_, rg_mode_, rg_preamp_, rg_compression_);
   ret->set_buffer_duration_nanosec(buffer_duration_nanosec_);
   ret->set_buffer_min_fill(buffer_min_fill_);
+  ret->set_prebuffer_duration_nanosec(prebuffer_duration_nanosec_);
   ret->set_mono_playback(mono_playback_);
   ret->set_sample_rate(sample_rate_);
   ret->set_format(format_);
 
-  ret->AddBufferConsumer(this);
+  ConnectPipeline(ret.get());
+
+  return ret;
+}
+
+void GstEngine::ConnectPipeline(GstEnginePipeline* pipeline) {
   for (BufferConsumer* consumer : buffer_consumers_) {
-    ret->AddBufferConsumer(consumer);
+    pipeline->AddBufferConsumer(consumer);
   }
 
-  connect(ret.get(), SIGNAL(EndOfStreamReached(int, bool)),
+  connect(pipeline, SIGNAL(EndOfStreamReached(int, bool)),
           SLOT(EndOfStreamReached(int, bool)));
-  connect(ret.get(), SIGNAL(Error(int, QString, int, int)),
+  connect(pipeline, SIGNAL(Error(int, QString, int, int)),
           SLOT(HandlePipelineError(int, QString, int, int)));
-  connect(ret.get(), SIGNAL(MetadataFound(int, Engine::SimpleMetaBundle)),
+  connect(pipeline, SIGNAL(MetadataFound(int, Engine::SimpleMetaBundle)),
           SLOT(NewMetaData(int, Engine::SimpleMetaBundle)));
-  connect(ret.get(), SIGNAL(BufferingStarted()), SLOT(BufferingStarted()));
-  connect(ret.get(), SIGNAL(BufferingProgress(int)),
+  connect(pipeline, SIGNAL(BufferingStarted()), SLOT(BufferingStarted()));
+  connect(pipeline, SIGNAL(BufferingProgress(int)),
           SLOT(BufferingProgress(int)));
-  connect(ret.get(), SIGNAL(BufferingFinished()), SLOT(BufferingFinished()));
+  connect(pipeline, SIGNAL(BufferingFinished()), SLOT(BufferingFinished()));
+}
+
+shared_ptr<GstEnginePipeline> GstEngine::TakeSparePipeline(
+    const MediaPlaybackRequest& req, qint64 end_nanosec) {
+  shared_ptr<GstEnginePipeline> ret;
+  ret.swap(spare_pipeline_);
+  if (!ret || !ret->ReloadFromReq(req, end_nanosec)) {
+    return shared_ptr<GstEnginePipeline>();
+  }
 
+  // Only the FadeoutFinished() connection is left from when it was retired.
+  disconnect(ret.get(), 0, 0, 0);
+  ConnectPipeline(ret.get());
   return ret;
 }
 
@@ -56,7 +56,7 @@ typedef struct _GTlsDatabase GTlsDatabase;
  * @short GStreamer engine plugin
  * @author Mark Kretschmann <markey@web.de>
  */
-class GstEngine : public Engine::Base, public BufferConsumer {
+class GstEngine : public Engine::Base {
   Q_OBJECT
 
  public:
@@ -73,6 +73,7 @@ class GstEngine : public Engine::Base, public BufferConsumer {
   typedef QList<OutputDetails> OutputDetailsList;
 
   static const int kAutoSampleRate = -1;
+  static const int kDefaultPrebufferDurationMsec = 5000;
   static const char* kOutFormatDetect;
   static const char* kOutFormatS16LE;
   static const char* kOutFormatF32LE;
@@ -97,9 +98,6 @@ class GstEngine : public Engine::Base, public BufferConsumer {
 
   GstElement* CreateElement(const QString& factoryName, GstElement* bin = 0);
 
-  // BufferConsumer
-  void ConsumeBuffer(GstBuffer* buffer, int pipeline_id);
-
  public slots:
   void StartPreloading(const MediaPlaybackRequest& req, bool force_stop_at_end,
                        qint64 beginning_nanosec, qint64 end_nanosec);
@@ -148,8 +146,8 @@ class GstEngine : public Engine::Base, public BufferConsumer {
   void HandlePipelineError(int pipeline_id, const QString& message, int domain,
                            int error_code);
   void NewMetaData(int pipeline_id, const Engine::SimpleMetaBundle& bundle);
-  void AddBufferToScope(GstBuffer* buf, int pipeline_id);
   void FadeoutFinished();
+  void FadeoutReady(QFuture<GstStateChangeReturn> future, int pipeline_id);
   void FadeoutPauseFinished();
   void SeekNow();
   void BackgroundStreamFinished();
@@ -179,8 +177,10 @@ class GstEngine : public Engine::Base, public BufferConsumer {
   std::shared_ptr<GstEnginePipeline> CreatePipeline();
   std::shared_ptr<GstEnginePipeline> CreatePipeline(
       const MediaPlaybackRequest& req, qint64 end_nanosec);
-
-  void UpdateScope(int chunk_length);
+  void ConnectPipeline(GstEnginePipeline* pipeline);
+  // Reuses the spare pipeline for req if there is one, keeping its output open.
+  std::shared_ptr<GstEnginePipeline> TakeSparePipeline(
+      const MediaPlaybackRequest& req, qint64 end_nanosec);
 
   int AddBackgroundStream(std::shared_ptr<GstEnginePipeline> pipeline);
 
@@ -205,12 +205,15 @@ class GstEngine : public Engine::Base, public BufferConsumer {
   std::shared_ptr<GstEnginePipeline> current_pipeline_;
   std::shared_ptr<GstEnginePipeline> fadeout_pipeline_;
   std::shared_ptr<GstEnginePipeline> fadeout_pause_pipeline_;
+  // A pipeline that has finished fading out is kept here, stopped but with
+  // its sink still open, so the next crossfade doesn't have to open another.
+  std::shared_ptr<GstEnginePipeline> spare_pipeline_;
+  // The pipeline that will become spare_pipeline_ once it has stopped.
+  std::shared_ptr<GstEnginePipeline> readying_pipeline_;
   QUrl preloaded_url_;
 
   QList<BufferConsumer*> buffer_consumers_;
 
-  GstBuffer* latest_buffer_;
-
   bool equalizer_enabled_;
   int equalizer_preamp_;
   QList<int> equalizer_gains_;
@@ -222,6 +225,7 @@ class GstEngine : public Engine::Base, public BufferConsumer {
   bool rg_compression_;
 
   qint64 buffer_duration_nanosec_;
+  qint64 prebuffer_duration_nanosec_;
 
   int buffer_min_fill_;
 
@@ -245,10 +249,6 @@ class GstEngine : public Engine::Base, public BufferConsumer {
   bool is_fading_out_to_pause_;
   bool has_faded_out_;
 
-  int scope_chunk_;
-  bool have_new_buffer_;
-  int scope_chunks_;
-
   QList<DeviceFinder*> device_finders_;
 
 #ifdef Q_OS_DARWIN
@@ -32,6 +32,7 @@
 #include "core/logging.h"
 #include "core/mac_startup.h"
 #include "core/signalchecker.h"
+#include "core/timeconstants.h"
 #include "core/utilities.h"
 #include "gstelementdeleter.h"
 #include "gstengine.h"
@@ -57,6 +58,7 @@ GstEnginePipeline::GstEnginePipeline(GstEngine* engine)
     : GstPipelineBase("audio"),
       engine_(engine),
       valid_(false),
+      reusable_(true),
       sink_(GstEngine::kAutoSink),
       segment_start_(0),
       segment_start_received_(false),
@@ -73,6 +75,11 @@ GstEnginePipeline::GstEnginePipeline(GstEngine* engine)
       buffer_duration_nanosec_(1 * kNsecPerSec),
       buffer_min_fill_(33),
       buffering_(false),
+      prebuffer_duration_nanosec_(0),
+      prebuffer_bin_(nullptr),
+      prebuffer_decodebin_(nullptr),
+      prebuffer_queue_(nullptr),
+      prebuffer_probe_id_(0),
       mono_playback_(false),
       sample_rate_(GstEngine::kAutoSampleRate),
       end_offset_nanosec_(-1),
@@ -132,6 +139,11 @@ void GstEnginePipeline::set_buffer_min_fill(int percent) {
   buffer_min_fill_ = percent;
 }
 
+void GstEnginePipeline::set_prebuffer_duration_nanosec(
+    qint64 duration_nanosec) {
+  prebuffer_duration_nanosec_ = duration_nanosec;
+}
+
 void GstEnginePipeline::set_mono_playback(bool enabled) {
   mono_playback_ = enabled;
 }
@@ -533,11 +545,12 @@ bool GstEnginePipeline::InitFromString(const QString& pipeline) {
   return gst_element_link(new_bin, audiobin_);
 }
 
-bool GstEnginePipeline::InitFromReq(const MediaPlaybackRequest& req,
-                                    qint64 end_nanosec) {
-  if (!Init()) return false;
-
+QUrl GstEnginePipeline::SetCurrentReq(const MediaPlaybackRequest& req,
+                                      qint64 end_nanosec) {
   current_ = req;
+  end_offset_nanosec_ = end_nanosec;
+  source_device_.clear();
+
   QUrl url = current_.url_;
 #ifdef HAVE_AUDIOCD
   if (url.scheme() == "cdda" && !url.path().isEmpty()) {
@@ -551,10 +564,15 @@ bool GstEnginePipeline::InitFromReq(const MediaPlaybackRequest& req,
     source_device_ = path.join("/");
   }
 #endif
-  end_offset_nanosec_ = end_nanosec;
+  return url;
+}
+
+bool GstEnginePipeline::InitFromReq(const MediaPlaybackRequest& req,
+                                    qint64 end_nanosec) {
+  if (!Init()) return false;
 
   // Decode bin
-  if (!ReplaceDecodeBin(url)) return false;
+  if (!ReplaceDecodeBin(SetCurrentReq(req, end_nanosec))) return false;
 
   if (!InitAudioBin()) return false;
 
@@ -564,6 +582,60 @@ bool GstEnginePipeline::InitFromReq(const MediaPlaybackRequest& req,
   return true;
 }
 
+bool GstEnginePipeline::ReloadFromReq(const MediaPlaybackRequest& req,
+                                      qint64 end_nanosec) {
+  if (!is_reusable()) return false;
+
+  // Unlike NULL, READY stops the streaming threads without closing the sink,
+  // which is the slow part of starting a pipeline with most audio servers.
+  if (gst_element_set_state(pipeline_, GST_STATE_READY) ==
+      GST_STATE_CHANGE_FAILURE) {
+    qLog(Warning) << id() << "Couldn't stop the pipeline to reuse it";
+    return false;
+  }
+
+  // Anything still waiting on the bus belongs to the old track.
+  GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline_));
+  gst_bus_set_flushing(bus, TRUE);
+  gst_bus_set_flushing(bus, FALSE);
+  gst_object_unref(bus);
+
+  RenewId();
+  DropPrebuffer();
+
+  fader_.reset();
+  fader_fudge_timer_.stop();
+  volume_modifier_ = 1.0;
+  UpdateVolume();
+
+  next_ = MediaPlaybackRequest();
+  next_beginning_offset_nanosec_ = -1;
+  next_end_offset_nanosec_ = -1;
+  emit_track_ended_on_stream_start_ = false;
+  emit_track_ended_on_time_discontinuity_ = false;
+  last_buffer_offset_ = 0;
+  ignore_next_seek_ = false;
+  redirect_url_ = QUrl();
+  buffering_ = false;
+  pipeline_is_initialised_ = false;
+  pending_seek_nanosec_ = -1;
+  last_known_position_ns_ = 0;
+  gst_segment_init(&last_decodebin_segment_, GST_FORMAT_TIME);
+
+  // Nothing is streaming, so the old decode bin can go straight away.
+  GstElement* old_decode_bin = uridecodebin_;
+  gst_object_ref(old_decode_bin);
+  const bool replaced = ReplaceDecodeBin(SetCurrentReq(req, end_nanosec));
+  gst_element_set_state(old_decode_bin, GST_STATE_NULL);
+  gst_object_unref(old_decode_bin);
+  if (!replaced) return false;
+
+  qLog(Debug) << id() << "Reusing pipeline for" << current_.url_;
+
+  MaybeLinkDecodeToAudio();
+  return true;
+}
+
 GstEnginePipeline::~GstEnginePipeline() {
   if (pipeline_) {
     GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline_));
@@ -695,6 +767,8 @@ void GstEnginePipeline::TaskEnterCallback(GstTask*, GThread*, gpointer) {
 }
 
 void GstEnginePipeline::ElementMessageReceived(GstMessage* msg) {
+  if (IsFromInactiveBin(msg)) return;
+
   const GstStructure* structure = gst_message_get_structure(msg);
 
   if (gst_structure_has_name(structure, "redirect")) {
@@ -719,6 +793,16 @@ void GstEnginePipeline::ErrorMessageReceived(GstMessage* msg) {
   g_error_free(error);
   g_free(debugs);
 
+  if (IsFromInactiveBin(msg)) {
+    // Probably the next track failed to open while it was being prebuffered.
+    // It's opened again when the current track finishes, and the error is
+    // reported then.
+    qLog(Warning) << id() << "Error from a decode bin that isn't playing:"
+                  << Utilities::ScrubUrlQueries(message);
+    QMetaObject::invokeMethod(this, "DropPrebuffer", Qt::QueuedConnection);
+    return;
+  }
+
   if (!redirect_url_.isEmpty() &&
       debugstr.contains(
           "A redirect message was posted on the bus and should have been "
@@ -760,6 +844,8 @@ bool IsAkamaiTag(const QString& tag) { return tag.contains("- text=\""); }
 }  // namespace
 
 void GstEnginePipeline::TagMessageReceived(GstMessage* msg) {
+  if (IsFromInactiveBin(msg)) return;
+
   GstTagList* taglist = nullptr;
   gst_message_parse_tag(msg, &taglist);
 
@@ -915,13 +1001,24 @@ void GstEnginePipeline::NewPadCallback(GstElement*, GstPad* pad,
   }
   gst_object_unref(audiopad);
 
+  instance->TrackDecodeBinPad(pad);
+
+  instance->pipeline_is_connected_ = true;
+  if (instance->pending_seek_nanosec_ != -1 &&
+      instance->pipeline_is_initialised_) {
+    QMetaObject::invokeMethod(instance, "Seek", Qt::QueuedConnection,
+                              Q_ARG(qint64, instance->pending_seek_nanosec_));
+  }
+}
+
+void GstEnginePipeline::TrackDecodeBinPad(GstPad* pad) {
   // Offset the timestamps on all the buffers coming out of the decodebin so
   // they line up exactly with the end of the last buffer from the old
   // decodebin.
   // "Running time" is the time since the last flushing seek.
   GstClockTime running_time = gst_segment_to_running_time(
-      &instance->last_decodebin_segment_, GST_FORMAT_TIME,
-      instance->last_decodebin_segment_.position);
+      &last_decodebin_segment_, GST_FORMAT_TIME,
+      last_decodebin_segment_.position);
   gst_pad_set_offset(pad, running_time);
 
   // Add a probe to the pad so we can update last_decodebin_segment_.
@@ -930,14 +1027,29 @@ void GstEnginePipeline::NewPadCallback(GstElement*, GstPad* pad,
       static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER |
                                    GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
                                    GST_PAD_PROBE_TYPE_EVENT_FLUSH),
-      DecodebinProbe, instance, nullptr);
+      DecodebinProbe, this, nullptr);
+}
 
-  instance->pipeline_is_connected_ = true;
-  if (instance->pending_seek_nanosec_ != -1 &&
-      instance->pipeline_is_initialised_) {
-    QMetaObject::invokeMethod(instance, "Seek", Qt::QueuedConnection,
-                              Q_ARG(qint64, instance->pending_seek_nanosec_));
+void GstEnginePipeline::PrebufferPadCallback(GstElement*, GstPad* pad,
+                                             gpointer queue) {
+  GstPad* const queue_pad =
+      gst_element_get_static_pad(GST_ELEMENT(queue), "sink");
+
+  qLog(Debug) << "Prebuffer decoder bin pad added:" << GST_PAD_NAME(pad);
+
+  if (GST_PAD_IS_LINKED(queue_pad)) {
+    qLog(Warning) << "Prebuffer queue is already linked, ignoring new pad";
+  } else if (gst_pad_link(pad, queue_pad) != GST_PAD_LINK_OK) {
+    qLog(Error) << "Failed to link decoder to prebuffer queue.";
   }
+  gst_object_unref(queue_pad);
+}
+
+GstPadProbeReturn GstEnginePipeline::PrebufferBlockProbe(GstPad*,
+                                                         GstPadProbeInfo*,
+                                                         gpointer) {
+  // Keep the data in the queue until the probe is removed.
+  return GST_PAD_PROBE_OK;
 }
 
 GstPadProbeReturn GstEnginePipeline::DecodebinProbe(GstPad* pad,
@@ -975,18 +1087,50 @@ GstPadProbeReturn GstEnginePipeline::DecodebinProbe(GstPad* pad,
       // A flushing seek resets the running time to 0, so remove any offset
       // we set on this pad before.
       gst_pad_set_offset(pad, 0);
+    } else if (event_type == GST_EVENT_EOS && gst_pad_is_linked(pad) &&
+               instance->CanTransitionToNext()) {
+      // A prebuffer bin doesn't emit "drained" when its queue runs out, and
+      // its decoder might have been drained before it was even spliced in.
+      // Move on here instead, exactly after its last buffer.  Plain decode
+      // bins have usually moved on at "drained" already.
+      instance->TransitionToNext();
+      return GST_PAD_PROBE_DROP;
     }
   }
 
   return GST_PAD_PROBE_OK;
 }
 
-GstPadProbeReturn GstEnginePipeline::HandoffCallback(GstPad*,
+GstPadProbeReturn GstEnginePipeline::HandoffCallback(GstPad* pad,
                                                      GstPadProbeInfo* info,
                                                      gpointer self) {
   GstEnginePipeline* instance = reinterpret_cast<GstEnginePipeline*>(self);
   GstBuffer* buf = gst_pad_probe_info_get_buffer(info);
 
+  // The probe sink syncs to the clock, so this buffer is starting to play
+  // right now.  The caps on this pad are always 16 bit samples.
+  GstMapInfo map;
+  if (gst_buffer_map(buf, &map, GST_MAP_READ)) {
+    const int count = map.size / sizeof(int16_t);
+
+    qint64 samples_per_second = 0;
+    if (GST_BUFFER_DURATION_IS_VALID(buf) && GST_BUFFER_DURATION(buf) > 0) {
+      samples_per_second = count * kNsecPerSec / GST_BUFFER_DURATION(buf);
+    }
+
+    int channels = 1;
+    GstCaps* caps = gst_pad_get_current_caps(pad);
+    if (caps) {
+      gst_structure_get_int(gst_caps_get_structure(caps, 0), "channels",
+                            &channels);
+      gst_caps_unref(caps);
+    }
+
+    instance->scope_buffer_.Write(reinterpret_cast<const int16_t*>(map.data),
+                                  count, channels, samples_per_second);
+    gst_buffer_unmap(buf, &map);
+  }
+
   QList<BufferConsumer*> consumers;
   {
     QMutexLocker l(&instance->buffer_consumers_mutex_);
@@ -1079,18 +1223,27 @@ void GstEnginePipeline::SourceDrainedCallback(GstURIDecodeBin* bin,
                                               gpointer self) {
   GstEnginePipeline* instance = reinterpret_cast<GstEnginePipeline*>(self);
 
-  if (instance->has_next_valid_url() &&
-      // I'm not sure why, but calling this when previous track is a local song
-      // and the next track is a Spotify song is buggy: the Spotify song will
-      // not start or with some offset. So just do nothing here: when the song
-      // finished, EndOfStreamReached/TrackEnded will be emitted anyway so
-      // NextItem will be called.
-      !(instance->current_.url_.scheme() != "spotify" &&
-        instance->next_.url_.scheme() == "spotify")) {
+  // Only a decode bin that's linked straight to the audio bin has really
+  // finished when it's drained.  Prebuffer bins still have their queue to
+  // play, and move on at EOS instead.
+  if (GST_ELEMENT(bin) != instance->uridecodebin_) return;
+
+  if (instance->CanTransitionToNext()) {
     instance->TransitionToNext();
   }
 }
 
+bool GstEnginePipeline::CanTransitionToNext() const {
+  return has_next_valid_url() &&
+         // I'm not sure why, but calling this when previous track is a local
+         // song and the next track is a Spotify song is buggy: the Spotify song
+         // will not start or with some offset. So just do nothing here: when
+         // the song finished, EndOfStreamReached/TrackEnded will be emitted
+         // anyway so NextItem will be called.
+         !(current_.url_.scheme() != "spotify" &&
+           next_.url_.scheme() == "spotify");
+}
+
 void GstEnginePipeline::SourceSetupCallback(GstURIDecodeBin* bin,
                                             GParamSpec* pspec, gpointer self) {
   GstEnginePipeline* instance = reinterpret_cast<GstEnginePipeline*>(self);
@@ -1127,9 +1280,18 @@ void GstEnginePipeline::SourceSetupCallback(GstURIDecodeBin* bin,
 
   if (g_object_class_find_property(G_OBJECT_GET_CLASS(element),
                                    "extra-headers")) {
-    if (!instance->current_.headers_.empty()) {
+    // A prebuffer bin's source is for the next track.
+    bool prebuffering = false;
+    {
+      QMutexLocker l(&instance->prebuffer_mutex_);
+      prebuffering = GST_ELEMENT(bin) == instance->prebuffer_decodebin_;
+    }
+    const MediaPlaybackRequest& req =
+        prebuffering ? instance->next_ : instance->current_;
+
+    if (!req.headers_.empty()) {
       GstStructure* gheaders = gst_structure_new_empty("headers");
-      QMapIterator<QByteArray, QByteArray> i(instance->current_.headers_);
+      QMapIterator<QByteArray, QByteArray> i(req.headers_);
       while (i.hasNext()) {
         i.next();
         qLog(Debug) << "Adding header" << i.key();
@@ -1149,12 +1311,14 @@ void GstEnginePipeline::TransitionToNext() {
 
   ignore_tags_ = true;
 
-  if (!ReplaceDecodeBin(next_.url_)) {
-    qLog(Error) << "ReplaceDecodeBin failed with " << next_.url_;
-    return;
+  if (!SplicePrebuffer()) {
+    if (!ReplaceDecodeBin(next_.url_)) {
+      qLog(Error) << "ReplaceDecodeBin failed with " << next_.url_;
+      return;
+    }
+    gst_element_set_state(uridecodebin_, GST_STATE_PLAYING);
+    MaybeLinkDecodeToAudio();
   }
-  gst_element_set_state(uridecodebin_, GST_STATE_PLAYING);
-  MaybeLinkDecodeToAudio();
 
   current_ = next_;
   end_offset_nanosec_ = next_end_offset_nanosec_;
@@ -1396,4 +1560,153 @@ void GstEnginePipeline::SetNextReq(const MediaPlaybackRequest& req,
   next_ = req;
   next_beginning_offset_nanosec_ = beginning_nanosec;
   next_end_offset_nanosec_ = end_nanosec;
+
+  StartPrebuffering();
+}
+
+void GstEnginePipeline::StartPrebuffering() {
+  {
+    QMutexLocker l(&prebuffer_mutex_);
+    if (prebuffer_bin_ && prebuffer_url_ == next_.url_) return;
+  }
+  DropPrebuffer();
+
+  if (prebuffer_duration_nanosec_ == 0 || !audiobin_ || !next_.url_.isValid())
+    return;
+
+  // The next section of the same file carries on without a new decode bin.
+  // Spotify starts sending its stream as soon as the bin is created, and a CD
+  // can only be read by one source at a time.
+  if (next_.url_ == current_.url_ || next_.url_.scheme() == "spotify" ||
+      next_.url_.scheme() == "cdda") {
+    return;
+  }
+
+  // The prebuffer bin contains:
+  //   uridecodebin ! queue
+  // The queue holds up to prebuffer_duration_nanosec_ of decoded audio, and
+  // its src pad is blocked, so once it's full the decoder waits.
+  GstElement* bin = gst_bin_new("prebufferbin");
+  GstElement* decodebin = engine_->CreateElement("uridecodebin", bin);
+  GstElement* queue = engine_->CreateElement("queue", bin);
+  if (!decodebin || !queue) {
+    gst_object_unref(GST_OBJECT(bin));
+    return;
+  }
+
+  const QByteArray uri = GstUriFromUrl(next_.url_);
+  g_object_set(G_OBJECT(decodebin), "uri", uri.constData(), nullptr);
+  CHECKED_GCONNECT(G_OBJECT(decodebin), "pad-added", &PrebufferPadCallback,
+                   queue);
+  CHECKED_GCONNECT(G_OBJECT(decodebin), "notify::source",
+                   &SourceSetupCallback, this);
+
+  g_object_set(G_OBJECT(queue), "max-size-buffers", 0, nullptr);
+  g_object_set(G_OBJECT(queue), "max-size-bytes", 0, nullptr);
+  g_object_set(G_OBJECT(queue), "max-size-time", prebuffer_duration_nanosec_,
+               nullptr);
+
+  GstPad* pad = gst_element_get_static_pad(queue, "src");
+  const gulong probe_id =
+      gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+                        &PrebufferBlockProbe, nullptr, nullptr);
+  gst_element_add_pad(bin, gst_ghost_pad_new("src", pad));
+  gst_object_unref(pad);
+
+  qLog(Debug) << id() << "Prebuffering" << next_.url_;
+
+  {
+    QMutexLocker l(&prebuffer_mutex_);
+    prebuffer_bin_ = bin;
+    prebuffer_decodebin_ = decodebin;
+    prebuffer_queue_ = queue;
+    prebuffer_probe_id_ = probe_id;
+    prebuffer_url_ = next_.url_;
+  }
+
+  gst_bin_add(GST_BIN(pipeline_), bin);
+  gst_element_sync_state_with_parent(bin);
+}
+
+bool GstEnginePipeline::SplicePrebuffer() {
+  GstElement* bin = nullptr;
+  GstElement* queue = nullptr;
+  gulong probe_id = 0;
+  {
+    QMutexLocker l(&prebuffer_mutex_);
+    if (!prebuffer_bin_ || prebuffer_url_ != next_.url_) return false;
+
+    bin = prebuffer_bin_;
+    queue = prebuffer_queue_;
+    probe_id = prebuffer_probe_id_;
+    prebuffer_bin_ = nullptr;
+    prebuffer_decodebin_ = nullptr;
+    prebuffer_queue_ = nullptr;
+    prebuffer_probe_id_ = 0;
+    prebuffer_url_ = QUrl();
+  }
+
+  qLog(Debug) << id() << "Splicing in prebuffered" << next_.url_;
+
+  // Like ReplaceDecodeBin, the caller must schedule the old decode bin for
+  // deletion.  The prebuffer bin is already in the pipeline.
+  if (uridecodebin_) {
+    gst_bin_remove(GST_BIN(pipeline_), uridecodebin_);
+  }
+  uridecodebin_ = bin;
+  segment_start_ = 0;
+  segment_start_received_ = false;
+
+  GstPad* pad = gst_element_get_static_pad(bin, "src");
+  GstPad* audiopad = gst_element_get_static_pad(audiobin_, "sink");
+  if (GST_PAD_IS_LINKED(audiopad)) {
+    gst_pad_unlink(GST_PAD_PEER(audiopad), audiopad);
+  }
+  if (gst_pad_link(pad, audiopad) != GST_PAD_LINK_OK) {
+    qLog(Error) << "Failed to link prebuffer bin to audio bin.";
+  }
+  gst_object_unref(audiopad);
+
+  TrackDecodeBinPad(pad);
+  gst_object_unref(pad);
+  pipeline_is_connected_ = true;
+
+  // Let the decoded audio through.
+  pad = gst_element_get_static_pad(queue, "src");
+  gst_pad_remove_probe(pad, probe_id);
+  gst_object_unref(pad);
+
+  return true;
+}
+
+void GstEnginePipeline::DropPrebuffer() {
+  GstElement* bin = nullptr;
+  {
+    QMutexLocker l(&prebuffer_mutex_);
+    bin = prebuffer_bin_;
+    prebuffer_bin_ = nullptr;
+    prebuffer_decodebin_ = nullptr;
+    prebuffer_queue_ = nullptr;
+    prebuffer_probe_id_ = 0;
+    prebuffer_url_ = QUrl();
+  }
+  if (!bin) return;
+
+  qLog(Debug) << id() << "Dropping prebuffer";
+
+  // Stopping the bin wakes up its blocked queue.
+  gst_object_ref(bin);
+  gst_bin_remove(GST_BIN(pipeline_), bin);
+  gst_element_set_state(bin, GST_STATE_NULL);
+  gst_object_unref(bin);
+}
+
+bool GstEnginePipeline::IsFromInactiveBin(GstMessage* msg) {
+  GstObject* src = GST_MESSAGE_SRC(msg);
+  if (!src || !pipeline_ || src == GST_OBJECT(pipeline_)) return false;
+  if (!gst_object_has_as_ancestor(src, GST_OBJECT(pipeline_))) return true;
+
+  QMutexLocker l(&prebuffer_mutex_);
+  return prebuffer_bin_ &&
+         gst_object_has_as_ancestor(src, GST_OBJECT(prebuffer_bin_));
 }
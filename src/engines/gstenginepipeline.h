@@ -28,6 +28,7 @@
 
 #include "engine_fwd.h"
 #include "gstpipelinebase.h"
+#include "pcmringbuffer.h"
 #include "playbackrequest.h"
 
 class GstElementDeleter;
@@ -49,6 +50,7 @@ class GstEnginePipeline : public GstPipelineBase {
   void set_replaygain(bool enabled, int mode, float preamp, bool compression);
   void set_buffer_duration_nanosec(qint64 duration_nanosec);
   void set_buffer_min_fill(int percent);
+  void set_prebuffer_duration_nanosec(qint64 duration_nanosec);
   void set_mono_playback(bool enabled);
   void set_sample_rate(int rate);
   void set_format(const QString& format) { format_ = format; }
@@ -57,11 +59,26 @@ class GstEnginePipeline : public GstPipelineBase {
   bool InitFromReq(const MediaPlaybackRequest& req, qint64 end_nanosec);
   bool InitFromString(const QString& pipeline);
 
+  // Stops the pipeline and swaps in a decode bin for another request, keeping
+  // the audio bin and its sink open.  The pipeline is left in the READY state
+  // with a new id().  Returns false if the pipeline can't be reused, in which
+  // case it shouldn't be played again.
+  bool ReloadFromReq(const MediaPlaybackRequest& req, qint64 end_nanosec);
+
+  // Cleared by GstEngine when the output settings change, since those are only
+  // applied when the pipeline is created.
+  void set_reusable(bool reusable) { reusable_ = reusable; }
+  bool is_reusable() const { return reusable_ && audiobin_ && uridecodebin_; }
+
   // BufferConsumers get fed audio data.  Thread-safe.
   void AddBufferConsumer(BufferConsumer* consumer);
   void RemoveBufferConsumer(BufferConsumer* consumer);
   void RemoveAllBufferConsumers();
 
+  // The samples that have just been played, for the analyzers.  Written to by
+  // the streaming thread, and should only be read from one other thread.
+  const PcmRingBuffer& scope_buffer() const { return scope_buffer_; }
+
   // Control the music playback
   QFuture<GstStateChangeReturn> SetState(GstState state);
   Q_INVOKABLE bool Seek(qint64 nanosec);
@@ -75,7 +92,8 @@ class GstEnginePipeline : public GstPipelineBase {
                   bool use_fudge_timer = true);
 
   // If this is set then it will be loaded automatically when playback finishes
-  // for gapless playback
+  // for gapless playback.  If a prebuffer duration is set, the next track is
+  // opened straight away and that much of it is decoded in advance.
   void SetNextReq(const MediaPlaybackRequest& req, qint64 beginning_nanosec,
                   qint64 end_nanosec);
   bool has_next_valid_url() const { return next_.url_.isValid(); }
@@ -127,6 +145,9 @@ class GstEnginePipeline : public GstPipelineBase {
   static GstBusSyncReply BusCallbackSync(GstBus*, GstMessage*, gpointer);
   static gboolean BusCallback(GstBus*, GstMessage*, gpointer);
   static void NewPadCallback(GstElement*, GstPad*, gpointer);
+  static void PrebufferPadCallback(GstElement*, GstPad*, gpointer);
+  static GstPadProbeReturn PrebufferBlockProbe(GstPad*, GstPadProbeInfo*,
+                                               gpointer);
   static GstPadProbeReturn HandoffCallback(GstPad*, GstPadProbeInfo*, gpointer);
   static GstPadProbeReturn EventHandoffCallback(GstPad*, GstPadProbeInfo*,
                                                 gpointer);
@@ -157,8 +178,25 @@ class GstEnginePipeline : public GstPipelineBase {
   void SetOutputFormat(const QString& format);
   bool ReplaceDecodeBin(GstElement* new_bin);
   bool ReplaceDecodeBin(const QUrl& url);
+  // Makes req the current request and returns the URL to give the decode bin.
+  QUrl SetCurrentReq(const MediaPlaybackRequest& req, qint64 end_nanosec);
 
   void TransitionToNext();
+  bool CanTransitionToNext() const;
+
+  // Offsets the timestamps of a new decode bin's src pad so they follow on
+  // from the old one, and watches its segments.
+  void TrackDecodeBinPad(GstPad* pad);
+
+  // Opens next_ in a separate bin that decodes into a queue until the queue
+  // is full or the bin replaces the current decode bin.
+  void StartPrebuffering();
+  // Replaces the current decode bin with the prebuffer bin if it holds
+  // next_.  Returns false if there isn't one.
+  bool SplicePrebuffer();
+  // Whether the message was posted by the prebuffer bin, or by a decode bin
+  // that has already been removed from the pipeline.
+  bool IsFromInactiveBin(GstMessage* msg);
 
   // If the decodebin is special (ie. not really a uridecodebin) then it'll have
   // a src pad immediately and we can link it after everything's created.
@@ -169,6 +207,8 @@ class GstEnginePipeline : public GstPipelineBase {
 
  private slots:
   void FaderTimelineFinished();
+  // Removes the prebuffer bin, if there is one.
+  void DropPrebuffer();
 
  private:
   static const int kGstStateTimeoutNanosecs;
@@ -182,12 +222,15 @@ class GstEnginePipeline : public GstPipelineBase {
 
   // General settings for the pipeline
   bool valid_;
+  bool reusable_;
   QString sink_;
   QVariant device_;
 
   // These get called when there is a new audio buffer available
   QList<BufferConsumer*> buffer_consumers_;
   QMutex buffer_consumers_mutex_;
+
+  PcmRingBuffer scope_buffer_;
   qint64 segment_start_;
   bool segment_start_received_;
   bool emit_track_ended_on_stream_start_;
@@ -215,6 +258,17 @@ class GstEnginePipeline : public GstPipelineBase {
   int buffer_min_fill_;
   bool buffering_;
 
+  // Prebuffering the next track.  The bin is created on the main thread but
+  // spliced in on a streaming thread, so the pointers are guarded by the
+  // mutex.
+  qint64 prebuffer_duration_nanosec_;
+  QMutex prebuffer_mutex_;
+  GstElement* prebuffer_bin_;
+  GstElement* prebuffer_decodebin_;
+  GstElement* prebuffer_queue_;
+  gulong prebuffer_probe_id_;
+  QUrl prebuffer_url_;
+
   bool mono_playback_;
   int sample_rate_;
   QString format_;
@@ -36,6 +36,10 @@ class GstPipelineBase : public QObject {
   void DumpGraph();
 
  protected:
+  // Gives the pipeline a new ID when it gets reused for something else, so
+  // signals that were queued with the old one can be told apart.
+  void RenewId() { id_ = sId++; }
+
   GstElement* pipeline_;
 
  private:
@@ -45,7 +49,7 @@ class GstPipelineBase : public QObject {
   // get created in the same address as old ones.  This ID will be unique for
   // each pipeline.
   static std::atomic<int> sId;
-  const int id_;
+  std::atomic<int> id_;
 };
 
 class GstPipelineModel : public QStandardItemModel {
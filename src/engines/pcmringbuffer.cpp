@@ -0,0 +1,128 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pcmringbuffer.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "core/timeconstants.h"
+
+PcmRingBuffer::PcmRingBuffer(int capacity)
+    : write_pos_(0),
+      sequence_(0),
+      chunk_start_(0),
+      chunk_time_nsec_(0),
+      samples_per_second_(0),
+      channels_(1) {
+  int size = 1;
+  while (size < capacity) size <<= 1;
+
+  data_.resize(size);
+  mask_ = size - 1;
+}
+
+qint64 PcmRingBuffer::Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void PcmRingBuffer::Write(const int16_t* samples, int count, int channels,
+                          qint64 samples_per_second) {
+  Write(samples, count, channels, samples_per_second, Now());
+}
+
+void PcmRingBuffer::Write(const int16_t* samples, int count, int channels,
+                          qint64 samples_per_second, qint64 now_nsec) {
+  if (count <= 0) return;
+
+  // Only the end of a huge chunk would survive anyway.
+  if (count > capacity()) {
+    samples += count - capacity();
+    count = capacity();
+  }
+
+  const quint64 pos = write_pos_.load(std::memory_order_relaxed);
+  const int offset = pos & mask_;
+  const int first = qMin(count, capacity() - offset);
+  memcpy(&data_[offset], samples, first * sizeof(int16_t));
+  memcpy(&data_[0], samples + first, (count - first) * sizeof(int16_t));
+
+  sequence_.fetch_add(1, std::memory_order_acq_rel);
+  chunk_start_.store(pos, std::memory_order_relaxed);
+  chunk_time_nsec_.store(now_nsec, std::memory_order_relaxed);
+  samples_per_second_.store(samples_per_second, std::memory_order_relaxed);
+  channels_.store(qMax(1, channels), std::memory_order_relaxed);
+  write_pos_.store(pos + count, std::memory_order_release);
+  sequence_.fetch_add(1, std::memory_order_release);
+}
+
+bool PcmRingBuffer::Read(int16_t* dest, int count) const {
+  return Read(dest, count, Now());
+}
+
+bool PcmRingBuffer::Read(int16_t* dest, int count, qint64 now_nsec) const {
+  // Leave plenty of room for the writer to carry on while we're copying.
+  if (count <= 0 || count > capacity() / 2) return false;
+
+  // Only try a couple of times - it's better to show a stale frame than to
+  // hold up the GUI thread.
+  for (int attempt = 0; attempt < 3; ++attempt) {
+    const quint32 sequence = sequence_.load(std::memory_order_acquire);
+    if (sequence & 1) continue;
+
+    const quint64 chunk_start = chunk_start_.load(std::memory_order_relaxed);
+    const qint64 chunk_time = chunk_time_nsec_.load(std::memory_order_relaxed);
+    const qint64 samples_per_second =
+        samples_per_second_.load(std::memory_order_relaxed);
+    const int channels = channels_.load(std::memory_order_relaxed);
+    const quint64 written = write_pos_.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence_.load(std::memory_order_relaxed) != sequence) continue;
+
+    // Work out which sample is playing now.  The chunk started playing when
+    // it was written, so count forward from there.
+    quint64 end = written;
+    if (samples_per_second > 0) {
+      // Chunks are short, so there's no point looking further ahead than this,
+      // and it keeps the arithmetic from overflowing.
+      const qint64 elapsed = qBound(qint64(0), now_nsec - chunk_time, kNsecPerSec);
+      const quint64 playing =
+          chunk_start + elapsed * samples_per_second / kNsecPerSec;
+      end = qMin(end, playing);
+    }
+    end -= end % channels;
+
+    if (end < quint64(count)) return false;
+
+    const quint64 start = end - count;
+    const int offset = start & mask_;
+    const int first = qMin(count, capacity() - offset);
+    memcpy(dest, &data_[offset], first * sizeof(int16_t));
+    memcpy(dest + first, &data_[0], (count - first) * sizeof(int16_t));
+
+    // Make sure the writer didn't lap us while we were copying.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (write_pos_.load(std::memory_order_relaxed) - start <=
+        quint64(capacity())) {
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,72 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ENGINES_PCMRINGBUFFER_H_
+#define ENGINES_PCMRINGBUFFER_H_
+
+#include <QtGlobal>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Keeps the most recent interleaved 16 bit samples that were played, so the
+// analyzers can look at the audio that's playing right now.
+// There must be only one thread writing and one thread reading.  Neither of
+// them ever blocks: the writer overwrites the oldest samples, and the reader
+// gives up if the samples it was copying were overwritten underneath it.
+class PcmRingBuffer {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit PcmRingBuffer(int capacity = kDefaultCapacity);
+
+  static const int kDefaultCapacity = 1 << 16;
+
+  int capacity() const { return static_cast<int>(data_.size()); }
+
+  // Adds samples that start playing at time now_nsec.  Only called by the
+  // writer thread.
+  void Write(const int16_t* samples, int count, int channels,
+             qint64 samples_per_second, qint64 now_nsec);
+  void Write(const int16_t* samples, int count, int channels,
+             qint64 samples_per_second);
+
+  // Copies the count samples leading up to the one playing at time now_nsec
+  // into dest.  Returns false if there aren't enough samples yet.  Only
+  // called by the reader thread.
+  bool Read(int16_t* dest, int count, qint64 now_nsec) const;
+  bool Read(int16_t* dest, int count) const;
+
+  // The clock used by the overloads that don't take a time.
+  static qint64 Now();
+
+ private:
+  std::vector<int16_t> data_;
+  quint64 mask_;
+
+  // Total number of samples ever written.
+  std::atomic<quint64> write_pos_;
+
+  // Describes the last chunk of samples that was written, so the reader can
+  // work out how far through it playback has got.  Protected by a sequence
+  // number that is odd while the writer is changing them.
+  std::atomic<quint32> sequence_;
+  std::atomic<quint64> chunk_start_;
+  std::atomic<qint64> chunk_time_nsec_;
+  std::atomic<qint64> samples_per_second_;
+  std::atomic<int> channels_;
+};
+
+#endif  // ENGINES_PCMRINGBUFFER_H_
@@ -118,6 +118,10 @@ void GlobalSearch::DoSearchAsync(int id, const QString& query) {
 }
 
 void GlobalSearch::CancelSearch(int id) {
+  for (SearchProvider* provider : providers_.keys()) {
+    provider->CancelSearch(id);
+  }
+
   QMap<int, DelayedSearch>::iterator it;
   for (it = delayed_searches_.begin(); it != delayed_searches_.end(); ++it) {
     if (it.value().id_ == id) {
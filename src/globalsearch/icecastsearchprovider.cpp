@@ -17,27 +17,49 @@
 
 #include "icecastsearchprovider.h"
 
-#include "internet/icecast/icecastbackend.h"
 #include "ui/iconloader.h"
 
 IcecastSearchProvider::IcecastSearchProvider(
     std::shared_ptr<IcecastBackend> backend, Application* app, QObject* parent)
-    : BlockingSearchProvider(app, parent), backend_(backend) {
+    : BlockingSearchProvider(app, parent),
+      backend_(backend),
+      stations_dirty_(true) {
   Init("Icecast", "icecast", IconLoader::Load("icon_radio", IconLoader::Lastfm),
        DisabledByDefault);
+
+  connect(backend_.get(), SIGNAL(DatabaseReset()), SLOT(StationsChanged()));
+}
+
+void IcecastSearchProvider::StationsChanged() {
+  QMutexLocker l(&mutex_);
+  stations_dirty_ = true;
+}
+
+void IcecastSearchProvider::MaybeLoadStations() {
+  if (!stations_dirty_) return;
+
+  stations_ = backend_->GetStations();
+  index_.Clear();
+  for (const IcecastBackend::Station& station : stations_) {
+    index_.Add(QStringList() << station.name);
+  }
+  stations_dirty_ = false;
 }
 
 SearchProvider::ResultList IcecastSearchProvider::Search(int id,
                                                          const QString& query) {
-  IcecastBackend::StationList stations = backend_->GetStations(query);
-  ResultList ret;
+  Q_UNUSED(id)
 
-  for (const IcecastBackend::Station& station : stations) {
+  QMutexLocker l(&mutex_);
+  MaybeLoadStations();
+
+  ResultList ret;
+  for (int i : index_.Match(TokenizeQuery(query))) {
     if (ret.count() > 3) break;
 
     Result result(this);
     result.group_automatically_ = false;
-    result.metadata_ = station.ToSong();
+    result.metadata_ = stations_[i].ToSong();
     ret << result;
   }
 
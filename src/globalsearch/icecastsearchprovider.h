@@ -18,21 +18,36 @@
 #ifndef ICECASTSEARCHPROVIDER_H
 #define ICECASTSEARCHPROVIDER_H
 
+#include <QMutex>
 #include <memory>
 
+#include "internet/icecast/icecastbackend.h"
 #include "searchprovider.h"
-
-class IcecastBackend;
+#include "trigramindex.h"
 
 class IcecastSearchProvider : public BlockingSearchProvider {
+  Q_OBJECT
+
  public:
   IcecastSearchProvider(std::shared_ptr<IcecastBackend> backend,
                         Application* app, QObject* parent);
 
   ResultList Search(int id, const QString& query);
 
+ private slots:
+  void StationsChanged();
+
  private:
+  // Loads the stations from the backend and indexes their names, if they've
+  // changed since the last search.  Called with mutex_ held.
+  void MaybeLoadStations();
+
   std::shared_ptr<IcecastBackend> backend_;
+
+  QMutex mutex_;
+  bool stations_dirty_;
+  IcecastBackend::StationList stations_;
+  TrigramIndex index_;
 };
 
 #endif  // ICECASTSEARCHPROVIDER_H
@@ -18,11 +18,13 @@
 #include "librarysearchprovider.h"
 
 #include <QStack>
+#include <QtConcurrentRun>
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
 #include <QRandomGenerator>
 #endif
 
+#include "core/closure.h"
 #include "core/logging.h"
 #include "covers/albumcoverloader.h"
 #include "library/librarybackend.h"
@@ -30,6 +32,9 @@
 #include "library/sqlrow.h"
 #include "playlist/songmimedata.h"
 
+const int LibrarySearchProvider::kFirstPageSize = 100;
+const int LibrarySearchProvider::kMaxResults = 500;
+
 LibrarySearchProvider::LibrarySearchProvider(LibraryBackendInterface* backend,
                                              const QString& name,
                                              const QString& id,
@@ -47,13 +52,78 @@ LibrarySearchProvider::LibrarySearchProvider(LibraryBackendInterface* backend,
   Init(name, id, icon, hints);
 }
 
+void LibrarySearchProvider::SearchAsync(int id, const QString& query) {
+  {
+    QMutexLocker l(&cancelled_mutex_);
+    running_.insert(id);
+  }
+  StartPage(id, query, 0);
+}
+
+void LibrarySearchProvider::CancelSearch(int id) {
+  QMutexLocker l(&cancelled_mutex_);
+  if (running_.contains(id)) cancelled_.insert(id);
+}
+
+bool LibrarySearchProvider::IsCancelled(int id) {
+  QMutexLocker l(&cancelled_mutex_);
+  return cancelled_.contains(id);
+}
+
+void LibrarySearchProvider::StartPage(int id, const QString& query,
+                                      int offset) {
+  const int limit = offset == 0 ? kFirstPageSize : kMaxResults - offset;
+  QFuture<ResultList> future = QtConcurrent::run(
+      this, &LibrarySearchProvider::SearchPage, id, query, offset, limit);
+  NewClosure(future, this,
+             SLOT(PageFinished(QFuture<ResultList>, int, QString, int)),
+             future, id, query, offset);
+}
+
+void LibrarySearchProvider::PageFinished(QFuture<ResultList> future, int id,
+                                         const QString& query, int offset) {
+  const ResultList results = future.result();
+  if (!IsCancelled(id)) {
+    emit ResultsAvailable(id, results);
+
+    // A full first page means there are probably more.
+    if (offset == 0 && results.count() == kFirstPageSize) {
+      StartPage(id, query, results.count());
+      return;
+    }
+  }
+
+  {
+    QMutexLocker l(&cancelled_mutex_);
+    running_.remove(id);
+    cancelled_.remove(id);
+  }
+  emit SearchFinished(id);
+}
+
 SearchProvider::ResultList LibrarySearchProvider::Search(int id,
                                                          const QString& query) {
+  return SearchPage(id, query, 0, kFirstPageSize);
+}
+
+SearchProvider::ResultList LibrarySearchProvider::SearchPage(
+    int id, const QString& query, int offset, int limit) {
+  // The user has probably typed something else while this page was queued.
+  if (IsCancelled(id)) return ResultList();
+
   QueryOptions options;
   options.set_filter(query);
 
   LibraryQuery q(options);
   q.SetColumnSpec("%songs_table.ROWID, " + Song::kColumnSpec);
+  if (q.join_with_fts()) {
+    // Break ties by ROWID so the pages don't overlap or skip songs.
+    q.SetOrderBy(
+        "fts_rank(matchinfo(fts.%fts_table_noprefix)) DESC,"
+        " %songs_table.ROWID");
+  }
+  q.SetLimit(limit);
+  q.SetOffset(offset);
 
   if (!backend_->ExecQuery(&q)) {
     return ResultList();
@@ -18,23 +18,56 @@
 #ifndef LIBRARYSEARCHPROVIDER_H
 #define LIBRARYSEARCHPROVIDER_H
 
+#include <QMutex>
+#include <QSet>
+
+#include "gtest/gtest_prod.h"
 #include "searchprovider.h"
 
 class LibraryBackendInterface;
 
+// Searches a library's FTS table.  Results are ranked by how well they
+// match and at most kMaxResults are returned, in two pages: a small one
+// with the best matches that shows up straight away, then the rest.
 class LibrarySearchProvider : public BlockingSearchProvider {
+  Q_OBJECT
+
  public:
   LibrarySearchProvider(LibraryBackendInterface* backend, const QString& name,
                         const QString& id, const QIcon& icon,
                         bool enabled_by_default, Application* app,
                         QObject* parent = nullptr);
 
+  static const int kFirstPageSize;
+  static const int kMaxResults;
+
+  void SearchAsync(int id, const QString& query);
+  void CancelSearch(int id);
+
+  // Returns the first page of results.
   ResultList Search(int id, const QString& query);
   MimeData* LoadTracks(const ResultList& results);
   QStringList GetSuggestions(int count);
 
+ private slots:
+  void PageFinished(QFuture<ResultList> future, int id, const QString& query,
+                    int offset);
+
  private:
+  void StartPage(int id, const QString& query, int offset);
+  ResultList SearchPage(int id, const QString& query, int offset, int limit);
+  bool IsCancelled(int id);
+
+  FRIEND_TEST(LibrarySearchProviderTest, RanksBetterMatchesFirst);
+  FRIEND_TEST(LibrarySearchProviderTest, PagesDontOverlap);
+
   LibraryBackendInterface* backend_;
+
+  // Searches that were cancelled while one of their pages was running.
+  // Pages run on other threads, which check this before querying.
+  QMutex cancelled_mutex_;
+  QSet<int> running_;
+  QSet<int> cancelled_;
 };
 
 #endif  // LIBRARYSEARCHPROVIDER_H
@@ -126,6 +126,11 @@ class SearchProvider : public QObject {
   // SearchFinished exactly once, using this ID.
   virtual void SearchAsync(int id, const QString& query) = 0;
 
+  // Tells the provider that nobody is interested in the results of this
+  // search any more.  It should stop the search as soon as it can, but must
+  // still emit SearchFinished for it.
+  virtual void CancelSearch(int id) {}
+
   // Starts loading an icon for a result that was previously emitted by
   // ResultsAvailable.  Must emit ArtLoaded exactly once with this ID.
   virtual void LoadArtAsync(int id, const Result& result);
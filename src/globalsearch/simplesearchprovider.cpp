@@ -62,37 +62,36 @@ SearchProvider::ResultList SimpleSearchProvider::Search(int id,
 
   has_searched_before_ = true;
 
-  ResultList ret;
-  const QStringList tokens = TokenizeQuery(query);
+  // Safe words match every item.
+  QStringList tokens;
+  for (const QString& token : TokenizeQuery(query)) {
+    if (!safe_words_.contains(token, Qt::CaseInsensitive)) tokens << token;
+  }
 
+  ResultList ret;
   QMutexLocker l(&items_mutex_);
-  for (const Item& item : items_) {
-    bool matched = true;
-    for (const QString& token : tokens) {
-      if (!item.keyword_.contains(token, Qt::CaseInsensitive) &&
-          !item.metadata_.title().contains(token, Qt::CaseInsensitive) &&
-          !safe_words_.contains(token, Qt::CaseInsensitive)) {
-        matched = false;
-        break;
-      }
-    }
-
-    if (matched) {
-      Result result(this);
-      result.group_automatically_ = false;
-      result.metadata_ = item.metadata_;
-      ret << result;
-    }
-
+  for (int i : index_.Match(tokens)) {
     if (ret.count() >= result_limit_) break;
+
+    Result result(this);
+    result.group_automatically_ = false;
+    result.metadata_ = items_[i].metadata_;
+    ret << result;
   }
 
   return ret;
 }
 
 void SimpleSearchProvider::SetItems(const ItemList& items) {
+  // Build the index before taking the lock so searches can carry on.
+  TrigramIndex index;
+  for (const Item& item : items) {
+    index.Add(QStringList() << item.keyword_ << item.metadata_.title());
+  }
+
   QMutexLocker l(&items_mutex_);
   items_ = items;
+  index_ = index;
   for (ItemList::iterator it = items_.begin(); it != items_.end(); ++it) {
     it->metadata_.set_filetype(Song::Type_Stream);
   }
@@ -19,6 +19,7 @@
 #define SIMPLESEARCHPROVIDER_H
 
 #include "searchprovider.h"
+#include "trigramindex.h"
 
 class SimpleSearchProvider : public BlockingSearchProvider {
   Q_OBJECT
@@ -73,6 +74,8 @@ class SimpleSearchProvider : public BlockingSearchProvider {
 
   QMutex items_mutex_;
   ItemList items_;
+  // Keywords and titles of items_, with the same ids as their positions.
+  TrigramIndex index_;
 
   bool items_dirty_;
   bool has_searched_before_;
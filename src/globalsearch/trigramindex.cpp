@@ -0,0 +1,124 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "trigramindex.h"
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+
+const int TrigramIndex::kGramLength = 3;
+
+TrigramIndex::TrigramIndex() {}
+
+TrigramIndex::Gram TrigramIndex::MakeGram(const QChar* data, int length) {
+  Gram ret = length;
+  for (int i = 0; i < length; ++i) {
+    ret = (ret << 16) | data[i].unicode();
+  }
+  return ret;
+}
+
+int TrigramIndex::Add(const QStringList& fields) {
+  const int id = texts_.count();
+
+  QStringList folded_fields;
+  for (const QString& field : fields) {
+    const QString folded = field.toCaseFolded();
+    folded_fields << folded;
+
+    const QChar* data = folded.constData();
+    for (int start = 0; start < folded.length(); ++start) {
+      const int max_length = qMin(kGramLength, folded.length() - start);
+      for (int length = 1; length <= max_length; ++length) {
+        IdList& ids = postings_[MakeGram(data + start, length)];
+        if (ids.isEmpty() || ids.last() != id) ids << id;
+      }
+    }
+  }
+
+  texts_ << folded_fields.join('\n');
+  return id;
+}
+
+void TrigramIndex::Clear() {
+  postings_.clear();
+  texts_.clear();
+}
+
+TrigramIndex::IdList TrigramIndex::MatchToken(const QString& folded) const {
+  // Short tokens are grams themselves.
+  if (folded.length() <= kGramLength) {
+    return postings_.value(MakeGram(folded.constData(), folded.length()));
+  }
+
+  // Start with the rarest trigram so the candidate list stays short.
+  QList<const IdList*> lists;
+  for (int start = 0; start + kGramLength <= folded.length(); ++start) {
+    auto it = postings_.constFind(
+        MakeGram(folded.constData() + start, kGramLength));
+    if (it == postings_.constEnd()) return IdList();
+    lists << &it.value();
+  }
+  std::sort(lists.begin(), lists.end(),
+            [](const IdList* a, const IdList* b) {
+              return a->count() < b->count();
+            });
+
+  IdList candidates = *lists.first();
+  for (int i = 1; i < lists.count() && !candidates.isEmpty(); ++i) {
+    IdList next;
+    std::set_intersection(candidates.constBegin(), candidates.constEnd(),
+                          lists[i]->constBegin(), lists[i]->constEnd(),
+                          std::back_inserter(next));
+    candidates = next;
+  }
+
+  // Having all the trigrams doesn't mean they're in the right order.
+  IdList ret;
+  for (int id : candidates) {
+    if (texts_[id].contains(folded)) ret << id;
+  }
+  return ret;
+}
+
+QVector<int> TrigramIndex::Match(const QStringList& tokens) const {
+  IdList ret;
+  bool match_all = true;
+
+  for (const QString& token : tokens) {
+    if (token.isEmpty()) continue;
+
+    const IdList ids = MatchToken(token.toCaseFolded());
+    if (match_all) {
+      ret = ids;
+      match_all = false;
+    } else {
+      IdList next;
+      std::set_intersection(ret.constBegin(), ret.constEnd(),
+                            ids.constBegin(), ids.constEnd(),
+                            std::back_inserter(next));
+      ret = next;
+    }
+    if (ret.isEmpty()) return ret;
+  }
+
+  if (match_all) {
+    ret.resize(count());
+    std::iota(ret.begin(), ret.end(), 0);
+  }
+  return ret;
+}
@@ -0,0 +1,65 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRIGRAMINDEX_H
+#define TRIGRAMINDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Finds which of a list of documents contain a substring, ignoring case,
+// without scanning all of them.
+//
+// Every substring of up to three characters of each field is mapped to the
+// documents containing it.  Shorter search tokens are looked up directly,
+// longer ones by intersecting the lists of their trigrams and checking the
+// few remaining candidates.
+//
+// The index is meant to be built once when the documents change, and is
+// safe to query from several threads at once.
+class TrigramIndex {
+ public:
+  TrigramIndex();
+
+  // Adds a document made of the given fields and returns its id.  Ids are
+  // assigned in order, starting from 0.  A match never spans two fields.
+  int Add(const QStringList& fields);
+
+  void Clear();
+  int count() const { return texts_.count(); }
+
+  // Returns the ids of the documents that contain every token, in ascending
+  // order.  Empty tokens match every document.
+  QVector<int> Match(const QStringList& tokens) const;
+
+ private:
+  typedef quint64 Gram;
+  typedef QVector<int> IdList;
+
+  static const int kGramLength;
+
+  static Gram MakeGram(const QChar* data, int length);
+  IdList MatchToken(const QString& folded) const;
+
+  QHash<Gram, IdList> postings_;
+
+  // The case folded fields of each document, separated by newlines.
+  QVector<QString> texts_;
+};
+
+#endif  // TRIGRAMINDEX_H
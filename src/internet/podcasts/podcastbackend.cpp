@@ -164,8 +164,7 @@ void PodcastBackend::UpdateEpisodes(const PodcastEpisodeList& episodes) {
 PodcastList PodcastBackend::GetAllSubscriptions() {
   PodcastList ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + Podcast::kColumnSpec + " FROM podcasts");
@@ -184,8 +183,7 @@ PodcastList PodcastBackend::GetAllSubscriptions() {
 Podcast PodcastBackend::GetSubscriptionById(int id) {
   Podcast ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + Podcast::kColumnSpec +
@@ -203,8 +201,7 @@ Podcast PodcastBackend::GetSubscriptionById(int id) {
 Podcast PodcastBackend::GetSubscriptionByUrl(const QUrl& url) {
   Podcast ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + Podcast::kColumnSpec +
@@ -222,8 +219,7 @@ Podcast PodcastBackend::GetSubscriptionByUrl(const QUrl& url) {
 PodcastEpisodeList PodcastBackend::GetEpisodes(int podcast_id) {
   PodcastEpisodeList ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + PodcastEpisode::kColumnSpec +
@@ -246,8 +242,7 @@ PodcastEpisodeList PodcastBackend::GetEpisodes(int podcast_id) {
 PodcastEpisode PodcastBackend::GetEpisodeById(int id) {
   PodcastEpisode ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + PodcastEpisode::kColumnSpec +
@@ -265,8 +260,7 @@ PodcastEpisode PodcastBackend::GetEpisodeById(int id) {
 PodcastEpisode PodcastBackend::GetEpisodeByUrl(const QUrl& url) {
   PodcastEpisode ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + PodcastEpisode::kColumnSpec +
@@ -284,8 +278,7 @@ PodcastEpisode PodcastBackend::GetEpisodeByUrl(const QUrl& url) {
 PodcastEpisode PodcastBackend::GetEpisodeByUrlOrLocalUrl(const QUrl& url) {
   PodcastEpisode ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + PodcastEpisode::kColumnSpec +
@@ -305,8 +298,7 @@ PodcastEpisodeList PodcastBackend::GetOldDownloadedEpisodes(
     const QDateTime& max_listened_date) {
   PodcastEpisodeList ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + PodcastEpisode::kColumnSpec +
@@ -329,8 +321,7 @@ PodcastEpisodeList PodcastBackend::GetOldDownloadedEpisodes(
 PodcastEpisode PodcastBackend::GetOldestDownloadedListenedEpisode() {
   PodcastEpisode ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + PodcastEpisode::kColumnSpec +
@@ -349,8 +340,7 @@ PodcastEpisode PodcastBackend::GetOldestDownloadedListenedEpisode() {
 PodcastEpisodeList PodcastBackend::GetNewDownloadedEpisodes() {
   PodcastEpisodeList ret;
 
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare("SELECT ROWID, " + PodcastEpisode::kColumnSpec +
@@ -58,4 +58,22 @@ Q_DECLARE_METATYPE(Subdirectory)
 typedef QList<Subdirectory> SubdirectoryList;
 Q_DECLARE_METATYPE(SubdirectoryList)
 
+// A subdirectory that a library scan has queued but not finished with yet.
+// These are saved in the database while the scan runs so that it can carry on
+// where it left off if Clementine is killed.
+struct ScanJournalEntry {
+  ScanJournalEntry()
+      : incremental(true), force_noincremental(false), ignores_mtime(false) {}
+
+  Subdirectory subdir;
+  // Whether the scan that queued this subdirectory was incremental.
+  bool incremental;
+  bool force_noincremental;
+  bool ignores_mtime;
+};
+Q_DECLARE_METATYPE(ScanJournalEntry)
+
+typedef QList<ScanJournalEntry> ScanJournal;
+Q_DECLARE_METATYPE(ScanJournal)
+
 #endif  // DIRECTORY_H
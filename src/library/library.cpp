@@ -156,6 +156,8 @@ void Library::Init() {
           SLOT(AddOrUpdateSongs(SongList)));
   connect(watcher_, SIGNAL(SongsMTimeUpdated(SongList)), backend_.get(),
           SLOT(UpdateMTimesOnly(SongList)));
+  connect(watcher_, SIGNAL(SongsFingerprinted(SongList)), backend_.get(),
+          SLOT(UpdateFileFingerprintsOnly(SongList)));
   connect(watcher_, SIGNAL(SongsDeleted(SongList)), backend_.get(),
           SLOT(MarkSongsUnavailable(SongList)));
   connect(watcher_, SIGNAL(SongsReadded(SongList, bool)), backend_.get(),
@@ -166,6 +168,12 @@ void Library::Init() {
           backend_.get(), SLOT(AddOrUpdateSubdirs(SubdirectoryList)));
   connect(watcher_, SIGNAL(CompilationsNeedUpdating()), backend_.get(),
           SLOT(UpdateCompilations()));
+  connect(watcher_,
+          SIGNAL(ScanJournalUpdated(int, ScanJournal, QStringList)),
+          backend_.get(),
+          SLOT(UpdateScanJournal(int, ScanJournal, QStringList)));
+  connect(watcher_, SIGNAL(ScanJournalCleared(int)), backend_.get(),
+          SLOT(ClearScanJournal(int)));
   connect(watcher_, &LibraryWatcher::Error, app_, &Application::AddError);
   connect(app_->playlist_manager(), SIGNAL(CurrentSongChanged(Song)),
           SLOT(CurrentSongChanged(Song)));
@@ -21,6 +21,7 @@
 #include <QDateTime>
 #include <QDir>
 #include <QFileInfo>
+#include <QHash>
 #include <QSettings>
 #include <QVariant>
 #include <QtDebug>
@@ -35,6 +36,10 @@
 #include "sqlrow.h"
 
 const char* LibraryBackend::kSettingsGroup = "LibraryBackend";
+const int LibraryBackend::kMaxIncrementalCompilationAlbums = 1000;
+// SQLite's default SQLITE_MAX_VARIABLE_NUMBER.
+const int LibraryBackend::kMaxBoundValues = 999;
+const int LibraryBackend::kMaxIdsPerQuery = 10000;
 
 const char* LibraryBackend::kNewScoreSql =
     "case when playcount <= 0 then (%1 * 100 + score) / 2"
@@ -45,7 +50,8 @@ const char* LibraryBackend::kNewScoreSql =
 LibraryBackend::LibraryBackend(QObject* parent)
     : LibraryBackendInterface(parent),
       save_statistics_in_file_(false),
-      save_ratings_in_file_(false) {}
+      save_ratings_in_file_(false),
+      compilations_need_full_update_(true) {}
 
 void LibraryBackend::Init(Database* db, const QString& songs_table,
                           const QString& fts_table) {
@@ -156,8 +162,7 @@ void LibraryBackend::ChangeDirPath(int id, const QString& old_path,
 }
 
 DirectoryList LibraryBackend::GetAllDirectories() {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   DirectoryList ret;
 
@@ -177,8 +182,7 @@ DirectoryList LibraryBackend::GetAllDirectories() {
 }
 
 SubdirectoryList LibraryBackend::SubdirsInDirectory(int id) {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db = db_->Connect();
+  QSqlDatabase db = db_->ConnectReadOnly();
   return SubdirsInDirectory(id, db);
 }
 
@@ -204,8 +208,7 @@ SubdirectoryList LibraryBackend::SubdirsInDirectory(int id, QSqlDatabase& db) {
 }
 
 void LibraryBackend::UpdateTotalSongCount() {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare(QString("SELECT COUNT(*) FROM %1 WHERE unavailable = 0")
@@ -262,6 +265,9 @@ void LibraryBackend::RemoveDirectory(int dir_id) {
   q.exec();
   if (db_->CheckErrors(q)) return;
 
+  // And anything an unfinished scan left behind
+  ClearScanJournal(dir_id);
+
   // Now remove the directory itself
   q = QSqlQuery(db);
   q.prepare(QString("DELETE FROM %1 WHERE ROWID = :id").arg(dirs_table_));
@@ -274,10 +280,102 @@ void LibraryBackend::RemoveDirectory(int dir_id) {
   transaction.Commit();
 }
 
-SongList LibraryBackend::FindSongsInDirectory(int id) {
+ScanJournal LibraryBackend::GetScanJournal(int dir_id) {
+  QSqlDatabase db(db_->ConnectReadOnly());
+
+  QSqlQuery q(db);
+  q.prepare(
+      "SELECT path, mtime, is_new, force_noincremental, ignores_mtime,"
+      " incremental"
+      " FROM scan_journal"
+      " WHERE songs_table = :songs_table AND directory = :directory");
+  q.bindValue(":songs_table", songs_table_);
+  q.bindValue(":directory", dir_id);
+  q.exec();
+  if (db_->CheckErrors(q)) return ScanJournal();
+
+  ScanJournal ret;
+  while (q.next()) {
+    ScanJournalEntry entry;
+    entry.subdir.directory_id = q.value(2).toBool() ? -1 : dir_id;
+    entry.subdir.path = q.value(0).toString();
+    entry.subdir.mtime = q.value(1).toUInt();
+    entry.force_noincremental = q.value(3).toBool();
+    entry.ignores_mtime = q.value(4).toBool();
+    entry.incremental = q.value(5).toBool();
+    ret << entry;
+  }
+  return ret;
+}
+
+void LibraryBackend::UpdateScanJournal(int dir_id, const ScanJournal& queued,
+                                       const QStringList& finished_paths) {
+  QMutexLocker l(db_->Mutex());
+  QSqlDatabase db(db_->Connect());
+
+  // The directory might have been removed while it was being scanned.
+  QSqlQuery check_dir(db);
+  check_dir.prepare(
+      QString("SELECT ROWID FROM %1 WHERE ROWID = :id").arg(dirs_table_));
+  check_dir.bindValue(":id", dir_id);
+  check_dir.exec();
+  if (db_->CheckErrors(check_dir) || !check_dir.next()) return;
+
+  QSqlQuery add_query(db);
+  add_query.prepare(
+      "INSERT OR REPLACE INTO scan_journal"
+      " (songs_table, directory, path, mtime, is_new, force_noincremental,"
+      "  ignores_mtime, incremental)"
+      " VALUES (:songs_table, :directory, :path, :mtime, :is_new,"
+      "  :force_noincremental, :ignores_mtime, :incremental)");
+  QSqlQuery delete_query(db);
+  delete_query.prepare(
+      "DELETE FROM scan_journal"
+      " WHERE songs_table = :songs_table AND directory = :directory"
+      " AND path = :path");
+
+  ScopedTransaction transaction(&db);
+  for (const ScanJournalEntry& entry : queued) {
+    add_query.bindValue(":songs_table", songs_table_);
+    add_query.bindValue(":directory", dir_id);
+    add_query.bindValue(":path", entry.subdir.path);
+    add_query.bindValue(":mtime", entry.subdir.mtime);
+    add_query.bindValue(":is_new", entry.subdir.directory_id == -1 ? 1 : 0);
+    add_query.bindValue(":force_noincremental",
+                        entry.force_noincremental ? 1 : 0);
+    add_query.bindValue(":ignores_mtime", entry.ignores_mtime ? 1 : 0);
+    add_query.bindValue(":incremental", entry.incremental ? 1 : 0);
+    add_query.exec();
+    if (db_->CheckErrors(add_query)) return;
+  }
+
+  for (const QString& path : finished_paths) {
+    delete_query.bindValue(":songs_table", songs_table_);
+    delete_query.bindValue(":directory", dir_id);
+    delete_query.bindValue(":path", path);
+    delete_query.exec();
+    if (db_->CheckErrors(delete_query)) return;
+  }
+  transaction.Commit();
+}
+
+void LibraryBackend::ClearScanJournal(int dir_id) {
   QMutexLocker l(db_->Mutex());
   QSqlDatabase db(db_->Connect());
 
+  QSqlQuery q(db);
+  q.prepare(
+      "DELETE FROM scan_journal"
+      " WHERE songs_table = :songs_table AND directory = :directory");
+  q.bindValue(":songs_table", songs_table_);
+  q.bindValue(":directory", dir_id);
+  q.exec();
+  db_->CheckErrors(q);
+}
+
+SongList LibraryBackend::FindSongsInDirectory(int id) {
+  QSqlDatabase db(db_->ConnectReadOnly());
+
   QSqlQuery q(db);
   q.prepare(QString("SELECT ROWID, " + Song::kColumnSpec +
                     " FROM %1 WHERE directory = :directory")
@@ -295,6 +393,33 @@ SongList LibraryBackend::FindSongsInDirectory(int id) {
   return ret;
 }
 
+SongList LibraryBackend::FindSongsWithoutFingerprint(int directory_id,
+                                                     int after_id, int limit) {
+  QSqlDatabase db(db_->ConnectReadOnly());
+
+  QSqlQuery q(db);
+  q.prepare(QString("SELECT ROWID, " + Song::kColumnSpec +
+                    " FROM %1 WHERE directory = :directory"
+                    " AND ROWID > :after_id AND unavailable = 0"
+                    " AND IFNULL(file_fingerprint, '') = ''"
+                    " AND IFNULL(cue_path, '') = ''"
+                    " ORDER BY ROWID LIMIT :limit")
+                .arg(songs_table_));
+  q.bindValue(":directory", directory_id);
+  q.bindValue(":after_id", after_id);
+  q.bindValue(":limit", limit);
+  q.exec();
+  if (db_->CheckErrors(q)) return SongList();
+
+  SongList ret;
+  while (q.next()) {
+    Song song;
+    song.InitFromQuery(q, true);
+    ret << song;
+  }
+  return ret;
+}
+
 void LibraryBackend::SongPathChanged(const Song& song,
                                      const QFileInfo& new_file) {
   // Take a song and update its path
@@ -362,86 +487,85 @@ void LibraryBackend::AddOrUpdateSongs(const SongList& songs) {
   QMutexLocker l(db_->Mutex());
   QSqlDatabase db(db_->Connect());
 
-  QSqlQuery check_dir(db);
-  check_dir.prepare(
-      QString("SELECT ROWID FROM %1 WHERE ROWID = :id").arg(dirs_table_));
-  QSqlQuery add_song(db);
-  add_song.prepare(QString("INSERT INTO %1 (" + Song::kColumnSpec +
-                           ")"
-                           " VALUES (" +
-                           Song::kBindSpec + ")")
-                       .arg(songs_table_));
-  QSqlQuery update_song(db);
-  update_song.prepare(
-      QString("UPDATE %1 SET " + Song::kUpdateSpec + " WHERE ROWID = :id")
-          .arg(songs_table_));
-  QSqlQuery add_song_fts(db);
-  add_song_fts.prepare(QString("INSERT INTO %1 (ROWID, " +
-                               Song::kFtsColumnSpec +
-                               ")"
-                               " VALUES (:id, " +
-                               Song::kFtsBindSpec + ")")
-                           .arg(fts_table_));
-  QSqlQuery update_song_fts(db);
-  update_song_fts.prepare(
-      QString("UPDATE %1 SET " + Song::kFtsUpdateSpec + " WHERE ROWID = :id")
-          .arg(fts_table_));
-
   ScopedTransaction transaction(&db);
 
-  SongList added_songs;
-  SongList deleted_songs;
+  // Do a sanity check first - make sure the songs' directories still exist.
+  // This is to fix a possible race condition when a directory is removed
+  // while LibraryWatcher is scanning it.
+  QSet<int> directory_ids;
+  if (!dirs_table_.isEmpty()) {
+    QSqlQuery q(db);
+    q.prepare(QString("SELECT ROWID FROM %1").arg(dirs_table_));
+    q.exec();
+    if (db_->CheckErrors(q)) return;
+    while (q.next()) directory_ids << q.value(0).toInt();
+  }
 
+  // Get the previous data of the songs being updated.
+  QStringList update_ids;
   for (const Song& song : songs) {
-    // Do a sanity check first - make sure the song's directory still exists
-    // This is to fix a possible race condition when a directory is removed
-    // while LibraryWatcher is scanning it.
-    if (!dirs_table_.isEmpty()) {
-      check_dir.bindValue(":id", song.directory_id());
-      check_dir.exec();
-      if (db_->CheckErrors(check_dir)) continue;
-
-      if (!check_dir.next()) continue;  // Directory didn't exist
+    if (song.id() != -1) update_ids << QString::number(song.id());
+  }
+  QHash<int, Song> old_songs;
+  for (int i = 0; i < update_ids.count(); i += kMaxIdsPerQuery) {
+    for (const Song& old_song :
+         GetSongsById(update_ids.mid(i, kMaxIdsPerQuery), db)) {
+      old_songs[old_song.id()] = old_song;
     }
+  }
+
+  // New songs get their IDs up front so they can be written together with
+  // the updated ones.
+  int next_id = 1;
+  {
+    QSqlQuery q(db);
+    q.prepare(QString("SELECT MAX(ROWID) FROM %1").arg(songs_table_));
+    q.exec();
+    if (db_->CheckErrors(q)) return;
+    if (q.next()) next_id = q.value(0).toInt() + 1;
+  }
+
+  SongList rows;
+  for (const Song& song : songs) {
+    if (!dirs_table_.isEmpty() && !directory_ids.contains(song.directory_id()))
+      continue;  // Directory didn't exist
 
     if (song.id() == -1) {
-      // Create
+      Song copy(song);
+      copy.set_id(next_id++);
+      rows << copy;
+    } else if (old_songs.contains(song.id())) {
+      rows << song;
+    }
+  }
 
-      // Insert the row and create a new ID
-      song.BindToQuery(&add_song);
-      add_song.exec();
-      if (db_->CheckErrors(add_song)) continue;
+  const int songs_per_statement =
+      kMaxBoundValues / (Song::kColumns.count() + 1);
 
-      // Get the new ID
-      const int id = add_song.lastInsertId().toInt();
+  SongList added_songs;
+  SongList deleted_songs;
 
-      // Add to the FTS index
-      add_song_fts.bindValue(":id", id);
-      song.BindToFtsQuery(&add_song_fts);
-      add_song_fts.exec();
-      if (db_->CheckErrors(add_song_fts)) continue;
+  for (int i = 0; i < rows.count(); i += songs_per_statement) {
+    const SongList batch = rows.mid(i, songs_per_statement);
 
-      Song copy(song);
-      copy.set_id(id);
-      added_songs << copy;
-    } else {
-      // Get the previous song data first
-      Song old_song(GetSongById(song.id()));
-      if (!old_song.is_valid()) continue;
-
-      // Update
-      song.BindToQuery(&update_song);
-      update_song.bindValue(":id", song.id());
-      update_song.exec();
-      if (db_->CheckErrors(update_song)) continue;
-
-      song.BindToFtsQuery(&update_song_fts);
-      update_song_fts.bindValue(":id", song.id());
-      update_song_fts.exec();
-      if (db_->CheckErrors(update_song_fts)) continue;
-
-      deleted_songs << old_song;
+    SongList written;
+    if (WriteSongs(batch, db, batch.count() == 1)) {
+      written = batch;
+    } else if (batch.count() > 1) {
+      // Write the songs one at a time to find and report the broken ones.
+      for (const Song& song : batch) {
+        if (WriteSongs(SongList() << song, db, true)) written << song;
+      }
+    }
+
+    for (const Song& song : written) {
+      if (old_songs.contains(song.id())) {
+        const Song& old_song = old_songs[song.id()];
+        deleted_songs << old_song;
+        MarkCompilationGroupDirty(old_song);
+      }
       added_songs << song;
+      MarkCompilationGroupDirty(song);
     }
   }
 
@@ -454,6 +578,56 @@ void LibraryBackend::AddOrUpdateSongs(const SongList& songs) {
   UpdateTotalSongCountAsync();
 }
 
+bool LibraryBackend::WriteSongs(const SongList& songs, QSqlDatabase& db,
+                                bool report_errors) {
+  QStringList values;
+  QStringList fts_values;
+  QStringList ids;
+  for (int i = 0; i < songs.count(); ++i) {
+    const QString suffix = QString("_%1").arg(i);
+    values << QString("(:id%1, %2)").arg(suffix, Song::BindSpec(suffix));
+    fts_values << QString("(:id%1, %2)").arg(suffix, Song::FtsBindSpec(suffix));
+    ids << QString::number(songs[i].id());
+  }
+
+  auto failed = [this, report_errors](const QSqlQuery& q) {
+    return report_errors ? db_->CheckErrors(q) : q.lastError().isValid();
+  };
+
+  QSqlQuery replace_songs(db);
+  replace_songs.prepare(QString("INSERT OR REPLACE INTO %1 (ROWID, " +
+                                Song::kColumnSpec + ") VALUES " +
+                                values.join(", "))
+                            .arg(songs_table_));
+  for (int i = 0; i < songs.count(); ++i) {
+    const QString suffix = QString("_%1").arg(i);
+    replace_songs.bindValue(":id" + suffix, songs[i].id());
+    songs[i].BindToQuery(&replace_songs, suffix);
+  }
+  replace_songs.exec();
+  if (failed(replace_songs)) return false;
+
+  // Replace the songs' FTS rows, binding the same values as the single song
+  // path does.
+  QSqlQuery delete_fts(db);
+  delete_fts.prepare(QString("DELETE FROM %1 WHERE ROWID IN (%2)")
+                         .arg(fts_table_, ids.join(",")));
+  delete_fts.exec();
+  if (failed(delete_fts)) return false;
+
+  QSqlQuery add_fts(db);
+  add_fts.prepare(QString("INSERT INTO %1 (ROWID, " + Song::kFtsColumnSpec +
+                          ") VALUES " + fts_values.join(", "))
+                      .arg(fts_table_));
+  for (int i = 0; i < songs.count(); ++i) {
+    const QString suffix = QString("_%1").arg(i);
+    add_fts.bindValue(":id" + suffix, songs[i].id());
+    songs[i].BindToFtsQuery(&add_fts, suffix);
+  }
+  add_fts.exec();
+  return !failed(add_fts);
+}
+
 void LibraryBackend::UpdateMTimesOnly(const SongList& songs) {
   QMutexLocker l(db_->Mutex());
   QSqlDatabase db(db_->Connect());
@@ -472,6 +646,26 @@ void LibraryBackend::UpdateMTimesOnly(const SongList& songs) {
   transaction.Commit();
 }
 
+void LibraryBackend::UpdateFileFingerprintsOnly(const SongList& songs) {
+  QMutexLocker l(db_->Mutex());
+  QSqlDatabase db(db_->Connect());
+
+  QSqlQuery q(db);
+  q.prepare(
+      QString("UPDATE %1 SET file_fingerprint = :file_fingerprint"
+              " WHERE ROWID = :id")
+          .arg(songs_table_));
+
+  ScopedTransaction transaction(&db);
+  for (const Song& song : songs) {
+    q.bindValue(":file_fingerprint", song.file_fingerprint());
+    q.bindValue(":id", song.id());
+    q.exec();
+    db_->CheckErrors(q);
+  }
+  transaction.Commit();
+}
+
 void LibraryBackend::DeleteSongs(const SongList& songs) {
   QMutexLocker l(db_->Mutex());
   QSqlDatabase db(db_->Connect());
@@ -491,6 +685,8 @@ void LibraryBackend::DeleteSongs(const SongList& songs) {
     remove_fts.bindValue(":id", song.id());
     remove_fts.exec();
     db_->CheckErrors(remove_fts);
+
+    MarkCompilationGroupDirty(song);
   }
   transaction.Commit();
 
@@ -514,6 +710,8 @@ void LibraryBackend::MarkSongsUnavailable(const SongList& songs,
     remove.bindValue(":id", song.id());
     remove.exec();
     db_->CheckErrors(remove);
+
+    MarkCompilationGroupDirty(song);
   }
   transaction.Commit();
 
@@ -527,7 +725,6 @@ QStringList LibraryBackend::GetAll(const QString& column,
   query.SetColumnSpec("DISTINCT " + column);
   query.AddCompilationRequirement(false);
 
-  QMutexLocker l(db_->Mutex());
   if (!ExecQuery(&query)) return QStringList();
 
   QStringList ret;
@@ -555,11 +752,8 @@ QStringList LibraryBackend::GetAllArtistsWithAlbums(const QueryOptions& opt) {
   query2.AddWhere("album", "", "!=");
   query2.AddWhere("albumartist", "", "=");
 
-  {
-    QMutexLocker l(db_->Mutex());
-    if (!ExecQuery(&query) || !ExecQuery(&query2)) {
-      return QStringList();
-    }
+  if (!ExecQuery(&query) || !ExecQuery(&query2)) {
+    return QStringList();
   }
 
   QSet<QString> artists;
@@ -607,7 +801,6 @@ SongList LibraryBackend::GetSongs(const QString& artist, const QString& album,
 
 SongList LibraryBackend::ExecLibraryQuery(LibraryQuery* query) {
   query->SetColumnSpec("%songs_table.ROWID, " + Song::kColumnSpec);
-  QMutexLocker l(db_->Mutex());
   if (!ExecQuery(query)) return SongList();
 
   SongList ret;
@@ -620,14 +813,12 @@ SongList LibraryBackend::ExecLibraryQuery(LibraryQuery* query) {
 }
 
 Song LibraryBackend::GetSongById(int id) {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
   return GetSongById(id, db);
 }
 
 SongList LibraryBackend::GetSongsById(const QList<int>& ids) {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QStringList str_ids;
   for (int id : ids) {
@@ -638,8 +829,7 @@ SongList LibraryBackend::GetSongsById(const QList<int>& ids) {
 }
 
 SongList LibraryBackend::GetSongsById(const QStringList& ids) {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   return GetSongsById(ids, db);
 }
@@ -647,8 +837,7 @@ SongList LibraryBackend::GetSongsById(const QStringList& ids) {
 SongList LibraryBackend::GetSongsByForeignId(const QStringList& ids,
                                              const QString& table,
                                              const QString& column) {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QString in = ids.join(",");
 
@@ -743,7 +932,6 @@ SongList LibraryBackend::GetCompilationSongs(const QString& album,
   query.AddCompilationRequirement(true);
   query.AddWhere("album", album);
 
-  QMutexLocker l(db_->Mutex());
   if (!ExecQuery(&query)) return SongList();
 
   SongList ret;
@@ -755,44 +943,90 @@ SongList LibraryBackend::GetCompilationSongs(const QString& album,
   return ret;
 }
 
+QString LibraryBackend::CompilationDirectory(const QUrl& url) {
+  return url.toString(QUrl::PreferLocalFile | QUrl::RemoveFilename);
+}
+
+void LibraryBackend::MarkCompilationGroupDirty(const Song& song) {
+  // Songs without an album are never part of a compilation
+  if (song.album().isEmpty()) return;
+
+  dirty_compilation_groups_[song.album()] << CompilationDirectory(song.url());
+}
+
 void LibraryBackend::UpdateCompilations() {
   QMutexLocker l(db_->Mutex());
+
+  if (!compilations_need_full_update_ && dirty_compilation_groups_.isEmpty()) {
+    return;
+  }
+
   QSqlDatabase db(db_->Connect());
 
+  // Only the directory + album groups that songs were added to, changed in or
+  // removed from can have changed.  If there are lots of them (after the first
+  // scan, say) it's quicker to look at every song at once.
+  const bool full_update =
+      compilations_need_full_update_ ||
+      dirty_compilation_groups_.count() > kMaxIncrementalCompilationAlbums;
+  QMap<QString, QSet<QString>> dirty_groups;
+  dirty_groups.swap(dirty_compilation_groups_);
+  compilations_need_full_update_ = false;
+
   // Look for albums that have songs by more than one 'effective album artist'
   // in the same
   // directory
 
   QSqlQuery q(db);
-  q.prepare(QString("SELECT effective_albumartist, album, filename, sampler "
-                    "FROM %1 WHERE unavailable = 0 ORDER BY album")
-                .arg(songs_table_));
-  q.exec();
-  if (db_->CheckErrors(q)) return;
+  if (full_update) {
+    q.prepare(QString("SELECT effective_albumartist, album, filename, sampler "
+                      "FROM %1 WHERE unavailable = 0 ORDER BY album")
+                  .arg(songs_table_));
+  } else {
+    q.prepare(QString("SELECT effective_albumartist, album, filename, sampler "
+                      "FROM %1 WHERE unavailable = 0 AND album = :album")
+                  .arg(songs_table_));
+  }
 
   QMap<QString, CompilationInfo> compilation_info;
-  while (q.next()) {
-    QString artist = q.value(0).toString();
-    QString album = q.value(1).toString();
-    QString filename = q.value(2).toString();
-    bool sampler = q.value(3).toBool();
-
-    // Ignore songs that don't have an album field set
-    if (album.isEmpty()) continue;
-
-    // Find the directory the song is in
-    QUrl url = QUrl::fromEncoded(filename.toUtf8());
-    QString directory =
-        url.toString(QUrl::PreferLocalFile | QUrl::RemoveFilename);
-
-    CompilationInfo& info = compilation_info[directory + album];
-    info.urls << url;
-    if (!info.artists.contains(artist)) info.artists << artist;
-    if (sampler)
-      ++info.has_samplers;
-    else
-      ++info.has_not_samplers;
+  const QStringList albums = full_update ? QStringList(QString())
+                                         : QStringList(dirty_groups.keys());
+  for (const QString& dirty_album : albums) {
+    if (!full_update) q.bindValue(":album", dirty_album);
+    q.exec();
+    if (db_->CheckErrors(q)) {
+      compilations_need_full_update_ = true;
+      return;
+    }
+
+    while (q.next()) {
+      QString artist = q.value(0).toString();
+      QString album = q.value(1).toString();
+      QString filename = q.value(2).toString();
+      bool sampler = q.value(3).toBool();
+
+      // Ignore songs that don't have an album field set
+      if (album.isEmpty()) continue;
+
+      // Find the directory the song is in
+      QUrl url = QUrl::fromEncoded(filename.toUtf8());
+      QString directory = CompilationDirectory(url);
+
+      // Other directories with this album weren't touched
+      if (!full_update && !dirty_groups[dirty_album].contains(directory)) {
+        continue;
+      }
+
+      CompilationInfo& info = compilation_info[directory + album];
+      info.urls << url;
+      if (!info.artists.contains(artist)) info.artists << artist;
+      if (sampler)
+        ++info.has_samplers;
+      else
+        ++info.has_not_samplers;
+    }
   }
+  q.finish();
 
   // Now mark the songs that we think are in compilations
 
@@ -887,10 +1121,7 @@ LibraryBackend::AlbumList LibraryBackend::GetAlbums(const QString& artist,
     query.AddWhere("artist", artist);
   }
 
-  {
-    QMutexLocker l(db_->Mutex());
-    if (!ExecQuery(&query)) return ret;
-  }
+  if (!ExecQuery(&query)) return ret;
 
   QString last_album;
   QString last_artist;
@@ -938,7 +1169,6 @@ LibraryBackend::Album LibraryBackend::GetAlbumArt(const QString& artist,
   }
   query.AddWhere("album", album);
 
-  QMutexLocker l(db_->Mutex());
   if (!ExecQuery(&query)) return ret;
 
   if (query.Next()) {
@@ -1085,12 +1315,12 @@ void LibraryBackend::ForceCompilation(const QString& album,
 }
 
 bool LibraryBackend::ExecQuery(LibraryQuery* q) {
-  return !db_->CheckErrors(q->Exec(db_->Connect(), songs_table_, fts_table_));
+  return !db_->CheckErrors(
+      q->Exec(db_->ConnectReadOnly(), songs_table_, fts_table_));
 }
 
 SongList LibraryBackend::FindSongs(const smart_playlists::Search& search) {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   // Build the query
   QString sql = search.ToSql(songs_table());
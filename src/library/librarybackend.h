@@ -19,6 +19,7 @@
 #define LIBRARYBACKEND_H
 
 #include <QFileInfo>
+#include <QMap>
 #include <QObject>
 #include <QSet>
 #include <QUrl>
@@ -148,8 +149,15 @@ class LibraryBackend : public LibraryBackendInterface {
   void UpdateTotalSongCountAsync();
 
   SongList FindSongsInDirectory(int id);
+  // Available songs in this directory that don't have a file fingerprint yet,
+  // in ROWID order starting after after_id.  Songs from cue sheets are left
+  // out since they're never fingerprinted.
+  SongList FindSongsWithoutFingerprint(int directory_id, int after_id,
+                                       int limit);
   SubdirectoryList SubdirsInDirectory(int id);
   DirectoryList GetAllDirectories();
+  // Subdirectories that an interrupted scan of this directory didn't finish.
+  ScanJournal GetScanJournal(int dir_id);
   void ChangeDirPath(int id, const QString& old_path, const QString& new_path);
 
   QStringList GetAll(const QString& column,
@@ -207,9 +215,13 @@ class LibraryBackend : public LibraryBackendInterface {
   void UpdateTotalSongCount();
   void AddOrUpdateSongs(const SongList& songs);
   void UpdateMTimesOnly(const SongList& songs);
+  void UpdateFileFingerprintsOnly(const SongList& songs);
   void DeleteSongs(const SongList& songs);
   void MarkSongsUnavailable(const SongList& songs, bool unavailable = true);
   void AddOrUpdateSubdirs(const SubdirectoryList& subdirs);
+  void UpdateScanJournal(int dir_id, const ScanJournal& queued,
+                         const QStringList& finished_paths);
+  void ClearScanJournal(int dir_id);
   void UpdateCompilations();
   void UpdateManualAlbumArt(const QString& artist, const QString& albumartist,
                             const QString& album, const QString& art);
@@ -248,6 +260,19 @@ class LibraryBackend : public LibraryBackendInterface {
   };
 
   static const char* kNewScoreSql;
+  static const int kMaxIncrementalCompilationAlbums;
+  static const int kMaxBoundValues;
+  static const int kMaxIdsPerQuery;
+
+  // Remembers that the compilation status of the song's directory + album
+  // group has to be re-evaluated by the next UpdateCompilations().
+  void MarkCompilationGroupDirty(const Song& song);
+  static QString CompilationDirectory(const QUrl& url);
+
+  // Writes songs, which must all have IDs, to the songs and FTS tables with
+  // one statement per table.  Existing rows are replaced.  Errors are only
+  // reported to the user if report_errors is set.
+  bool WriteSongs(const SongList& songs, QSqlDatabase& db, bool report_errors);
 
   void UpdateCompilations(const QSqlDatabase& db, SongList& deleted_songs,
                           SongList& added_songs, const QUrl& url,
@@ -268,6 +293,13 @@ class LibraryBackend : public LibraryBackendInterface {
   QString fts_table_;
   bool save_statistics_in_file_;
   bool save_ratings_in_file_;
+
+  // Album -> directories with songs that were added, changed or removed since
+  // the last UpdateCompilations().  Protected by db_->Mutex().  We don't know
+  // what happened before we were started, so the first update looks at every
+  // album.
+  QMap<QString, QSet<QString>> dirty_compilation_groups_;
+  bool compilations_need_full_update_;
 };
 
 #endif  // LIBRARYBACKEND_H
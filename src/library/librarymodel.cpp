@@ -17,6 +17,7 @@
 
 #include "librarymodel.h"
 
+#include <QDateTime>
 #include <QFuture>
 #include <QIODevice>
 #include <QMetaEnum>
@@ -62,6 +63,8 @@ const char* LibraryModel::kSavedGroupingsSettingsGroup = "SavedGroupings";
 const int LibraryModel::kSmartPlaylistsVersion = 4;
 const int LibraryModel::kPrettyCoverSize = 32;
 const qint64 LibraryModel::kIconCacheSize = 100000000;  //~100MB
+const int LibraryModel::kPrefetchCacheRows = 5000;
+const int LibraryModel::kMaxPrefetchQueries = 2;
 
 static bool IsArtistGroupBy(const LibraryModel::GroupBy by) {
   return by == LibraryModel::GroupBy_Artist ||
@@ -88,7 +91,15 @@ LibraryModel::LibraryModel(std::shared_ptr<LibraryBackend> backend,
       thread_pool_(this),
       init_task_id_(-1),
       use_pretty_covers_(false),
-      show_dividers_(true) {
+      show_dividers_(true),
+      lazy_populate_async_(true),
+      next_populate_id_(0),
+      prefetched_(kPrefetchCacheRows),
+      reset_id_(0),
+      snapshot_loaded_(false),
+      snapshot_loading_(false),
+      snapshot_id_(0),
+      filter_ids_id_(0) {
   root_->lazy_loaded = true;
 
   group_by_[0] = GroupBy_AlbumArtist;
@@ -98,9 +109,13 @@ LibraryModel::LibraryModel(std::shared_ptr<LibraryBackend> backend,
   cover_loader_options_.desired_height_ = kPrettyCoverSize;
   cover_loader_options_.pad_output_image_ = true;
   cover_loader_options_.scale_output_image_ = true;
+  cover_loader_options_.use_thumbnail_cache_ = true;
 
-  connect(app_->album_cover_loader(), SIGNAL(ImageLoaded(quint64, QImage)),
-          SLOT(AlbumArtLoaded(quint64, QImage)));
+  // There's no Application in tests.
+  if (app_) {
+    connect(app_->album_cover_loader(), SIGNAL(ImageLoaded(quint64, QImage)),
+            SLOT(AlbumArtLoaded(quint64, QImage)));
+  }
 
   icon_cache_->setCacheDirectory(
       Utilities::GetConfigPath(Utilities::Path_PixmapCache));
@@ -119,6 +134,7 @@ LibraryModel::LibraryModel(std::shared_ptr<LibraryBackend> backend,
           SLOT(SongsSlightlyChanged(SongList)));
   connect(backend_.get(), SIGNAL(SongsRatingChanged(SongList)),
           SLOT(SongsSlightlyChanged(SongList)));
+  connect(backend_.get(), SIGNAL(DatabaseReset()), SLOT(ReloadSnapshot()));
   connect(backend_.get(), SIGNAL(DatabaseReset()), SLOT(Reset()));
   connect(backend_.get(), SIGNAL(TotalSongCountUpdated(int)),
           SLOT(TotalSongCountUpdatedSlot(int)));
@@ -158,6 +174,8 @@ void LibraryModel::SaveGrouping(QString name) {
 }
 
 void LibraryModel::Init(bool async) {
+  LoadSnapshotAsync();
+
   if (async) {
     // Show a loading indicator in the model.
     LibraryItem* loading =
@@ -177,10 +195,21 @@ void LibraryModel::Init(bool async) {
 }
 
 void LibraryModel::SongsDiscovered(const SongList& songs) {
+  InvalidatePopulates();
+  UpdateSnapshot(songs, false);
+
   for (const Song& song : songs) {
     // Sanity check to make sure we don't add songs that are outside the user's
     // filter
     if (!query_options_.Matches(song)) continue;
+    if (!query_options_.filter().isEmpty()) {
+      filter_ids_.insert(song.id());
+      // The FTS query for this filter might have run before the song was
+      // added, so remember it until the results are in.
+      if (filter_ids_text_ != query_options_.filter()) {
+        filter_ids_discovered_.insert(song.id());
+      }
+    }
 
     // Hey, we've already got that one!
     if (song_nodes_.contains(song.id())) continue;
@@ -206,55 +235,7 @@ void LibraryModel::SongsDiscovered(const SongList& songs) {
       } else {
         // Otherwise find the proper container at this level based on the
         // item's key
-        QString key;
-        switch (type) {
-          case GroupBy_Album:
-            key = song.album();
-            break;
-          case GroupBy_Artist:
-            key = song.artist();
-            break;
-          case GroupBy_Composer:
-            key = song.composer();
-            break;
-          case GroupBy_Performer:
-            key = song.performer();
-            break;
-          case GroupBy_Disc:
-            key = QString::number(song.disc());
-            break;
-          case GroupBy_Grouping:
-            key = song.grouping();
-            break;
-          case GroupBy_Genre:
-            key = song.genre();
-            break;
-          case GroupBy_AlbumArtist:
-            key = song.effective_albumartist();
-            break;
-          case GroupBy_Year:
-            key = QString::number(qMax(0, song.year()));
-            break;
-          case GroupBy_OriginalYear:
-            key = QString::number(qMax(0, song.effective_originalyear()));
-            break;
-          case GroupBy_YearAlbum:
-            key = PrettyYearAlbum(qMax(0, song.year()), song.album());
-            break;
-          case GroupBy_OriginalYearAlbum:
-            key = PrettyYearAlbum(qMax(0, song.effective_originalyear()),
-                                  song.album());
-            break;
-          case GroupBy_FileType:
-            key = song.filetype();
-            break;
-          case GroupBy_Bitrate:
-            key = song.bitrate();
-            break;
-          case GroupBy_None:
-            qLog(Error) << "GroupBy_None";
-            break;
-        }
+        const QString key = ContainerKey(type, song);
 
         // Does it exist already?
         if (!container_nodes_[i].contains(key)) {
@@ -266,11 +247,12 @@ void LibraryModel::SongsDiscovered(const SongList& songs) {
       }
 
       // If we just created the damn thing then we don't need to continue into
-      // it any further because it'll get lazy-loaded properly later.
-      if (!container->lazy_loaded) break;
+      // it any further because it'll get lazy-loaded properly later.  The
+      // same goes for containers whose children are still being loaded.
+      if (!container->lazy_loaded || loading_.contains(container)) break;
     }
 
-    if (!container->lazy_loaded) continue;
+    if (!container->lazy_loaded || loading_.contains(container)) continue;
 
     // We've gone all the way down to the deepest level and everything was
     // already lazy loaded, so now we have to create the song in the container.
@@ -283,6 +265,9 @@ void LibraryModel::SongsSlightlyChanged(const SongList& songs) {
   // This is called if there was a minor change to the songs that will not
   // normally require the library to be restructured.  We can just update our
   // internal cache of Song objects without worrying about resetting the model.
+  InvalidatePopulates();
+  UpdateSnapshot(songs, false);
+
   for (const Song& song : songs) {
     if (song_nodes_.contains(song.id())) {
       song_nodes_[song.id()]->metadata = song;
@@ -393,7 +378,63 @@ QString LibraryModel::DividerDisplayText(GroupBy type,
   return QString();
 }
 
+QString LibraryModel::ContainerKey(GroupBy type, const Song& song) {
+  // The same as the key of the item ItemFromSong makes.
+  switch (type) {
+    case GroupBy_Album:
+      return song.album();
+    case GroupBy_Artist:
+      return song.artist();
+    case GroupBy_Composer:
+      return song.composer();
+    case GroupBy_Performer:
+      return song.performer();
+    case GroupBy_Disc:
+      return QString::number(song.disc());
+    case GroupBy_Grouping:
+      return song.grouping();
+    case GroupBy_Genre:
+      return song.genre();
+    case GroupBy_AlbumArtist:
+      return song.effective_albumartist();
+    case GroupBy_Year:
+      return QString::number(qMax(0, song.year()));
+    case GroupBy_OriginalYear:
+      return QString::number(qMax(0, song.effective_originalyear()));
+    case GroupBy_YearAlbum:
+      return PrettyYearAlbum(qMax(0, song.year()), song.album());
+    case GroupBy_OriginalYearAlbum:
+      return PrettyYearAlbum(qMax(0, song.effective_originalyear()),
+                             song.album());
+    case GroupBy_FileType:
+      return song.TextForFiletype();
+    case GroupBy_Bitrate:
+      return QString::number(qMax(0, song.bitrate()));
+    case GroupBy_None:
+      qLog(Error) << "GroupBy_None";
+      break;
+  }
+  return QString();
+}
+
 void LibraryModel::SongsDeleted(const SongList& songs) {
+  if (CanUseSnapshot()) {
+    // Find where the songs are shown while they're still in the snapshot.
+    QHash<LibraryItem*, ChildrenByKey> children_by_key;
+    QSet<LibraryItem*> containers;
+    for (const Song& song : songs) {
+      const int row = snapshot_.row(song.id());
+      if (row != -1) containers << LoadedContainer(row, &children_by_key);
+    }
+
+    UpdateSnapshot(songs, true);
+    MergeDeletions(containers);
+    return;
+  }
+
+  UpdateSnapshot(songs, true);
+  InvalidatePopulates();
+
   // Delete the actual song nodes first, keeping track of each parent so we
   // might check to see if they're empty later.
   QSet<LibraryItem*> parents;
@@ -534,6 +575,8 @@ QVariant LibraryModel::AlbumIcon(const QModelIndex& index) {
   if (!songs.isEmpty()) {
     const quint64 id = app_->album_cover_loader()->LoadImageAsync(
         cover_loader_options_, songs.first());
+    // The icon is only asked for when it's about to be drawn.
+    app_->album_cover_loader()->PrioritiseTasks(QSet<quint64>() << id);
     pending_art_[id] = ItemAndCacheKey(item, cache_key);
     pending_cache_keys_.insert(cache_key);
   }
@@ -688,15 +731,21 @@ bool LibraryModel::HasCompilations(const LibraryQuery& query) {
   q.AddCompilationRequirement(true);
   q.SetLimit(1);
 
-  QMutexLocker l(backend_->db()->Mutex());
   if (!backend_->ExecQuery(&q)) return false;
 
   return q.Next();
 }
 
 LibraryModel::QueryResult LibraryModel::RunQuery(LibraryItem* parent) {
-  QueryResult result;
+  if (PopulatesFromSnapshot(parent)) return SnapshotQuery(parent);
+
+  bool check_compilations = false;
+  LibraryQuery q = ChildQuery(parent, &check_compilations);
+  return ExecChildQuery(q, check_compilations);
+}
 
+LibraryQuery LibraryModel::ChildQuery(LibraryItem* parent,
+                                      bool* check_compilations) {
   // Information about what we want the children to be
   int child_level = parent == root_ ? 0 : parent->container_level + 1;
   GroupBy child_type = child_level >= 3 ? GroupBy_None : group_by_[child_level];
@@ -714,7 +763,16 @@ LibraryModel::QueryResult LibraryModel::RunQuery(LibraryItem* parent) {
   }
 
   // Artists GroupBy is special - we don't want compilation albums appearing
-  if (IsArtistGroupBy(child_type)) {
+  // outside the special Various artists node.
+  *check_compilations = IsArtistGroupBy(child_type);
+  return q;
+}
+
+LibraryModel::QueryResult LibraryModel::ExecChildQuery(
+    LibraryQuery q, bool check_compilations) {
+  QueryResult result;
+
+  if (check_compilations) {
     // Add the special Various artists node
     if (show_various_artists_ && HasCompilations(q)) {
       result.create_va = true;
@@ -725,7 +783,6 @@ LibraryModel::QueryResult LibraryModel::RunQuery(LibraryItem* parent) {
   }
 
   // Execute the query
-  QMutexLocker l(backend_->db()->Mutex());
   if (!backend_->ExecQuery(&q)) return result;
 
   while (q.Next()) {
@@ -759,24 +816,759 @@ void LibraryModel::PostQuery(LibraryItem* parent,
   }
 }
 
+void LibraryModel::LazyPopulate(LibraryItem* parent) {
+  if (parent->lazy_loaded) return;
+
+  if (!lazy_populate_async_ || prefetched_.contains(parent) ||
+      PopulatesFromSnapshot(parent)) {
+    LazyPopulate(parent, true);
+    return;
+  }
+
+  parent->lazy_loaded = true;
+  loading_.insert(parent);
+  prefetch_queue_.removeAll(parent);
+
+  LibraryItem* loading = new LibraryItem(LibraryItem::Type_LoadingIndicator);
+  loading->display_text = tr("Loading...");
+  loading->lazy_loaded = true;
+  loading->InsertNotify(parent);
+
+  // A prefetch might already be running for this item, in which case we just
+  // wait for it to finish.
+  if (!populate_ids_.contains(parent)) StartPopulate(parent);
+}
+
 void LibraryModel::LazyPopulate(LibraryItem* parent, bool signal) {
+  if (loading_.contains(parent)) {
+    // Something needs the children right now, so don't wait for the
+    // background query to finish.
+    RemoveLoadingIndicator(parent);
+    parent->lazy_loaded = false;
+  }
   if (parent->lazy_loaded) return;
   parent->lazy_loaded = true;
+  populate_ids_.remove(parent);
+  prefetch_queue_.removeAll(parent);
 
-  QueryResult result = RunQuery(parent);
-  PostQuery(parent, result, signal);
+  std::unique_ptr<QueryResult> prefetched(prefetched_.take(parent));
+  if (prefetched) {
+    PostQuery(parent, *prefetched, signal);
+  } else {
+    PostQuery(parent, RunQuery(parent), signal);
+  }
 }
 
-void LibraryModel::ResetAsync() {
+void LibraryModel::RemoveLoadingIndicator(LibraryItem* parent) {
+  loading_.remove(parent);
+
+  // Nothing else gets added to the item while it's loading, so the indicator
+  // is its only child.
+  if (!parent->children.isEmpty() &&
+      parent->children[0]->type == LibraryItem::Type_LoadingIndicator) {
+    parent->DeleteNotify(0);
+  }
+}
+
+void LibraryModel::Prefetch(const QModelIndexList& indexes) {
+  prefetch_queue_.clear();
+  for (const QModelIndex& index : indexes) {
+    if (!index.isValid()) continue;
+
+    LibraryItem* item = IndexToItem(index);
+    if (item->type != LibraryItem::Type_Container || item->lazy_loaded ||
+        populate_ids_.contains(item) || prefetched_.contains(item) ||
+        PopulatesFromSnapshot(item)) {
+      continue;
+    }
+    prefetch_queue_ << item;
+  }
+  StartPrefetches();
+}
+
+void LibraryModel::StartPrefetches() {
+  // Keep most of the thread pool free for nodes the user actually expands.
+  while (!prefetch_queue_.isEmpty() &&
+         populate_ids_.count() - loading_.count() < kMaxPrefetchQueries) {
+    StartPopulate(prefetch_queue_.takeFirst());
+  }
+}
+
+void LibraryModel::StartPopulate(LibraryItem* parent) {
+  const int id = next_populate_id_++;
+  populate_ids_[parent] = id;
+
+  bool check_compilations = false;
+  LibraryQuery q = ChildQuery(parent, &check_compilations);
+
   QFuture<LibraryModel::QueryResult> future =
-      QtConcurrent::run(&thread_pool_, this, &LibraryModel::RunQuery, root_);
+      QtConcurrent::run(&thread_pool_, this, &LibraryModel::ExecChildQuery, q,
+                        check_compilations);
+  NewClosure(future, this,
+             SLOT(PopulateQueryFinished(QFuture<LibraryModel::QueryResult>,
+                                        LibraryItem*, int)),
+             future, parent, id);
+}
+
+void LibraryModel::PopulateQueryFinished(
+    QFuture<LibraryModel::QueryResult> future, LibraryItem* parent, int id) {
+  // The model was reset, the item was populated some other way or the
+  // library changed since the query was started.  parent might not even
+  // exist any more.
+  if (populate_ids_.value(parent, -1) != id) return;
+  populate_ids_.remove(parent);
+
+  const QueryResult result = future.result();
+  if (loading_.contains(parent)) {
+    RemoveLoadingIndicator(parent);
+    PostQuery(parent, result, true);
+    emit ChildrenLoaded(ItemToIndex(parent));
+  } else {
+    // Nobody has expanded it yet, keep it for when they do.
+    prefetched_.insert(parent, new QueryResult(result),
+                       qMax(1, result.rows.count()));
+  }
+
+  StartPrefetches();
+}
+
+void LibraryModel::InvalidatePopulates() {
+  prefetched_.clear();
+  prefetch_queue_.clear();
+
+  for (LibraryItem* item : populate_ids_.keys()) {
+    if (loading_.contains(item)) {
+      // Run the query again so it sees the changes.
+      StartPopulate(item);
+    } else {
+      populate_ids_.remove(item);
+    }
+  }
+}
+
+void LibraryModel::LoadSnapshotAsync() {
+  snapshot_loading_ = true;
+  snapshot_changes_.clear();
+
+  QFuture<LibrarySnapshot> future =
+      QtConcurrent::run(&thread_pool_, this, &LibraryModel::LoadSnapshot);
+  NewClosure(future, this,
+             SLOT(SnapshotLoaded(QFuture<LibrarySnapshot>, int)), future,
+             ++snapshot_id_);
+}
+
+LibrarySnapshot LibraryModel::LoadSnapshot() {
+  LibrarySnapshot snapshot;
+
+  LibraryQuery q;
+  q.SetColumnSpec(QString("%songs_table.ROWID, ") +
+                  LibrarySnapshot::kColumnSpec);
+  if (!backend_->ExecQuery(&q)) return snapshot;
+
+  while (q.Next()) {
+    snapshot.Add(SqlRow(q));
+  }
+  return snapshot;
+}
+
+void LibraryModel::SnapshotLoaded(QFuture<LibrarySnapshot> future, int id) {
+  if (id != snapshot_id_) return;
+
+  snapshot_ = future.result();
+  snapshot_loading_ = false;
+  snapshot_loaded_ = true;
+
+  // Catch up with anything that changed since the query ran.
+  for (const QPair<Song, bool>& change : snapshot_changes_) {
+    if (change.second) {
+      snapshot_.Remove(change.first.id());
+    } else {
+      snapshot_.AddOrUpdate(change.first);
+    }
+  }
+  snapshot_changes_.clear();
+
+  if (!query_options_.filter().isEmpty() &&
+      filter_ids_text_ != query_options_.filter()) {
+    LoadFilterIdsAsync();
+  }
+}
+
+void LibraryModel::ReloadSnapshot() {
+  snapshot_loaded_ = false;
+  snapshot_.Clear();
+  LoadSnapshotAsync();
+}
+
+void LibraryModel::UpdateSnapshot(const SongList& songs, bool deleted) {
+  if (snapshot_loading_) {
+    for (const Song& song : songs) {
+      snapshot_changes_ << qMakePair(song, deleted);
+    }
+  } else if (snapshot_loaded_) {
+    for (const Song& song : songs) {
+      if (deleted) {
+        snapshot_.Remove(song.id());
+      } else {
+        snapshot_.AddOrUpdate(song);
+      }
+    }
+  }
+}
+
+void LibraryModel::LoadFilterIdsAsync() {
+  // Only the filter text goes through the database, the age is checked
+  // against the snapshot.  Keeping the FTS lookup means the filter syntax
+  // (column prefixes, comparisons) works exactly as it does in SQL.
+  QueryOptions options;
+  options.set_filter(query_options_.filter());
+  LibraryQuery q(options);
+  q.SetColumnSpec("%songs_table.ROWID");
+  filter_ids_discovered_.clear();
+
+  QFuture<QSet<int>> future =
+      QtConcurrent::run(&thread_pool_, this, &LibraryModel::LoadFilterIds, q);
   NewClosure(future, this,
-             SLOT(ResetAsyncQueryFinished(QFuture<LibraryModel::QueryResult>)),
-             future);
+             SLOT(FilterIdsLoaded(QFuture<QSet<int> >, QString, int)), future,
+             query_options_.filter(), ++filter_ids_id_);
+}
+
+QSet<int> LibraryModel::LoadFilterIds(LibraryQuery q) {
+  QSet<int> ret;
+  if (!backend_->ExecQuery(&q)) return ret;
+
+  while (q.Next()) {
+    ret.insert(q.Value(0).toInt());
+  }
+  return ret;
+}
+
+void LibraryModel::FilterIdsLoaded(QFuture<QSet<int>> future,
+                                   const QString& filter, int id) {
+  if (id != filter_ids_id_) return;
+
+  filter_ids_ = future.result();
+  filter_ids_.unite(filter_ids_discovered_);
+  filter_ids_discovered_.clear();
+  filter_ids_text_ = filter;
+
+  if (CanUseSnapshot()) Refilter();
+}
+
+bool LibraryModel::CanUseSnapshot() const {
+  return snapshot_loaded_ &&
+         query_options_.query_mode() == QueryOptions::QueryMode_All &&
+         (query_options_.filter().isEmpty() ||
+          query_options_.filter() == filter_ids_text_);
+}
+
+bool LibraryModel::PopulatesFromSnapshot(LibraryItem* parent) const {
+  const int child_level = parent == root_ ? 0 : parent->container_level + 1;
+  return child_level < 3 && group_by_[child_level] != GroupBy_None &&
+         CanUseSnapshot();
+}
+
+QList<LibrarySnapshot::Column> LibraryModel::SnapshotColumns(GroupBy type) {
+  // The same columns, in the same order, as InitQuery selects.
+  typedef LibrarySnapshot S;
+  switch (type) {
+    case GroupBy_Artist:
+      return QList<S::Column>() << S::Column_Artist;
+    case GroupBy_Album:
+      return QList<S::Column>() << S::Column_Album;
+    case GroupBy_Composer:
+      return QList<S::Column>() << S::Column_Composer;
+    case GroupBy_Performer:
+      return QList<S::Column>() << S::Column_Performer;
+    case GroupBy_Disc:
+      return QList<S::Column>() << S::Column_Disc;
+    case GroupBy_Grouping:
+      return QList<S::Column>() << S::Column_Grouping;
+    case GroupBy_YearAlbum:
+      return QList<S::Column>() << S::Column_Year << S::Column_Album
+                                << S::Column_Grouping;
+    case GroupBy_OriginalYearAlbum:
+      return QList<S::Column>() << S::Column_Year << S::Column_OriginalYear
+                                << S::Column_Album << S::Column_Grouping;
+    case GroupBy_Year:
+      return QList<S::Column>() << S::Column_Year;
+    case GroupBy_OriginalYear:
+      return QList<S::Column>() << S::Column_EffectiveOriginalYear;
+    case GroupBy_Genre:
+      return QList<S::Column>() << S::Column_Genre;
+    case GroupBy_AlbumArtist:
+      return QList<S::Column>() << S::Column_EffectiveAlbumArtist;
+    case GroupBy_Bitrate:
+      return QList<S::Column>() << S::Column_Bitrate;
+    case GroupBy_FileType:
+      return QList<S::Column>() << S::Column_FileType;
+    case GroupBy_None:
+      break;
+  }
+  return QList<S::Column>();
+}
+
+LibrarySnapshot::Key LibraryModel::SnapshotKey(GroupBy type, int row) const {
+  // This is called for every row, so it avoids SnapshotColumns.
+  typedef LibrarySnapshot S;
+  LibrarySnapshot::Key key;
+  switch (type) {
+    case GroupBy_Artist:
+      key.v[0] = snapshot_.value(row, S::Column_Artist);
+      break;
+    case GroupBy_Album:
+      key.v[0] = snapshot_.value(row, S::Column_Album);
+      break;
+    case GroupBy_Composer:
+      key.v[0] = snapshot_.value(row, S::Column_Composer);
+      break;
+    case GroupBy_Performer:
+      key.v[0] = snapshot_.value(row, S::Column_Performer);
+      break;
+    case GroupBy_Disc:
+      key.v[0] = snapshot_.value(row, S::Column_Disc);
+      break;
+    case GroupBy_Grouping:
+      key.v[0] = snapshot_.value(row, S::Column_Grouping);
+      break;
+    case GroupBy_YearAlbum:
+      key.v[0] = snapshot_.value(row, S::Column_Year);
+      key.v[1] = snapshot_.value(row, S::Column_Album);
+      key.v[2] = snapshot_.value(row, S::Column_Grouping);
+      break;
+    case GroupBy_OriginalYearAlbum:
+      key.v[0] = snapshot_.value(row, S::Column_Year);
+      key.v[1] = snapshot_.value(row, S::Column_OriginalYear);
+      key.v[2] = snapshot_.value(row, S::Column_Album);
+      key.v[3] = snapshot_.value(row, S::Column_Grouping);
+      break;
+    case GroupBy_Genre:
+      key.v[0] = snapshot_.value(row, S::Column_Genre);
+      break;
+    case GroupBy_AlbumArtist:
+      key.v[0] = snapshot_.value(row, S::Column_EffectiveAlbumArtist);
+      break;
+    case GroupBy_FileType:
+      key.v[0] = snapshot_.value(row, S::Column_FileType);
+      break;
+    case GroupBy_Year:
+      key.v[0] = snapshot_.value(row, S::Column_Year);
+      break;
+    case GroupBy_OriginalYear:
+      key.v[0] = snapshot_.value(row, S::Column_EffectiveOriginalYear);
+      break;
+    case GroupBy_Bitrate:
+      key.v[0] = snapshot_.value(row, S::Column_Bitrate);
+      break;
+
+    case GroupBy_None:
+      break;
+  }
+  return NormaliseKey(type, key);
+}
+
+LibrarySnapshot::Key LibraryModel::SnapshotKey(GroupBy type,
+                                               LibraryItem* item) const {
+  // Mirrors FilterQuery.
+  LibrarySnapshot::Key key;
+  switch (type) {
+    case GroupBy_YearAlbum:
+      key.v[0] = item->metadata.year();
+      key.v[1] = snapshot_.StringId(item->metadata.album());
+      key.v[2] = snapshot_.StringId(item->metadata.grouping());
+      break;
+    case GroupBy_OriginalYearAlbum:
+      key.v[0] = item->metadata.year();
+      key.v[1] = item->metadata.originalyear();
+      key.v[2] = snapshot_.StringId(item->metadata.album());
+      key.v[3] = snapshot_.StringId(item->metadata.grouping());
+      break;
+    case GroupBy_FileType:
+      key.v[0] = item->metadata.filetype();
+      break;
+    case GroupBy_Year:
+    case GroupBy_OriginalYear:
+    case GroupBy_Disc:
+    case GroupBy_Bitrate:
+      key.v[0] = item->key.toInt();
+      break;
+    case GroupBy_Artist:
+    case GroupBy_Album:
+    case GroupBy_Composer:
+    case GroupBy_Performer:
+    case GroupBy_Grouping:
+    case GroupBy_Genre:
+    case GroupBy_AlbumArtist:
+      key.v[0] = snapshot_.StringId(item->key);
+      break;
+    case GroupBy_None:
+      qLog(Error) << "Unknown GroupBy type" << type << "used in filter";
+      break;
+  }
+  return NormaliseKey(type, key);
+}
+
+LibrarySnapshot::Key LibraryModel::NormaliseKey(GroupBy type,
+                                                LibrarySnapshot::Key key) {
+  // Items are made from songs (ItemFromSong) as well as from query rows
+  // (ItemFromQuery), and those only agree on what's shown.  Keep just that.
+  switch (type) {
+    case GroupBy_Year:
+    case GroupBy_OriginalYear:
+    case GroupBy_Bitrate:
+    case GroupBy_YearAlbum:
+      key.v[0] = qMax(0, key.v[0]);
+      break;
+    case GroupBy_OriginalYearAlbum:
+      // Grouped by the effective original year
+      key.v[0] = qMax(0, key.v[1] < 0 ? key.v[0] : key.v[1]);
+      key.v[1] = 0;
+      break;
+    default:
+      break;
+  }
+  return key;
+}
+
+QVector<int> LibraryModel::SnapshotRows(LibraryItem* parent) const {
+  const uint min_ctime =
+      query_options_.max_age() == -1
+          ? 0
+          : QDateTime::currentDateTime().toTime_t() - query_options_.max_age();
+  QVector<int> rows = snapshot_.Rows(
+      min_ctime, query_options_.filter().isEmpty() ? nullptr : &filter_ids_);
+
+  // Walk up through the item's parents, like ChildQuery does.
+  struct Filter {
+    GroupBy type;
+    LibrarySnapshot::Key key;
+    int compilation;  // -1 if it doesn't matter
+  };
+  QList<Filter> filters;
+  for (LibraryItem* p = parent; p && p->type == LibraryItem::Type_Container;
+       p = p->parent) {
+    Filter filter;
+    filter.type = group_by_[p->container_level];
+    filter.compilation = -1;
+    if (IsArtistGroupBy(filter.type)) {
+      filter.compilation = IsCompilationArtistNode(p) ? 1 : 0;
+    }
+    if (filter.compilation != 1) filter.key = SnapshotKey(filter.type, p);
+    filters << filter;
+  }
+  if (filters.isEmpty()) return rows;
+
+  QVector<int> ret;
+  for (int row : rows) {
+    bool matches = true;
+    for (const Filter& filter : filters) {
+      if (filter.compilation != -1 &&
+          snapshot_.value(row, LibrarySnapshot::Column_Compilation) !=
+              filter.compilation) {
+        matches = false;
+        break;
+      }
+      if (filter.compilation != 1 &&
+          !(SnapshotKey(filter.type, row) == filter.key)) {
+        matches = false;
+        break;
+      }
+    }
+    if (matches) ret << row;
+  }
+  return ret;
+}
+
+LibraryModel::SnapshotGroups LibraryModel::GroupSnapshotRows(
+    GroupBy type, const QVector<int>& rows,
+    QVector<int>* compilation_rows) const {
+  const bool split_compilations = IsArtistGroupBy(type);
+
+  SnapshotGroups groups;
+  for (int row : rows) {
+    if (split_compilations &&
+        snapshot_.value(row, LibrarySnapshot::Column_Compilation)) {
+      // These go in the Various artists node, if there is one.
+      if (show_various_artists_) compilation_rows->append(row);
+      continue;
+    }
+    groups[SnapshotKey(type, row)].append(row);
+  }
+  return groups;
+}
+
+LibraryModel::QueryResult LibraryModel::SnapshotQuery(
+    LibraryItem* parent) const {
+  const int child_level = parent == root_ ? 0 : parent->container_level + 1;
+  const GroupBy child_type = group_by_[child_level];
+  const QList<LibrarySnapshot::Column> columns = SnapshotColumns(child_type);
+
+  QVector<int> compilation_rows;
+  const SnapshotGroups groups =
+      GroupSnapshotRows(child_type, SnapshotRows(parent), &compilation_rows);
+
+  QueryResult result;
+  result.create_va = !compilation_rows.isEmpty();
+  for (const QVector<int>& group : groups) {
+    // Any row in the group will do, they all produce the same item.
+    QList<QVariant> values;
+    for (LibrarySnapshot::Column column : columns) {
+      values << snapshot_.variant(group.first(), column);
+    }
+    result.rows << SqlRow(values);
+  }
+  return result;
+}
+
+void LibraryModel::Refilter() {
+  if (init_task_id_ != -1) {
+    // The top level isn't there yet.
+    ResetAsync();
+    return;
+  }
+
+  InvalidatePopulates();
+
+  // Smart playlists are only shown when there's no filter.
+  const bool show_smart_playlists =
+      show_smart_playlists_ && query_options_.filter().isEmpty();
+  if (!show_smart_playlists && smart_playlist_node_) {
+    DeleteItem(smart_playlist_node_);
+    smart_playlist_node_ = nullptr;
+  } else if (show_smart_playlists && !smart_playlist_node_) {
+    beginInsertRows(QModelIndex(), root_->children.count(),
+                    root_->children.count());
+    CreateSmartPlaylists();
+    endInsertRows();
+  }
+
+  MergeChildren(root_, SnapshotRows(root_));
+  RemoveUnusedDividers();
+}
+
+void LibraryModel::RemoveUnusedDividers() {
+  // Top level items have the key of their divider prepended to their sort
+  // text.
+  for (LibraryItem* divider : divider_nodes_.values()) {
+    bool used = false;
+    for (LibraryItem* item : root_->children) {
+      if (item->type == LibraryItem::Type_Container &&
+          item->sort_text.startsWith(divider->key)) {
+        used = true;
+        break;
+      }
+    }
+    if (!used) {
+      divider_nodes_.remove(divider->key);
+      root_->DeleteNotify(divider->row);
+    }
+  }
+}
+
+void LibraryModel::MergeChildren(LibraryItem* parent,
+                                 const QVector<int>& rows) {
+  // Items that haven't been loaded will get the right children when they
+  // are, and ones that are loading were restarted by InvalidatePopulates.
+  if (!parent->lazy_loaded || loading_.contains(parent)) return;
+
+  const int child_level = parent == root_ ? 0 : parent->container_level + 1;
+  const GroupBy child_type =
+      child_level >= 3 ? GroupBy_None : group_by_[child_level];
+  if (child_type == GroupBy_None) {
+    MergeSongs(parent, rows);
+    return;
+  }
+
+  QVector<int> compilation_rows;
+  const SnapshotGroups groups =
+      GroupSnapshotRows(child_type, rows, &compilation_rows);
+
+  // Remove the children that don't match any more, and merge the ones that do
+  QSet<LibrarySnapshot::Key> existing;
+  for (LibraryItem* child : QList<LibraryItem*>(parent->children)) {
+    if (child->type != LibraryItem::Type_Container) continue;
+
+    if (IsCompilationArtistNode(child)) {
+      if (compilation_rows.isEmpty()) {
+        DeleteItem(child);
+      } else {
+        MergeChildren(child, compilation_rows);
+      }
+      continue;
+    }
+
+    const LibrarySnapshot::Key key = SnapshotKey(child_type, child);
+    SnapshotGroups::const_iterator it = groups.constFind(key);
+    if (it == groups.constEnd() || existing.contains(key)) {
+      DeleteItem(child);
+      continue;
+    }
+    existing.insert(key);
+    MergeChildren(child, it.value());
+  }
+
+  // Add the new ones
+  if (!compilation_rows.isEmpty() && !parent->compilation_artist_node_) {
+    CreateCompilationArtistNode(true, parent);
+  }
+
+  const QList<LibrarySnapshot::Column> columns = SnapshotColumns(child_type);
+  for (SnapshotGroups::const_iterator it = groups.constBegin();
+       it != groups.constEnd(); ++it) {
+    if (existing.contains(it.key())) continue;
+
+    QList<QVariant> values;
+    for (LibrarySnapshot::Column column : columns) {
+      values << snapshot_.variant(it.value().first(), column);
+    }
+    LibraryItem* item = ItemFromQuery(child_type, true, child_level == 0,
+                                      parent, SqlRow(values), child_level);
+    container_nodes_[child_level][item->key] = item;
+  }
+}
+
+LibraryItem* LibraryModel::LoadedContainer(
+    int row, QHash<LibraryItem*, ChildrenByKey>* children_by_key) const {
+  LibraryItem* node = root_;
+  for (int level = 0; level < 3 && group_by_[level] != GroupBy_None; ++level) {
+    const GroupBy type = group_by_[level];
+
+    LibraryItem* child = nullptr;
+    if (IsArtistGroupBy(type) &&
+        snapshot_.value(row, LibrarySnapshot::Column_Compilation)) {
+      child = node->compilation_artist_node_;
+    } else {
+      // Index each item's children once rather than once for every song.
+      if (!children_by_key->contains(node)) {
+        ChildrenByKey& index = (*children_by_key)[node];
+        for (LibraryItem* c : node->children) {
+          if (c->type == LibraryItem::Type_Container &&
+              !IsCompilationArtistNode(c)) {
+            index.insert(SnapshotKey(type, c), c);
+          }
+        }
+      }
+      child = children_by_key->value(node).value(SnapshotKey(type, row));
+    }
+
+    if (!child || !child->lazy_loaded || loading_.contains(child)) break;
+    node = child;
+  }
+  return node;
+}
+
+void LibraryModel::MergeDeletions(const QSet<LibraryItem*>& containers) {
+  InvalidatePopulates();
+
+  // Deepest first, so merging an item never deletes one that's still to do.
+  QMap<int, LibraryItem*> by_depth;
+  for (LibraryItem* item : containers) {
+    int depth = 0;
+    for (LibraryItem* p = item; p != root_; p = p->parent) ++depth;
+    by_depth.insertMulti(-depth, item);
+  }
+
+  QSet<LibraryItem*> deleted;
+  bool top_level_changed = containers.contains(root_);
+  for (LibraryItem* item : by_depth) {
+    if (deleted.contains(item)) continue;
+    MergeChildren(item, SnapshotRows(item));
+
+    while (item != root_ && item->children.isEmpty()) {
+      LibraryItem* parent = item->parent;
+      if (parent == root_) top_level_changed = true;
+      deleted << item;
+      DeleteItem(item);
+      item = parent;
+    }
+  }
+
+  if (top_level_changed) RemoveUnusedDividers();
+}
+
+void LibraryModel::MergeSongs(LibraryItem* parent, const QVector<int>& rows) {
+  QSet<int> ids;
+  for (int row : rows) {
+    ids.insert(snapshot_.id(row));
+  }
+
+  for (LibraryItem* child : QList<LibraryItem*>(parent->children)) {
+    if (child->type != LibraryItem::Type_Song) continue;
+    if (!ids.remove(child->metadata.id())) DeleteItem(child);
+  }
+
+  if (ids.isEmpty()) return;
+
+  // These songs weren't shown before, so we need their full metadata.
+  for (const Song& song : backend_->GetSongsById(ids.toList())) {
+    song_nodes_[song.id()] =
+        ItemFromSong(GroupBy_None, true, false, parent, song, -1);
+  }
+}
+
+void LibraryModel::DeleteItem(LibraryItem* item) {
+  ForgetItem(item);
+  item->parent->DeleteNotify(item->row);
+}
+
+void LibraryModel::ForgetItem(LibraryItem* item) {
+  for (LibraryItem* child : item->children) {
+    ForgetItem(child);
+  }
+
+  if (item->type == LibraryItem::Type_Song) {
+    if (song_nodes_.value(item->metadata.id()) == item) {
+      song_nodes_.remove(item->metadata.id());
+    }
+  } else if (item->type == LibraryItem::Type_Container) {
+    if (IsCompilationArtistNode(item)) {
+      item->parent->compilation_artist_node_ = nullptr;
+    } else if (container_nodes_[item->container_level].value(item->key) ==
+               item) {
+      container_nodes_[item->container_level].remove(item->key);
+    }
+  }
+
+  populate_ids_.remove(item);
+  loading_.remove(item);
+  prefetched_.remove(item);
+  prefetch_queue_.removeAll(item);
+
+  QMap<quint64, ItemAndCacheKey>::iterator i = pending_art_.begin();
+  while (i != pending_art_.end()) {
+    if (i.value().first == item) {
+      pending_cache_keys_.remove(i.value().second);
+      i = pending_art_.erase(i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+void LibraryModel::ResetAsync() {
+  // Building the top level from the snapshot is quick enough to do here.
+  if (PopulatesFromSnapshot(root_)) {
+    Reset();
+    return;
+  }
+
+  bool check_compilations = false;
+  LibraryQuery q = ChildQuery(root_, &check_compilations);
+
+  QFuture<LibraryModel::QueryResult> future =
+      QtConcurrent::run(&thread_pool_, this, &LibraryModel::ExecChildQuery, q,
+                        check_compilations);
+  NewClosure(
+      future, this,
+      SLOT(ResetAsyncQueryFinished(QFuture<LibraryModel::QueryResult>, int)),
+      future, ++reset_id_);
 }
 
 void LibraryModel::ResetAsyncQueryFinished(
-    QFuture<LibraryModel::QueryResult> future) {
+    QFuture<LibraryModel::QueryResult> future, int id) {
+  // Ignore results that were overtaken by another reset.
+  if (id != reset_id_) return;
+
   const struct QueryResult result = future.result();
 
   BeginReset();
@@ -802,6 +1594,10 @@ void LibraryModel::BeginReset() {
   divider_nodes_.clear();
   pending_art_.clear();
   pending_cache_keys_.clear();
+  populate_ids_.clear();
+  loading_.clear();
+  prefetched_.clear();
+  prefetch_queue_.clear();
   smart_playlist_node_ = nullptr;
 
   root_ = new LibraryItem(this);
@@ -814,11 +1610,17 @@ void LibraryModel::BeginReset() {
 }
 
 void LibraryModel::Reset() {
+  ++reset_id_;
   BeginReset();
 
   // Populate top level
   LazyPopulate(root_, false);
 
+  if (init_task_id_ != -1) {
+    app_->task_manager()->SetTaskFinished(init_task_id_);
+    init_task_id_ = -1;
+  }
+
   endResetModel();
 }
 
@@ -1059,7 +1861,6 @@ LibraryItem* LibraryModel::ItemFromSong(GroupBy type, bool signal,
                                         int container_level) {
   LibraryItem* item = InitItem(type, signal, parent, container_level);
   int year = 0;
-  int originalyear = 0;
   int effective_originalyear = 0;
   int bitrate = 0;
 
@@ -1072,19 +1873,19 @@ LibraryItem* LibraryModel::ItemFromSong(GroupBy type, bool signal,
 
     case GroupBy_YearAlbum:
       year = qMax(0, s.year());
-      item->metadata.set_year(year);
+      item->metadata.set_year(s.year());
       item->metadata.set_album(s.album());
+      item->metadata.set_grouping(s.grouping());
       item->key = PrettyYearAlbum(year, s.album());
       item->sort_text = SortTextForNumber(year) + s.grouping() + s.album();
       break;
 
     case GroupBy_OriginalYearAlbum:
-      year = qMax(0, s.year());
-      originalyear = qMax(0, s.originalyear());
       effective_originalyear = qMax(0, s.effective_originalyear());
-      item->metadata.set_year(year);
-      item->metadata.set_originalyear(originalyear);
+      item->metadata.set_year(s.year());
+      item->metadata.set_originalyear(s.originalyear());
       item->metadata.set_album(s.album());
+      item->metadata.set_grouping(s.grouping());
       item->key = PrettyYearAlbum(effective_originalyear, s.album());
       item->sort_text =
           SortTextForNumber(effective_originalyear) + s.grouping() + s.album();
@@ -1103,22 +1904,12 @@ LibraryItem* LibraryModel::ItemFromSong(GroupBy type, bool signal,
       break;
 
     case GroupBy_Composer:
-      item->key = s.composer();
-      // fallthrough
     case GroupBy_Performer:
-      item->key = s.performer();
-      // fallthrough
     case GroupBy_Grouping:
-      item->key = s.grouping();
-      // fallthrough
     case GroupBy_Genre:
-      if (item->key.isNull()) item->key = s.genre();
-      // fallthrough
     case GroupBy_Album:
-      if (item->key.isNull()) item->key = s.album();
-      // fallthrough
     case GroupBy_AlbumArtist:
-      if (item->key.isNull()) item->key = s.effective_albumartist();
+      item->key = ContainerKey(type, s);
       item->display_text = TextOrUnknown(item->key);
       item->sort_text = SortTextForArtist(item->key);
       break;
@@ -1291,7 +2082,7 @@ void LibraryModel::GetChildSongs(LibraryItem* item, QList<QUrl>* urls,
                                  SongList* songs, QSet<int>* song_ids) const {
   switch (item->type) {
     case LibraryItem::Type_Container: {
-      const_cast<LibraryModel*>(this)->LazyPopulate(item);
+      const_cast<LibraryModel*>(this)->LazyPopulate(item, true);
 
       QList<LibraryItem*> children = item->children;
       std::sort(children.begin(), children.end(),
@@ -1332,17 +2123,32 @@ SongList LibraryModel::GetChildSongs(const QModelIndex& index) const {
 
 void LibraryModel::SetFilterAge(int age) {
   query_options_.set_max_age(age);
-  ResetAsync();
+  if (CanUseSnapshot()) {
+    Refilter();
+  } else {
+    ResetAsync();
+  }
 }
 
 void LibraryModel::SetFilterText(const QString& text) {
   query_options_.set_filter(text);
-  ResetAsync();
+  if (CanUseSnapshot()) {
+    Refilter();
+  } else if (snapshot_loaded_) {
+    // Refilters once we know which songs match.
+    LoadFilterIdsAsync();
+  } else {
+    ResetAsync();
+  }
 }
 
 void LibraryModel::SetFilterQueryMode(QueryOptions::QueryMode query_mode) {
   query_options_.set_query_mode(query_mode);
-  ResetAsync();
+  if (CanUseSnapshot()) {
+    Refilter();
+  } else {
+    ResetAsync();
+  }
 }
 
 bool LibraryModel::canFetchMore(const QModelIndex& parent) const {
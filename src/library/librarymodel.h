@@ -19,6 +19,7 @@
 #define LIBRARYMODEL_H
 
 #include <QAbstractItemModel>
+#include <QCache>
 #include <QIcon>
 #include <QNetworkDiskCache>
 #include <QThreadPool>
@@ -28,8 +29,10 @@
 #include "core/song.h"
 #include "covers/albumcoverloaderoptions.h"
 #include "engines/engine_fwd.h"
+#include "gtest/gtest_prod.h"
 #include "libraryitem.h"
 #include "libraryquery.h"
+#include "librarysnapshot.h"
 #include "librarywatcher.h"
 #include "playlist/playlistmanager.h"
 #include "smartplaylists/generator_fwd.h"
@@ -59,6 +62,8 @@ class LibraryModel : public SimpleTreeModel<LibraryItem> {
   static const int kSmartPlaylistsVersion;
   static const int kPrettyCoverSize;
   static const qint64 kIconCacheSize;
+  static const int kPrefetchCacheRows;
+  static const int kMaxPrefetchQueries;
 
   enum Role {
     Role_Type = Qt::UserRole + 1,
@@ -133,6 +138,17 @@ class LibraryModel : public SimpleTreeModel<LibraryItem> {
     show_various_artists_ = show_various_artists;
   }
 
+  // When a node is expanded its children are normally loaded in the
+  // background while a "Loading..." row is shown.  Views that need the real
+  // children straight away (to auto-expand after a reset, for example) can
+  // turn this off temporarily.
+  void set_lazy_populate_async(bool async) { lazy_populate_async_ = async; }
+
+  // Speculatively loads the children of these containers in the background
+  // so they appear instantly when expanded.  Replaces any earlier request
+  // that hasn't started yet.
+  void Prefetch(const QModelIndexList& indexes);
+
   // Get information about the library
   void GetChildSongs(LibraryItem* item, QList<QUrl>* urls, SongList* songs,
                      QSet<int>* song_ids) const;
@@ -177,6 +193,9 @@ class LibraryModel : public SimpleTreeModel<LibraryItem> {
  signals:
   void TotalSongCountUpdated(int count);
   void GroupingChanged(const LibraryModel::Grouping& g);
+  // The children of an item that was loading in the background have
+  // replaced its "Loading..." row.
+  void ChildrenLoaded(const QModelIndex& parent);
 
  public slots:
   void SetFilterAge(int age);
@@ -190,7 +209,10 @@ class LibraryModel : public SimpleTreeModel<LibraryItem> {
   void ResetAsync();
 
  protected:
-  void LazyPopulate(LibraryItem* item) { LazyPopulate(item, true); }
+  // Called when a node is expanded.  Loads the children in the background
+  // unless they were prefetched already.
+  void LazyPopulate(LibraryItem* item);
+  // Loads the children immediately.
   void LazyPopulate(LibraryItem* item, bool signal);
 
  private slots:
@@ -201,10 +223,20 @@ class LibraryModel : public SimpleTreeModel<LibraryItem> {
   void TotalSongCountUpdatedSlot(int count);
 
   // Called after ResetAsync
-  void ResetAsyncQueryFinished(QFuture<LibraryModel::QueryResult> future);
+  void ResetAsyncQueryFinished(QFuture<LibraryModel::QueryResult> future,
+                               int id);
+
+  // Called after StartPopulate
+  void PopulateQueryFinished(QFuture<LibraryModel::QueryResult> future,
+                             LibraryItem* parent, int id);
 
   void AlbumArtLoaded(quint64 id, const QImage& image);
 
+  void ReloadSnapshot();
+  void SnapshotLoaded(QFuture<LibrarySnapshot> future, int id);
+  void FilterIdsLoaded(QFuture<QSet<int>> future, const QString& filter,
+                       int id);
+
  private:
   // Provides some optimisations for loading the list of items in the root.
   // This gets called a lot when filtering the playlist, so it's nice to be
@@ -212,8 +244,62 @@ class LibraryModel : public SimpleTreeModel<LibraryItem> {
   QueryResult RunQuery(LibraryItem* parent);
   void PostQuery(LibraryItem* parent, const QueryResult& result, bool signal);
 
+  // RunQuery split in two: ChildQuery walks the item's parents so must be
+  // called on the GUI thread, ExecChildQuery only touches the database and
+  // can be run anywhere.
+  LibraryQuery ChildQuery(LibraryItem* parent, bool* check_compilations);
+  QueryResult ExecChildQuery(LibraryQuery q, bool check_compilations);
+
+  // Background population of nodes that haven't been lazy loaded yet.
+  void StartPopulate(LibraryItem* parent);
+  void StartPrefetches();
+  void RemoveLoadingIndicator(LibraryItem* parent);
+  // Throws away prefetched results and restarts running queries after the
+  // library changed underneath them.
+  void InvalidatePopulates();
+
   bool HasCompilations(const LibraryQuery& query);
 
+  // Once the snapshot is loaded, container levels are built from it in
+  // memory instead of with a DISTINCT query, and changing the filter merges
+  // the new results into the existing tree instead of resetting it.  Song
+  // nodes are still loaded from the database.
+  void LoadSnapshotAsync();
+  LibrarySnapshot LoadSnapshot();
+  void UpdateSnapshot(const SongList& songs, bool deleted);
+  void LoadFilterIdsAsync();
+  QSet<int> LoadFilterIds(LibraryQuery q);
+  bool CanUseSnapshot() const;
+  bool PopulatesFromSnapshot(LibraryItem* parent) const;
+
+  // Snapshot equivalents of InitQuery and FilterQuery.  Rows with the same
+  // key end up in the same item.
+  typedef QHash<LibrarySnapshot::Key, QVector<int>> SnapshotGroups;
+  typedef QHash<LibrarySnapshot::Key, LibraryItem*> ChildrenByKey;
+  static QList<LibrarySnapshot::Column> SnapshotColumns(GroupBy type);
+  LibrarySnapshot::Key SnapshotKey(GroupBy type, int row) const;
+  LibrarySnapshot::Key SnapshotKey(GroupBy type, LibraryItem* item) const;
+  static LibrarySnapshot::Key NormaliseKey(GroupBy type,
+                                           LibrarySnapshot::Key key);
+  QVector<int> SnapshotRows(LibraryItem* parent) const;
+  SnapshotGroups GroupSnapshotRows(GroupBy type, const QVector<int>& rows,
+                                   QVector<int>* compilation_rows) const;
+  QueryResult SnapshotQuery(LibraryItem* parent) const;
+
+  // Brings the loaded parts of the tree in line with the current filter.
+  void Refilter();
+  void RemoveUnusedDividers();
+  void MergeChildren(LibraryItem* parent, const QVector<int>& rows);
+  // The deepest loaded item that a snapshot row is shown under.
+  LibraryItem* LoadedContainer(
+      int row, QHash<LibraryItem*, ChildrenByKey>* children_by_key) const;
+  // Merges just these items after their songs were deleted, then removes
+  // the ones that are left empty.
+  void MergeDeletions(const QSet<LibraryItem*>& containers);
+  void MergeSongs(LibraryItem* parent, const QVector<int>& rows);
+  void DeleteItem(LibraryItem* item);
+  void ForgetItem(LibraryItem* item);
+
   void BeginReset();
 
   // Functions for working with queries and creating items.
@@ -232,6 +318,8 @@ class LibraryModel : public SimpleTreeModel<LibraryItem> {
   LibraryItem* ItemFromSong(GroupBy type, bool signal, bool create_divider,
                             LibraryItem* parent, const Song& s,
                             int container_level);
+  // The key of the item ItemFromSong would make for the song.
+  static QString ContainerKey(GroupBy type, const Song& song);
 
   // The "Various Artists" node is an annoying special case.
   LibraryItem* CreateCompilationArtistNode(bool signal, LibraryItem* parent);
@@ -303,6 +391,39 @@ class LibraryModel : public SimpleTreeModel<LibraryItem> {
   typedef QPair<LibraryItem*, QString> ItemAndCacheKey;
   QMap<quint64, ItemAndCacheKey> pending_art_;
   QSet<QString> pending_cache_keys_;
+
+  bool lazy_populate_async_;
+  int next_populate_id_;
+  // Background queries that are still running, keyed on the item whose
+  // children they load.  Results for an item are only used if the ID matches.
+  QHash<LibraryItem*, int> populate_ids_;
+  // Items that were expanded and are showing a loading indicator.
+  QSet<LibraryItem*> loading_;
+  // Finished prefetches for items that haven't been expanded yet.
+  QCache<LibraryItem*, QueryResult> prefetched_;
+  QList<LibraryItem*> prefetch_queue_;
+
+  int reset_id_;
+
+  LibrarySnapshot snapshot_;
+  bool snapshot_loaded_;
+  bool snapshot_loading_;
+  int snapshot_id_;
+  // Changes made while the snapshot is loading, replayed once it's ready.
+  // The flag is true for deleted songs.
+  QList<QPair<Song, bool>> snapshot_changes_;
+
+  // Songs that match the filter text, looked up in the FTS table.
+  QSet<int> filter_ids_;
+  QString filter_ids_text_;
+  int filter_ids_id_;
+  // Songs matching the filter that were discovered while its query ran.
+  QSet<int> filter_ids_discovered_;
+
+  FRIEND_TEST(LibraryModelMergeTest, KeepsContainersMadeFromSongs);
+  FRIEND_TEST(LibraryModelMergeTest, RemovesOnlyEmptiedContainers);
+  FRIEND_TEST(LibraryModelMergeTest, KeepsSongsAddedDuringFilterQuery);
+  FRIEND_TEST(LibraryModelTest, PrefetchedChildrenAppearImmediately);
 };
 
 Q_DECLARE_METATYPE(LibraryModel::Grouping)
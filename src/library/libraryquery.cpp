@@ -52,7 +52,10 @@ const QMap<QString, Song::FileType> kFiletypeId = QMap<QString, Song::FileType>(
                                       {"unknown", Song::Type_Unknown}});
 
 LibraryQuery::LibraryQuery(const QueryOptions& options)
-    : include_unavailable_(false), join_with_fts_(false), limit_(-1) {
+    : include_unavailable_(false),
+      join_with_fts_(false),
+      limit_(-1),
+      offset_(0) {
   if (!options.filter().isEmpty()) {
     // We need to munge the filter text a little bit to get it to work as
     // expected with sqlite's FTS3:
@@ -247,7 +250,9 @@ QSqlQuery LibraryQuery::Exec(QSqlDatabase db, const QString& songs_table,
 
   if (!order_by_.isEmpty()) sql += " ORDER BY " + order_by_;
 
-  if (limit_ != -1) sql += " LIMIT " + QString::number(limit_);
+  // sqlite only allows OFFSET after a LIMIT, where -1 means no limit.
+  if (limit_ != -1 || offset_ > 0) sql += " LIMIT " + QString::number(limit_);
+  if (offset_ > 0) sql += " OFFSET " + QString::number(offset_);
 
   sql.replace("%songs_table", songs_table);
   sql.replace("%fts_table_noprefix", fts_table.section('.', -1, -1));
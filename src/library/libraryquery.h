@@ -82,10 +82,16 @@ class LibraryQuery {
 
   void AddCompilationRequirement(bool compilation);
   void SetLimit(int limit) { limit_ = limit; }
+  // Skips this many rows of the result.
+  void SetOffset(int offset) { offset_ = offset; }
   void SetIncludeUnavailable(bool include_unavailable) {
     include_unavailable_ = include_unavailable;
   }
 
+  // True if the filter has terms that are matched against the FTS table,
+  // which is then available as "fts" in the other clauses.
+  bool join_with_fts() const { return join_with_fts_; }
+
   QSqlQuery Exec(QSqlDatabase db, const QString& songs_table,
                  const QString& fts_table);
   bool Next();
@@ -105,6 +111,7 @@ class LibraryQuery {
   QStringList where_clauses_;
   QVariantList bound_values_;
   int limit_;
+  int offset_;
   bool duplicates_only_;
 
   QSqlQuery query_;
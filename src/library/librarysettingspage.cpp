@@ -21,6 +21,7 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QSettings>
+#include <QThread>
 #include <QtConcurrentRun>
 
 #include "core/application.h"
@@ -52,6 +53,8 @@ LibrarySettingsPage::LibrarySettingsPage(SettingsDialog* dialog)
   connect(ui_->remove, SIGNAL(clicked()), SLOT(Remove()));
   connect(ui_->sync_stats_button, SIGNAL(clicked()),
           SLOT(WriteAllSongsStatisticsToFiles()));
+
+  ui_->scan_threads->setMaximum(QThread::idealThreadCount() * 2);
 }
 
 LibrarySettingsPage::~LibrarySettingsPage() { delete ui_; }
@@ -102,6 +105,8 @@ void LibrarySettingsPage::Save() {
   QStringList extensions = skip_extensions.split(',', QString::SkipEmptyParts);
   s.setValue("skip_file_extensions", extensions);
 
+  s.setValue("scan_threads", ui_->scan_threads->value());
+
   s.endGroup();
 
   s.beginGroup(LibraryBackend::kSettingsGroup);
@@ -146,6 +151,9 @@ void LibrarySettingsPage::Load() {
   QStringList extensions = s.value("skip_file_extensions").toStringList();
   ui_->skip_extensions->setText(extensions.join(","));
 
+  ui_->scan_threads->setValue(
+      s.value("scan_threads", QThread::idealThreadCount()).toInt());
+
   s.endGroup();
 
   s.beginGroup(LibraryBackend::kSettingsGroup);
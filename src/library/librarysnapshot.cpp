@@ -0,0 +1,128 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "librarysnapshot.h"
+
+#include "core/song.h"
+#include "sqlrow.h"
+
+const char* LibrarySnapshot::kColumnSpec =
+    "artist, album, effective_albumartist, composer, performer, grouping, "
+    "genre, year, originalyear, effective_originalyear, disc, bitrate, "
+    "filetype, effective_compilation, ctime";
+
+LibrarySnapshot::LibrarySnapshot() {}
+
+void LibrarySnapshot::Clear() {
+  ids_.clear();
+  for (int i = 0; i < ColumnCount; ++i) columns_[i].clear();
+  rows_by_id_.clear();
+  free_rows_.clear();
+  strings_.clear();
+  string_ids_.clear();
+}
+
+int LibrarySnapshot::AllocateRow(int id) {
+  int row = rows_by_id_.value(id, -1);
+  if (row != -1) return row;
+
+  if (free_rows_.isEmpty()) {
+    row = ids_.count();
+    ids_.append(id);
+    for (int i = 0; i < ColumnCount; ++i) columns_[i].append(0);
+  } else {
+    row = free_rows_.takeLast();
+    ids_[row] = id;
+  }
+  rows_by_id_[id] = row;
+  return row;
+}
+
+int LibrarySnapshot::Intern(const QString& str) {
+  QHash<QString, int>::const_iterator it = string_ids_.constFind(str);
+  if (it != string_ids_.constEnd()) return it.value();
+
+  const int string_id = strings_.count();
+  strings_.append(str);
+  string_ids_.insert(str, string_id);
+  return string_id;
+}
+
+void LibrarySnapshot::Add(const SqlRow& row) {
+  const int r = AllocateRow(row.value(0).toInt());
+  for (int i = 0; i < ColumnCount; ++i) {
+    const QVariant& value = row.value(i + 1);
+    columns_[i][r] = IsStringColumn(Column(i)) ? Intern(value.toString())
+                                                : value.toInt();
+  }
+}
+
+// Song::BindToQuery stores these as -1 in the database, do the same here so
+// songs look the same whichever way they were added.
+static int IntValue(int value) { return value <= 0 ? -1 : value; }
+
+void LibrarySnapshot::AddOrUpdate(const Song& song) {
+  const int r = AllocateRow(song.id());
+  columns_[Column_Artist][r] = Intern(song.artist());
+  columns_[Column_Album][r] = Intern(song.album());
+  columns_[Column_EffectiveAlbumArtist][r] =
+      Intern(song.effective_albumartist());
+  columns_[Column_Composer][r] = Intern(song.composer());
+  columns_[Column_Performer][r] = Intern(song.performer());
+  columns_[Column_Grouping][r] = Intern(song.grouping());
+  columns_[Column_Genre][r] = Intern(song.genre());
+  columns_[Column_Year][r] = IntValue(song.year());
+  columns_[Column_OriginalYear][r] = IntValue(song.originalyear());
+  columns_[Column_EffectiveOriginalYear][r] =
+      IntValue(song.effective_originalyear());
+  columns_[Column_Disc][r] = IntValue(song.disc());
+  columns_[Column_Bitrate][r] = IntValue(song.bitrate());
+  columns_[Column_FileType][r] = song.filetype();
+  columns_[Column_Compilation][r] = song.is_compilation() ? 1 : 0;
+  columns_[Column_CTime][r] = song.ctime();
+}
+
+void LibrarySnapshot::Remove(int id) {
+  QHash<int, int>::iterator it = rows_by_id_.find(id);
+  if (it == rows_by_id_.end()) return;
+
+  const int row = it.value();
+  rows_by_id_.erase(it);
+  ids_[row] = -1;
+  free_rows_.append(row);
+}
+
+QVector<int> LibrarySnapshot::Rows(uint min_ctime,
+                                   const QSet<int>* ids) const {
+  QVector<int> ret;
+  ret.reserve(count());
+
+  const int* ctime = columns_[Column_CTime].constData();
+  for (int row = 0; row < ids_.count(); ++row) {
+    const int id = ids_[row];
+    if (id == -1) continue;
+    if (min_ctime && uint(ctime[row]) <= min_ctime) continue;
+    if (ids && !ids->contains(id)) continue;
+    ret.append(row);
+  }
+  return ret;
+}
+
+QVariant LibrarySnapshot::variant(int row, Column column) const {
+  const int value = columns_[column][row];
+  if (IsStringColumn(column)) return strings_[value];
+  return value;
+}
@@ -0,0 +1,125 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBRARYSNAPSHOT_H
+#define LIBRARYSNAPSHOT_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+
+class Song;
+class SqlRow;
+
+// An in-memory, column-oriented copy of the columns LibraryModel groups by,
+// for every available song in the library.  Strings are interned, so each
+// column is a flat array of ints that can be scanned and compared quickly.
+// LibraryModel builds its container levels from this rather than running a
+// DISTINCT query for every node, and keeps it up to date as songs are added
+// and removed.
+class LibrarySnapshot {
+ public:
+  LibrarySnapshot();
+
+  enum Column {
+    // String columns.  The values are IDs from StringId().
+    Column_Artist = 0,
+    Column_Album,
+    Column_EffectiveAlbumArtist,
+    Column_Composer,
+    Column_Performer,
+    Column_Grouping,
+    Column_Genre,
+
+    // Integer columns.
+    Column_Year,
+    Column_OriginalYear,
+    Column_EffectiveOriginalYear,
+    Column_Disc,
+    Column_Bitrate,
+    Column_FileType,
+    Column_Compilation,
+    Column_CTime,
+
+    ColumnCount
+  };
+
+  // The columns to select, after the ROWID, for rows passed to Add().
+  static const char* kColumnSpec;
+
+  // Up to four column values that identify a group of rows.
+  struct Key {
+    Key() : v{0, 0, 0, 0} {}
+    bool operator==(const Key& other) const {
+      return v[0] == other.v[0] && v[1] == other.v[1] && v[2] == other.v[2] &&
+             v[3] == other.v[3];
+    }
+
+    int v[4];
+  };
+
+  static bool IsStringColumn(Column column) { return column < Column_Year; }
+
+  // Number of songs.
+  int count() const { return rows_by_id_.count(); }
+
+  // Rows are numbered from 0 to row_count() - 1.  Rows of removed songs are
+  // reused later, id() is -1 for them in the mean time.
+  int row_count() const { return ids_.count(); }
+
+  void Clear();
+
+  // Adds a song from a query that selected ROWID followed by kColumnSpec.
+  void Add(const SqlRow& row);
+  void AddOrUpdate(const Song& song);
+  void Remove(int id);
+
+  // Returns the rows of songs that were added after min_ctime (pass 0 to
+  // include everything) and, if ids is not null, are contained in it.
+  QVector<int> Rows(uint min_ctime, const QSet<int>* ids) const;
+
+  int id(int row) const { return ids_[row]; }
+  // Returns the row of a song, or -1 if it isn't in the snapshot.
+  int row(int id) const { return rows_by_id_.value(id, -1); }
+  int value(int row, Column column) const { return columns_[column][row]; }
+  // Like value(), but returns the string for string columns.
+  QVariant variant(int row, Column column) const;
+
+  // Returns the ID of an interned string, or -1 if no song ever had it.
+  // Null and empty strings share an ID.
+  int StringId(const QString& str) const { return string_ids_.value(str, -1); }
+  const QString& string(int string_id) const { return strings_[string_id]; }
+
+ private:
+  int AllocateRow(int id);
+  int Intern(const QString& str);
+
+  QVector<int> ids_;
+  QVector<int> columns_[ColumnCount];
+  QHash<int, int> rows_by_id_;
+  QVector<int> free_rows_;
+
+  QVector<QString> strings_;
+  QHash<QString, int> string_ids_;
+};
+
+inline uint qHash(const LibrarySnapshot::Key& key) {
+  return qHashBits(key.v, sizeof(key.v));
+}
+
+#endif  // LIBRARYSNAPSHOT_H
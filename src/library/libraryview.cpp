@@ -22,9 +22,11 @@
 #include <QMenu>
 #include <QMessageBox>
 #include <QPainter>
+#include <QScrollBar>
 #include <QSet>
 #include <QSettings>
 #include <QSortFilterProxyModel>
+#include <QTimer>
 #include <QToolTip>
 #include <QWhatsThis>
 
@@ -49,6 +51,7 @@
 using smart_playlists::Wizard;
 
 const char* LibraryView::kSettingsGroup = "LibraryView";
+const int LibraryView::kPrefetchDelayMsec = 200;
 
 LibraryItemDelegate::LibraryItemDelegate(QObject* parent)
     : QStyledItemDelegate(parent) {}
@@ -173,6 +176,7 @@ LibraryView::LibraryView(QWidget* parent)
       app_(nullptr),
       filter_(nullptr),
       total_song_count_(-1),
+      prefetch_timer_(new QTimer(this)),
       context_menu_(nullptr),
       is_in_keyboard_search_(false) {
   QIcon nomusic = IconLoader::Load("nomusic", IconLoader::Other);
@@ -186,10 +190,54 @@ LibraryView::LibraryView(QWidget* parent)
   setSelectionMode(QAbstractItemView::ExtendedSelection);
 
   setStyleSheet("QTreeView::item{padding-top:1px;}");
+
+  // Load the children of visible containers once scrolling settles down.
+  prefetch_timer_->setSingleShot(true);
+  prefetch_timer_->setInterval(kPrefetchDelayMsec);
+  connect(prefetch_timer_, SIGNAL(timeout()), SLOT(PrefetchVisible()));
+  connect(verticalScrollBar(), SIGNAL(valueChanged(int)), prefetch_timer_,
+          SLOT(start()));
+  connect(this, SIGNAL(expanded(QModelIndex)), prefetch_timer_,
+          SLOT(start()));
 }
 
 LibraryView::~LibraryView() {}
 
+void LibraryView::reset() {
+  // Auto-expanding needs to know how many children each node has, so don't
+  // load them in the background here.
+  LibraryModel* library_model = app_ ? app_->library_model() : nullptr;
+  if (library_model) library_model->set_lazy_populate_async(false);
+  AutoExpandingTreeView::reset();
+  if (library_model) library_model->set_lazy_populate_async(true);
+
+  prefetch_timer_->start();
+}
+
+void LibraryView::PrefetchVisible() {
+  QSortFilterProxyModel* proxy = qobject_cast<QSortFilterProxyModel*>(model());
+  if (!app_ || !proxy) return;
+
+  QModelIndexList containers;
+  const int bottom = viewport()->height();
+  for (QModelIndex index = indexAt(QPoint(0, 0));
+       index.isValid() && visualRect(index).top() < bottom;
+       index = indexBelow(index)) {
+    if (!isExpanded(index) && model()->canFetchMore(index)) {
+      containers << proxy->mapToSource(index);
+    }
+  }
+  app_->library_model()->Prefetch(containers);
+}
+
+void LibraryView::LibraryChildrenLoaded(const QModelIndex& source_index) {
+  QSortFilterProxyModel* proxy = qobject_cast<QSortFilterProxyModel*>(model());
+  if (!proxy) return;
+
+  const QModelIndex index = proxy->mapFromSource(source_index);
+  if (index.isValid()) ChildrenLoaded(index);
+}
+
 void LibraryView::SaveFocus() {
   QModelIndex current = currentIndex();
   QVariant type = model()->data(current, LibraryModel::Role_Type);
@@ -319,6 +367,8 @@ void LibraryView::ReloadSettings() {
 
 void LibraryView::SetApplication(Application* app) {
   app_ = app;
+  connect(app_->library_model(), SIGNAL(ChildrenLoaded(QModelIndex)),
+          SLOT(LibraryChildrenLoaded(QModelIndex)));
   ReloadSettings();
 }
 
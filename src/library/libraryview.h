@@ -30,6 +30,7 @@ class LibraryFilterWidget;
 class OrganiseDialog;
 
 class QMimeData;
+class QTimer;
 
 namespace smart_playlists {
 class Wizard;
@@ -56,6 +57,7 @@ class LibraryView : public AutoExpandingTreeView {
   ~LibraryView();
 
   static const char* kSettingsGroup;
+  static const int kPrefetchDelayMsec;
 
   // Returns Songs currently selected in the library view. Please note that the
   // selection is recursive meaning that if for example an album is selected
@@ -82,6 +84,9 @@ class LibraryView : public AutoExpandingTreeView {
   void ShowConfigDialog();
 
  protected:
+  // QAbstractItemView
+  void reset();
+
   // QWidget
   void paintEvent(QPaintEvent* event);
   void mouseReleaseEvent(QMouseEvent* e);
@@ -112,6 +117,9 @@ class LibraryView : public AutoExpandingTreeView {
 
   void DeleteFinished(const SongList& songs_with_errors);
 
+  void PrefetchVisible();
+  void LibraryChildrenLoaded(const QModelIndex& source_index);
+
  private:
   void RecheckIsEmpty();
   void ShowInVarious(bool on);
@@ -126,6 +134,8 @@ class LibraryView : public AutoExpandingTreeView {
 
   QPixmap nomusic_;
 
+  QTimer* prefetch_timer_;
+
   QMenu* context_menu_;
   QModelIndex context_menu_index_;
   QAction* load_;
@@ -20,6 +20,7 @@
 #include <fileref.h>
 #include <tag.h>
 
+#include <QCryptographicHash>
 #include <QDateTime>
 #include <QDirIterator>
 #include <QHash>
@@ -28,6 +29,7 @@
 #include <QSettings>
 #include <QThread>
 #include <QTimer>
+#include <QtConcurrentRun>
 #include <QtDebug>
 
 #include "core/filesystemwatcherinterface.h"
@@ -50,6 +52,24 @@ static const char* kNoMusicFile = ".nomusic";
 
 static const int kUnfilteredImageLimit = 10;
 
+// New songs are sent to the backend in batches of this size while a scan is
+// still running, so a large import doesn't have to be held in memory and
+// shows up in the library gradually.
+static const int kMaxSongsPerCommit = 500;
+// Results are also committed, and the scan journal updated, after this many
+// subdirectories have been scanned.  This bounds how much work is redone when
+// an interrupted scan is resumed.
+static const int kMaxSubdirsPerCommit = 100;
+// How much data is hashed from each end of a file to fingerprint it.  Tags
+// usually live at one end or the other, and the audio in between makes the
+// fingerprint unique.
+static const qint64 kFingerprintChunkSize = 16 * 1024;
+// Songs added before files were fingerprinted are caught up this many at a
+// time, with a pause in between so it doesn't get in the way of scans or
+// playback.
+static const int kFingerprintBackfillBatch = 50;
+static const int kFingerprintBackfillIntervalMsec = 2000;
+
 QStringList LibraryWatcher::sValidImages;
 
 const char* LibraryWatcher::kSettingsGroup = "LibraryWatcher";
@@ -61,12 +81,16 @@ LibraryWatcher::LibraryWatcher(QObject* parent)
       fs_watcher_(FileSystemWatcherInterface::Create(this)),
       scan_on_startup_(true),
       monitor_(true),
+      scan_threads_(1),
       rescan_timer_(new QTimer(this)),
       rescan_paused_(false),
+      fingerprint_timer_(new QTimer(this)),
       total_watches_(0),
       cue_parser_(new CueParser(backend_, this)) {
   rescan_timer_->setInterval(1000);
   rescan_timer_->setSingleShot(true);
+  fingerprint_timer_->setInterval(kFingerprintBackfillIntervalMsec);
+  fingerprint_timer_->setSingleShot(true);
 
   if (sValidImages.isEmpty()) {
     sValidImages << "jpg"
@@ -78,6 +102,8 @@ LibraryWatcher::LibraryWatcher(QObject* parent)
   ReloadSettings();
 
   connect(rescan_timer_, SIGNAL(timeout()), SLOT(RescanPathsNow()));
+  connect(fingerprint_timer_, SIGNAL(timeout()),
+          SLOT(BackfillFingerprintsNow()));
 }
 
 // Holding a reference to a directory is safe because a ScanTransaction object
@@ -87,7 +113,9 @@ LibraryWatcher::LibraryWatcher(QObject* parent)
 LibraryWatcher::ScanTransaction::ScanTransaction(
     LibraryWatcher* watcher, const LibraryWatcher::WatchedDir& dir,
     bool incremental, bool ignores_mtime)
-    : progress_(0),
+    : busy_scanners_(0),
+      uses_journal_(false),
+      progress_(0),
       progress_max_(0),
       dir_(dir),
       incremental_(incremental),
@@ -112,93 +140,305 @@ LibraryWatcher::ScanTransaction::~ScanTransaction() {
     return;
   }
 
-  if (!new_songs.isEmpty()) emit watcher_->NewOrUpdatedSongs(new_songs);
-
-  if (!touched_songs.isEmpty()) emit watcher_->SongsMTimeUpdated(touched_songs);
-
-  if (!deleted_songs.isEmpty()) emit watcher_->SongsDeleted(deleted_songs);
-
-  if (!readded_songs.isEmpty()) emit watcher_->SongsReadded(readded_songs);
+  QMutexLocker l(&mutex_);
+  CommitScanResults();
 
-  if (!new_subdirs.isEmpty()) emit watcher_->SubdirsDiscovered(new_subdirs);
+  // Whatever is still missing now hasn't been moved anywhere else.
+  if (!deleted_songs_.isEmpty()) emit watcher_->SongsDeleted(deleted_songs_);
 
-  if (!touched_subdirs.isEmpty())
-    emit watcher_->SubdirsMTimeUpdated(touched_subdirs);
+  // Everything that was queued has been scanned.
+  if (uses_journal_) emit watcher_->ScanJournalCleared(dir_id());
 
   watcher_->task_manager_->SetTaskFinished(task_id_);
 
-  for (const Subdirectory& subdir : deleted_subdirs) {
+  for (const Subdirectory& subdir : deleted_subdirs_) {
     watcher_->RemoveWatch(dir_, subdir);
   }
 
   if (watcher_->monitor_) {
     // Watch the new subdirectories
-    for (const Subdirectory& subdir : new_subdirs) {
+    for (const Subdirectory& subdir : subdirs_to_watch_) {
       watcher_->AddWatch(dir_, subdir.path);
     }
   }
 }
 
+void LibraryWatcher::ScanTransaction::CommitScanResults() {
+  if (!new_songs_.isEmpty()) emit watcher_->NewOrUpdatedSongs(new_songs_);
+
+  if (!touched_songs_.isEmpty())
+    emit watcher_->SongsMTimeUpdated(touched_songs_);
+
+  if (!fingerprinted_songs_.isEmpty())
+    emit watcher_->SongsFingerprinted(fingerprinted_songs_);
+
+  if (!readded_songs_.isEmpty()) emit watcher_->SongsReadded(readded_songs_);
+
+  if (!new_subdirs_.isEmpty()) emit watcher_->SubdirsDiscovered(new_subdirs_);
+
+  if (!touched_subdirs_.isEmpty())
+    emit watcher_->SubdirsMTimeUpdated(touched_subdirs_);
+
+  // The backend handles these signals in order, so the journal is only
+  // updated once the results it describes are in the database.
+  if (!journal_queued_.isEmpty() || !journal_finished_.isEmpty()) {
+    emit watcher_->ScanJournalUpdated(dir_id(), journal_queued_,
+                                      journal_finished_);
+  }
+
+  subdirs_to_watch_ << new_subdirs_;
+
+  new_songs_.clear();
+  touched_songs_.clear();
+  fingerprinted_songs_.clear();
+  readded_songs_.clear();
+  new_subdirs_.clear();
+  touched_subdirs_.clear();
+  journal_queued_.clear();
+  journal_finished_.clear();
+}
+
+void LibraryWatcher::ScanTransaction::ResumeFromJournal(
+    const ScanJournal& journal) {
+  QMutexLocker l(&mutex_);
+  for (const ScanJournalEntry& entry : journal) {
+    pending_subdirs_.enqueue(
+        PendingSubdir(entry.subdir, entry.force_noincremental));
+    journaled_paths_.insert(entry.subdir.path);
+  }
+  uses_journal_ = true;
+}
+
 void LibraryWatcher::ScanTransaction::AddToProgress(int n) {
+  QMutexLocker l(&mutex_);
   progress_ += n;
   watcher_->task_manager_->SetTaskProgress(task_id_, progress_, progress_max_);
 }
 
 void LibraryWatcher::ScanTransaction::AddToProgressMax(int n) {
+  QMutexLocker l(&mutex_);
   progress_max_ += n;
   watcher_->task_manager_->SetTaskProgress(task_id_, progress_, progress_max_);
 }
 
+void LibraryWatcher::ScanTransaction::AddPendingSubdir(
+    const Subdirectory& subdir, bool force_noincremental) {
+  QMutexLocker l(&mutex_);
+  pending_subdirs_.enqueue(PendingSubdir(subdir, force_noincremental));
+  pending_subdirs_changed_.wakeOne();
+
+  // An incremental scan skips most subdirectories because their mtimes
+  // haven't changed, so it only journals the ones it actually enters.  The
+  // others keep their old mtimes if it's interrupted before getting to them,
+  // and the next incremental scan looks at them again anyway.
+  if (incremental_ && !ignores_mtime_ && !force_noincremental) return;
+  AddJournalEntryLocked(subdir, force_noincremental);
+}
+
+void LibraryWatcher::ScanTransaction::AddJournalEntry(
+    const Subdirectory& subdir) {
+  QMutexLocker l(&mutex_);
+  AddJournalEntryLocked(subdir, false);
+}
+
+void LibraryWatcher::ScanTransaction::AddJournalEntryLocked(
+    const Subdirectory& subdir, bool force_noincremental) {
+  ScanJournalEntry entry;
+  entry.subdir = subdir;
+  entry.incremental = incremental_;
+  entry.force_noincremental = force_noincremental;
+  entry.ignores_mtime = ignores_mtime_;
+  journal_queued_ << entry;
+  journaled_paths_.insert(subdir.path);
+  uses_journal_ = true;
+}
+
+bool LibraryWatcher::ScanTransaction::TakePendingSubdir(PendingSubdir* out) {
+  QMutexLocker l(&mutex_);
+
+  // Another thread that is still scanning might find more subdirectories, so
+  // only give up when the queue is empty and nobody is busy.
+  while (pending_subdirs_.isEmpty() && busy_scanners_ > 0 && !aborted()) {
+    pending_subdirs_changed_.wait(&mutex_);
+  }
+
+  if (pending_subdirs_.isEmpty() || aborted()) {
+    pending_subdirs_changed_.wakeAll();
+    return false;
+  }
+
+  *out = pending_subdirs_.dequeue();
+  busy_scanners_++;
+  return true;
+}
+
+void LibraryWatcher::ScanTransaction::PendingSubdirFinished(
+    const PendingSubdir& pending) {
+  QMutexLocker l(&mutex_);
+  busy_scanners_--;
+  pending_subdirs_changed_.wakeAll();
+
+  // Don't record the subdirectory as done if the scan was stopped half way
+  // through it.
+  if (aborted()) return;
+
+  // Nothing to take out of the journal if it was never put in.
+  if (!journaled_paths_.remove(pending.subdir.path)) return;
+
+  // If this subdirectory's missing songs haven't been sent yet, it has to be
+  // scanned again if the scan is interrupted.
+  if (!deleted_song_dirs_.contains(pending.subdir.path)) {
+    journal_finished_ << pending.subdir.path;
+  }
+  if (journal_finished_.count() >= kMaxSubdirsPerCommit) CommitScanResults();
+}
+
+void LibraryWatcher::ScanTransaction::AddNewSong(const Song& song) {
+  QMutexLocker l(&mutex_);
+  new_songs_ << song;
+  if (new_songs_.count() >= kMaxSongsPerCommit) CommitScanResults();
+}
+
+void LibraryWatcher::ScanTransaction::AddTouchedSong(const Song& song) {
+  QMutexLocker l(&mutex_);
+  touched_songs_ << song;
+  if (touched_songs_.count() >= kMaxSongsPerCommit) CommitScanResults();
+}
+
+void LibraryWatcher::ScanTransaction::AddFingerprintedSong(const Song& song) {
+  QMutexLocker l(&mutex_);
+  fingerprinted_songs_ << song;
+  if (fingerprinted_songs_.count() >= kMaxSongsPerCommit) CommitScanResults();
+}
+
+void LibraryWatcher::ScanTransaction::AddDeletedSong(const Song& song) {
+  QMutexLocker l(&mutex_);
+  if (moved_song_ids_.contains(song.id())) return;
+  deleted_songs_ << song;
+  deleted_song_dirs_ << QFileInfo(song.url().toLocalFile()).path();
+}
+
+void LibraryWatcher::ScanTransaction::AddReaddedSong(const Song& song) {
+  QMutexLocker l(&mutex_);
+  readded_songs_ << song;
+}
+
+void LibraryWatcher::ScanTransaction::AddNewSubdir(const Subdirectory& subdir) {
+  QMutexLocker l(&mutex_);
+  new_subdirs_ << subdir;
+}
+
+bool LibraryWatcher::ScanTransaction::TakeMovedSong(const QString& fingerprint,
+                                                    Song* out) {
+  if (fingerprint.isEmpty()) return false;
+
+  QMutexLocker l(&mutex_);
+  EnsureCachedSongsLoaded();
+
+  SongList candidates;
+  for (const Song& song : cached_songs_by_fingerprint_.values(fingerprint)) {
+    if (moved_song_ids_.contains(song.id()) ||
+        QFile::exists(song.url().toLocalFile())) {
+      continue;
+    }
+    candidates << song;
+  }
+
+  // If several missing songs had the same contents we can't tell which one
+  // this is, so it's treated as a new song.
+  if (candidates.count() != 1) return false;
+
+  *out = candidates.first();
+  moved_song_ids_ << out->id();
+
+  // The old location might have been scanned already.  Its deletion is held
+  // until the end of the scan, so it can still be taken back.
+  for (int i = 0; i < deleted_songs_.count(); ++i) {
+    if (deleted_songs_[i].id() == out->id()) {
+      deleted_songs_.removeAt(i);
+      break;
+    }
+  }
+  return true;
+}
+
+void LibraryWatcher::ScanTransaction::AddTouchedSubdir(
+    const Subdirectory& subdir) {
+  QMutexLocker l(&mutex_);
+  touched_subdirs_ << subdir;
+}
+
+void LibraryWatcher::ScanTransaction::AddDeletedSubdir(
+    const Subdirectory& subdir) {
+  QMutexLocker l(&mutex_);
+  deleted_subdirs_ << subdir;
+}
+
 SongList LibraryWatcher::ScanTransaction::FindSongsInSubdirectory(
     const QString& path) {
-  if (cached_songs_dirty_) {
-    cached_songs_ = watcher_->backend_->FindSongsInDirectory(dir_id());
-    cached_songs_dirty_ = false;
-  }
+  QMutexLocker l(&mutex_);
+  EnsureCachedSongsLoaded();
+  return cached_songs_.values(path);
+}
 
-  // TODO: Make this faster
-  SongList ret;
-  for (const Song& song : cached_songs_) {
-    if (song.url().toLocalFile().section('/', 0, -2) == path) ret << song;
+void LibraryWatcher::ScanTransaction::EnsureCachedSongsLoaded() {
+  if (!cached_songs_dirty_) return;
+
+  for (const Song& song : watcher_->backend_->FindSongsInDirectory(dir_id())) {
+    cached_songs_.insert(song.url().toLocalFile().section('/', 0, -2), song);
+    // Cue sections share their file with other songs, so they're never
+    // matched up by fingerprint.
+    if (!song.file_fingerprint().isEmpty() && !song.has_cue()) {
+      cached_songs_by_fingerprint_.insert(song.file_fingerprint(), song);
+    }
   }
-  return ret;
+  cached_songs_dirty_ = false;
 }
 
 void LibraryWatcher::ScanTransaction::SetKnownSubdirs(
     const SubdirectoryList& subdirs) {
-  known_subdirs_ = subdirs;
-  known_subdirs_dirty_ = false;
+  QMutexLocker l(&mutex_);
+  SetKnownSubdirsLocked(subdirs);
 }
 
-bool LibraryWatcher::ScanTransaction::HasSeenSubdir(const QString& path) {
-  if (known_subdirs_dirty_)
-    SetKnownSubdirs(watcher_->backend_->SubdirsInDirectory(dir_id()));
+void LibraryWatcher::ScanTransaction::SetKnownSubdirsLocked(
+    const SubdirectoryList& subdirs) {
+  known_subdirs_ = subdirs;
+  known_subdir_mtimes_.clear();
+  known_subdir_children_.clear();
 
   for (const Subdirectory& subdir : known_subdirs_) {
-    if (subdir.path == path && subdir.mtime != 0) return true;
+    if (subdir.mtime == 0) continue;
+
+    known_subdir_mtimes_[subdir.path] = subdir.mtime;
+    known_subdir_children_.insert(
+        subdir.path.left(subdir.path.lastIndexOf(QDir::separator())), subdir);
   }
-  return false;
+
+  known_subdirs_dirty_ = false;
 }
 
-SubdirectoryList LibraryWatcher::ScanTransaction::GetImmediateSubdirs(
-    const QString& path) {
+void LibraryWatcher::ScanTransaction::EnsureKnownSubdirsLoaded() {
   if (known_subdirs_dirty_)
-    SetKnownSubdirs(watcher_->backend_->SubdirsInDirectory(dir_id()));
+    SetKnownSubdirsLocked(watcher_->backend_->SubdirsInDirectory(dir_id()));
+}
 
-  SubdirectoryList ret;
-  for (const Subdirectory& subdir : known_subdirs_) {
-    if (subdir.path.left(subdir.path.lastIndexOf(QDir::separator())) == path &&
-        subdir.mtime != 0) {
-      ret << subdir;
-    }
-  }
+bool LibraryWatcher::ScanTransaction::HasSeenSubdir(const QString& path) {
+  QMutexLocker l(&mutex_);
+  EnsureKnownSubdirsLoaded();
+  return known_subdir_mtimes_.contains(path);
+}
 
-  return ret;
+SubdirectoryList LibraryWatcher::ScanTransaction::GetImmediateSubdirs(
+    const QString& path) {
+  QMutexLocker l(&mutex_);
+  EnsureKnownSubdirsLoaded();
+  return known_subdir_children_.values(path);
 }
 
 SubdirectoryList LibraryWatcher::ScanTransaction::GetAllSubdirs() {
-  if (known_subdirs_dirty_)
-    SetKnownSubdirs(watcher_->backend_->SubdirsInDirectory(dir_id()));
+  QMutexLocker l(&mutex_);
+  EnsureKnownSubdirsLoaded();
   return known_subdirs_;
 }
 
@@ -234,28 +474,63 @@ void LibraryWatcher::AddDirectory(const Directory& dir,
   watched_dirs_.Add(dir);
   const WatchedDir& new_dir = watched_dirs_.list_[dir.id];
 
-  if (subdirs.isEmpty()) {
+  const ScanJournal journal = backend_->GetScanJournal(dir.id);
+  QSet<QString> resumed_paths;
+  if (!journal.isEmpty()) {
+    // The last scan of this directory was interrupted.  Finish it off first,
+    // the same way it was started - everything that isn't in the journal has
+    // been scanned already.
+    qLog(Info) << "Resuming interrupted scan of" << dir.GetPath() << "-"
+               << journal.count() << "subdirectories left";
+    ScanTransaction transaction(this, new_dir, journal.first().incremental,
+                                journal.first().ignores_mtime);
+    transaction.SetKnownSubdirs(subdirs);
+    transaction.ResumeFromJournal(journal);
+    transaction.AddToProgressMax(journal.count());
+    ScanSubdirectories(SubdirectoryList(), &transaction);
+    if (transaction.aborted()) return;
+
+    for (const ScanJournalEntry& entry : journal) {
+      resumed_paths << entry.subdir.path;
+    }
+  }
+
+  if (subdirs.isEmpty() && journal.isEmpty()) {
     // This is a new directory that we've never seen before.
     // Scan it fully.
     ScanTransaction transaction(this, new_dir, false);
     transaction.SetKnownSubdirs(subdirs);
-    transaction.AddToProgressMax(1);
-    ScanSubdirectory(new_dir.path, Subdirectory(), &transaction);
-  } else {
+
+    Subdirectory root;
+    root.path = new_dir.path;
+    ScanSubdirectories(SubdirectoryList() << root, &transaction);
+  } else if (!subdirs.isEmpty()) {
     // We can do an incremental scan - looking at the mtimes of each
     // subdirectory and only rescan if the directory has changed.
     ScanTransaction transaction(this, new_dir, true);
     transaction.SetKnownSubdirs(subdirs);
-    transaction.AddToProgressMax(subdirs.count());
+
+    // Subdirectories the resumed scan just finished don't need another look.
+    SubdirectoryList startup_subdirs;
     for (const Subdirectory& subdir : subdirs) {
-      if (transaction.aborted()) return;
+      if (!resumed_paths.contains(subdir.path)) startup_subdirs << subdir;
+    }
 
-      if (scan_on_startup_) ScanSubdirectory(subdir.path, subdir, &transaction);
+    if (scan_on_startup_) ScanSubdirectories(startup_subdirs, &transaction);
+    if (transaction.aborted()) return;
 
-      if (monitor_) AddWatch(new_dir, subdir.path);
+    if (monitor_) {
+      for (const Subdirectory& subdir : subdirs) {
+        AddWatch(new_dir, subdir.path);
+      }
     }
   }
 
+  // Catch up on songs from before files were fingerprinted without making
+  // every subdirectory look changed.
+  fingerprint_backfill_[dir.id] = -1;
+  if (!rescan_paused_) fingerprint_timer_->start();
+
   emit CompilationsNeedUpdating();
 }
 
@@ -290,6 +565,10 @@ void LibraryWatcher::ScanSubdirectory(const QString& path,
     return;
   }
 
+  if (t->is_incremental() && !t->ignores_mtime() && !force_noincremental) {
+    t->AddJournalEntry(subdir);
+  }
+
   QMap<QString, QStringList> album_art;
   QStringList files_on_disk;
   SubdirectoryList my_new_subdirs;
@@ -301,7 +580,7 @@ void LibraryWatcher::ScanSubdirectory(const QString& path,
   for (const Subdirectory& subdir : previous_subdirs) {
     if (!QFile::exists(subdir.path) && subdir.path != path) {
       t->AddToProgressMax(1);
-      ScanSubdirectory(subdir.path, subdir, t, true);
+      t->AddPendingSubdir(subdir, true);
     }
   }
 
@@ -345,6 +624,10 @@ void LibraryWatcher::ScanSubdirectory(const QString& path,
   // Ask the database for a list of files in this directory
   SongList songs_in_db = t->FindSongsInSubdirectory(path);
 
+  const QHash<QString, Song> prefetched_songs =
+      ReadNewFiles(files_on_disk, songs_in_db, t);
+  if (t->aborted()) return;
+
   QSet<QString> cues_processed;
 
   // Now compare the list from the database with the list of files on disk
@@ -404,21 +687,28 @@ void LibraryWatcher::ScanSubdirectory(const QString& path,
           UpdateNonCueAssociatedSong(file, matching_song, image, cue_deleted,
                                      t);
         }
+      } else if (matching_song.file_fingerprint().isEmpty() &&
+                 !matching_song.has_cue()) {
+        // Songs added before files were fingerprinted get one the next time
+        // their directory is scanned, so they can be recognised if moved.
+        Song song(matching_song);
+        song.set_file_fingerprint(FileFingerprint(file));
+        t->AddFingerprintedSong(song);
       }
 
       // nothing has changed - mark the song available without re-scanning
-      if (matching_song.is_unavailable()) t->readded_songs << matching_song;
+      if (matching_song.is_unavailable()) t->AddReaddedSong(matching_song);
 
     } else {
       // The song is on disk but not in the DB
-      SongList song_list =
-          ScanNewFile(file, path, matching_cue, &cues_processed);
+      SongList song_list = ScanNewFile(file, path, matching_cue,
+                                       &cues_processed, prefetched_songs);
 
       if (song_list.isEmpty()) {
         continue;
       }
 
-      qLog(Debug) << file << "created";
+      if (song_list.first().id() == -1) qLog(Debug) << file << "created";
       // choose an image for the song(s)
       QString image = ImageForSong(file, &album_art, t);
 
@@ -426,7 +716,7 @@ void LibraryWatcher::ScanSubdirectory(const QString& path,
         song.set_directory_id(t->dir_id());
         if (song.art_automatic().isEmpty()) song.set_art_automatic(image);
 
-        t->new_songs << song;
+        t->AddNewSong(song);
       }
     }
   }
@@ -436,7 +726,7 @@ void LibraryWatcher::ScanSubdirectory(const QString& path,
     if (!song.is_unavailable() &&
         !files_on_disk.contains(song.url().toLocalFile())) {
       qLog(Debug) << "Song deleted from disk:" << song.url().toLocalFile();
-      t->deleted_songs << song;
+      t->AddDeletedSong(song);
     }
   }
 
@@ -448,23 +738,163 @@ void LibraryWatcher::ScanSubdirectory(const QString& path,
   updated_subdir.path = path;
 
   if (subdir.directory_id == -1)
-    t->new_subdirs << updated_subdir;
+    t->AddNewSubdir(updated_subdir);
   else
-    t->touched_subdirs << updated_subdir;
+    t->AddTouchedSubdir(updated_subdir);
 
   if (updated_subdir.mtime ==
       0) {  // Subdirectory deleted, mark it for removal from the watcher.
-    t->deleted_subdirs << updated_subdir;
+    t->AddDeletedSubdir(updated_subdir);
   }
 
   t->AddToProgress(1);
 
-  // Recurse into the new subdirs that we found
+  // Queue the new subdirs that we found so they get scanned too
   t->AddToProgressMax(my_new_subdirs.count());
   for (const Subdirectory& my_new_subdir : my_new_subdirs) {
+    t->AddPendingSubdir(my_new_subdir, true);
+  }
+}
+
+void LibraryWatcher::ScanSubdirectories(const SubdirectoryList& subdirs,
+                                        ScanTransaction* t) {
+  t->AddToProgressMax(subdirs.count());
+  for (const Subdirectory& subdir : subdirs) {
+    t->AddPendingSubdir(subdir);
+  }
+
+  // This thread does its share of the work too, so only start the extra ones.
+  QList<QFuture<void>> scanners;
+  for (int i = 1; i < scan_threads_; ++i) {
+    scanners << QtConcurrent::run(&scan_thread_pool_, this,
+                                  &LibraryWatcher::ScanPendingSubdirs, t);
+  }
+
+  ScanPendingSubdirs(t);
+
+  for (QFuture<void>& scanner : scanners) {
+    scanner.waitForFinished();
+  }
+}
+
+void LibraryWatcher::ScanPendingSubdirs(ScanTransaction* t) {
+  ScanTransaction::PendingSubdir pending;
+  while (t->TakePendingSubdir(&pending)) {
+    ScanSubdirectory(pending.subdir.path, pending.subdir, t,
+                     pending.force_noincremental);
+    t->PendingSubdirFinished(pending);
+  }
+}
+
+void LibraryWatcher::ScanChangedFiles(const QString& path,
+                                      const QStringList& files,
+                                      ScanTransaction* t) {
+  QFileInfo path_info(path);
+  QDir path_dir(path);
+
+  bool needs_full_scan = !path_info.exists() || path_dir.exists(kNoMediaFile) ||
+                         path_dir.exists(kNoMusicFile);
+  for (const QString& file : files) {
+    const QString ext_part(ExtensionPart(file));
+    if (ext_part == "cue" || sValidImages.contains(ext_part)) {
+      needs_full_scan = true;
+    }
+  }
+
+  if (needs_full_scan) {
+    Subdirectory subdir;
+    subdir.directory_id = t->dir_id();
+    subdir.mtime = 0;
+    subdir.path = path;
+    ScanSubdirectories(SubdirectoryList() << subdir, t);
+    return;
+  }
+
+  t->AddToProgressMax(1);
+
+  SongList songs_in_db = t->FindSongsInSubdirectory(path);
+
+  QMap<QString, QStringList> album_art;
+  QStringList image_filters;
+  for (const QString& ext : sValidImages) {
+    image_filters << "*." + ext;
+  }
+  for (const QString& image :
+       path_dir.entryList(image_filters, QDir::Files | QDir::Hidden)) {
+    album_art[path] << path_dir.filePath(image);
+  }
+
+  QStringList files_on_disk;
+  for (const QString& file : files) {
+    QFileInfo file_info(file);
+    if (file_info.exists() && !file_info.isHidden() &&
+        !skip_file_extensions_.contains(ExtensionPart(file))) {
+      files_on_disk << file;
+    }
+  }
+  const QHash<QString, Song> prefetched_songs =
+      ReadNewFiles(files_on_disk, songs_in_db, t);
+  if (t->aborted()) return;
+
+  QSet<QString> cues_processed;
+
+  for (const QString& file : files) {
     if (t->aborted()) return;
-    ScanSubdirectory(my_new_subdir.path, my_new_subdir, t, true);
+
+    Song matching_song;
+    const bool in_db = FindSongByPath(songs_in_db, file, &matching_song);
+
+    QFileInfo file_info(file);
+    if (!file_info.exists()) {
+      if (in_db && !matching_song.is_unavailable()) {
+        qLog(Debug) << "Song deleted from disk:" << file;
+        t->AddDeletedSong(matching_song);
+      }
+      continue;
+    }
+
+    if (file_info.isHidden() ||
+        skip_file_extensions_.contains(ExtensionPart(file))) {
+      continue;
+    }
+
+    const QString matching_cue = NoExtensionPart(file) + ".cue";
+    const QString image = ImageForSong(file, &album_art, t);
+
+    if (in_db) {
+      qLog(Debug) << file << "changed";
+
+      if (matching_song.has_cue() || GetMtimeForCue(matching_cue)) {
+        UpdateCueAssociatedSongs(file, path, matching_cue, image, t);
+      } else {
+        UpdateNonCueAssociatedSong(file, matching_song, image, false, t);
+      }
+
+      if (matching_song.is_unavailable()) t->AddReaddedSong(matching_song);
+    } else {
+      SongList song_list = ScanNewFile(file, path, matching_cue,
+                                       &cues_processed, prefetched_songs);
+      if (song_list.isEmpty()) continue;
+
+      if (song_list.first().id() == -1) qLog(Debug) << file << "created";
+      for (Song song : song_list) {
+        song.set_directory_id(t->dir_id());
+        if (song.art_automatic().isEmpty()) song.set_art_automatic(image);
+
+        t->AddNewSong(song);
+      }
+    }
   }
+
+  // Record the directory's new mtime so the next incremental scan doesn't
+  // look at it again.
+  Subdirectory updated_subdir;
+  updated_subdir.directory_id = t->dir_id();
+  updated_subdir.mtime = path_info.lastModified().toTime_t();
+  updated_subdir.path = path;
+  t->AddTouchedSubdir(updated_subdir);
+
+  t->AddToProgress(1);
 }
 
 void LibraryWatcher::UpdateCueAssociatedSongs(const QString& file,
@@ -491,7 +921,7 @@ void LibraryWatcher::UpdateCueAssociatedSongs(const QString& file,
     Song matching = sections_map[cue_song.beginning_nanosec()];
     // a new section
     if (!matching.is_valid()) {
-      t->new_songs << cue_song;
+      t->AddNewSong(cue_song);
       // changed section
     } else {
       PreserveUserSetData(file, image, matching, &cue_song, t);
@@ -502,7 +932,7 @@ void LibraryWatcher::UpdateCueAssociatedSongs(const QString& file,
   // sections that are now missing
   for (const Song& matching : old_sections) {
     if (!used_ids.contains(matching.id())) {
-      t->deleted_songs << matching;
+      t->AddDeletedSong(matching);
     }
   }
 }
@@ -519,7 +949,7 @@ void LibraryWatcher::UpdateNonCueAssociatedSong(const QString& file,
     for (const Song& song :
          backend_->GetSongsByUrl(QUrl::fromLocalFile(file))) {
       if (!song.IsMetadataEqual(matching_song)) {
-        t->deleted_songs << song;
+        t->AddDeletedSong(song);
       }
     }
   }
@@ -527,15 +957,83 @@ void LibraryWatcher::UpdateNonCueAssociatedSong(const QString& file,
   Song song_on_disk;
   song_on_disk.set_directory_id(t->dir_id());
   TagReaderClient::Instance()->ReadFileBlocking(file, &song_on_disk);
+  song_on_disk.set_file_fingerprint(FileFingerprint(file));
 
   if (song_on_disk.is_valid()) {
     PreserveUserSetData(file, image, matching_song, &song_on_disk, t);
   }
 }
 
-SongList LibraryWatcher::ScanNewFile(const QString& file, const QString& path,
-                                     const QString& matching_cue,
-                                     QSet<QString>* cues_processed) {
+QHash<QString, Song> LibraryWatcher::ReadNewFiles(
+    const QStringList& files_on_disk, const SongList& songs_in_db,
+    ScanTransaction* t) {
+  QSet<QString> files_in_db;
+  for (const Song& song : songs_in_db) {
+    files_in_db << song.url().toLocalFile();
+  }
+
+  QHash<QString, Song> ret;
+  QStringList new_files;
+  QStringList new_fingerprints;
+  for (const QString& file : files_on_disk) {
+    if (t->aborted()) return ret;
+    if (files_in_db.contains(file)) continue;
+    // Files with a cue sheet are split into sections by ScanNewFile instead.
+    if (GetMtimeForCue(NoExtensionPart(file) + ".cue")) continue;
+
+    const QString fingerprint = FileFingerprint(file);
+    Song moved_song;
+    if (t->TakeMovedSong(fingerprint, &moved_song)) {
+      qLog(Debug) << moved_song.url().toLocalFile() << "moved to" << file;
+
+      // Keep everything the library knows about the song, including its ID
+      // and the user's ratings and play counts, and just update its location.
+      QFileInfo file_info(file);
+      moved_song.set_url(QUrl::fromLocalFile(file));
+      moved_song.set_basefilename(file_info.fileName());
+      moved_song.set_mtime(file_info.lastModified().toTime_t());
+      moved_song.set_ctime(file_info.created().toTime_t());
+      moved_song.set_filesize(file_info.size());
+      moved_song.set_unavailable(false);
+      if (!moved_song.has_embedded_cover()) moved_song.set_art_automatic("");
+      ret[file] = moved_song;
+      continue;
+    }
+
+    new_files << file;
+    new_fingerprints << fingerprint;
+  }
+
+  if (new_files.isEmpty()) return ret;
+
+  SongList songs;
+  TagReaderClient::Instance()->ReadFilesBlocking(new_files, &songs);
+  for (int i = 0; i < new_files.count() && i < songs.count(); ++i) {
+    songs[i].set_file_fingerprint(new_fingerprints[i]);
+    ret[new_files[i]] = songs[i];
+  }
+  return ret;
+}
+
+QString LibraryWatcher::FileFingerprint(const QString& filename) {
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly)) return QString();
+
+  const qint64 size = file.size();
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(file.read(kFingerprintChunkSize));
+  if (size > kFingerprintChunkSize) {
+    file.seek(qMax(kFingerprintChunkSize, size - kFingerprintChunkSize));
+    hash.addData(file.read(kFingerprintChunkSize));
+  }
+
+  return QString::number(size) + ":" + hash.result().toHex();
+}
+
+SongList LibraryWatcher::ScanNewFile(
+    const QString& file, const QString& path, const QString& matching_cue,
+    QSet<QString>* cues_processed,
+    const QHash<QString, Song>& prefetched_songs) {
   SongList song_list;
 
   uint matching_cue_mtime = GetMtimeForCue(matching_cue);
@@ -567,7 +1065,12 @@ SongList LibraryWatcher::ScanNewFile(const QString& file, const QString& path,
     // it's a normal media file
   } else {
     Song song;
-    TagReaderClient::Instance()->ReadFileBlocking(file, &song);
+    if (prefetched_songs.contains(file)) {
+      song = prefetched_songs[file];
+    } else {
+      TagReaderClient::Instance()->ReadFileBlocking(file, &song);
+      song.set_file_fingerprint(FileFingerprint(file));
+    }
 
     if (song.is_valid()) {
       song_list << song;
@@ -595,15 +1098,18 @@ void LibraryWatcher::PreserveUserSetData(const QString& file,
   if (matching_song.is_unavailable()) {
     qLog(Debug) << file << " unavailable song restored";
 
-    t->new_songs << *out;
-  } else if (!matching_song.IsMetadataEqual(*out)) {
+    t->AddNewSong(*out);
+  } else if (!matching_song.IsMetadataEqual(*out) ||
+             matching_song.file_fingerprint() != out->file_fingerprint()) {
+    // The fingerprint isn't metadata, but an mtime-only update wouldn't
+    // store it.
     qLog(Debug) << file << "metadata changed";
 
     // Update the song in the DB
-    t->new_songs << *out;
+    t->AddNewSong(*out);
   } else {
     // Only the mtime's changed
-    t->touched_songs << *out;
+    t->AddTouchedSong(*out);
   }
 }
 
@@ -629,6 +1135,9 @@ void LibraryWatcher::AddWatch(const Directory& dir, const QString& path) {
 
   connect(fs_watcher_, SIGNAL(PathChanged(const QString&)), this,
           SLOT(DirectoryChanged(const QString&)), Qt::UniqueConnection);
+  connect(fs_watcher_, SIGNAL(FilesChanged(const QString&, const QStringList&)),
+          this, SLOT(FilesChanged(const QString&, const QStringList&)),
+          Qt::UniqueConnection);
   if (!fs_watcher_->AddPath(path)) {
     // Since this may be a system error, don't spam the user.
     static int errCount = 0;
@@ -673,6 +1182,8 @@ void LibraryWatcher::RemoveDirectory(int dir_id) {
 
 void LibraryWatcher::DoRemoveDirectory(int dir_id) {
   rescan_queue_.remove(dir_id);
+  rescan_files_queue_.remove(dir_id);
+  fingerprint_backfill_.remove(dir_id);
 
   const WatchedDir& dir = watched_dirs_.list_[dir_id];
   // Stop watching the directory's subdirectories
@@ -713,8 +1224,33 @@ void LibraryWatcher::DirectoryChanged(const QString& subdir) {
   if (!rescan_paused_) rescan_timer_->start();
 }
 
+void LibraryWatcher::FilesChanged(const QString& subdir,
+                                  const QStringList& files) {
+  // Find what dir it was in
+  QHash<QString, Directory>::const_iterator it =
+      subdir_mapping_.constFind(subdir);
+  if (it == subdir_mapping_.constEnd()) {
+    return;
+  }
+  Directory dir = *it;
+
+  qLog(Debug) << files.count() << "files changed in subdir" << subdir
+              << "under directory" << dir.path << "id" << dir.id;
+
+  // Queue the files for rescanning
+  QStringList& queued_files = rescan_files_queue_[dir.id][subdir];
+  for (const QString& file : files) {
+    if (!queued_files.contains(file)) queued_files << file;
+  }
+
+  if (!rescan_paused_) rescan_timer_->start();
+}
+
 void LibraryWatcher::RescanPathsNow() {
-  for (int id : rescan_queue_.keys()) {
+  QSet<int> ids = rescan_queue_.keys().toSet();
+  ids.unite(rescan_files_queue_.keys().toSet());
+
+  for (int id : ids) {
     if (!watched_dirs_.list_.contains(id)) {
       qLog(Warning) << "Rescan id" << id << "not in watch list.";
       continue;
@@ -724,19 +1260,34 @@ void LibraryWatcher::RescanPathsNow() {
     if (!dir.active_) continue;
 
     ScanTransaction transaction(this, dir, false);
-    transaction.AddToProgressMax(rescan_queue_[id].count());
 
-    for (const QString& path : rescan_queue_[id]) {
-      if (transaction.aborted()) return;
+    const QStringList paths = rescan_queue_.value(id);
+    SubdirectoryList subdirs;
+    for (const QString& path : paths) {
       Subdirectory subdir;
       subdir.directory_id = id;
       subdir.mtime = 0;
       subdir.path = path;
-      ScanSubdirectory(path, subdir, &transaction);
+      subdirs << subdir;
+    }
+
+    if (!subdirs.isEmpty()) ScanSubdirectories(subdirs, &transaction);
+    if (transaction.aborted()) return;
+
+    const QHash<QString, QStringList> changed_files =
+        rescan_files_queue_.value(id);
+    for (auto it = changed_files.constBegin(); it != changed_files.constEnd();
+         ++it) {
+      // Already picked up by rescanning the whole subdirectory.
+      if (paths.contains(it.key())) continue;
+
+      ScanChangedFiles(it.key(), it.value(), &transaction);
+      if (transaction.aborted()) return;
     }
   }
 
   rescan_queue_.clear();
+  rescan_files_queue_.clear();
 
   emit CompilationsNeedUpdating();
 }
@@ -825,6 +1376,9 @@ void LibraryWatcher::ReloadSettings() {
   s.beginGroup(kSettingsGroup);
   scan_on_startup_ = s.value("startup_scan", true).toBool();
   monitor_ = s.value("monitor", true).toBool();
+  scan_threads_ =
+      qMax(1, s.value("scan_threads", QThread::idealThreadCount()).toInt());
+  scan_thread_pool_.setMaxThreadCount(qMax(1, scan_threads_ - 1));
 
   best_image_filters_.clear();
   QStringList filters = s.value("cover_art_patterns", QStringList() << "front"
@@ -862,7 +1416,45 @@ void LibraryWatcher::SetRescanPausedAsync(bool pause) {
 
 void LibraryWatcher::SetRescanPaused(bool pause) {
   rescan_paused_ = pause;
-  if (!rescan_paused_ && !rescan_queue_.isEmpty()) RescanPathsNow();
+  if (!rescan_paused_ &&
+      (!rescan_queue_.isEmpty() || !rescan_files_queue_.isEmpty())) {
+    RescanPathsNow();
+  }
+  if (!rescan_paused_ && !fingerprint_backfill_.isEmpty()) {
+    fingerprint_timer_->start();
+  }
+}
+
+void LibraryWatcher::BackfillFingerprintsNow() {
+  if (rescan_paused_ || fingerprint_backfill_.isEmpty()) return;
+
+  const int dir_id = fingerprint_backfill_.firstKey();
+  if (!watched_dirs_.list_.contains(dir_id) ||
+      !watched_dirs_.list_[dir_id].active_) {
+    fingerprint_backfill_.remove(dir_id);
+  } else {
+    const SongList songs = backend_->FindSongsWithoutFingerprint(
+        dir_id, fingerprint_backfill_[dir_id], kFingerprintBackfillBatch);
+
+    SongList fingerprinted;
+    for (Song song : songs) {
+      // Files that can't be read are skipped, and tried again on a later run.
+      const QString fingerprint = FileFingerprint(song.url().toLocalFile());
+      if (fingerprint.isEmpty()) continue;
+
+      song.set_file_fingerprint(fingerprint);
+      fingerprinted << song;
+    }
+    if (!fingerprinted.isEmpty()) emit SongsFingerprinted(fingerprinted);
+
+    if (songs.count() < kFingerprintBackfillBatch) {
+      fingerprint_backfill_.remove(dir_id);
+    } else {
+      fingerprint_backfill_[dir_id] = songs.last().id();
+    }
+  }
+
+  if (!fingerprint_backfill_.isEmpty()) fingerprint_timer_->start();
 }
 
 void LibraryWatcher::IncrementalScanAsync() {
@@ -894,13 +1486,8 @@ void LibraryWatcher::PerformScan(bool incremental, bool ignore_mtimes) {
       subdirs << subdir;
     }
 
-    transaction.AddToProgressMax(subdirs.count());
-
-    for (const Subdirectory& subdir : subdirs) {
-      if (transaction.aborted()) return;
-
-      ScanSubdirectory(subdir.path, subdir, &transaction);
-    }
+    ScanSubdirectories(subdirs, &transaction);
+    if (transaction.aborted()) return;
   }
 
   emit CompilationsNeedUpdating();
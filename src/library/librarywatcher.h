@@ -22,7 +22,11 @@
 #include <QMap>
 #include <QMutex>
 #include <QObject>
+#include <QQueue>
+#include <QSet>
 #include <QStringList>
+#include <QThreadPool>
+#include <QWaitCondition>
 
 #include "core/song.h"
 #include "directory.h"
@@ -65,11 +69,18 @@ class LibraryWatcher : public QObject {
  signals:
   void NewOrUpdatedSongs(const SongList& songs);
   void SongsMTimeUpdated(const SongList& songs);
+  // Only the file fingerprints of these songs need saving.
+  void SongsFingerprinted(const SongList& songs);
   void SongsDeleted(const SongList& songs);
   void SongsReadded(const SongList& songs, bool unavailable = false);
   void SubdirsDiscovered(const SubdirectoryList& subdirs);
   void SubdirsMTimeUpdated(const SubdirectoryList& subdirs);
   void CompilationsNeedUpdating();
+  // The scan journal records which subdirectories a scan still has to look
+  // at, so it can be resumed if it's interrupted.
+  void ScanJournalUpdated(int dir_id, const ScanJournal& queued,
+                          const QStringList& finished_paths);
+  void ScanJournalCleared(int dir_id);
 
   void ScanStarted(int task_id);
 
@@ -98,6 +109,9 @@ class LibraryWatcher : public QObject {
   // to the library.  Multiple calls to FindSongsInSubdirectory during one
   // transaction will only result in one call to
   // LibraryBackend::FindSongsInDirectory.
+  // Subdirectories waiting to be scanned are kept in a queue on the
+  // transaction so that several scanner threads can work on it at once.  All
+  // the public methods are thread-safe.
   class ScanTransaction {
    public:
     ScanTransaction(LibraryWatcher* watcher,
@@ -105,6 +119,15 @@ class LibraryWatcher : public QObject {
                     bool ignores_mtime = false);
     ~ScanTransaction();
 
+    struct PendingSubdir {
+      PendingSubdir() : force_noincremental(false) {}
+      PendingSubdir(const Subdirectory& subdir, bool force_noincremental)
+          : subdir(subdir), force_noincremental(force_noincremental) {}
+
+      Subdirectory subdir;
+      bool force_noincremental;
+    };
+
     SongList FindSongsInSubdirectory(const QString& path);
     bool HasSeenSubdir(const QString& path);
     void SetKnownSubdirs(const SubdirectoryList& subdirs);
@@ -114,23 +137,73 @@ class LibraryWatcher : public QObject {
     void AddToProgress(int n = 1);
     void AddToProgressMax(int n);
 
+    // Queues a subdirectory to be picked up by one of the scanner threads.
+    void AddPendingSubdir(const Subdirectory& subdir,
+                          bool force_noincremental = false);
+    // Blocks until there is a subdirectory to scan, and returns false once the
+    // queue is empty and no other thread can add anything more to it.  Every
+    // successful call must be followed by a call to PendingSubdirFinished.
+    bool TakePendingSubdir(PendingSubdir* out);
+    // Journals a subdirectory that an incremental scan queued without
+    // journaling, once it's found to have changed.
+    void AddJournalEntry(const Subdirectory& subdir);
+    void PendingSubdirFinished(const PendingSubdir& pending);
+    // Queues the subdirectories left over by an interrupted scan.
+    void ResumeFromJournal(const ScanJournal& journal);
+
+    void AddNewSong(const Song& song);
+    void AddTouchedSong(const Song& song);
+    void AddFingerprintedSong(const Song& song);
+    void AddDeletedSong(const Song& song);
+    void AddReaddedSong(const Song& song);
+    void AddNewSubdir(const Subdirectory& subdir);
+    // Looks for a song in this directory whose file has disappeared and had
+    // the same fingerprint, meaning it has been moved or renamed.  A song is
+    // only returned once, and isn't reported as deleted after that.
+    bool TakeMovedSong(const QString& fingerprint, Song* out);
+    void AddTouchedSubdir(const Subdirectory& subdir);
+    void AddDeletedSubdir(const Subdirectory& subdir);
+
     int dir_id() const { return dir_.id; }
     bool is_incremental() const { return incremental_; }
     bool ignores_mtime() const { return ignores_mtime_; }
 
     bool aborted() { return !dir_.active_; }
 
-    SongList deleted_songs;
-    SongList readded_songs;
-    SongList new_songs;
-    SongList touched_songs;
-    SubdirectoryList new_subdirs;
-    SubdirectoryList touched_subdirs;
-    SubdirectoryList deleted_subdirs;
-
    private:
     ScanTransaction& operator=(const ScanTransaction&) { return *this; }
 
+    // Sends the results so far to the backend without waiting for the rest of
+    // the scan to finish, and updates the scan journal to match.  Deleted
+    // songs are held back until the end.  Must be called with mutex_ held.
+    void CommitScanResults();
+    void AddJournalEntryLocked(const Subdirectory& subdir,
+                               bool force_noincremental);
+    void EnsureCachedSongsLoaded();
+    void EnsureKnownSubdirsLoaded();
+    void SetKnownSubdirsLocked(const SubdirectoryList& subdirs);
+
+    QMutex mutex_;
+    QWaitCondition pending_subdirs_changed_;
+    QQueue<PendingSubdir> pending_subdirs_;
+    int busy_scanners_;
+
+    SongList deleted_songs_;
+    SongList readded_songs_;
+    SongList new_songs_;
+    SongList touched_songs_;
+    SongList fingerprinted_songs_;
+    SubdirectoryList new_subdirs_;
+    SubdirectoryList touched_subdirs_;
+    SubdirectoryList deleted_subdirs_;
+    SubdirectoryList subdirs_to_watch_;
+
+    ScanJournal journal_queued_;
+    QStringList journal_finished_;
+    // Subdirectories in the journal that haven't been scanned yet.
+    QSet<QString> journaled_paths_;
+    bool uses_journal_;
+
     int task_id_;
     int progress_;
     int progress_max_;
@@ -147,18 +220,36 @@ class LibraryWatcher : public QObject {
 
     LibraryWatcher* watcher_;
 
-    SongList cached_songs_;
+    // Subdirectory path -> songs in that subdirectory
+    QMultiHash<QString, Song> cached_songs_;
+    // File fingerprint -> songs with that fingerprint
+    QMultiHash<QString, Song> cached_songs_by_fingerprint_;
     bool cached_songs_dirty_;
 
+    // Songs that have been found in a new location during this scan.
+    QSet<int> moved_song_ids_;
+    // Directories containing songs in deleted_songs_.  Those songs are only
+    // sent to the backend at the end of the scan, since they might still turn
+    // up somewhere else, so these directories stay in the scan journal until
+    // then.
+    QSet<QString> deleted_song_dirs_;
+
     SubdirectoryList known_subdirs_;
+    // Path -> mtime, and parent path -> subdirectory
+    QHash<QString, uint> known_subdir_mtimes_;
+    QMultiHash<QString, Subdirectory> known_subdir_children_;
     bool known_subdirs_dirty_;
   };
 
  private slots:
   void DirectoryChanged(const QString& path);
+  void FilesChanged(const QString& path, const QStringList& files);
   void IncrementalScanNow();
   void FullScanNow();
   void RescanPathsNow();
+  // Fingerprints a batch of songs that were added before files were
+  // fingerprinted, and schedules the next batch.
+  void BackfillFingerprintsNow();
   void ScanSubdirectory(const QString& path, const Subdirectory& subdir,
                         ScanTransaction* t, bool force_noincremental = false);
   void DoRemoveDirectory(int dir_id);
@@ -177,6 +268,19 @@ class LibraryWatcher : public QObject {
   void RemoveWatch(const Directory& dir, const Subdirectory& subdir);
   uint GetMtimeForCue(const QString& cue_path);
   void PerformScan(bool incremental, bool ignore_mtimes);
+  // Scans the given subdirectories and everything discovered beneath them,
+  // spreading the work over scan_thread_pool_.  Returns when the scan is
+  // complete or has been aborted.
+  void ScanSubdirectories(const SubdirectoryList& subdirs, ScanTransaction* t);
+  // Takes subdirectories off the transaction's queue and scans them until
+  // there are none left.  Run on each of the scanner threads.
+  void ScanPendingSubdirs(ScanTransaction* t);
+  // Rescans just the given files in a subdirectory, for watchers that can
+  // tell exactly what changed.  Falls back to rescanning the whole
+  // subdirectory if the change could affect other files, like a new cue sheet
+  // or cover image.
+  void ScanChangedFiles(const QString& path, const QStringList& files,
+                        ScanTransaction* t);
 
   // Updates the sections of a cue associated and altered (according to mtime)
   // media file during a scan.
@@ -198,9 +302,22 @@ class LibraryWatcher : public QObject {
   // library.
   // It may result in a multiple files added to the library when the media file
   // has many sections (like a CUE related media file).
+  // If the file's tags have already been read by ReadNewFiles they are taken
+  // from prefetched_songs instead of asking the tag reader again.
   SongList ScanNewFile(const QString& file, const QString& path,
                        const QString& matching_cue,
-                       QSet<QString>* cues_processed);
+                       QSet<QString>* cues_processed,
+                       const QHash<QString, Song>& prefetched_songs);
+  // Reads the tags of all the files on disk that aren't in the library yet and
+  // don't have a cue sheet, using batched tag reader requests.  Files that
+  // turn out to be songs moved from elsewhere in the directory are returned
+  // as the existing song, with its ID, instead of being read again.
+  QHash<QString, Song> ReadNewFiles(const QStringList& files_on_disk,
+                                    const SongList& songs_in_db,
+                                    ScanTransaction* t);
+  // Returns a fingerprint of the file's size and the data at its beginning
+  // and end, or an empty string if it can't be read.
+  static QString FileFingerprint(const QString& filename);
 
  private:
   LibraryBackend* backend_;
@@ -223,6 +340,11 @@ class LibraryWatcher : public QObject {
   bool scan_on_startup_;
   bool monitor_;
 
+  // Number of threads used to scan a directory, including the watcher's own
+  // thread.  Each of them can have a tag reader request in flight.
+  int scan_threads_;
+  QThreadPool scan_thread_pool_;
+
   // All methods of QMap are reentrant We should only need to worry about
   // syncronizing methods that remove directories on the watcher thread and
   // methods that modify directories called from other threads.
@@ -247,8 +369,15 @@ class LibraryWatcher : public QObject {
   QTimer* rescan_timer_;
   QMap<int, QStringList>
       rescan_queue_;  // dir id -> list of subdirs to be scanned
+  // dir id -> subdir -> list of files in it to be scanned
+  QMap<int, QHash<QString, QStringList>> rescan_files_queue_;
   bool rescan_paused_;
 
+  // Songs without fingerprints are fingerprinted a few at a time while the
+  // watcher is otherwise idle.  dir id -> ID of the last song looked at.
+  QTimer* fingerprint_timer_;
+  QMap<int, int> fingerprint_backfill_;
+
   int total_watches_;
 
   CueParser* cue_parser_;
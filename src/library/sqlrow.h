@@ -30,6 +30,7 @@ class SqlRow {
   // WARNING: Implicit construction from QSqlQuery and LibraryQuery.
   SqlRow(const QSqlQuery& query);
   SqlRow(const LibraryQuery& query);
+  explicit SqlRow(const QList<QVariant>& columns) : columns_(columns) {}
 
   const QVariant& value(int i) const { return columns_[i]; }
 
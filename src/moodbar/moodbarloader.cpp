@@ -24,23 +24,34 @@
 #include <QThread>
 #include <QTimer>
 #include <QUrl>
+#include <QtConcurrentRun>
 #include <memory>
 
 #include "core/application.h"
 #include "core/closure.h"
 #include "core/logging.h"
+#include "core/song.h"
+#include "core/taskmanager.h"
 #include "core/utilities.h"
+#include "library/librarybackend.h"
 #include "moodbarpipeline.h"
 
 #ifdef Q_OS_WIN32
 #include <windows.h>
 #endif
 
+const int MoodbarLoader::kMaxBatchSkipsPerCall = 100;
+
 MoodbarLoader::MoodbarLoader(Application* app, QObject* parent)
     : QObject(parent),
+      app_(app),
       cache_(new QNetworkDiskCache(this)),
       thread_(new QThread(this)),
       kMaxActiveRequests(qMax(1, QThread::idealThreadCount() / 2)),
+      kMaxBatchRequests(qMax(1, QThread::idealThreadCount())),
+      batch_task_id_(-1),
+      batch_total_(0),
+      batch_done_(0),
       save_alongside_originals_(false),
       disable_moodbar_calculation_(false) {
   cache_->setCacheDirectory(
@@ -64,6 +75,7 @@ void MoodbarLoader::ReloadSettings() {
       s.value("save_alongside_originals", false).toBool();
 
   disable_moodbar_calculation_ = !s.value("calculate", true).toBool();
+  if (disable_moodbar_calculation_) CancelBatch();
   MaybeTakeNextRequest();
 }
 
@@ -114,36 +126,76 @@ MoodbarLoader::Result MoodbarLoader::Load(const QUrl& url, QByteArray* data,
     }
   }
 
+  // There was no existing file, analyze the audio file and create one.
+  MoodbarPipeline* pipeline = CreatePipeline(url);
+  queued_requests_ << url;
+
+  MaybeTakeNextRequest();
+
+  *async_pipeline = pipeline;
+  return WillLoadAsync;
+}
+
+MoodbarPipeline* MoodbarLoader::CreatePipeline(const QUrl& url) {
   if (!thread_->isRunning()) thread_->start(QThread::IdlePriority);
 
-  // There was no existing file, analyze the audio file and create one.
   MoodbarPipeline* pipeline = new MoodbarPipeline(url);
   pipeline->moveToThread(thread_);
   NewClosure(pipeline, SIGNAL(Finished(bool)), this,
              SLOT(RequestFinished(MoodbarPipeline*, QUrl)), pipeline, url);
 
   requests_[url] = pipeline;
-  queued_requests_ << url;
+  return pipeline;
+}
 
-  MaybeTakeNextRequest();
+void MoodbarLoader::StartPipeline(const QUrl& url) {
+  active_requests_ << url;
 
-  *async_pipeline = pipeline;
-  return WillLoadAsync;
+  qLog(Info) << "Creating moodbar data for" << url.toLocalFile();
+  QMetaObject::invokeMethod(requests_[url], "Start", Qt::QueuedConnection);
 }
 
 void MoodbarLoader::MaybeTakeNextRequest() {
   Q_ASSERT(QThread::currentThread() == qApp->thread());
 
-  if (active_requests_.count() >= kMaxActiveRequests ||
-      queued_requests_.isEmpty() || disable_moodbar_calculation_) {
-    return;
+  if (disable_moodbar_calculation_) return;
+
+  while (active_requests_.count() < kMaxActiveRequests &&
+         !queued_requests_.isEmpty()) {
+    StartPipeline(queued_requests_.takeFirst());
   }
 
-  const QUrl url = queued_requests_.takeFirst();
-  active_requests_ << url;
+  // Batch requests may use every core, but only once the songs that are
+  // being shown have been taken care of.
+  if (!queued_requests_.isEmpty()) return;
+
+  int skipped = 0;
+  while (active_requests_.count() < kMaxBatchRequests &&
+         !batch_queue_.isEmpty()) {
+    if (!TakeNextBatchRequest() && ++skipped >= kMaxBatchSkipsPerCall) {
+      // Don't hold up the UI thread on a long run of songs that already have
+      // cached moodbars - continue from the event loop instead.
+      QMetaObject::invokeMethod(this, "MaybeTakeNextRequest",
+                                Qt::QueuedConnection);
+      return;
+    }
+  }
+}
 
-  qLog(Info) << "Creating moodbar data for" << url.toLocalFile();
-  QMetaObject::invokeMethod(requests_[url], "Start", Qt::QueuedConnection);
+bool MoodbarLoader::TakeNextBatchRequest() {
+  const QUrl url = batch_queue_.takeFirst();
+
+  // Skip songs that were generated (or are being generated) since the batch
+  // was started.
+  if (requests_.contains(url) || cache_->metaData(url).isValid()) {
+    BatchRequestFinished();
+    return false;
+  }
+
+  CreatePipeline(url);
+  batch_requests_ << url;
+  StartPipeline(url);
+  return true;
 }
 
 void MoodbarLoader::RequestFinished(MoodbarPipeline* request, const QUrl& url) {
@@ -187,8 +239,91 @@ void MoodbarLoader::RequestFinished(MoodbarPipeline* request, const QUrl& url) {
   // Remove the request from the active list and delete it
   requests_.remove(url);
   active_requests_.remove(url);
+  if (batch_requests_.remove(url)) BatchRequestFinished();
 
   QTimer::singleShot(1000, request, SLOT(deleteLater()));
 
   MaybeTakeNextRequest();
 }
+
+void MoodbarLoader::GenerateForLibrary() {
+  if (batch_task_id_ != -1 || disable_moodbar_calculation_) return;
+
+  batch_task_id_ = app_->task_manager()->StartTask(tr("Generating moodbars"));
+  batch_total_ = 0;
+  batch_done_ = 0;
+
+  QFuture<QList<QUrl>> future =
+      QtConcurrent::run(&MoodbarLoader::LibraryUrlsWithoutMoodFiles,
+                        app_->library_backend());
+  NewClosure(future,
+             [this, future]() { LibraryUrlsLoaded(future.result()); });
+}
+
+QList<QUrl> MoodbarLoader::LibraryUrlsWithoutMoodFiles(
+    LibraryBackend* backend) {
+  QList<QUrl> ret;
+  QSet<QUrl> seen;
+
+  for (const Song& song : backend->GetAllSongs()) {
+    const QUrl& url = song.url();
+    if (song.is_unavailable() || url.scheme() != "file" || seen.contains(url)) {
+      continue;
+    }
+    seen << url;
+
+    bool has_mood_file = false;
+    for (const QString& mood_file : MoodFilenames(url.toLocalFile())) {
+      if (QFile::exists(mood_file)) {
+        has_mood_file = true;
+        break;
+      }
+    }
+    if (!has_mood_file) ret << url;
+  }
+  return ret;
+}
+
+void MoodbarLoader::LibraryUrlsLoaded(const QList<QUrl>& urls) {
+  // The batch might have been cancelled while we were looking.
+  if (batch_task_id_ == -1) return;
+
+  qLog(Info) << "Generating moodbars for up to" << urls.count() << "songs";
+
+  batch_queue_ = urls;
+  batch_total_ = urls.count();
+  batch_done_ = 0;
+
+  if (batch_queue_.isEmpty()) {
+    CancelBatch();
+    return;
+  }
+
+  app_->task_manager()->SetTaskProgress(batch_task_id_, 0, batch_total_);
+  MaybeTakeNextRequest();
+}
+
+void MoodbarLoader::BatchRequestFinished() {
+  if (batch_task_id_ == -1) return;
+
+  ++batch_done_;
+  if (batch_done_ >= batch_total_) {
+    qLog(Info) << "Finished generating moodbars";
+    CancelBatch();
+  } else {
+    app_->task_manager()->SetTaskProgress(batch_task_id_, batch_done_,
+                                          batch_total_);
+  }
+}
+
+void MoodbarLoader::CancelBatch() {
+  // Pipelines that are already running are left to finish, their results are
+  // saved as usual.
+  batch_queue_.clear();
+  batch_requests_.clear();
+
+  if (batch_task_id_ != -1) {
+    app_->task_manager()->SetTaskFinished(batch_task_id_);
+    batch_task_id_ = -1;
+  }
+}
@@ -18,14 +18,16 @@
 #ifndef MOODBARLOADER_H
 #define MOODBARLOADER_H
 
+#include <QList>
 #include <QMap>
 #include <QObject>
 #include <QSet>
+#include <QUrl>
 
 class QNetworkDiskCache;
-class QUrl;
 
 class Application;
+class LibraryBackend;
 class MoodbarPipeline;
 
 class MoodbarLoader : public QObject {
@@ -51,6 +53,12 @@ class MoodbarLoader : public QObject {
   Result Load(const QUrl& url, QByteArray* data,
               MoodbarPipeline** async_pipeline);
 
+ public slots:
+  // Generates moodbar data for every local file in the library that doesn't
+  // have any yet.  The files are analyzed in the background, with one
+  // pipeline per core, and progress is reported through the TaskManager.
+  void GenerateForLibrary();
+
  private slots:
   void ReloadSettings();
 
@@ -60,16 +68,39 @@ class MoodbarLoader : public QObject {
  private:
   static QStringList MoodFilenames(const QString& song_filename);
 
+  // Returns the URLs of the local files in the library that don't have a
+  // mood file next to them.  Called in a background thread.
+  static QList<QUrl> LibraryUrlsWithoutMoodFiles(LibraryBackend* backend);
+  void LibraryUrlsLoaded(const QList<QUrl>& urls);
+
+  MoodbarPipeline* CreatePipeline(const QUrl& url);
+  void StartPipeline(const QUrl& url);
+  bool TakeNextBatchRequest();
+  void BatchRequestFinished();
+  void CancelBatch();
+
  private:
+  static const int kMaxBatchSkipsPerCall;
+
+  Application* app_;
   QNetworkDiskCache* cache_;
   QThread* thread_;
 
   const int kMaxActiveRequests;
+  const int kMaxBatchRequests;
 
   QMap<QUrl, MoodbarPipeline*> requests_;
   QList<QUrl> queued_requests_;
   QSet<QUrl> active_requests_;
 
+  // Requests made by GenerateForLibrary.  These only run when there are no
+  // queued requests for songs that are being shown.
+  QList<QUrl> batch_queue_;
+  QSet<QUrl> batch_requests_;
+  int batch_task_id_;
+  int batch_total_;
+  int batch_done_;
+
   bool save_alongside_originals_;
   bool disable_moodbar_calculation_;
 };
@@ -198,6 +198,13 @@ void IncomingDataParser::Parse(const cpb::remote::Message& msg) {
     case cpb::remote::GET_LIBRARY:
       emit SendLibrary(client);
       break;
+    case cpb::remote::REQUEST_LIBRARY_CHANGES: {
+      const cpb::remote::RequestLibraryChanges& request =
+          msg.request_library_changes();
+      emit SendLibraryChanges(client, request.revision(),
+                              request.accepts_compressed());
+      break;
+    }
     case cpb::remote::RATE_SONG:
       RateSong(msg);
       break;
@@ -60,6 +60,8 @@ class IncomingDataParser : public QObject {
   void RemoveSongs(int id, const QList<int>& indices);
   void SeekTo(int seconds);
   void SendLibrary(RemoteClient* client);
+  void SendLibraryChanges(RemoteClient* client, qint64 revision,
+                          bool compress);
   void RateCurrentSong(double);
 
   void DoGlobalSearch(QString, RemoteClient*);
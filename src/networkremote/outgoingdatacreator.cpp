@@ -20,6 +20,7 @@
 #include <QDir>
 #include <QSqlDatabase>
 #include <QSqlQuery>
+#include <QtConcurrentRun>
 #include <cmath>
 
 #include "core/database.h"
@@ -34,6 +35,7 @@
 #include "ui/iconloader.h"
 
 const quint32 OutgoingDataCreator::kFileChunkSize = 100000;  // in Bytes
+const int OutgoingDataCreator::kLibraryBatchSize = 1000;
 
 OutgoingDataCreator::OutgoingDataCreator(Application* app)
     : app_(app),
@@ -671,6 +673,120 @@ void OutgoingDataCreator::SendLibrary(RemoteClient* client) {
   file.remove();
 }
 
+void OutgoingDataCreator::SendLibraryChanges(RemoteClient* client,
+                                             qint64 revision, bool compress) {
+  QtConcurrent::run(this, &OutgoingDataCreator::CollectLibraryChanges, client,
+                    revision, compress);
+}
+
+void OutgoingDataCreator::CollectLibraryChanges(RemoteClient* client,
+                                                qint64 revision,
+                                                bool compress) {
+  QSqlDatabase db(app_->database()->ConnectReadOnly());
+
+  // Read everything from the same snapshot, so songs changed while we're
+  // sending are picked up by the next sync instead of half of them now.
+  db.transaction();
+
+  QSqlQuery q(db);
+  q.exec("SELECT IFNULL(MAX(revision), 0) FROM songs_revisions");
+  if (app_->database()->CheckErrors(q) || !q.next()) {
+    db.rollback();
+    return;
+  }
+  const qint64 latest = q.value(0).toLongLong();
+
+  // A revision from the future means the client synced with another
+  // database.
+  const bool reset = revision <= 0 || revision > latest;
+
+  cpb::remote::ResponseLibraryChanges changes;
+  changes.set_reset(reset);
+  changes.set_revision(latest);
+
+  if (reset) {
+    q.prepare("SELECT ROWID, " + Song::kColumnSpec +
+              " FROM songs WHERE unavailable = 0");
+  } else {
+    // Songs that went unavailable count as deleted as far as the remote is
+    // concerned, and the triggers mark them so.
+    q.prepare(
+        "SELECT song_id FROM songs_revisions"
+        " WHERE revision > :revision AND deleted != 0");
+    q.bindValue(":revision", revision);
+    q.exec();
+    if (app_->database()->CheckErrors(q)) {
+      db.rollback();
+      return;
+    }
+    while (q.next()) changes.add_deleted_ids(q.value(0).toInt());
+
+    q.prepare("SELECT songs.ROWID, " + Song::kColumnSpec +
+              " FROM songs_revisions"
+              " INNER JOIN songs ON songs.ROWID = songs_revisions.song_id"
+              " WHERE revision > :revision AND deleted = 0");
+    q.bindValue(":revision", revision);
+  }
+
+  q.exec();
+  if (app_->database()->CheckErrors(q)) {
+    db.rollback();
+    return;
+  }
+
+  while (q.next()) {
+    Song song;
+    song.InitFromQuery(q, true);
+    CreateSong(song, QImage(), 0, changes.add_songs());
+
+    if (changes.songs_size() >= kLibraryBatchSize) {
+      PostLibraryChanges(client, &changes, compress);
+      changes.clear_reset();
+      changes.clear_deleted_ids();
+    }
+  }
+
+  changes.set_complete(true);
+  PostLibraryChanges(client, &changes, compress);
+
+  db.commit();
+}
+
+void OutgoingDataCreator::PostLibraryChanges(
+    RemoteClient* client, cpb::remote::ResponseLibraryChanges* changes,
+    bool compress) {
+  if (compress && changes->songs_size() > 0) {
+    cpb::remote::LibrarySongs songs;
+    songs.mutable_songs()->Swap(changes->mutable_songs());
+
+    const std::string data = songs.SerializeAsString();
+    const QByteArray compressed = qCompress(
+        reinterpret_cast<const uchar*>(data.data()), int(data.size()));
+    changes->set_compressed_songs(compressed.constData(), compressed.size());
+  }
+
+  const std::string data = changes->SerializeAsString();
+  metaObject()->invokeMethod(
+      this, "SendLibraryChangesBatch", Qt::QueuedConnection,
+      Q_ARG(RemoteClient*, client),
+      Q_ARG(QByteArray, QByteArray(data.data(), int(data.size()))));
+
+  changes->clear_songs();
+  changes->clear_compressed_songs();
+}
+
+void OutgoingDataCreator::SendLibraryChangesBatch(RemoteClient* client,
+                                                  const QByteArray& batch) {
+  // The client might have gone away while we were reading the library.
+  if (!clients_->contains(client)) return;
+
+  cpb::remote::Message msg;
+  msg.set_type(cpb::remote::LIBRARY_CHANGES);
+  msg.mutable_response_library_changes()->ParseFromArray(batch.constData(),
+                                                         batch.size());
+  client->SendData(&msg);
+}
+
 void OutgoingDataCreator::EnableKittens(bool aww) { aww_ = aww; }
 
 void OutgoingDataCreator::SendKitten(const QImage& kitten) {
@@ -45,6 +45,7 @@ class OutgoingDataCreator : public QObject {
   ~OutgoingDataCreator();
 
   static const quint32 kFileChunkSize;
+  static const int kLibraryBatchSize;
 
   void SetClients(QList<RemoteClient*>* clients);
   void SetRemoteRootFiles(const QString& files_root_folder) {
@@ -84,6 +85,11 @@ class OutgoingDataCreator : public QObject {
   void GetLyrics();
   void SendLyrics(int id, const SongInfoFetcher::Result& result);
   void SendLibrary(RemoteClient* client);
+  // Sends the songs that changed since revision, or the whole library if the
+  // client doesn't have a revision we know about.  The songs are read on a
+  // worker thread and sent in batches as they're ready.
+  void SendLibraryChanges(RemoteClient* client, qint64 revision,
+                          bool compress);
   void EnableKittens(bool aww);
   void SendKitten(const QImage& kitten);
 
@@ -94,6 +100,10 @@ class OutgoingDataCreator : public QObject {
   void SendListFiles(QString relative_path, RemoteClient* client);
   void SendSavedRadios(RemoteClient* client);
 
+ private slots:
+  // batch is a serialized ResponseLibraryChanges.
+  void SendLibraryChangesBatch(RemoteClient* client, const QByteArray& batch);
+
  private:
   Application* app_;
   QList<RemoteClient*>* clients_;
@@ -117,6 +127,11 @@ class OutgoingDataCreator : public QObject {
   QMap<int, GlobalSearchRequest> global_search_result_map_;
 
   void SendDataToClients(cpb::remote::Message* msg);
+  void CollectLibraryChanges(RemoteClient* client, qint64 revision,
+                             bool compress);
+  void PostLibraryChanges(RemoteClient* client,
+                          cpb::remote::ResponseLibraryChanges* changes,
+                          bool compress);
   void SetEngineState(cpb::remote::ResponseClementineInfo* msg);
   void CheckEnabledProviders();
   SongInfoProvider* ProviderByName(const QString& name) const;
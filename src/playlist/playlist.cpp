@@ -60,6 +60,7 @@
 #include "playlistbackend.h"
 #include "playlistfilter.h"
 #include "playlistitemmimedata.h"
+#include "playlistsorter.h"
 #include "playlistundocommands.h"
 #include "playlistview.h"
 #include "queue.h"
@@ -99,6 +100,9 @@ const char* Playlist::kSortIgnorePrefixList = "sort_ignore_prefix_list";
 const int Playlist::kUndoStackSize = 20;
 const int Playlist::kUndoItemLimit = 500;
 
+const int Playlist::kRestoreFirstPageSize = 100;
+const int Playlist::kRestorePageSize = 2000;
+
 const qint64 Playlist::kMinScrobblePointNsecs = 31ll * kNsecPerSec;
 const qint64 Playlist::kMaxScrobblePointNsecs = 240ll * kNsecPerSec;
 
@@ -135,7 +139,12 @@ Playlist::Playlist(PlaylistBackend* backend, TaskManager* task_manager,
       ignore_sorting_(false),
       undo_stack_(new QUndoStack(this)),
       special_type_(special_type),
-      cancel_restore_(false) {
+      cancel_restore_(false),
+      restoring_(false),
+      restored_row_count_(0),
+      save_after_restore_(false),
+      restore_undo_command_(nullptr),
+      restore_undo_clean_(true) {
   undo_stack_->setUndoLimit(kUndoStackSize);
 
   connect(this, SIGNAL(rowsInserted(const QModelIndex&, int, int)),
@@ -301,7 +310,8 @@ QVariant Playlist::data(const QModelIndex& index, int role) const {
       PlaylistItemPtr item = items_[index.row()];
       Song song = item->Metadata();
 
-      // Don't forget to change Playlist::CompareItems when adding new columns
+      // Don't forget to change Playlist::CompareItems and PlaylistSorter when
+      // adding new columns
       switch (index.column()) {
         case Column_Title:
           return song.PrettyTitle();
@@ -1019,12 +1029,31 @@ void Playlist::InsertItems(const PlaylistItemList& itemsIn, int pos,
                            bool play_now, bool enqueue, bool enqueue_next) {
   if (itemsIn.isEmpty()) return;
 
-  PlaylistItemList items = itemsIn;
+  const PlaylistItemList items = WithoutVetoedItems(itemsIn);
+  if (items.isEmpty()) return;
+
+  const int start = pos == -1 ? items_.count() : pos;
+
+  if (items.count() > kUndoItemLimit) {
+    // Too big to keep in the undo stack. Also clear the stack because it
+    // might have been invalidated.
+    InsertItemsWithoutUndo(items, pos, enqueue, enqueue_next);
+    undo_stack_->clear();
+  } else {
+    undo_stack_->push(new PlaylistUndoCommands::InsertItems(
+        this, items, pos, enqueue, enqueue_next));
+  }
+
+  if (play_now) emit PlayRequested(index(start, 0));
+}
+
+PlaylistItemList Playlist::WithoutVetoedItems(const PlaylistItemList& items) {
+  PlaylistItemList ret = items;
 
   // exercise vetoes
   SongList songs;
 
-  for (PlaylistItemPtr item : items) {
+  for (PlaylistItemPtr item : ret) {
     songs << item->Metadata();
   }
 
@@ -1037,14 +1066,13 @@ void Playlist::InsertItems(const PlaylistItemList& itemsIn, int pos,
       vetoed.insert(song);
     }
     if (vetoed.count() == song_count) {
-      // all songs were vetoed and there's nothing more to do (there's no need
-      // for an undo step)
-      return;
+      // all songs were vetoed
+      return PlaylistItemList();
     }
   }
 
   if (!vetoed.isEmpty()) {
-    QMutableListIterator<PlaylistItemPtr> it(items);
+    QMutableListIterator<PlaylistItemPtr> it(ret);
     while (it.hasNext()) {
       PlaylistItemPtr item = it.next();
       const Song& current = item->Metadata();
@@ -1054,26 +1082,9 @@ void Playlist::InsertItems(const PlaylistItemList& itemsIn, int pos,
         it.remove();
       }
     }
-
-    // check for empty items once again after veto
-    if (items.isEmpty()) {
-      return;
-    }
-  }
-
-  const int start = pos == -1 ? items_.count() : pos;
-
-  if (items.count() > kUndoItemLimit) {
-    // Too big to keep in the undo stack. Also clear the stack because it
-    // might have been invalidated.
-    InsertItemsWithoutUndo(items, pos, enqueue, enqueue_next);
-    undo_stack_->clear();
-  } else {
-    undo_stack_->push(new PlaylistUndoCommands::InsertItems(
-        this, items, pos, enqueue, enqueue_next));
   }
 
-  if (play_now) emit PlayRequested(index(start, 0));
+  return ret;
 }
 
 void Playlist::InsertItemsWithoutUndo(const PlaylistItemList& items, int pos,
@@ -1364,18 +1375,6 @@ bool Playlist::CompareItems(int column, Qt::SortOrder order,
   return false;
 }
 
-bool Playlist::ComparePathDepths(Qt::SortOrder order,
-                                 shared_ptr<PlaylistItem> _a,
-                                 shared_ptr<PlaylistItem> _b) {
-  shared_ptr<PlaylistItem> a = order == Qt::AscendingOrder ? _a : _b;
-  shared_ptr<PlaylistItem> b = order == Qt::AscendingOrder ? _b : _a;
-
-  int a_dir_level = a->Url().path().count('/');
-  int b_dir_level = b->Url().path().count('/');
-
-  return a_dir_level < b_dir_level;
-}
-
 QString Playlist::column_name(Column column) {
   switch (column) {
     case Column_Title:
@@ -1466,9 +1465,9 @@ void Playlist::sort(int column, Qt::SortOrder order) {
   if (ignore_sorting_) return;
 
   PlaylistItemList new_items(items_);
-  PlaylistItemList::iterator begin = new_items.begin();
+  int begin = 0;
   if (dynamic_playlist_ && current_item_index_.isValid())
-    begin += current_item_index_.row() + 1;
+    begin = current_item_index_.row() + 1;
 
   QSettings s;
   s.beginGroup(Playlist::kSettingsGroup);
@@ -1485,30 +1484,7 @@ void Playlist::sort(int column, Qt::SortOrder order) {
   }
   s.endGroup();
 
-  if (column == Column_Album) {
-    // When sorting by album, also take into account discs and tracks.
-    std::stable_sort(begin, new_items.end(),
-                     std::bind(&Playlist::CompareItems, Column_Track, order, _1,
-                               _2, prefixes));
-    std::stable_sort(begin, new_items.end(),
-                     std::bind(&Playlist::CompareItems, Column_Disc, order, _1,
-                               _2, prefixes));
-    std::stable_sort(begin, new_items.end(),
-                     std::bind(&Playlist::CompareItems, Column_Album, order, _1,
-                               _2, prefixes));
-  } else if (column == Column_Filename) {
-    // When sorting by full paths we also expect a hierarchical order. This
-    // returns a breath-first ordering of paths.
-    std::stable_sort(begin, new_items.end(),
-                     std::bind(&Playlist::CompareItems, Column_Filename, order,
-                               _1, _2, prefixes));
-    std::stable_sort(begin, new_items.end(),
-                     std::bind(&Playlist::ComparePathDepths, order, _1, _2));
-  } else {
-    std::stable_sort(
-        begin, new_items.end(),
-        std::bind(&Playlist::CompareItems, column, order, _1, _2, prefixes));
-  }
+  PlaylistSorter(column, order, prefixes).Sort(&new_items, begin);
 
   undo_stack_->push(
       new PlaylistUndoCommands::SortItems(this, column, order, new_items));
@@ -1557,6 +1533,10 @@ void Playlist::SetCurrentIsPaused(bool paused) {
 
 void Playlist::Save() const {
   if (!backend_ || is_loading_) return;
+  if (restoring_) {
+    save_after_restore_ = true;
+    return;
+  }
 
   backend_->SavePlaylistAsync(id_, items_, last_played_row(),
                               dynamic_playlist_);
@@ -1570,16 +1550,36 @@ void Playlist::Restore() {
   library_items_by_id_.clear();
 
   cancel_restore_ = false;
+  restoring_ = true;
+  restored_row_count_ = 0;
+  save_after_restore_ = false;
+  restore_last_index_ = QPersistentModelIndex();
+  restore_undo_command_ = LastUndoCommand();
+  restore_undo_clean_ = true;
+  RestoreNextPage();
+}
+
+const QUndoCommand* Playlist::LastUndoCommand() const {
+  const int top = undo_stack_->index();
+  return top == 0 ? nullptr : undo_stack_->command(top - 1);
+}
+
+void Playlist::RestoreNextPage() {
+  const int limit = restored_row_count_ == 0 ? kRestoreFirstPageSize
+                                             : kRestorePageSize;
   QFuture<QList<PlaylistItemPtr>> future =
-      QtConcurrent::run(backend_, &PlaylistBackend::GetPlaylistItems, id_);
-  NewClosure(future, this, SLOT(ItemsLoaded(QFuture<PlaylistItemList>)),
-             future);
+      QtConcurrent::run(backend_, &PlaylistBackend::GetPlaylistItems, id_,
+                        restored_row_count_, limit);
+  NewClosure(future, this, SLOT(ItemsLoaded(QFuture<PlaylistItemList>, int)),
+             future, limit);
 }
 
-void Playlist::ItemsLoaded(QFuture<PlaylistItemList> future) {
+void Playlist::ItemsLoaded(QFuture<PlaylistItemList> future, int limit) {
   if (cancel_restore_) return;
 
   PlaylistItemList items = future.result();
+  const bool last_page = items.count() < limit;
+  restored_row_count_ += items.count();
 
   // backend returns empty elements for library items which it couldn't
   // match (because they got deleted); we don't need those
@@ -1592,9 +1592,38 @@ void Playlist::ItemsLoaded(QFuture<PlaylistItemList> future) {
     }
   }
 
-  is_loading_ = true;
-  InsertItems(items, 0);
-  is_loading_ = false;
+  if (LastUndoCommand() != restore_undo_command_) restore_undo_clean_ = false;
+
+  items = WithoutVetoedItems(items);
+  if (!items.isEmpty()) {
+    const int pos =
+        restore_last_index_.isValid() ? restore_last_index_.row() + 1 : 0;
+
+    // Pages always go on the undo stack, whatever their size, so anything the
+    // user did while the restore was running can still be undone.
+    is_loading_ = true;
+    undo_stack_->push(new PlaylistUndoCommands::InsertItems(this, items, pos));
+    is_loading_ = false;
+
+    restore_last_index_ = index(pos + items.count() - 1, 0);
+    restore_undo_command_ = LastUndoCommand();
+  }
+
+  if (!last_page) {
+    RestoreNextPage();
+    return;
+  }
+
+  restoring_ = false;
+  restore_last_index_ = QPersistentModelIndex();
+  if (restored_row_count_ > kRestoreFirstPageSize && restore_undo_clean_) {
+    // Don't let the restore be undone a page at a time
+    undo_stack_->clear();
+  }
+  if (save_after_restore_) {
+    save_after_restore_ = false;
+    Save();
+  }
 
   PlaylistBackend::Playlist p = backend_->GetPlaylist(id_);
 
@@ -1710,6 +1739,13 @@ PlaylistItemList Playlist::RemoveItemsWithoutUndo(int row, int count) {
   if (row < 0 || row >= items_.size() || row + count > items_.size()) {
     return PlaylistItemList();
   }
+  if (restore_last_index_.isValid() && restore_last_index_.row() >= row &&
+      restore_last_index_.row() < row + count) {
+    // The rest of the restore goes where the removed rows were
+    restore_last_index_ =
+        row == 0 ? QPersistentModelIndex() : index(row - 1, 0);
+  }
+
   beginRemoveRows(QModelIndex(), row, row + count - 1);
 
   // Remove items
@@ -1897,6 +1933,7 @@ void Playlist::UpdatePlayCountPoint(qint64 seek_point_nanosec) {
 void Playlist::Clear() {
   // If loading songs from session restore async, don't insert them
   cancel_restore_ = true;
+  restoring_ = false;
 
   const int count = items_.count();
 
@@ -36,6 +36,7 @@ class InternetService;
 class TaskManager;
 
 class QSortFilterProxyModel;
+class QUndoCommand;
 class QUndoStack;
 class QStringList;
 
@@ -164,6 +165,11 @@ class Playlist : public QAbstractListModel {
   static const int kUndoStackSize;
   static const int kUndoItemLimit;
 
+  // Playlists are restored in pages.  The first one is small so something
+  // shows up straight away.
+  static const int kRestoreFirstPageSize;
+  static const int kRestorePageSize;
+
   static const qint64 kMinScrobblePointNsecs;
   static const qint64 kMaxScrobblePointNsecs;
 
@@ -323,9 +329,6 @@ class Playlist : public QAbstractListModel {
   bool removeRows(int row, int count,
                   const QModelIndex& parent = QModelIndex());
 
-  static bool ComparePathDepths(Qt::SortOrder, PlaylistItemPtr,
-                                PlaylistItemPtr);
-
  public slots:
   void set_current_row(int index, bool is_stopping = false);
   void Paused();
@@ -414,10 +417,15 @@ class Playlist : public QAbstractListModel {
   void SongSaveComplete(TagReaderReply* reply,
                         const QPersistentModelIndex& index);
   void ItemReloadComplete(const QPersistentModelIndex& index);
-  void ItemsLoaded(QFuture<PlaylistItemList> future);
+  void ItemsLoaded(QFuture<PlaylistItemList> future, int limit);
   void SongInsertVetoListenerDestroyed();
 
  private:
+  void RestoreNextPage();
+  // Returns the items that none of the veto listeners object to.
+  PlaylistItemList WithoutVetoedItems(const PlaylistItemList& items);
+  const QUndoCommand* LastUndoCommand() const;
+
   bool is_loading_;
   PlaylistFilter* proxy_;
   Queue* queue_;
@@ -471,6 +479,20 @@ class Playlist : public QAbstractListModel {
 
   // Cancel async restore if songs are already replaced
   bool cancel_restore_;
+
+  // Set while the pages of a restore are coming in.  Saving before the last
+  // one would lose the rest of the playlist, so Save() waits until then.
+  bool restoring_;
+  int restored_row_count_;
+  mutable bool save_after_restore_;
+  // The last restored row, which the next page goes after.  It follows the
+  // rows the user moves around meanwhile; if it isn't valid the next page
+  // goes at the top.
+  QPersistentModelIndex restore_last_index_;
+  // The command on top of the undo stack after the last restored page.  If
+  // the user pushes or undoes anything meanwhile, the stack is kept.
+  const QUndoCommand* restore_undo_command_;
+  bool restore_undo_clean_;
 };
 
 // QDataStream& operator <<(QDataStream&, const Playlist*);
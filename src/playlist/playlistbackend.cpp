@@ -21,7 +21,9 @@
 #include <QHash>
 #include <QMutexLocker>
 #include <QSqlQuery>
+#include <QTimer>
 #include <QtDebug>
+#include <algorithm>
 #include <functional>
 #include <memory>
 
@@ -42,9 +44,23 @@ using std::placeholders::_1;
 using smart_playlists::GeneratorPtr;
 
 const int PlaylistBackend::kSongTableJoins = 4;
+const int PlaylistBackend::kSaveDelayMsec = 500;
+const qint64 PlaylistBackend::kOrderKeyGap = 1 << 16;
 
 PlaylistBackend::PlaylistBackend(Application* app, QObject* parent)
-    : QObject(parent), app_(app), db_(app_->database()) {}
+    : QObject(parent),
+      app_(app),
+      db_(app_->database()),
+      save_timer_started_(false) {}
+
+PlaylistBackend::PlaylistBackend(Application* app, Database* db,
+                                 QObject* parent)
+    : QObject(parent), app_(app), db_(db), save_timer_started_(false) {}
+
+PlaylistBackend::~PlaylistBackend() {
+  // Our thread has stopped by now, so the timer won't fire any more.
+  FlushPendingSaves();
+}
 
 PlaylistBackend::PlaylistList PlaylistBackend::GetAllPlaylists() {
   return GetPlaylists(GetPlaylists_All);
@@ -60,8 +76,7 @@ PlaylistBackend::PlaylistList PlaylistBackend::GetAllFavoritePlaylists() {
 
 PlaylistBackend::PlaylistList PlaylistBackend::GetPlaylists(
     GetPlaylistsFlags flags) {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   PlaylistList ret;
 
@@ -106,8 +121,7 @@ PlaylistBackend::PlaylistList PlaylistBackend::GetPlaylists(
 }
 
 PlaylistBackend::Playlist PlaylistBackend::GetPlaylist(int id) {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QSqlQuery q(db);
   q.prepare(
@@ -136,9 +150,9 @@ PlaylistBackend::Playlist PlaylistBackend::GetPlaylist(int id) {
   return p;
 }
 
-QSqlQuery PlaylistBackend::GetPlaylistRows(int playlist) {
-  QMutexLocker l(db_->Mutex());
-  QSqlDatabase db(db_->Connect());
+QSqlQuery PlaylistBackend::GetPlaylistRows(int playlist, int limit, int offset,
+                                           qint64 after_key) {
+  QSqlDatabase db(db_->ConnectReadOnly());
 
   QString query = "SELECT songs.ROWID, " + Song::JoinSpec("songs") +
                   ","
@@ -151,7 +165,7 @@ QSqlQuery PlaylistBackend::GetPlaylistRows(int playlist) {
                   "       p.ROWID, " +
                   Song::JoinSpec("p") +
                   ","
-                  "       p.type, p.radio_service"
+                  "       p.type, p.radio_service, p.position"
                   " FROM playlist_items AS p"
                   " LEFT JOIN songs"
                   "    ON p.library_id = songs.ROWID"
@@ -160,33 +174,76 @@ QSqlQuery PlaylistBackend::GetPlaylistRows(int playlist) {
                   " LEFT JOIN jamendo.songs AS jamendo_songs"
                   "    ON p.library_id = jamendo_songs.ROWID"
                   " WHERE p.playlist = :playlist";
+  if (after_key != -1) query += " AND p.position > :after_key";
+  query += " ORDER BY p.position LIMIT :limit OFFSET :offset";
+
   QSqlQuery q(db);
   // Forward iterations only may be faster
   q.setForwardOnly(true);
   q.prepare(query);
   q.bindValue(":playlist", playlist);
+  if (after_key != -1) q.bindValue(":after_key", after_key);
+  q.bindValue(":limit", limit);
+  q.bindValue(":offset", offset);
   q.exec();
 
   return q;
 }
 
-QList<PlaylistItemPtr> PlaylistBackend::GetPlaylistItems(int playlist) {
-  QSqlQuery q = GetPlaylistRows(playlist);
+QList<PlaylistItemPtr> PlaylistBackend::GetPlaylistItems(int playlist,
+                                                         int offset,
+                                                         int limit) {
+  QMutexLocker save_locker(&save_mutex_);
+
+  qint64 after_key = -1;
+  if (offset == 0) {
+    // The items we return are what the next save of this playlist is
+    // compared against, so write any changes that are still waiting first.
+    WritePendingSave(playlist);
+    saved_items_.remove(playlist);
+    restoring_items_[playlist] = SavedItemList();
+  } else if (restoring_items_.contains(playlist) &&
+             restoring_items_[playlist].count() == offset) {
+    // Carry on after the last row of the previous page instead of making
+    // SQLite step over all the rows before it again.
+    after_key = restoring_items_[playlist].last().order_key;
+    offset = 0;
+  } else {
+    restoring_items_.remove(playlist);
+  }
+  const bool restoring = restoring_items_.contains(playlist);
+
+  QSqlQuery q = GetPlaylistRows(playlist, limit, offset, after_key);
   // Note that as this only accesses the query, not the db, we don't need the
   // mutex.
-  if (db_->CheckErrors(q)) return QList<PlaylistItemPtr>();
+  if (db_->CheckErrors(q)) {
+    restoring_items_.remove(playlist);
+    return QList<PlaylistItemPtr>();
+  }
 
   // it's probable that we'll have a few songs associated with the
   // same CUE so we're caching results of parsing CUEs
   std::shared_ptr<NewSongFromQueryState> state_ptr(new NewSongFromQueryState());
   QList<PlaylistItemPtr> playlistitems;
   while (q.next()) {
-    playlistitems << NewPlaylistItemFromQuery(SqlRow(q), state_ptr);
+    SavedItem saved;
+    playlistitems << NewPlaylistItemFromQuery(SqlRow(q), state_ptr, &saved);
+    if (restoring) restoring_items_[playlist] << saved;
+  }
+
+  // Once we've seen the last page we know what's in the database.
+  if (restoring && (limit == -1 || playlistitems.count() < limit)) {
+    saved_items_[playlist] = restoring_items_.take(playlist);
   }
   return playlistitems;
 }
 
 QList<Song> PlaylistBackend::GetPlaylistSongs(int playlist) {
+  {
+    QMutexLocker save_locker(&save_mutex_);
+    WritePendingSave(playlist);
+  }
+
   QSqlQuery q = GetPlaylistRows(playlist);
   // Note that as this only accesses the query, not the db, we don't need the
   // mutex.
@@ -203,18 +260,27 @@ QList<Song> PlaylistBackend::GetPlaylistSongs(int playlist) {
 }
 
 PlaylistItemPtr PlaylistBackend::NewPlaylistItemFromQuery(
-    const SqlRow& row, std::shared_ptr<NewSongFromQueryState> state) {
+    const SqlRow& row, std::shared_ptr<NewSongFromQueryState> state,
+    SavedItem* saved) {
   // The song tables get joined first, plus one each for the song ROWIDs
   const int playlist_row = (Song::kColumns.count() + 1) * kSongTableJoins;
 
   PlaylistItemPtr item(
       PlaylistItem::NewFromType(row.value(playlist_row).toString()));
+  if (saved) {
+    saved->row_id =
+        row.value(playlist_row - Song::kColumns.count() - 1).toInt();
+    saved->order_key = row.value(playlist_row + 2).toLongLong();
+  }
   if (item) {
     item->InitFromQuery(row);
-    return RestoreCueData(item, state);
-  } else {
-    return item;
+    // Remember what was in the database before the CUE sheet had a say, so
+    // the row gets updated if it changed.
+    if (saved) saved->state = item->GetDatabaseState();
+    item = RestoreCueData(item, state);
   }
+  if (saved) saved->item = item;
+  return item;
 }
 
 Song PlaylistBackend::NewSongFromQuery(
@@ -231,14 +297,14 @@ PlaylistItemPtr PlaylistBackend::RestoreCueData(
   if (item->type() != "File") {
     return item;
   }
-  CueParser cue_parser(app_->library_backend());
-
   Song song = item->Metadata();
   // we're only interested in .cue songs here
   if (!song.has_cue()) {
     return item;
   }
 
+  CueParser cue_parser(app_->library_backend());
+
   QString cue_path = song.cue_path();
   // if .cue was deleted - reload the song
   if (!QFile::exists(cue_path)) {
@@ -279,14 +345,63 @@ PlaylistItemPtr PlaylistBackend::RestoreCueData(
 void PlaylistBackend::SavePlaylistAsync(int playlist,
                                         const PlaylistItemList& items,
                                         int last_played, GeneratorPtr dynamic) {
-  metaObject()->invokeMethod(
-      this, "SavePlaylist", Qt::QueuedConnection, Q_ARG(int, playlist),
-      Q_ARG(PlaylistItemList, items), Q_ARG(int, last_played),
-      Q_ARG(smart_playlists::GeneratorPtr, dynamic));
+  QMutexLocker l(&pending_mutex_);
+
+  PendingSave& pending = pending_saves_[playlist];
+  pending.items = items;
+  pending.last_played = last_played;
+  pending.dynamic = dynamic;
+
+  if (!save_timer_started_) {
+    save_timer_started_ = true;
+    metaObject()->invokeMethod(this, "StartSaveTimer", Qt::QueuedConnection);
+  }
+}
+
+void PlaylistBackend::StartSaveTimer() {
+  QTimer::singleShot(kSaveDelayMsec, this, SLOT(FlushPendingSaves()));
+}
+
+void PlaylistBackend::FlushPendingSaves() {
+  QMutexLocker save_locker(&save_mutex_);
+
+  QHash<int, PendingSave> pending;
+  {
+    QMutexLocker l(&pending_mutex_);
+    pending.swap(pending_saves_);
+    save_timer_started_ = false;
+  }
+
+  for (auto it = pending.constBegin(); it != pending.constEnd(); ++it) {
+    WritePlaylist(it.key(), it->items, it->last_played, it->dynamic);
+  }
+}
+
+void PlaylistBackend::WritePendingSave(int playlist) {
+  PendingSave pending;
+  {
+    QMutexLocker l(&pending_mutex_);
+    if (!pending_saves_.contains(playlist)) return;
+    pending = pending_saves_.take(playlist);
+  }
+
+  WritePlaylist(playlist, pending.items, pending.last_played, pending.dynamic);
 }
 
 void PlaylistBackend::SavePlaylist(int playlist, const PlaylistItemList& items,
                                    int last_played, GeneratorPtr dynamic) {
+  QMutexLocker save_locker(&save_mutex_);
+  {
+    // This is newer than anything that's still waiting.
+    QMutexLocker l(&pending_mutex_);
+    pending_saves_.remove(playlist);
+  }
+
+  WritePlaylist(playlist, items, last_played, dynamic);
+}
+
+void PlaylistBackend::WritePlaylist(int playlist, const PlaylistItemList& items,
+                                    int last_played, GeneratorPtr dynamic) {
   QMutexLocker l(db_->Mutex());
   QSqlDatabase db(db_->Connect());
 
@@ -294,14 +409,19 @@ void PlaylistBackend::SavePlaylist(int playlist, const PlaylistItemList& items,
 
   QSqlQuery clear(db);
   clear.prepare("DELETE FROM playlist_items WHERE playlist = :playlist");
+  QSqlQuery remove(db);
+  remove.prepare("DELETE FROM playlist_items WHERE ROWID = :id");
   QSqlQuery insert(db);
   insert.prepare(
       "INSERT INTO playlist_items"
-      " (playlist, type, library_id, radio_service, " +
+      " (playlist, position, type, library_id, radio_service, " +
       Song::kColumnSpec +
       ")"
-      " VALUES (:playlist, :type, :library_id, :radio_service, " +
+      " VALUES (:playlist, :position, :type, :library_id, :radio_service, " +
       Song::kBindSpec + ")");
+  QSqlQuery move(db);
+  move.prepare("UPDATE playlist_items SET position = :position"
+               " WHERE ROWID = :id");
   QSqlQuery update(db);
   update.prepare(
       "UPDATE playlists SET "
@@ -313,18 +433,78 @@ void PlaylistBackend::SavePlaylist(int playlist, const PlaylistItemList& items,
 
   ScopedTransaction transaction(&db);
 
-  // Clear the existing items in the playlist
-  clear.bindValue(":playlist", playlist);
-  clear.exec();
-  if (db_->CheckErrors(clear)) return;
+  // If anything goes wrong we don't know what's in the database any more, so
+  // the next save will start from scratch.
+  const bool have_saved_items = saved_items_.contains(playlist);
+  const SavedItemList old_items = saved_items_.take(playlist);
+  restoring_items_.remove(playlist);
+
+  if (!have_saved_items) {
+    // Clear the existing items in the playlist
+    clear.bindValue(":playlist", playlist);
+    clear.exec();
+    if (db_->CheckErrors(clear)) return;
+  }
+
+  // Find the items whose rows can stay as they are, apart from their order.
+  QHash<PlaylistItem*, int> old_indices;
+  for (int i = 0; i < old_items.count(); ++i) {
+    if (old_items[i].item) old_indices[old_items[i].item.get()] = i;
+  }
+
+  QVector<bool> kept(old_items.count(), false);
+  QVector<qint64> old_keys(items.count(), -1);
+  SavedItemList new_items;
+  new_items.reserve(items.count());
+
+  for (int i = 0; i < items.count(); ++i) {
+    SavedItem saved;
+    saved.item = items[i];
+    saved.state = items[i]->GetDatabaseState();
+    saved.row_id = -1;
+
+    const int old_index = old_indices.value(items[i].get(), -1);
+    if (old_index != -1 && !kept[old_index] &&
+        old_items[old_index].state == saved.state) {
+      kept[old_index] = true;
+      saved.row_id = old_items[old_index].row_id;
+      old_keys[i] = old_items[old_index].order_key;
+    }
+    new_items << saved;
+  }
 
-  // Save the new ones
-  for (PlaylistItemPtr item : items) {
-    insert.bindValue(":playlist", playlist);
-    item->BindToQuery(&insert);
+  // Remove the rows of items that were removed or changed
+  for (int i = 0; i < old_items.count(); ++i) {
+    if (kept[i]) continue;
+    remove.bindValue(":id", old_items[i].row_id);
+    remove.exec();
+    if (db_->CheckErrors(remove)) return;
+  }
 
-    insert.exec();
-    db_->CheckErrors(insert);
+  // Insert the new ones and reorder the ones that moved
+  const QVector<qint64> new_keys = AssignOrderKeys(old_keys);
+  SavedItemList written_items;
+  written_items.reserve(new_items.count());
+
+  for (int i = 0; i < new_items.count(); ++i) {
+    SavedItem& saved = new_items[i];
+    saved.order_key = new_keys[i];
+
+    if (saved.row_id == -1) {
+      insert.bindValue(":playlist", playlist);
+      insert.bindValue(":position", saved.order_key);
+      saved.item->BindToQuery(&insert);
+      insert.exec();
+      if (db_->CheckErrors(insert)) continue;
+
+      saved.row_id = insert.lastInsertId().toInt();
+    } else if (old_keys[i] != new_keys[i]) {
+      move.bindValue(":position", saved.order_key);
+      move.bindValue(":id", saved.row_id);
+      move.exec();
+      if (db_->CheckErrors(move)) return;
+    }
+    written_items << saved;
   }
 
   // Update the last played track number
@@ -343,10 +523,68 @@ void PlaylistBackend::SavePlaylist(int playlist, const PlaylistItemList& items,
   if (db_->CheckErrors(update)) return;
 
   transaction.Commit();
+  saved_items_[playlist] = written_items;
+}
+
+QVector<qint64> PlaylistBackend::AssignOrderKeys(const QVector<qint64>& keys) {
+  const int count = keys.count();
+  QVector<qint64> ret(keys);
+
+  // Find the longest run of existing keys that are still in order - those
+  // items can stay where they are.  tails[n] is the index of the item with the
+  // smallest key that ends an increasing run of length n + 1.
+  QVector<int> tails;
+  QVector<int> previous(count, -1);
+  for (int i = 0; i < count; ++i) {
+    if (keys[i] < 0) continue;
+
+    auto it = std::lower_bound(
+        tails.begin(), tails.end(), keys[i],
+        [&keys](int index, qint64 key) { return keys[index] < key; });
+    if (it != tails.begin()) previous[i] = *(it - 1);
+    if (it == tails.end()) {
+      tails << i;
+    } else {
+      *it = i;
+    }
+  }
+
+  QVector<bool> fixed(count, false);
+  for (int i = tails.isEmpty() ? -1 : tails.last(); i != -1; i = previous[i]) {
+    fixed[i] = true;
+  }
+
+  // Spread the other items evenly between the fixed ones around them.
+  int first = 0;
+  qint64 low = 0;
+  for (int i = 0; i <= count; ++i) {
+    if (i < count && !fixed[i]) continue;
+
+    const int gap_count = i - first;
+    if (gap_count > 0) {
+      const qint64 high =
+          i < count ? keys[i] : low + kOrderKeyGap * (gap_count + 1);
+      if (high - low <= gap_count) {
+        // There's no room left between these two, so renumber everything.
+        for (int j = 0; j < count; ++j) ret[j] = (j + 1) * kOrderKeyGap;
+        return ret;
+      }
+      for (int j = 0; j < gap_count; ++j) {
+        ret[first + j] = low + (high - low) * (j + 1) / (gap_count + 1);
+      }
+    }
+
+    if (i < count) {
+      low = keys[i];
+      first = i + 1;
+    }
+  }
+  return ret;
 }
 
 int PlaylistBackend::CreatePlaylist(const QString& name,
                                     const QString& special_type) {
+  QMutexLocker save_locker(&save_mutex_);
   QMutexLocker l(db_->Mutex());
   QSqlDatabase db(db_->Connect());
 
@@ -359,10 +597,21 @@ int PlaylistBackend::CreatePlaylist(const QString& name,
   q.exec();
   if (db_->CheckErrors(q)) return -1;
 
-  return q.lastInsertId().toInt();
+  // It's empty, so the first save only has to insert its items.
+  const int id = q.lastInsertId().toInt();
+  saved_items_[id] = SavedItemList();
+  return id;
 }
 
 void PlaylistBackend::RemovePlaylist(int id) {
+  QMutexLocker save_locker(&save_mutex_);
+  {
+    QMutexLocker l(&pending_mutex_);
+    pending_saves_.remove(id);
+  }
+  saved_items_.remove(id);
+  restoring_items_.remove(id);
+
   QMutexLocker l(db_->Mutex());
   QSqlDatabase db(db_->Connect());
   QSqlQuery delete_playlist(db);
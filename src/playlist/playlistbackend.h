@@ -22,6 +22,7 @@
 #include <QList>
 #include <QMutex>
 #include <QObject>
+#include <QVector>
 
 #include "playlistitem.h"
 #include "smartplaylists/generator_fwd.h"
@@ -34,6 +35,9 @@ class PlaylistBackend : public QObject {
 
  public:
   Q_INVOKABLE PlaylistBackend(Application* app, QObject* parent = nullptr);
+  // Uses db instead of the application's database.
+  PlaylistBackend(Application* app, Database* db, QObject* parent = nullptr);
+  ~PlaylistBackend();
 
   struct Playlist {
     Playlist() : id(-1), favorite(false), last_played(0) {}
@@ -54,19 +58,32 @@ class PlaylistBackend : public QObject {
   typedef QList<Playlist> PlaylistList;
 
   static const int kSongTableJoins;
+  static const int kSaveDelayMsec;
+  static const qint64 kOrderKeyGap;
+
+  // Takes the order keys a playlist's items were saved with, in the items'
+  // new order, with -1 for items that haven't been saved yet.  Returns the
+  // keys to save them with now, keeping as many of the existing ones as
+  // possible so that moving or inserting a few items only touches their rows.
+  static QVector<qint64> AssignOrderKeys(const QVector<qint64>& keys);
 
   PlaylistList GetAllPlaylists();
   PlaylistList GetAllOpenPlaylists();
   PlaylistList GetAllFavoritePlaylists();
   PlaylistBackend::Playlist GetPlaylist(int id);
 
-  QList<PlaylistItemPtr> GetPlaylistItems(int playlist);
+  // Returns limit items (or all of them if -1) starting at offset.  Reading
+  // a playlist page by page from offset 0 is much cheaper than jumping about.
+  QList<PlaylistItemPtr> GetPlaylistItems(int playlist, int offset = 0,
+                                          int limit = -1);
   QList<Song> GetPlaylistSongs(int playlist);
 
   void SetPlaylistOrder(const QList<int>& ids);
   void SetPlaylistUiPath(int id, const QString& path);
 
   int CreatePlaylist(const QString& name, const QString& special_type);
+  // Saves are delayed by kSaveDelayMsec so bursts of changes to a playlist
+  // are written together.
   void SavePlaylistAsync(int playlist, const PlaylistItemList& items,
                          int last_played,
                          smart_playlists::GeneratorPtr dynamic);
@@ -80,18 +97,41 @@ class PlaylistBackend : public QObject {
   void SavePlaylist(int playlist, const PlaylistItemList& items,
                     int last_played, smart_playlists::GeneratorPtr dynamic);
 
+ private slots:
+  void StartSaveTimer();
+  void FlushPendingSaves();
+
  private:
   struct NewSongFromQueryState {
     QHash<QString, SongList> cached_cues_;
     QMutex mutex_;
   };
 
-  QSqlQuery GetPlaylistRows(int playlist);
+  // A row of playlist_items, as it was last loaded or saved.
+  struct SavedItem {
+    PlaylistItemPtr item;
+    PlaylistItem::DatabaseState state;
+    int row_id;
+    qint64 order_key;
+  };
+  typedef QList<SavedItem> SavedItemList;
+
+  struct PendingSave {
+    PlaylistItemList items;
+    int last_played;
+    smart_playlists::GeneratorPtr dynamic;
+  };
+
+  // Returns limit rows (or all of them if -1), skipping the first offset rows
+  // and the rows up to and including after_key, if that isn't -1.
+  QSqlQuery GetPlaylistRows(int playlist, int limit = -1, int offset = 0,
+                            qint64 after_key = -1);
 
   Song NewSongFromQuery(const SqlRow& row,
                         std::shared_ptr<NewSongFromQueryState> state);
   PlaylistItemPtr NewPlaylistItemFromQuery(
-      const SqlRow& row, std::shared_ptr<NewSongFromQueryState> state);
+      const SqlRow& row, std::shared_ptr<NewSongFromQueryState> state,
+      SavedItem* saved = nullptr);
   PlaylistItemPtr RestoreCueData(PlaylistItemPtr item,
                                  std::shared_ptr<NewSongFromQueryState> state);
 
@@ -102,8 +142,27 @@ class PlaylistBackend : public QObject {
   };
   PlaylistList GetPlaylists(GetPlaylistsFlags flags);
 
+  // Both need save_mutex_ to be held.
+  void WritePendingSave(int playlist);
+  void WritePlaylist(int playlist, const PlaylistItemList& items,
+                     int last_played, smart_playlists::GeneratorPtr dynamic);
+
   Application* app_;
   Database* db_;
+
+  // Held while playlist_items is written, or read into saved_items_.  Taken
+  // before the database mutex.
+  QMutex save_mutex_;
+  // What's in playlist_items for each playlist we've loaded or saved, in
+  // order.  Playlists that aren't in here are rewritten from scratch.
+  QHash<int, SavedItemList> saved_items_;
+  // The same for playlists that are being read page by page, until we've
+  // seen the last page.
+  QHash<int, SavedItemList> restoring_items_;
+
+  QMutex pending_mutex_;
+  QHash<int, PendingSave> pending_saves_;
+  bool save_timer_started_;
 };
 
 #endif  // PLAYLISTBACKEND_H
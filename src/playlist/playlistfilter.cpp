@@ -17,14 +17,21 @@
 
 #include "playlistfilter.h"
 
+#include <QFuture>
+#include <QList>
+#include <QtConcurrentRun>
 #include <QtDebug>
 
 #include "playlistfilterparser.h"
 
+const int PlaylistFilter::kRowsPerChunk = 4096;
+
 PlaylistFilter::PlaylistFilter(QObject* parent)
     : QSortFilterProxyModel(parent),
       filter_tree_(new NopFilter),
-      query_hash_(0) {
+      query_hash_(0),
+      index_(QList<int>()),
+      accepted_valid_(false) {
   setDynamicSortFilter(true);
 
   column_names_["title"] = Playlist::Column_Title;
@@ -53,6 +60,8 @@ PlaylistFilter::PlaylistFilter(QObject* parent)
                      << Playlist::Column_OriginalYear << Playlist::Column_Score
                      << Playlist::Column_BPM << Playlist::Column_Bitrate
                      << Playlist::Column_Rating;
+
+  index_ = PlaylistFilterIndex(column_names_.values().toSet().toList());
 }
 
 PlaylistFilter::~PlaylistFilter() {}
@@ -73,8 +82,44 @@ bool PlaylistFilter::filterAcceptsRow(int row,
     filter_tree_.reset(p.parse());
 
     query_hash_ = hash;
+    accepted_valid_ = false;
+  }
+
+  if (filter_tree_->type() == FilterTree::Nop) return true;
+
+  const Playlist* playlist = static_cast<const Playlist*>(sourceModel());
+
+  if (!accepted_valid_) {
+    // This is the first row tested against a new query, so test all of them
+    // now while the index is hot.
+    index_.Update(playlist);
+    accepted_.resize(index_.row_count());
+
+    // The last chunk is done on this thread while the others run.
+    bool* accepted = accepted_.data();
+    const int count = accepted_.count();
+    QList<QFuture<void>> chunks;
+    int begin = 0;
+    for (; begin + kRowsPerChunk < count; begin += kRowsPerChunk) {
+      chunks << QtConcurrent::run(this, &PlaylistFilter::AcceptRows, begin,
+                                  begin + kRowsPerChunk, accepted);
+    }
+    AcceptRows(begin, count, accepted);
+    for (QFuture<void>& chunk : chunks) chunk.waitForFinished();
+
+    accepted_valid_ = true;
+  }
+
+  // Rows that were inserted, moved or edited since then are tested again.
+  if (index_.UpdateRow(playlist, row) || row >= accepted_.count()) {
+    if (row >= accepted_.count()) accepted_.resize(index_.row_count());
+    accepted_[row] = filter_tree_->accept(row, index_);
   }
+  return accepted_[row];
+}
 
-  // Test the row
-  return filter_tree_->accept(row, parent, sourceModel());
+void PlaylistFilter::AcceptRows(int begin, int end, bool* accepted) const {
+  for (int row = begin; row < end; ++row) {
+    accepted[row] = filter_tree_->accept(row, index_);
+  }
 }
@@ -21,8 +21,10 @@
 #include <QScopedPointer>
 #include <QSet>
 #include <QSortFilterProxyModel>
+#include <QVector>
 
 #include "playlist.h"
+#include "playlistfilterindex.h"
 
 class FilterTree;
 
@@ -41,12 +43,24 @@ class PlaylistFilter : public QSortFilterProxyModel {
   bool filterAcceptsRow(int source_row, const QModelIndex& source_parent) const;
 
  private:
+  // Rows are tested in chunks of this size on the global thread pool when
+  // the query changes.
+  static const int kRowsPerChunk;
+
+  void AcceptRows(int begin, int end, bool* accepted) const;
+
   // Mutable because they're modified from filterAcceptsRow() const
   mutable QScopedPointer<FilterTree> filter_tree_;
   mutable uint query_hash_;
 
   QMap<QString, int> column_names_;
   QSet<int> numerical_columns_;
+
+  // Result of filter_tree_ for every row, computed in one pass when the
+  // query changes and re-checked per row if the row's data changed.
+  mutable PlaylistFilterIndex index_;
+  mutable QVector<bool> accepted_;
+  mutable bool accepted_valid_;
 };
 
 #endif  // PLAYLISTFILTER_H
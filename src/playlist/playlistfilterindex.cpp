@@ -0,0 +1,57 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "playlistfilterindex.h"
+
+#include "playlist.h"
+
+PlaylistFilterIndex::PlaylistFilterIndex(const QList<int>& columns)
+    : columns_(columns), slots_(Playlist::ColumnCount, -1) {
+  for (int i = 0; i < columns_.count(); ++i) slots_[columns_[i]] = i;
+  values_.resize(columns_.count());
+}
+
+void PlaylistFilterIndex::Resize(int rows) {
+  items_.resize(rows);
+  metadata_.resize(rows);
+  for (QVector<QString>& column : values_) column.resize(rows);
+}
+
+void PlaylistFilterIndex::Update(const Playlist* playlist) {
+  const int rows = playlist->rowCount();
+  Resize(rows);
+  for (int row = 0; row < rows; ++row) UpdateRow(playlist, row);
+}
+
+bool PlaylistFilterIndex::UpdateRow(const Playlist* playlist, int row) {
+  if (row >= items_.count()) Resize(playlist->rowCount());
+
+  const PlaylistItemPtr& item = playlist->item_at(row);
+  const Song metadata = item->Metadata();
+  if (items_[row] == item.get() && metadata_[row].SharesDataWith(metadata)) {
+    return false;
+  }
+
+  items_[row] = item.get();
+  metadata_[row] = metadata;
+  for (int i = 0; i < columns_.count(); ++i) {
+    values_[i][row] = playlist->index(row, columns_[i])
+                          .data()
+                          .toString()
+                          .toLower();
+  }
+  return true;
+}
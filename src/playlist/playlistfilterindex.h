@@ -0,0 +1,68 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLAYLISTFILTERINDEX_H
+#define PLAYLISTFILTERINDEX_H
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include "core/song.h"
+
+class Playlist;
+class PlaylistItem;
+
+// Column-wise cache of the lowercased display text of every filterable
+// column of a playlist, so the filter tree can test rows without going
+// through QAbstractItemModel::data() each time the query changes.
+//
+// A row is re-read only when the item at that position changed or its
+// metadata was modified since the last read.
+class PlaylistFilterIndex {
+ public:
+  explicit PlaylistFilterIndex(const QList<int>& columns);
+
+  // Brings every row up to date with the playlist.
+  void Update(const Playlist* playlist);
+
+  // Brings one row up to date.  Returns true if it had to be re-read.
+  bool UpdateRow(const Playlist* playlist, int row);
+
+  int row_count() const { return items_.count(); }
+  const QList<int>& columns() const { return columns_; }
+
+  // The lowercased text of a column that was passed to the constructor.
+  const QString& value(int row, int column) const {
+    return values_[slots_[column]][row];
+  }
+
+ private:
+  void Resize(int rows);
+
+  QList<int> columns_;
+  QVector<int> slots_;
+
+  // Used only to tell whether a row is stale.  The cached Song keeps the
+  // metadata it was read from alive, so comparing pointers is safe.
+  QVector<const PlaylistItem*> items_;
+  QVector<Song> metadata_;
+
+  // Indexed by slot, then by row.
+  QVector<QVector<QString>> values_;
+};
+
+#endif  // PLAYLISTFILTERINDEX_H
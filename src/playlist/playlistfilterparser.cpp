@@ -17,10 +17,9 @@
 
 #include "playlistfilterparser.h"
 
-#include <QAbstractItemModel>
-
 #include "core/logging.h"
 #include "playlist.h"
+#include "playlistfilterindex.h"
 
 class SearchTermComparator {
  public:
@@ -189,11 +188,9 @@ class FilterTerm : public FilterTree {
                       const QList<int>& columns)
       : cmp_(comparator), columns_(columns) {}
 
-  virtual bool accept(int row, const QModelIndex& parent,
-                      const QAbstractItemModel* const model) const {
+  virtual bool accept(int row, const PlaylistFilterIndex& index) const {
     for (int i : columns_) {
-      QModelIndex idx(model->index(row, i, parent));
-      if (cmp_->Matches(idx.data().toString().toLower())) return true;
+      if (cmp_->Matches(index.value(row, i))) return true;
     }
     return false;
   }
@@ -211,10 +208,8 @@ class FilterColumnTerm : public FilterTree {
   FilterColumnTerm(int column, SearchTermComparator* comparator)
       : col(column), cmp_(comparator) {}
 
-  virtual bool accept(int row, const QModelIndex& parent,
-                      const QAbstractItemModel* const model) const {
-    QModelIndex idx(model->index(row, col, parent));
-    return cmp_->Matches(idx.data().toString().toLower());
+  virtual bool accept(int row, const PlaylistFilterIndex& index) const {
+    return cmp_->Matches(index.value(row, col));
   }
   virtual FilterType type() { return Column; }
 
@@ -227,9 +222,8 @@ class NotFilter : public FilterTree {
  public:
   explicit NotFilter(const FilterTree* inv) : child_(inv) {}
 
-  virtual bool accept(int row, const QModelIndex& parent,
-                      const QAbstractItemModel* const model) const {
-    return !child_->accept(row, parent, model);
+  virtual bool accept(int row, const PlaylistFilterIndex& index) const {
+    return !child_->accept(row, index);
   }
   virtual FilterType type() { return Not; }
 
@@ -241,10 +235,9 @@ class OrFilter : public FilterTree {
  public:
   ~OrFilter() { qDeleteAll(children_); }
   virtual void add(FilterTree* child) { children_.append(child); }
-  virtual bool accept(int row, const QModelIndex& parent,
-                      const QAbstractItemModel* const model) const {
+  virtual bool accept(int row, const PlaylistFilterIndex& index) const {
     for (FilterTree* child : children_) {
-      if (child->accept(row, parent, model)) return true;
+      if (child->accept(row, index)) return true;
     }
     return false;
   }
@@ -258,10 +251,9 @@ class AndFilter : public FilterTree {
  public:
   virtual ~AndFilter() { qDeleteAll(children_); }
   virtual void add(FilterTree* child) { children_.append(child); }
-  virtual bool accept(int row, const QModelIndex& parent,
-                      const QAbstractItemModel* const model) const {
+  virtual bool accept(int row, const PlaylistFilterIndex& index) const {
     for (FilterTree* child : children_) {
-      if (!child->accept(row, parent, model)) return false;
+      if (!child->accept(row, index)) return false;
     }
     return true;
   }
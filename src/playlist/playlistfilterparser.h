@@ -19,18 +19,16 @@
 #define PLAYLISTFILTERPARSER_H
 
 #include <QMap>
-#include <QModelIndex>
 #include <QSet>
 #include <QString>
 
-class QAbstractItemModel;
+class PlaylistFilterIndex;
 
 // structure for filter parse tree
 class FilterTree {
  public:
   virtual ~FilterTree() {}
-  virtual bool accept(int row, const QModelIndex& parent,
-                      const QAbstractItemModel* const model) const = 0;
+  virtual bool accept(int row, const PlaylistFilterIndex& index) const = 0;
   enum FilterType { Nop = 0, Or, And, Not, Column, Term };
   virtual FilterType type() = 0;
 };
@@ -38,8 +36,7 @@ class FilterTree {
 // trivial filter that accepts *anything*
 class NopFilter : public FilterTree {
  public:
-  virtual bool accept(int row, const QModelIndex& parent,
-                      const QAbstractItemModel* const model) const {
+  virtual bool accept(int row, const PlaylistFilterIndex& index) const {
     return true;
   }
   virtual FilterType type() { return Nop; }
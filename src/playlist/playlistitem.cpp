@@ -70,6 +70,28 @@ void PlaylistItem::BindToQuery(QSqlQuery* query) const {
   DatabaseSongMetadata().BindToQuery(query);
 }
 
+Song PlaylistItem::DatabaseSongMetadata() const {
+  // Always the same empty song so DatabaseState sees that it hasn't changed.
+  static const Song kEmptySong;
+  return kEmptySong;
+}
+
+PlaylistItem::DatabaseState PlaylistItem::GetDatabaseState() const {
+  DatabaseState ret;
+  ret.type = type();
+  ret.library_id = DatabaseValue(Column_LibraryId);
+  ret.radio_service = DatabaseValue(Column_InternetService);
+  ret.metadata = DatabaseSongMetadata();
+  return ret;
+}
+
+bool PlaylistItem::DatabaseState::operator==(
+    const DatabaseState& other) const {
+  return type == other.type && library_id == other.library_id &&
+         radio_service == other.radio_service &&
+         metadata.SharesDataWith(other.metadata);
+}
+
 void PlaylistItem::SetTemporaryMetadata(const Song& metadata) {
   temp_metadata_ = metadata;
   temp_metadata_.set_filetype(Song::Type_Stream);
@@ -61,6 +61,23 @@ class PlaylistItem : public std::enable_shared_from_this<PlaylistItem> {
 
   virtual bool InitFromQuery(const SqlRow& query) = 0;
   void BindToQuery(QSqlQuery* query) const;
+
+  // The values BindToQuery() writes, in a form that's cheap to copy and
+  // compare.  PlaylistBackend uses this to skip rows that haven't changed
+  // since they were last saved.
+  struct DatabaseState {
+    bool operator==(const DatabaseState& other) const;
+    bool operator!=(const DatabaseState& other) const {
+      return !(*this == other);
+    }
+
+    QString type;
+    QVariant library_id;
+    QVariant radio_service;
+    Song metadata;
+  };
+  DatabaseState GetDatabaseState() const;
+
   virtual void Reload() {}
   QFuture<void> BackgroundReload();
 
@@ -105,7 +122,7 @@ class PlaylistItem : public std::enable_shared_from_this<PlaylistItem> {
   virtual QVariant DatabaseValue(DatabaseColumn) const {
     return QVariant(QVariant::String);
   }
-  virtual Song DatabaseSongMetadata() const { return Song(); }
+  virtual Song DatabaseSongMetadata() const;
 
   QString type_;
 
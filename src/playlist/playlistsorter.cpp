@@ -0,0 +1,304 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "playlistsorter.h"
+
+#include <QCollator>
+#include <QFuture>
+#include <QList>
+#include <QThread>
+#include <QtConcurrentRun>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <numeric>
+
+#include "playlist.h"
+
+using std::placeholders::_1;
+using std::placeholders::_2;
+
+const int PlaylistSorter::kParallelThreshold = 10000;
+
+struct PlaylistSorter::Key {
+  explicit Key(const QCollatorSortKey& text)
+      : major(0), real(0), text(text), minor(0) {}
+
+  // Compared in this order.
+  qint64 major;
+  double real;
+  QCollatorSortKey text;
+  qint64 minor;
+};
+
+namespace {
+
+QString RemovePrefix(const QString& a, const QStringList& prefixes) {
+  for (const QString& prefix : prefixes) {
+    if (a.startsWith(prefix)) {
+      return a.mid(prefix.size());
+    }
+  }
+  return a;
+}
+
+// Orders by disc, then by track.
+qint64 PackDiscAndTrack(int disc, int track) {
+  return qint64(disc) * (Q_INT64_C(1) << 32) +
+         (qint64(track) - std::numeric_limits<int>::min());
+}
+
+void WaitForAll(QList<QFuture<void>>* futures) {
+  for (QFuture<void>& future : *futures) future.waitForFinished();
+  futures->clear();
+}
+
+}  // namespace
+
+PlaylistSorter::PlaylistSorter(int column, Qt::SortOrder order,
+                               const QStringList& prefixes)
+    : column_(column),
+      order_(order),
+      prefixes_(prefixes),
+      text_key_(column == Playlist::Column_Title ||
+                column == Playlist::Column_Artist ||
+                column == Playlist::Column_Album ||
+                column == Playlist::Column_AlbumArtist ||
+                column == Playlist::Column_Composer ||
+                column == Playlist::Column_Performer ||
+                column == Playlist::Column_Grouping ||
+                column == Playlist::Column_Genre ||
+                column == Playlist::Column_Comment ||
+                column == Playlist::Column_Filename) {}
+
+bool PlaylistSorter::HasSortKey(int column) {
+  switch (column) {
+    case Playlist::Column_BaseFilename:
+    case Playlist::Column_Source:
+    case Playlist::Column_Mood:
+      return false;
+    default:
+      return column >= 0 && column < Playlist::ColumnCount;
+  }
+}
+
+void PlaylistSorter::ExtractKeys(const PlaylistItemList* items, int begin,
+                                 int end, KeyList* keys) const {
+  // QCollator isn't thread-safe, so every chunk gets its own.
+  QCollator collator(QLocale::system());
+  const QCollatorSortKey no_text = collator.sortKey(QString());
+
+  keys->reserve(end - begin);
+  for (int i = begin; i < end; ++i) {
+    const PlaylistItemPtr& item = items->at(i);
+    const Song song = item->Metadata();
+
+    keys->emplace_back(no_text);
+    Key& key = keys->back();
+
+#define number(field) key.major = song.field()
+#define real(field) key.real = song.field()
+#define text(field) \
+  key.text = collator.sortKey(RemovePrefix(song.field().toLower(), prefixes_))
+
+    switch (column_) {
+      case Playlist::Column_Title:
+        text(title);
+        break;
+      case Playlist::Column_Artist:
+        text(artist);
+        break;
+      case Playlist::Column_Album:
+        // When sorting by album, also take into account discs and tracks.
+        text(album);
+        key.minor = PackDiscAndTrack(song.disc(), song.track());
+        break;
+      case Playlist::Column_Length:
+        number(length_nanosec);
+        break;
+      case Playlist::Column_Track:
+        number(track);
+        break;
+      case Playlist::Column_Disc:
+        number(disc);
+        break;
+      case Playlist::Column_Year:
+        number(year);
+        break;
+      case Playlist::Column_OriginalYear:
+        number(originalyear);
+        break;
+      case Playlist::Column_Genre:
+        text(genre);
+        break;
+      case Playlist::Column_AlbumArtist:
+        text(playlist_albumartist);
+        break;
+      case Playlist::Column_Composer:
+        text(composer);
+        break;
+      case Playlist::Column_Performer:
+        text(performer);
+        break;
+      case Playlist::Column_Grouping:
+        text(grouping);
+        break;
+
+      case Playlist::Column_Rating:
+        real(rating);
+        break;
+      case Playlist::Column_PlayCount:
+        number(playcount);
+        break;
+      case Playlist::Column_SkipCount:
+        number(skipcount);
+        break;
+      case Playlist::Column_LastPlayed:
+        number(lastplayed);
+        break;
+      case Playlist::Column_Score:
+        number(score);
+        break;
+
+      case Playlist::Column_BPM:
+        real(bpm);
+        break;
+      case Playlist::Column_Bitrate:
+        number(bitrate);
+        break;
+      case Playlist::Column_Samplerate:
+        number(samplerate);
+        break;
+      case Playlist::Column_Filename: {
+        // Full paths are ordered breadth-first.
+        const QString path = item->Url().path();
+        key.major = path.count('/');
+        key.text = collator.sortKey(path.toLower());
+        break;
+      }
+      case Playlist::Column_Filesize:
+        number(filesize);
+        break;
+      case Playlist::Column_Filetype:
+        number(filetype);
+        break;
+      case Playlist::Column_DateModified:
+        number(mtime);
+        break;
+      case Playlist::Column_DateCreated:
+        number(ctime);
+        break;
+
+      case Playlist::Column_Comment:
+        text(comment);
+        break;
+    }
+
+#undef number
+#undef real
+#undef text
+  }
+}
+
+int PlaylistSorter::Compare(const Key& a, const Key& b) const {
+  if (a.major != b.major) return a.major < b.major ? -1 : 1;
+  if (a.real != b.real) return a.real < b.real ? -1 : 1;
+  if (text_key_) {
+    const int ret = a.text.compare(b.text);
+    if (ret != 0) return ret;
+  }
+  if (a.minor != b.minor) return a.minor < b.minor ? -1 : 1;
+  return 0;
+}
+
+void PlaylistSorter::Sort(PlaylistItemList* items, int begin) const {
+  const int count = items->count() - begin;
+  if (count < 2) return;
+
+  if (!HasSortKey(column_)) {
+    std::stable_sort(items->begin() + begin, items->end(),
+                     std::bind(&Playlist::CompareItems, column_, order_, _1,
+                               _2, prefixes_));
+    return;
+  }
+
+  // Split the items into one chunk per core.  The first chunk is always
+  // done on this thread.
+  const int chunk_count = count > kParallelThreshold
+                              ? qMax(1, QThread::idealThreadCount())
+                              : 1;
+  std::vector<int> bounds;
+  for (int i = 0; i <= chunk_count; ++i) {
+    bounds.push_back(qint64(count) * i / chunk_count);
+  }
+
+  QList<QFuture<void>> futures;
+  std::vector<KeyList> chunk_keys(chunk_count);
+  for (int i = 1; i < chunk_count; ++i) {
+    futures << QtConcurrent::run(this, &PlaylistSorter::ExtractKeys, items,
+                                 begin + bounds[i], begin + bounds[i + 1],
+                                 &chunk_keys[i]);
+  }
+  ExtractKeys(items, begin + bounds[0], begin + bounds[1], &chunk_keys[0]);
+  WaitForAll(&futures);
+
+  KeyList keys;
+  keys.reserve(count);
+  for (KeyList& chunk : chunk_keys) {
+    keys.insert(keys.end(), std::make_move_iterator(chunk.begin()),
+                std::make_move_iterator(chunk.end()));
+  }
+
+  // Sort the item positions instead of the keys so nothing gets copied.
+  // Equal keys are ordered by position, which keeps the sort stable.
+  auto less = [this, &keys](int a, int b) {
+    int ret = Compare(keys[a], keys[b]);
+    if (order_ == Qt::DescendingOrder) ret = -ret;
+    return ret != 0 ? ret < 0 : a < b;
+  };
+
+  std::vector<int> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  auto position = [&order](int i) { return order.begin() + i; };
+
+  for (int i = 1; i < chunk_count; ++i) {
+    futures << QtConcurrent::run([&, i]() {
+      std::sort(position(bounds[i]), position(bounds[i + 1]), less);
+    });
+  }
+  std::sort(position(bounds[0]), position(bounds[1]), less);
+  WaitForAll(&futures);
+
+  // Merge neighbouring chunks pairwise until there's only one left.
+  for (int width = 1; width < chunk_count; width *= 2) {
+    for (int i = 0; i + width < chunk_count; i += 2 * width) {
+      const int first = bounds[i];
+      const int middle = bounds[i + width];
+      const int last = bounds[qMin(i + 2 * width, chunk_count)];
+      futures << QtConcurrent::run([&, first, middle, last]() {
+        std::inplace_merge(position(first), position(middle), position(last),
+                           less);
+      });
+    }
+    WaitForAll(&futures);
+  }
+
+  const PlaylistItemList old_items = items->mid(begin);
+  for (int i = 0; i < count; ++i) {
+    (*items)[begin + i] = old_items[order[i]];
+  }
+}
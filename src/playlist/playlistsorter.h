@@ -0,0 +1,65 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLAYLISTSORTER_H
+#define PLAYLISTSORTER_H
+
+#include <vector>
+
+#include <Qt>
+#include <QStringList>
+
+#include "playlistitem.h"
+
+// Sorts playlist items by one of the Playlist columns.
+//
+// Instead of comparing Songs directly, a compact key is extracted from each
+// item once: text columns are lowercased, stripped of the ignored prefixes
+// and turned into collation keys, and the disc and track numbers used as
+// tie-breakers for the album column are packed into one integer.  The keys
+// are then sorted, on the global thread pool for large playlists.
+//
+// The result is the same as Playlist::CompareItems with std::stable_sort.
+class PlaylistSorter {
+ public:
+  // Playlists with more items than this are sorted in parallel.
+  static const int kParallelThreshold;
+
+  PlaylistSorter(int column, Qt::SortOrder order,
+                 const QStringList& prefixes = QStringList());
+
+  // Stable-sorts the items from begin to the end of the list.
+  void Sort(PlaylistItemList* items, int begin = 0) const;
+
+  // Columns without a sort key are sorted with Playlist::CompareItems.
+  static bool HasSortKey(int column);
+
+ private:
+  struct Key;
+  typedef std::vector<Key> KeyList;
+
+  void ExtractKeys(const PlaylistItemList* items, int begin, int end,
+                   KeyList* keys) const;
+  // Returns <0, 0 or >0 like QString::compare, in ascending order.
+  int Compare(const Key& a, const Key& b) const;
+
+  const int column_;
+  const Qt::SortOrder order_;
+  const QStringList prefixes_;
+  const bool text_key_;
+};
+
+#endif  // PLAYLISTSORTER_H
@@ -29,6 +29,7 @@
 #include <QPainter>
 #include <QProgressBar>
 #include <QPushButton>
+#include <QScrollBar>
 #include <QSettings>
 #include <QShortcut>
 #include <QTimer>
@@ -83,6 +84,8 @@ AlbumCoverManager::AlbumCoverManager(Application* app,
   ui_->setupUi(this);
   ui_->albums->set_cover_manager(this);
 
+  cover_loader_options_.use_thumbnail_cache_ = true;
+
   // Icons
   ui_->action_fetch->setIcon(IconLoader::Load("download", IconLoader::Base));
   ui_->export_covers->setIcon(
@@ -174,6 +177,12 @@ void AlbumCoverManager::Init() {
           SLOT(ArtistChanged(QListWidgetItem*)));
   connect(ui_->filter, SIGNAL(textChanged(QString)), SLOT(UpdateFilter()));
   connect(filter_group, SIGNAL(triggered(QAction*)), SLOT(UpdateFilter()));
+  connect(ui_->filter, SIGNAL(textChanged(QString)),
+          SLOT(PrioritiseVisibleCovers()));
+  connect(filter_group, SIGNAL(triggered(QAction*)),
+          SLOT(PrioritiseVisibleCovers()));
+  connect(ui_->albums->verticalScrollBar(), SIGNAL(valueChanged(int)),
+          SLOT(PrioritiseVisibleCovers()));
   connect(ui_->view, SIGNAL(clicked()), ui_->view, SLOT(showMenu()));
   connect(ui_->fetch, SIGNAL(clicked()), SLOT(FetchAlbumCovers()));
   connect(ui_->export_covers, SIGNAL(clicked()), SLOT(ExportCovers()));
@@ -351,6 +360,24 @@ void AlbumCoverManager::ArtistChanged(QListWidgetItem* current) {
   }
 
   UpdateFilter();
+  PrioritiseVisibleCovers();
+}
+
+void AlbumCoverManager::PrioritiseVisibleCovers() {
+  // Load the covers that are on screen before the rest of the list.
+  const QRect viewport = ui_->albums->viewport()->rect();
+
+  QSet<quint64> ids;
+  for (auto it = cover_loading_tasks_.constBegin();
+       it != cover_loading_tasks_.constEnd(); ++it) {
+    QListWidgetItem* item = it.value();
+    if (!item->isHidden() &&
+        ui_->albums->visualItemRect(item).intersects(viewport)) {
+      ids << it.key();
+    }
+  }
+
+  if (!ids.isEmpty()) app_->album_cover_loader()->PrioritiseTasks(ids);
 }
 
 void AlbumCoverManager::CoverImageLoaded(quint64 id, const QImage& image) {
@@ -79,6 +79,7 @@ class AlbumCoverManager : public QMainWindow {
  private slots:
   void ArtistChanged(QListWidgetItem* current);
   void CoverImageLoaded(quint64 id, const QImage& image);
+  void PrioritiseVisibleCovers();
   void UpdateFilter();
   void FetchAlbumCovers();
   void ExportCovers();
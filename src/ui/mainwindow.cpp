@@ -142,6 +142,7 @@
 
 #ifdef HAVE_MOODBAR
 #include "moodbar/moodbarcontroller.h"
+#include "moodbar/moodbarloader.h"
 #include "moodbar/moodbarproxystyle.h"
 #endif
 
@@ -929,6 +930,16 @@ MainWindow::MainWindow(Application* app, SystemTrayIcon* tray_icon, OSD* osd,
   connect(app_->moodbar_controller(),
           SIGNAL(CurrentMoodbarDataChanged(QByteArray)),
           ui_->track_slider->moodbar_style(), SLOT(SetMoodbarData(QByteArray)));
+
+  QAction* generate_moodbars =
+      new QAction(tr("Generate moodbars for the whole library"), this);
+  connect(generate_moodbars, SIGNAL(triggered()), app_->moodbar_loader(),
+          SLOT(GenerateForLibrary()));
+  QList<QAction*> tools_actions = ui_->menu_tools->actions();
+  const int full_scan_index =
+      tools_actions.indexOf(ui_->action_full_library_scan);
+  ui_->menu_tools->insertAction(tools_actions.value(full_scan_index + 1),
+                                generate_moodbars);
 #endif
 
   // Now playing widget
@@ -126,6 +126,9 @@ void PlaybackSettingsPage::Load() {
       s.value(GstEngine::kSettingFormat, GstEngine::kOutFormatDetect)
           .toString()));
   ui_->buffer_min_fill->setValue(s.value("bufferminfill", 33).toInt());
+  ui_->gapless_prebuffer->setValue(
+      s.value("prebufferduration", GstEngine::kDefaultPrebufferDurationMsec)
+          .toInt());
   s.endGroup();
 }
 
@@ -166,6 +169,7 @@ void PlaybackSettingsPage::Save() {
              ui_->output_format->itemData(ui_->output_format->currentIndex())
                  .toString());
   s.setValue("bufferminfill", ui_->buffer_min_fill->value());
+  s.setValue("prebufferduration", ui_->gapless_prebuffer->value());
   s.endGroup();
 }
 
@@ -77,6 +77,10 @@ void AutoExpandingTreeView::ItemExpanded(const QModelIndex& index) {
     expand(model()->index(0, 0, index));
 }
 
+void AutoExpandingTreeView::ChildrenLoaded(const QModelIndex& index) {
+  if (isExpanded(index)) ItemExpanded(index);
+}
+
 void AutoExpandingTreeView::ItemClicked(const QModelIndex& index) {
   if (ignore_next_click_) {
     ignore_next_click_ = false;
@@ -34,6 +34,9 @@ class AutoExpandingTreeView : public QTreeView {
 
  public slots:
   void RecursivelyExpand(const QModelIndex& index);
+  // For models that load an item's children after it was expanded: does
+  // what expanding it would have done with the real children.
+  void ChildrenLoaded(const QModelIndex& index);
   void UpAndFocus();
   void DownAndFocus();
 
@@ -0,0 +1,135 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+
+#include <QSignalSpy>
+#include <QSqlQuery>
+
+#include "core/database.h"
+#include "core/song.h"
+#include "gtest/gtest.h"
+#include "library/library.h"
+#include "library/librarybackend.h"
+
+namespace {
+
+class LibraryBackendWriteTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    database_.reset(new MemoryDatabase(nullptr));
+    backend_.reset(new LibraryBackend);
+    backend_->Init(database_, Library::kSongsTable, Library::kDirsTable,
+                   Library::kSubdirsTable, Library::kFtsTable);
+    backend_->AddDirectory("/tmp");
+  }
+
+  Song MakeSong(int i) {
+    Song ret;
+    ret.set_directory_id(1);
+    ret.set_title(QString("Title %1").arg(i));
+    ret.set_url(QUrl::fromLocalFile(QString("/tmp/%1.mp3").arg(i)));
+    ret.set_mtime(1);
+    ret.set_ctime(1);
+    ret.set_filesize(1);
+    return ret;
+  }
+
+  QVariant FtsValue(int id, const QString& column) {
+    QSqlQuery q(database_->Connect());
+    q.prepare(QString("SELECT %1 FROM %2 WHERE ROWID = :id")
+                  .arg(column, Library::kFtsTable));
+    q.bindValue(":id", id);
+    q.exec();
+    return q.next() ? q.value(0) : QVariant();
+  }
+
+  std::shared_ptr<Database> database_;
+  std::unique_ptr<LibraryBackend> backend_;
+};
+
+TEST_F(LibraryBackendWriteTest, AddManySongs) {
+  // Enough songs to need several statements, with a broken one in the middle
+  SongList songs;
+  for (int i = 0; i < 50; ++i) songs << MakeSong(i);
+  songs[25].set_mtime(-1);
+
+  QSignalSpy added_spy(backend_.get(), SIGNAL(SongsDiscovered(SongList)));
+  backend_->AddOrUpdateSongs(songs);
+
+  ASSERT_EQ(1, added_spy.count());
+  SongList added = *(reinterpret_cast<SongList*>(added_spy[0][0].data()));
+  ASSERT_EQ(49, added.count());
+  EXPECT_EQ("Title 0", added[0].title());
+  EXPECT_EQ("Title 49", added[48].title());
+  EXPECT_EQ(49, backend_->GetAllSongs().count());
+
+  // Updating them all again shouldn't add any new rows
+  QSignalSpy deleted_spy(backend_.get(), SIGNAL(SongsDeleted(SongList)));
+  backend_->AddOrUpdateSongs(added);
+  ASSERT_EQ(1, deleted_spy.count());
+  SongList deleted = *(reinterpret_cast<SongList*>(deleted_spy[0][0].data()));
+  EXPECT_EQ(49, deleted.count());
+  EXPECT_EQ(49, backend_->GetAllSongs().count());
+}
+
+TEST_F(LibraryBackendWriteTest, FtsRowsMatchSingleSongPath) {
+  // A song without a year is indexed with the value Song::BindToFtsQuery
+  // gives it, not the -1 that's stored in the songs table.
+  SongList songs;
+  for (int i = 0; i < 3; ++i) songs << MakeSong(i);
+  songs[0].set_year(0);
+  songs[1].set_year(1999);
+
+  QSignalSpy added_spy(backend_.get(), SIGNAL(SongsDiscovered(SongList)));
+  backend_->AddOrUpdateSongs(songs);
+  ASSERT_EQ(1, added_spy.count());
+  SongList added = *(reinterpret_cast<SongList*>(added_spy[0][0].data()));
+  ASSERT_EQ(3, added.count());
+
+  EXPECT_EQ(0, FtsValue(added[0].id(), "ftsyear").toInt());
+  EXPECT_EQ(1999, FtsValue(added[1].id(), "ftsyear").toInt());
+  EXPECT_EQ(-1, FtsValue(added[2].id(), "ftsyear").toInt());
+  EXPECT_EQ("Title 2", FtsValue(added[2].id(), "ftstitle").toString());
+}
+
+TEST_F(LibraryBackendWriteTest, BackfillFingerprints) {
+  SongList songs;
+  for (int i = 0; i < 3; ++i) songs << MakeSong(i);
+  songs[1].set_file_fingerprint("1:abc");
+
+  QSignalSpy added_spy(backend_.get(), SIGNAL(SongsDiscovered(SongList)));
+  backend_->AddOrUpdateSongs(songs);
+  ASSERT_EQ(1, added_spy.count());
+
+  SongList missing = backend_->FindSongsWithoutFingerprint(1, -1, 10);
+  ASSERT_EQ(2, missing.count());
+  EXPECT_EQ("Title 0", missing[0].title());
+  EXPECT_EQ("Title 2", missing[1].title());
+  EXPECT_EQ(1, backend_->FindSongsWithoutFingerprint(1, -1, 1).count());
+  EXPECT_EQ(1, backend_->FindSongsWithoutFingerprint(1, missing[0].id(), 10)
+                   .count());
+
+  missing[0].set_file_fingerprint("0:def");
+  backend_->UpdateFileFingerprintsOnly(SongList() << missing[0]);
+
+  SongList left = backend_->FindSongsWithoutFingerprint(1, -1, 10);
+  ASSERT_EQ(1, left.count());
+  EXPECT_EQ("Title 2", left[0].title());
+  EXPECT_EQ("0:def", backend_->GetSongById(missing[0].id()).file_fingerprint());
+}
+
+}  // namespace
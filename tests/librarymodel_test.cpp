@@ -29,17 +29,17 @@
 #include <QThread>
 #include <QSignalSpy>
 #include <QSortFilterProxyModel>
+#include <QTest>
 
-namespace {
-
+// Not in an anonymous namespace so the model can befriend the tests.
 class LibraryModelTest : public ::testing::Test {
  protected:
   void SetUp() {
-    database_.reset(new MemoryDatabase);
+    database_.reset(new MemoryDatabase(nullptr));
     backend_.reset(new LibraryBackend);
     backend_->Init(database_, Library::kSongsTable,
                    Library::kDirsTable, Library::kSubdirsTable, Library::kFtsTable);
-    model_.reset(new LibraryModel(backend_.get(), nullptr));
+    model_.reset(new LibraryModel(backend_, nullptr));
 
     added_dir_ = false;
 
@@ -72,8 +72,21 @@ class LibraryModelTest : public ::testing::Test {
     return AddSong(song);
   }
 
+  // Expanding an item loads its children in the background, behind a
+  // "Loading..." row.  Waits for the real ones.
+  void FetchMore(const QModelIndex& index) {
+    QSignalSpy spy(model_.get(), SIGNAL(ChildrenLoaded(QModelIndex)));
+    model_->fetchMore(index);
+
+    if (model_->rowCount(index) == 1 &&
+        model_->index(0, 0, index).data(LibraryModel::Role_Type).toInt() ==
+            LibraryItem::Type_LoadingIndicator) {
+      ASSERT_TRUE(spy.wait());
+    }
+  }
+
   std::shared_ptr<Database> database_;
-  std::unique_ptr<LibraryBackend> backend_;
+  std::shared_ptr<LibraryBackend> backend_;
   std::unique_ptr<LibraryModel> model_;
   std::unique_ptr<QSortFilterProxyModel> model_sorted_;
 
@@ -105,7 +118,7 @@ TEST_F(LibraryModelTest, CompilationAlbums) {
 
   AddSong(song);
   model_->Init(false);
-  model_->fetchMore(model_->index(0, 0));
+  FetchMore(model_->index(0, 0));
 
   ASSERT_EQ(1, model_->rowCount(QModelIndex()));
 
@@ -149,7 +162,7 @@ TEST_F(LibraryModelTest, MixedCaseHeaders) {
 TEST_F(LibraryModelTest, UnknownArtists) {
   AddSong("Title", "", "Album", 123);
   model_->Init(false);
-  model_->fetchMore(model_->index(0, 0));
+  FetchMore(model_->index(0, 0));
 
   ASSERT_EQ(1, model_->rowCount(QModelIndex()));
   QModelIndex unknown_index = model_->index(0, 0, QModelIndex());
@@ -163,7 +176,7 @@ TEST_F(LibraryModelTest, UnknownAlbums) {
   AddSong("Title", "Artist", "", 123);
   AddSong("Title", "Artist", "Album", 123);
   model_->Init(false);
-  model_->fetchMore(model_->index(0, 0));
+  FetchMore(model_->index(0, 0));
 
   QModelIndex artist_index = model_->index(0, 0, QModelIndex());
   ASSERT_EQ(2, model_->rowCount(artist_index));
@@ -195,11 +208,11 @@ TEST_F(LibraryModelTest, VariousArtistSongs) {
   model_->Init(false);
 
   QModelIndex artist_index = model_->index(0, 0, QModelIndex());
-  model_->fetchMore(artist_index);
+  FetchMore(artist_index);
   ASSERT_EQ(1, model_->rowCount(artist_index));
 
   QModelIndex album_index = model_->index(0, 0, artist_index);
-  model_->fetchMore(album_index);
+  FetchMore(album_index);
   ASSERT_EQ(4, model_->rowCount(album_index));
 
   EXPECT_EQ("Artist 1 - Title 1", model_->index(0, 0, album_index).data().toString());
@@ -216,10 +229,10 @@ TEST_F(LibraryModelTest, RemoveSongsLazyLoaded) {
 
   // Lazy load the items
   QModelIndex artist_index = model_->index(0, 0, QModelIndex());
-  model_->fetchMore(artist_index);
+  FetchMore(artist_index);
   ASSERT_EQ(1, model_->rowCount(artist_index));
   QModelIndex album_index = model_->index(0, 0, artist_index);
-  model_->fetchMore(album_index);
+  FetchMore(album_index);
   ASSERT_EQ(3, model_->rowCount(album_index));
 
   // Remove the first two songs
@@ -264,7 +277,7 @@ TEST_F(LibraryModelTest, RemoveEmptyAlbums) {
   model_->Init(false);
 
   QModelIndex artist_index = model_->index(0, 0, QModelIndex());
-  model_->fetchMore(artist_index);
+  FetchMore(artist_index);
   ASSERT_EQ(2, model_->rowCount(artist_index));
 
   // Remove one song from each album
@@ -272,10 +285,10 @@ TEST_F(LibraryModelTest, RemoveEmptyAlbums) {
 
   // Check the model
   artist_index = model_->index(0, 0, QModelIndex());
-  model_->fetchMore(artist_index);
+  FetchMore(artist_index);
   ASSERT_EQ(1, model_->rowCount(artist_index));
   QModelIndex album_index = model_->index(0, 0, artist_index);
-  model_->fetchMore(album_index);
+  FetchMore(album_index);
   EXPECT_EQ("Album 2", album_index.data().toString());
 
   ASSERT_EQ(1, model_->rowCount(album_index));
@@ -288,10 +301,10 @@ TEST_F(LibraryModelTest, RemoveEmptyArtists) {
 
   // Lazy load the items
   QModelIndex artist_index = model_->index(0, 0, QModelIndex());
-  model_->fetchMore(artist_index);
+  FetchMore(artist_index);
   ASSERT_EQ(1, model_->rowCount(artist_index));
   QModelIndex album_index = model_->index(0, 0, artist_index);
-  model_->fetchMore(album_index);
+  FetchMore(album_index);
   ASSERT_EQ(1, model_->rowCount(album_index));
 
   // The artist header is there too right?
@@ -304,4 +317,66 @@ TEST_F(LibraryModelTest, RemoveEmptyArtists) {
   ASSERT_EQ(0, model_->rowCount(QModelIndex()));
 }
 
-} // namespace
+TEST_F(LibraryModelTest, LoadsChildrenInBackground) {
+  AddSong("Title", "Artist", "Album", 123);
+  model_->set_show_dividers(false);
+  model_->Init(false);
+
+  QModelIndex artist_index = model_->index(0, 0, QModelIndex());
+  QSignalSpy spy(model_.get(), SIGNAL(ChildrenLoaded(QModelIndex)));
+  model_->fetchMore(artist_index);
+
+  ASSERT_EQ(1, model_->rowCount(artist_index));
+  EXPECT_EQ(LibraryItem::Type_LoadingIndicator,
+            model_->index(0, 0, artist_index)
+                .data(LibraryModel::Role_Type)
+                .toInt());
+
+  ASSERT_TRUE(spy.wait());
+  EXPECT_EQ(artist_index, spy[0][0].value<QModelIndex>());
+  ASSERT_EQ(1, model_->rowCount(artist_index));
+  EXPECT_EQ("Album", model_->index(0, 0, artist_index).data().toString());
+}
+
+TEST_F(LibraryModelTest, RestartsLoadsWhenLibraryChanges) {
+  AddSong("Title 1", "Artist", "Album 1", 123);
+  model_->set_show_dividers(false);
+  model_->Init(false);
+
+  QModelIndex artist_index = model_->index(0, 0, QModelIndex());
+  QSignalSpy spy(model_.get(), SIGNAL(ChildrenLoaded(QModelIndex)));
+  model_->fetchMore(artist_index);
+
+  // The query that's already running might not see this one
+  Song song;
+  song.Init("Title 2", "Artist", "Album 2", 123);
+  song.set_url(QUrl("file:///tmp/bar"));
+  AddSong(song);
+
+  ASSERT_TRUE(spy.wait());
+  EXPECT_EQ(1, spy.count());
+  EXPECT_EQ(2, model_->rowCount(artist_index));
+}
+
+TEST_F(LibraryModelTest, PrefetchedChildrenAppearImmediately) {
+  AddSong("Title", "Artist", "Album", 123);
+  model_->set_show_dividers(false);
+  model_->Init(false);
+
+  QModelIndex artist_index = model_->index(0, 0, QModelIndex());
+  LibraryItem* artist = model_->IndexToItem(artist_index);
+  model_->Prefetch(QModelIndexList() << artist_index);
+
+  ASSERT_TRUE(model_->populate_ids_.contains(artist));
+  while (model_->populate_ids_.contains(artist)) QTest::qWait(10);
+  ASSERT_TRUE(model_->prefetched_.contains(artist));
+
+  // No "Loading..." row this time
+  QSignalSpy spy(model_.get(), SIGNAL(ChildrenLoaded(QModelIndex)));
+  model_->fetchMore(artist_index);
+
+  ASSERT_EQ(1, model_->rowCount(artist_index));
+  EXPECT_EQ("Album", model_->index(0, 0, artist_index).data().toString());
+  EXPECT_EQ(0, spy.count());
+  EXPECT_FALSE(model_->prefetched_.contains(artist));
+}
@@ -0,0 +1,167 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+
+#include <QPersistentModelIndex>
+#include <QSignalSpy>
+#include <QTest>
+#include <QtConcurrentRun>
+
+#include "core/database.h"
+#include "core/song.h"
+#include "gtest/gtest.h"
+#include "library/library.h"
+#include "library/librarybackend.h"
+#include "library/librarymodel.h"
+
+// Checks that changes to the library are merged into the loaded parts of the
+// tree, rather than the tree being rebuilt.
+class LibraryModelMergeTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    database_.reset(new MemoryDatabase(nullptr));
+    backend_.reset(new LibraryBackend);
+    backend_->Init(database_, Library::kSongsTable, Library::kDirsTable,
+                   Library::kSubdirsTable, Library::kFtsTable);
+    backend_->AddDirectory("/tmp");
+
+    model_.reset(new LibraryModel(backend_, nullptr));
+    model_->set_show_dividers(false);
+  }
+
+  // Returns the song with its ID filled in.
+  Song AddSong(const QString& title, const QString& artist,
+               const QString& album, int year = -1,
+               const QString& grouping = QString()) {
+    Song song;
+    song.Init(title, artist, album, 123);
+    song.set_year(year);
+    song.set_grouping(grouping);
+    song.set_directory_id(1);
+    song.set_url(QUrl::fromLocalFile("/tmp/" + title + ".mp3"));
+    song.set_mtime(1);
+    song.set_ctime(1);
+    song.set_filesize(1);
+
+    QSignalSpy spy(backend_.get(), SIGNAL(SongsDiscovered(SongList)));
+    backend_->AddOrUpdateSongs(SongList() << song);
+    if (spy.isEmpty()) return Song();
+    return reinterpret_cast<SongList*>(spy[0][0].data())->first();
+  }
+
+  QModelIndex Child(const QModelIndex& parent, const QString& text) {
+    for (int i = 0; i < model_->rowCount(parent); ++i) {
+      QModelIndex index = model_->index(i, 0, parent);
+      if (index.data().toString() == text) return index;
+    }
+    return QModelIndex();
+  }
+
+  std::shared_ptr<Database> database_;
+  std::shared_ptr<LibraryBackend> backend_;
+  std::unique_ptr<LibraryModel> model_;
+};
+
+TEST_F(LibraryModelMergeTest, KeepsContainersMadeFromSongs) {
+  model_->SetGroupBy(LibraryModel::Grouping(LibraryModel::GroupBy_Artist,
+                                            LibraryModel::GroupBy_YearAlbum));
+  AddSong("Title 1", "Artist", "Album 1");
+  model_->Init(false);
+  while (!model_->snapshot_loaded_) QTest::qWait(10);
+
+  QModelIndex artist = Child(QModelIndex(), "Artist");
+  ASSERT_TRUE(artist.isValid());
+  model_->fetchMore(artist);
+  ASSERT_EQ(1, model_->rowCount(artist));
+
+  // This container is made from the song, not from a query.  It has no year
+  // and a grouping, which is what used to make its key differ.
+  AddSong("Title 2", "Artist", "Album 2", -1, "Grouping");
+  ASSERT_EQ(2, model_->rowCount(artist));
+  QPersistentModelIndex album_1 = Child(artist, "Album 1");
+  QPersistentModelIndex album_2 = Child(artist, "Album 2");
+  ASSERT_TRUE(album_1.isValid());
+  ASSERT_TRUE(album_2.isValid());
+
+  QSignalSpy removed(model_.get(), SIGNAL(rowsRemoved(QModelIndex, int, int)));
+  QSignalSpy inserted(model_.get(),
+                      SIGNAL(rowsInserted(QModelIndex, int, int)));
+  model_->SetFilterAge(-1);
+
+  EXPECT_EQ(0, removed.count());
+  EXPECT_EQ(0, inserted.count());
+  EXPECT_TRUE(album_1.isValid());
+  EXPECT_TRUE(album_2.isValid());
+}
+
+TEST_F(LibraryModelMergeTest, RemovesOnlyEmptiedContainers) {
+  Song one = AddSong("Title 1", "Artist 1", "Album 1");
+  AddSong("Title 2", "Artist 1", "Album 2");
+  Song three = AddSong("Title 3", "Artist 2", "Album 3");
+  model_->Init(false);
+  while (!model_->snapshot_loaded_) QTest::qWait(10);
+
+  QModelIndex artist_1 = Child(QModelIndex(), "Artist 1");
+  ASSERT_TRUE(artist_1.isValid());
+  model_->fetchMore(artist_1);
+  ASSERT_EQ(2, model_->rowCount(artist_1));
+
+  QPersistentModelIndex album_1 = Child(artist_1, "Album 1");
+  QPersistentModelIndex album_2 = Child(artist_1, "Album 2");
+  QPersistentModelIndex artist_2 = Child(QModelIndex(), "Artist 2");
+  QSignalSpy reset(model_.get(), SIGNAL(modelReset()));
+
+  // A loaded container
+  backend_->DeleteSongs(SongList() << one);
+  EXPECT_FALSE(album_1.isValid());
+  EXPECT_TRUE(album_2.isValid());
+  EXPECT_TRUE(artist_2.isValid());
+  EXPECT_EQ(1, model_->rowCount(artist_1));
+
+  // One that was never loaded
+  backend_->DeleteSongs(SongList() << three);
+  EXPECT_FALSE(artist_2.isValid());
+  EXPECT_TRUE(album_2.isValid());
+  EXPECT_EQ(1, model_->rowCount(QModelIndex()));
+
+  EXPECT_EQ(0, reset.count());
+}
+
+TEST_F(LibraryModelMergeTest, KeepsSongsAddedDuringFilterQuery) {
+  Song one = AddSong("Title 1", "Artist", "Album 1");
+  model_->Init(false);
+  while (!model_->snapshot_loaded_) QTest::qWait(10);
+
+  model_->SetFilterText("artist");
+  Song two = AddSong("Title 2", "Artist", "Album 2");
+
+  // What the query would have found if it ran before the second song was
+  // added.
+  const int id = one.id();
+  QFuture<QSet<int>> future =
+      QtConcurrent::run([id]() { return QSet<int>() << id; });
+  future.waitForFinished();
+  model_->FilterIdsLoaded(future, "artist", model_->filter_ids_id_);
+
+  EXPECT_TRUE(model_->filter_ids_.contains(one.id()));
+  EXPECT_TRUE(model_->filter_ids_.contains(two.id()));
+
+  QModelIndex artist = Child(QModelIndex(), "Artist");
+  ASSERT_TRUE(artist.isValid());
+  model_->fetchMore(artist);
+  EXPECT_EQ(2, model_->rowCount(artist));
+}
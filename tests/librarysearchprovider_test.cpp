@@ -0,0 +1,111 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+
+#include <QIcon>
+#include <QSet>
+#include <QSignalSpy>
+
+#include "core/database.h"
+#include "core/song.h"
+#include "globalsearch/librarysearchprovider.h"
+#include "gtest/gtest.h"
+#include "library/library.h"
+#include "library/librarybackend.h"
+
+class LibrarySearchProviderTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    database_.reset(new MemoryDatabase(nullptr));
+    backend_.reset(new LibraryBackend);
+    backend_->Init(database_, Library::kSongsTable, Library::kDirsTable,
+                   Library::kSubdirsTable, Library::kFtsTable);
+    backend_->AddDirectory("/tmp");
+    provider_.reset(new LibrarySearchProvider(
+        backend_.get(), "Library", "library", QIcon(), true, nullptr));
+  }
+
+  Song MakeSong(const QString& title) {
+    Song ret;
+    ret.set_directory_id(1);
+    ret.set_title(title);
+    ret.set_url(QUrl::fromLocalFile("/tmp/" + title + ".mp3"));
+    ret.set_mtime(1);
+    ret.set_ctime(1);
+    ret.set_filesize(1);
+    return ret;
+  }
+
+  // Adds the songs and returns them with their IDs filled in.
+  SongList AddSongs(const SongList& songs) {
+    QSignalSpy spy(backend_.get(), SIGNAL(SongsDiscovered(SongList)));
+    backend_->AddOrUpdateSongs(songs);
+    if (spy.isEmpty()) return SongList();
+    return *(reinterpret_cast<SongList*>(spy[0][0].data()));
+  }
+
+  QStringList Titles(const SearchProvider::ResultList& results) {
+    QStringList ret;
+    for (const SearchProvider::Result& result : results) {
+      ret << result.metadata_.title();
+    }
+    return ret;
+  }
+
+  std::shared_ptr<Database> database_;
+  std::unique_ptr<LibraryBackend> backend_;
+  std::unique_ptr<LibrarySearchProvider> provider_;
+};
+
+TEST_F(LibrarySearchProviderTest, RanksBetterMatchesFirst) {
+  // Added worst match first, so ROWID order would be the wrong answer
+  SongList songs;
+  songs << MakeSong("in comment") << MakeSong("in album")
+        << MakeSong("in artist") << MakeSong("needle");
+  songs[0].set_comment("needle");
+  songs[1].set_album("needle");
+  songs[2].set_artist("needle");
+  ASSERT_EQ(4, AddSongs(songs).count());
+
+  EXPECT_EQ((QStringList{"needle", "in artist", "in album", "in comment"}),
+            Titles(provider_->SearchPage(1, "needle", 0, 10)));
+}
+
+TEST_F(LibrarySearchProviderTest, PagesDontOverlap) {
+  // Every song matches equally well, so only the ROWID orders them
+  SongList songs;
+  for (int i = 0; i < 7; ++i) {
+    songs << MakeSong(QString("needle %1").arg(i));
+  }
+  songs = AddSongs(songs);
+  ASSERT_EQ(7, songs.count());
+
+  QList<int> ids;
+  for (int offset = 0; offset < 7; offset += 3) {
+    const SearchProvider::ResultList page =
+        provider_->SearchPage(1, "needle", offset, 3);
+    EXPECT_EQ(qMin(3, 7 - offset), page.count());
+    for (const SearchProvider::Result& result : page) {
+      ids << result.metadata_.id();
+    }
+  }
+
+  QList<int> expected;
+  for (const Song& song : songs) expected << song.id();
+  EXPECT_EQ(expected, ids);
+  EXPECT_EQ(7, ids.toSet().count());
+}
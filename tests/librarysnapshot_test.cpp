@@ -0,0 +1,135 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "library/librarysnapshot.h"
+
+#include "core/song.h"
+#include "gtest/gtest.h"
+#include "library/sqlrow.h"
+
+namespace {
+
+class LibrarySnapshotTest : public ::testing::Test {
+ protected:
+  void AddSong(int id, const QString& artist, const QString& album, int year,
+               uint ctime = 1) {
+    Song song;
+    song.Init("Title", artist, album, 123);
+    song.set_id(id);
+    song.set_year(year);
+    song.set_ctime(ctime);
+    snapshot_.AddOrUpdate(song);
+  }
+
+  int Row(int id) const { return snapshot_.row(id); }
+
+  QVector<int> Ids(const QVector<int>& rows) const {
+    QVector<int> ret;
+    for (int row : rows) ret << snapshot_.id(row);
+    return ret;
+  }
+
+  LibrarySnapshot snapshot_;
+};
+
+TEST_F(LibrarySnapshotTest, InternsStrings) {
+  AddSong(1, "Artist", "Album 1", 2000);
+  AddSong(2, "Artist", "Album 2", 2001);
+  AddSong(3, "", "Album 3", 2002);
+  AddSong(4, QString(), "Album 4", 2003);
+
+  EXPECT_EQ(4, snapshot_.count());
+  const int artist = snapshot_.StringId("Artist");
+  ASSERT_NE(-1, artist);
+  EXPECT_EQ("Artist", snapshot_.string(artist));
+  EXPECT_EQ(artist, snapshot_.value(Row(1), LibrarySnapshot::Column_Artist));
+  EXPECT_EQ(artist, snapshot_.value(Row(2), LibrarySnapshot::Column_Artist));
+
+  // Null and empty strings are the same thing.
+  EXPECT_EQ(snapshot_.value(Row(3), LibrarySnapshot::Column_Artist),
+            snapshot_.value(Row(4), LibrarySnapshot::Column_Artist));
+  EXPECT_EQ(-1, snapshot_.StringId("Nobody"));
+
+  EXPECT_EQ(QVariant("Album 2"),
+            snapshot_.variant(Row(2), LibrarySnapshot::Column_Album));
+  EXPECT_EQ(QVariant(2001),
+            snapshot_.variant(Row(2), LibrarySnapshot::Column_Year));
+}
+
+TEST_F(LibrarySnapshotTest, UnknownNumbersMatchTheDatabase) {
+  AddSong(1, "Artist", "Album", 0);
+  EXPECT_EQ(-1, snapshot_.value(Row(1), LibrarySnapshot::Column_Year));
+  EXPECT_EQ(-1, snapshot_.value(Row(1), LibrarySnapshot::Column_Disc));
+}
+
+TEST_F(LibrarySnapshotTest, UpdatesInPlace) {
+  AddSong(1, "Artist", "Album", 2000);
+  const int row = Row(1);
+  AddSong(1, "Other artist", "Album", 2000);
+
+  EXPECT_EQ(1, snapshot_.count());
+  EXPECT_EQ(row, Row(1));
+  EXPECT_EQ(QVariant("Other artist"),
+            snapshot_.variant(row, LibrarySnapshot::Column_Artist));
+}
+
+TEST_F(LibrarySnapshotTest, ReusesRemovedRows) {
+  AddSong(1, "Artist", "Album", 2000);
+  AddSong(2, "Artist", "Album", 2000);
+  const int row = Row(1);
+
+  snapshot_.Remove(1);
+  snapshot_.Remove(42);
+  EXPECT_EQ(1, snapshot_.count());
+  EXPECT_EQ(-1, snapshot_.id(row));
+  EXPECT_EQ(QVector<int>() << 2, Ids(snapshot_.Rows(0, nullptr)));
+
+  AddSong(3, "Artist", "Album", 2000);
+  EXPECT_EQ(2, snapshot_.row_count());
+  EXPECT_EQ(row, Row(3));
+}
+
+TEST_F(LibrarySnapshotTest, FiltersRows) {
+  AddSong(1, "Artist", "Album", 2000, 100);
+  AddSong(2, "Artist", "Album", 2000, 200);
+  AddSong(3, "Artist", "Album", 2000, 300);
+
+  EXPECT_EQ(QVector<int>() << 1 << 2 << 3, Ids(snapshot_.Rows(0, nullptr)));
+  EXPECT_EQ(QVector<int>() << 3, Ids(snapshot_.Rows(200, nullptr)));
+
+  QSet<int> ids;
+  ids << 1 << 3;
+  EXPECT_EQ(QVector<int>() << 1 << 3, Ids(snapshot_.Rows(0, &ids)));
+  EXPECT_EQ(QVector<int>() << 3, Ids(snapshot_.Rows(100, &ids)));
+}
+
+TEST_F(LibrarySnapshotTest, AddsQueryRows) {
+  // ROWID followed by kColumnSpec.
+  QList<QVariant> values;
+  values << 7 << "Artist" << "Album" << "Album artist" << "Composer"
+         << "Performer" << "Grouping" << "Genre" << 1999 << 1970 << 1970 << 2
+         << 320 << Song::Type_Flac << 1 << 12345;
+  snapshot_.Add(SqlRow(values));
+
+  ASSERT_EQ(1, snapshot_.count());
+  const int row = Row(7);
+  for (int i = 0; i < LibrarySnapshot::ColumnCount; ++i) {
+    EXPECT_EQ(values[i + 1].toString(),
+              snapshot_.variant(row, LibrarySnapshot::Column(i)).toString());
+  }
+}
+
+}  // namespace
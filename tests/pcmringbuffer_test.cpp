@@ -0,0 +1,121 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+#include "core/timeconstants.h"
+#include "engines/pcmringbuffer.h"
+
+namespace {
+
+std::vector<int16_t> Ramp(int start, int count) {
+  std::vector<int16_t> ret(count);
+  for (int i = 0; i < count; ++i) ret[i] = start + i;
+  return ret;
+}
+
+TEST(PcmRingBufferTest, CapacityIsPowerOfTwo) {
+  EXPECT_EQ(1024, PcmRingBuffer(1000).capacity());
+  EXPECT_EQ(1024, PcmRingBuffer(1024).capacity());
+}
+
+TEST(PcmRingBufferTest, NotEnoughSamples) {
+  PcmRingBuffer buffer(1024);
+  int16_t dest[100];
+  EXPECT_FALSE(buffer.Read(dest, 100, 0));
+
+  const std::vector<int16_t> samples = Ramp(0, 50);
+  buffer.Write(samples.data(), 50, 1, 0, 0);
+  EXPECT_FALSE(buffer.Read(dest, 100, 0));
+}
+
+TEST(PcmRingBufferTest, ReadsLatestSamples) {
+  PcmRingBuffer buffer(1024);
+  const std::vector<int16_t> samples = Ramp(0, 300);
+  buffer.Write(samples.data(), 300, 1, 0, 0);
+
+  int16_t dest[100];
+  ASSERT_TRUE(buffer.Read(dest, 100, 0));
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(200 + i, dest[i]);
+}
+
+TEST(PcmRingBufferTest, WrapsAround) {
+  PcmRingBuffer buffer(256);
+  for (int i = 0; i < 10; ++i) {
+    const std::vector<int16_t> samples = Ramp(i * 100, 100);
+    buffer.Write(samples.data(), 100, 1, 0, 0);
+  }
+
+  int16_t dest[100];
+  ASSERT_TRUE(buffer.Read(dest, 100, 0));
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(900 + i, dest[i]);
+}
+
+TEST(PcmRingBufferTest, FollowsPlaybackThroughChunk) {
+  PcmRingBuffer buffer(4096);
+  const std::vector<int16_t> samples = Ramp(0, 2000);
+
+  // 1000 samples per second, so the chunk lasts two seconds.  Only the
+  // window leading up to the current playback position is read.
+  buffer.Write(samples.data(), 1000, 1, 1000, 0);
+  buffer.Write(samples.data() + 1000, 1000, 1, 1000, kNsecPerSec);
+
+  int16_t dest[100];
+  ASSERT_TRUE(buffer.Read(dest, 100, kNsecPerSec + kNsecPerSec / 2));
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(1400 + i, dest[i]);
+
+  // Past the end of the chunk the latest samples are used.
+  ASSERT_TRUE(buffer.Read(dest, 100, 10 * kNsecPerSec));
+  for (int i = 0; i < 100; ++i) EXPECT_EQ(1900 + i, dest[i]);
+}
+
+TEST(PcmRingBufferTest, KeepsFramesTogether) {
+  PcmRingBuffer buffer(4096);
+  const std::vector<int16_t> samples = Ramp(0, 1000);
+  buffer.Write(samples.data(), 1000, 2, 1000, 0);
+
+  // 0.501 seconds in is sample 501, which is half way through a frame.
+  int16_t dest[100];
+  ASSERT_TRUE(buffer.Read(dest, 100, 501 * kNsecPerMsec));
+  EXPECT_EQ(400, dest[0]);
+}
+
+TEST(PcmRingBufferTest, ConcurrentReadsAreConsistent) {
+  PcmRingBuffer buffer(1024);
+
+  std::thread writer([&buffer]() {
+    for (int i = 0; i < 10000; ++i) {
+      const std::vector<int16_t> samples(64, i % 1000);
+      buffer.Write(samples.data(), 64, 1, 0, 0);
+    }
+  });
+
+  // Every successful read must be a run of whole chunks, not a mixture of
+  // old and new data in the same position.
+  int16_t dest[64];
+  for (int i = 0; i < 10000; ++i) {
+    if (buffer.Read(dest, 64, 0)) {
+      for (int j = 1; j < 64; ++j) ASSERT_EQ(dest[0], dest[j]);
+    }
+  }
+
+  writer.join();
+}
+
+}  // namespace
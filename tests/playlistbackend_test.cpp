@@ -0,0 +1,202 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+
+#include <QHash>
+#include <QSqlQuery>
+#include <QStringList>
+
+#include "core/database.h"
+#include "core/song.h"
+#include "gtest/gtest.h"
+#include "playlist/playlistbackend.h"
+#include "playlist/songplaylistitem.h"
+
+namespace {
+
+typedef QVector<qint64> Keys;
+
+const qint64 kGap = PlaylistBackend::kOrderKeyGap;
+
+void ExpectIncreasing(const Keys& keys) {
+  for (int i = 1; i < keys.count(); ++i) {
+    EXPECT_LT(keys[i - 1], keys[i]) << "at index " << i;
+  }
+}
+
+int CountChanged(const Keys& before, const Keys& after) {
+  int ret = 0;
+  for (int i = 0; i < before.count(); ++i) {
+    if (before[i] != after[i]) ++ret;
+  }
+  return ret;
+}
+
+TEST(PlaylistOrderKeysTest, Empty) {
+  EXPECT_TRUE(PlaylistBackend::AssignOrderKeys(Keys()).isEmpty());
+}
+
+TEST(PlaylistOrderKeysTest, NewPlaylist) {
+  const Keys keys = PlaylistBackend::AssignOrderKeys(Keys{-1, -1, -1});
+  EXPECT_EQ((Keys{kGap, 2 * kGap, 3 * kGap}), keys);
+}
+
+TEST(PlaylistOrderKeysTest, UnchangedKeysStay) {
+  const Keys before{1, 2, 3, 10, 20};
+  EXPECT_EQ(before, PlaylistBackend::AssignOrderKeys(before));
+}
+
+TEST(PlaylistOrderKeysTest, InsertInTheMiddle) {
+  const Keys before{kGap, 2 * kGap, -1, -1, 3 * kGap};
+  const Keys after = PlaylistBackend::AssignOrderKeys(before);
+  ExpectIncreasing(after);
+  EXPECT_EQ(2, CountChanged(before, after));
+}
+
+TEST(PlaylistOrderKeysTest, AppendAndPrepend) {
+  const Keys before{-1, kGap, 2 * kGap, -1};
+  const Keys after = PlaylistBackend::AssignOrderKeys(before);
+  ExpectIncreasing(after);
+  EXPECT_EQ(2, CountChanged(before, after));
+  EXPECT_GT(after[0], 0);
+}
+
+TEST(PlaylistOrderKeysTest, MoveOneItem) {
+  // The last item was moved to the front
+  const Keys before{5 * kGap, kGap, 2 * kGap, 3 * kGap, 4 * kGap};
+  const Keys after = PlaylistBackend::AssignOrderKeys(before);
+  ExpectIncreasing(after);
+  EXPECT_EQ(1, CountChanged(before, after));
+}
+
+TEST(PlaylistOrderKeysTest, Reverse) {
+  const Keys before{5, 4, 3, 2, 1};
+  const Keys after = PlaylistBackend::AssignOrderKeys(before);
+  ExpectIncreasing(after);
+}
+
+TEST(PlaylistOrderKeysTest, RenumbersWhenThereIsNoRoom) {
+  const Keys before{1, -1, 2};
+  const Keys after = PlaylistBackend::AssignOrderKeys(before);
+  EXPECT_EQ((Keys{kGap, 2 * kGap, 3 * kGap}), after);
+}
+
+class PlaylistBackendSaveTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    database_.reset(new MemoryDatabase(nullptr));
+    backend_.reset(new PlaylistBackend(nullptr, database_.get()));
+    playlist_ = backend_->CreatePlaylist("Test", QString());
+  }
+
+  PlaylistItemPtr MakeItem(const QString& title) {
+    Song song;
+    song.Init(title, "Artist", "Album", 123);
+    song.set_url(QUrl::fromLocalFile("/tmp/" + title + ".mp3"));
+    return PlaylistItemPtr(new SongPlaylistItem(song));
+  }
+
+  void Save(const PlaylistItemList& items) {
+    backend_->SavePlaylist(playlist_, items, 0,
+                           smart_playlists::GeneratorPtr());
+  }
+
+  // Reads the rows straight from the database.  Loading them through the
+  // backend would make it compare the next save against the loaded items.
+  QStringList SavedTitles() {
+    QStringList ret;
+    QSqlQuery q(database_->Connect());
+    q.prepare(
+        "SELECT title FROM playlist_items WHERE playlist = :id"
+        " ORDER BY position");
+    q.bindValue(":id", playlist_);
+    q.exec();
+    while (q.next()) ret << q.value(0).toString();
+    return ret;
+  }
+
+  // Title -> ROWID
+  QHash<QString, int> SavedRowIds() {
+    QHash<QString, int> ret;
+    QSqlQuery q(database_->Connect());
+    q.prepare("SELECT title, ROWID FROM playlist_items WHERE playlist = :id");
+    q.bindValue(":id", playlist_);
+    q.exec();
+    while (q.next()) ret[q.value(0).toString()] = q.value(1).toInt();
+    return ret;
+  }
+
+  int RowCount() {
+    QSqlQuery q(database_->Connect());
+    q.prepare("SELECT COUNT(*) FROM playlist_items WHERE playlist = :id");
+    q.bindValue(":id", playlist_);
+    q.exec();
+    return q.next() ? q.value(0).toInt() : -1;
+  }
+
+  std::unique_ptr<MemoryDatabase> database_;
+  std::unique_ptr<PlaylistBackend> backend_;
+  int playlist_;
+};
+
+TEST_F(PlaylistBackendSaveTest, IncrementalSaves) {
+  PlaylistItemList items;
+  items << MakeItem("a") << MakeItem("b") << MakeItem("c");
+  Save(items);
+  EXPECT_EQ((QStringList{"a", "b", "c"}), SavedTitles());
+  QHash<QString, int> row_ids = SavedRowIds();
+
+  // Insert in the middle.  Only the new item gets a row.
+  items.insert(1, MakeItem("d"));
+  Save(items);
+  EXPECT_EQ((QStringList{"a", "d", "b", "c"}), SavedTitles());
+  ASSERT_TRUE(SavedRowIds().contains("d"));
+  row_ids["d"] = SavedRowIds()["d"];
+  EXPECT_EQ(row_ids, SavedRowIds());
+
+  // Move the last item to the front.  Its row is reordered, not rewritten.
+  items.prepend(items.takeLast());
+  Save(items);
+  EXPECT_EQ((QStringList{"c", "a", "d", "b"}), SavedTitles());
+  EXPECT_EQ(row_ids, SavedRowIds());
+
+  // Remove one
+  items.removeAt(2);
+  Save(items);
+  EXPECT_EQ((QStringList{"c", "a", "b"}), SavedTitles());
+  EXPECT_EQ(3, RowCount());
+  row_ids.remove("d");
+  EXPECT_EQ(row_ids, SavedRowIds());
+}
+
+TEST_F(PlaylistBackendSaveTest, SaveAfterReload) {
+  PlaylistItemList items;
+  items << MakeItem("a") << MakeItem("b") << MakeItem("c");
+  Save(items);
+
+  // Saves compare against the reloaded items from now on
+  PlaylistItemList loaded = backend_->GetPlaylistItems(playlist_);
+  ASSERT_EQ(3, loaded.count());
+  loaded.move(0, 2);
+  loaded.insert(0, MakeItem("d"));
+  Save(loaded);
+
+  EXPECT_EQ((QStringList{"d", "b", "c", "a"}), SavedTitles());
+  EXPECT_EQ(4, RowCount());
+}
+
+}  // namespace
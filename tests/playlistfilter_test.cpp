@@ -0,0 +1,144 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QSortFilterProxyModel>
+#include <QStringList>
+
+#include "core/song.h"
+#include "gtest/gtest.h"
+#include "playlist/playlist.h"
+#include "playlist/songplaylistitem.h"
+
+namespace {
+
+// Checks that the filter's cached index and per-row results follow changes
+// made to the playlist after the query was entered.
+class PlaylistFilterTest : public ::testing::Test {
+ protected:
+  PlaylistFilterTest() : playlist_(nullptr, nullptr, nullptr, 1) {}
+
+  Song MakeSong(const QString& title, const QString& artist) {
+    Song song;
+    song.Init(title, artist, "Album", 123);
+    song.set_url(QUrl::fromLocalFile("/tmp/" + title + ".mp3"));
+    return song;
+  }
+
+  PlaylistItemPtr MakeItem(const QString& title,
+                           const QString& artist = "Artist") {
+    return PlaylistItemPtr(new SongPlaylistItem(MakeSong(title, artist)));
+  }
+
+  void SetFilter(const QString& text) {
+    playlist_.proxy()->setFilterFixedString(text);
+  }
+
+  QStringList FilteredTitles() {
+    QSortFilterProxyModel* proxy = playlist_.proxy();
+    QStringList ret;
+    for (int i = 0; i < proxy->rowCount(); ++i) {
+      ret << proxy->index(i, Playlist::Column_Title).data().toString();
+    }
+    return ret;
+  }
+
+  Playlist playlist_;
+};
+
+TEST_F(PlaylistFilterTest, Query) {
+  playlist_.InsertItems(PlaylistItemList() << MakeItem("Apple")
+                                           << MakeItem("Banana")
+                                           << MakeItem("Cherry", "Banana"));
+
+  SetFilter("banana");
+  EXPECT_EQ((QStringList{"Banana", "Cherry"}), FilteredTitles());
+
+  SetFilter("title:banana");
+  EXPECT_EQ((QStringList{"Banana"}), FilteredTitles());
+
+  SetFilter("");
+  EXPECT_EQ(3, FilteredTitles().count());
+}
+
+TEST_F(PlaylistFilterTest, ChangedMetadata) {
+  PlaylistItemPtr apple = MakeItem("Apple");
+  playlist_.InsertItems(PlaylistItemList() << apple << MakeItem("Banana"));
+
+  SetFilter("an");
+  EXPECT_EQ((QStringList{"Banana"}), FilteredTitles());
+
+  // Same item, new Song data
+  apple->SetTemporaryMetadata(MakeSong("Mango", "Artist"));
+  playlist_.ItemChanged(apple);
+  EXPECT_EQ((QStringList{"Mango", "Banana"}), FilteredTitles());
+
+  apple->ClearTemporaryMetadata();
+  playlist_.ItemChanged(apple);
+  EXPECT_EQ((QStringList{"Banana"}), FilteredTitles());
+}
+
+TEST_F(PlaylistFilterTest, ReplacedItem) {
+  playlist_.InsertItems(PlaylistItemList() << MakeItem("Apple")
+                                           << MakeItem("Banana"));
+
+  SetFilter("orange");
+  EXPECT_TRUE(FilteredTitles().isEmpty());
+
+  // A new item for the same URL
+  playlist_.UpdateItems(SongList() << MakeSong("Apple", "Orange"));
+  EXPECT_EQ((QStringList{"Apple"}), FilteredTitles());
+}
+
+TEST_F(PlaylistFilterTest, InsertedAndRemovedRows) {
+  playlist_.InsertItems(PlaylistItemList() << MakeItem("Apple")
+                                           << MakeItem("Banana")
+                                           << MakeItem("Cherry"));
+
+  SetFilter("an");
+  EXPECT_EQ((QStringList{"Banana"}), FilteredTitles());
+
+  // Rows after the insertion point move down
+  playlist_.InsertItems(PlaylistItemList() << MakeItem("Mango"), 0);
+  EXPECT_EQ((QStringList{"Mango", "Banana"}), FilteredTitles());
+
+  playlist_.InsertItems(PlaylistItemList() << MakeItem("Orange"));
+  EXPECT_EQ((QStringList{"Mango", "Banana", "Orange"}), FilteredTitles());
+
+  // And back up again
+  playlist_.removeRows(0, 2);
+  EXPECT_EQ((QStringList{"Banana", "Orange"}), FilteredTitles());
+
+  playlist_.removeRows(0, 1);
+  EXPECT_EQ((QStringList{"Orange"}), FilteredTitles());
+}
+
+TEST_F(PlaylistFilterTest, ManyRows) {
+  // Enough for the rows to be tested in several chunks.
+  PlaylistItemList items;
+  for (int i = 0; i < 10000; ++i) {
+    items << MakeItem(QString("Title %1").arg(i),
+                      i % 3 == 0 ? "Banana" : "Apple");
+  }
+  playlist_.InsertItems(items);
+
+  SetFilter("banana");
+  const QStringList titles = FilteredTitles();
+  ASSERT_EQ(3334, titles.count());
+  EXPECT_EQ("Title 0", titles.first());
+  EXPECT_EQ("Title 9999", titles.last());
+}
+
+}  // namespace
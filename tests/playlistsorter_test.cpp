@@ -0,0 +1,157 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <functional>
+
+#include "core/timeconstants.h"
+#include "playlist/playlist.h"
+#include "playlist/playlistsorter.h"
+#include "playlist/songplaylistitem.h"
+#include "test_utils.h"
+
+#include "gtest/gtest.h"
+
+using std::placeholders::_1;
+using std::placeholders::_2;
+
+namespace {
+
+// Lots of duplicates so the sort has to be stable.
+PlaylistItemList MakeItems(int count) {
+  static const char* kWords[] = {"the beatles", "abba", "Zappa", "the who",
+                                 "Blur", "air", ""};
+  static const int kWordCount = sizeof(kWords) / sizeof(kWords[0]);
+
+  PlaylistItemList ret;
+  unsigned int state = 1;
+  auto next = [&state](int max) {
+    state = state * 1103515245 + 12345;
+    return int((state >> 16) % max);
+  };
+
+  for (int i = 0; i < count; ++i) {
+    Song song;
+    song.Init(kWords[next(kWordCount)], kWords[next(kWordCount)],
+              kWords[next(kWordCount)], next(400) * kNsecPerSec);
+    song.set_disc(next(3) - 1);
+    song.set_track(next(20) - 1);
+    song.set_year(1960 + next(50));
+    song.set_rating(next(11) / 10.0);
+    song.set_url(QUrl::fromLocalFile(QString("/music/%1/%2/%3.mp3")
+                                         .arg(kWords[next(kWordCount)])
+                                         .arg(next(3) ? "cd" : "")
+                                         .arg(i)));
+    ret << PlaylistItemPtr(new SongPlaylistItem(song));
+  }
+  return ret;
+}
+
+// What Playlist::sort did before it used PlaylistSorter.
+PlaylistItemList ExpectedOrder(const PlaylistItemList& items, int column,
+                               Qt::SortOrder order, const QStringList& p) {
+  PlaylistItemList ret(items);
+  auto by = [&](int c) {
+    std::stable_sort(ret.begin(), ret.end(),
+                     std::bind(&Playlist::CompareItems, c, order, _1, _2, p));
+  };
+
+  if (column == Playlist::Column_Album) {
+    by(Playlist::Column_Track);
+    by(Playlist::Column_Disc);
+    by(Playlist::Column_Album);
+  } else if (column == Playlist::Column_Filename) {
+    by(Playlist::Column_Filename);
+    std::stable_sort(ret.begin(), ret.end(), [order](PlaylistItemPtr a,
+                                                     PlaylistItemPtr b) {
+      if (order == Qt::DescendingOrder) std::swap(a, b);
+      return a->Url().path().count('/') < b->Url().path().count('/');
+    });
+  } else {
+    by(column);
+  }
+  return ret;
+}
+
+void ExpectSameOrder(const PlaylistItemList& expected,
+                     const PlaylistItemList& actual) {
+  ASSERT_EQ(expected.count(), actual.count());
+  for (int i = 0; i < expected.count(); ++i) {
+    ASSERT_EQ(expected[i].get(), actual[i].get()) << "at row " << i;
+  }
+}
+
+class PlaylistSorterTest
+    : public ::testing::TestWithParam<std::tuple<int, Qt::SortOrder>> {};
+
+TEST_P(PlaylistSorterTest, MatchesCompareItems) {
+  const int column = std::get<0>(GetParam());
+  const Qt::SortOrder order = std::get<1>(GetParam());
+  const PlaylistItemList items = MakeItems(500);
+
+  PlaylistItemList actual(items);
+  PlaylistSorter(column, order).Sort(&actual);
+  ExpectSameOrder(ExpectedOrder(items, column, order, QStringList()), actual);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Columns, PlaylistSorterTest,
+    ::testing::Combine(
+        ::testing::Values(Playlist::Column_Title, Playlist::Column_Artist,
+                          Playlist::Column_Album, Playlist::Column_Length,
+                          Playlist::Column_Disc, Playlist::Column_Year,
+                          Playlist::Column_Rating, Playlist::Column_Filename,
+                          Playlist::Column_Source),
+        ::testing::Values(Qt::AscendingOrder, Qt::DescendingOrder)));
+
+TEST(PlaylistSorterTest, IgnoresPrefixes) {
+  const QStringList prefixes = QStringList() << "the ";
+  const PlaylistItemList items = MakeItems(500);
+
+  PlaylistItemList actual(items);
+  PlaylistSorter(Playlist::Column_Artist, Qt::AscendingOrder, prefixes)
+      .Sort(&actual);
+  ExpectSameOrder(ExpectedOrder(items, Playlist::Column_Artist,
+                                Qt::AscendingOrder, prefixes),
+                  actual);
+}
+
+TEST(PlaylistSorterTest, LeavesItemsBeforeBeginAlone) {
+  const PlaylistItemList items = MakeItems(100);
+
+  PlaylistItemList actual(items);
+  PlaylistSorter(Playlist::Column_Title, Qt::AscendingOrder).Sort(&actual, 40);
+
+  PlaylistItemList expected = ExpectedOrder(
+      items.mid(40), Playlist::Column_Title, Qt::AscendingOrder, {});
+  expected = items.mid(0, 40) + expected;
+  ExpectSameOrder(expected, actual);
+}
+
+TEST(PlaylistSorterTest, SortsLargePlaylistsInParallel) {
+  const PlaylistItemList items =
+      MakeItems(PlaylistSorter::kParallelThreshold * 3 + 7);
+
+  for (Qt::SortOrder order : {Qt::AscendingOrder, Qt::DescendingOrder}) {
+    PlaylistItemList actual(items);
+    PlaylistSorter(Playlist::Column_Album, order).Sort(&actual);
+    ExpectSameOrder(
+        ExpectedOrder(items, Playlist::Column_Album, order, QStringList()),
+        actual);
+  }
+}
+
+}  // namespace
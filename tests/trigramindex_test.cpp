@@ -0,0 +1,90 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "globalsearch/trigramindex.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+class TrigramIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    index_.Add(QStringList() << "rock" << "Radio Paradise");
+    index_.Add(QStringList() << "jazz" << "Groove Salad");
+    index_.Add(QStringList() << "" << "Secret Agent");
+    index_.Add(QStringList() << "rockabilly" << "DEF CON Radio");
+  }
+
+  QVector<int> Match(const QString& query) const {
+    return index_.Match(query.split(' '));
+  }
+
+  TrigramIndex index_;
+};
+
+TEST_F(TrigramIndexTest, AssignsIdsInOrder) {
+  EXPECT_EQ(4, index_.count());
+  EXPECT_EQ(4, index_.Add(QStringList() << "ambient"));
+  EXPECT_EQ(5, index_.count());
+}
+
+TEST_F(TrigramIndexTest, EmptyQueryMatchesEverything) {
+  EXPECT_EQ(QVector<int>() << 0 << 1 << 2 << 3, Match(""));
+}
+
+TEST_F(TrigramIndexTest, ShortTokens) {
+  EXPECT_EQ(QVector<int>() << 0 << 1 << 3, Match("o"));
+  EXPECT_EQ(QVector<int>() << 0 << 3, Match("ra"));
+  EXPECT_EQ(QVector<int>() << 1, Match("jaz"));
+  EXPECT_EQ(QVector<int>(), Match("x"));
+}
+
+TEST_F(TrigramIndexTest, LongTokens) {
+  EXPECT_EQ(QVector<int>() << 0 << 3, Match("radio"));
+  EXPECT_EQ(QVector<int>() << 3, Match("rockab"));
+  EXPECT_EQ(QVector<int>() << 2, Match("agent"));
+}
+
+TEST_F(TrigramIndexTest, IgnoresCase) {
+  EXPECT_EQ(QVector<int>() << 0 << 3, Match("RADIO"));
+  EXPECT_EQ(QVector<int>() << 3, Match("def"));
+}
+
+TEST_F(TrigramIndexTest, ChecksTrigramOrder) {
+  // Every trigram of "paradio" is in "radio paradise".
+  EXPECT_EQ(QVector<int>(), Match("paradio"));
+}
+
+TEST_F(TrigramIndexTest, DoesNotMatchAcrossFields) {
+  EXPECT_EQ(QVector<int>(), Match("kr"));
+  EXPECT_EQ(QVector<int>(), Match("rockradio"));
+}
+
+TEST_F(TrigramIndexTest, AllTokensMustMatch) {
+  EXPECT_EQ(QVector<int>() << 0 << 3, Match("rock radio"));
+  EXPECT_EQ(QVector<int>() << 3, Match("radio def"));
+  EXPECT_EQ(QVector<int>(), Match("rock jazz"));
+}
+
+TEST_F(TrigramIndexTest, Clear) {
+  index_.Clear();
+  EXPECT_EQ(0, index_.count());
+  EXPECT_EQ(QVector<int>(), Match("rock"));
+  EXPECT_EQ(QVector<int>(), Match(""));
+}
+
+}  // namespace
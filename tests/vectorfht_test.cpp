@@ -0,0 +1,167 @@
+/* This file is part of Clementine.
+
+   Clementine is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Clementine is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Clementine.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "analyzers/fht.h"
+#include "analyzers/vectorfht.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// A couple of sines plus some deterministic noise, like a real scope.
+std::vector<float> MakeSignal(int size, int seed = 1) {
+  std::vector<float> ret(size);
+  unsigned int state = seed;
+  for (int i = 0; i < size; ++i) {
+    state = state * 1103515245 + 12345;
+    const float noise = ((state >> 16) & 0x7fff) / 32768.0f - 0.5f;
+    ret[i] = 0.5f * std::sin(2 * M_PI * 5 * i / size) +
+             0.25f * std::sin(2 * M_PI * 37 * i / size) + 0.1f * noise;
+  }
+  return ret;
+}
+
+void ExpectNear(const std::vector<float>& expected,
+                const std::vector<float>& actual, int count, float tolerance) {
+  for (int i = 0; i < count; ++i) {
+    EXPECT_NEAR(expected[i], actual[i],
+                tolerance * std::max(1.0f, std::fabs(expected[i])))
+        << "at index " << i;
+  }
+}
+
+class VectorFHTTest : public ::testing::TestWithParam<int> {};
+
+TEST_P(VectorFHTTest, TransformMatchesFHT) {
+  const int exp = GetParam();
+  FHT fht(exp);
+  VectorFHT vector_fht(exp);
+  ASSERT_EQ(fht.size(), vector_fht.size());
+  ASSERT_EQ(fht.sizeExp(), vector_fht.sizeExp());
+
+  std::vector<float> expected = MakeSignal(fht.size());
+  std::vector<float> actual = expected;
+  fht.transform(expected.data());
+  vector_fht.transform(actual.data());
+  ExpectNear(expected, actual, fht.size(), 1e-4);
+}
+
+TEST_P(VectorFHTTest, SpectrumMatchesFHT) {
+  const int exp = GetParam();
+  FHT fht(exp);
+  VectorFHT vector_fht(exp);
+
+  std::vector<float> expected = MakeSignal(fht.size(), 2);
+  std::vector<float> actual = expected;
+  fht.spectrum(expected.data());
+  vector_fht.spectrum(actual.data());
+  ExpectNear(expected, actual, fht.size() / 2, 1e-4);
+}
+
+TEST_P(VectorFHTTest, Power2MatchesFHT) {
+  const int exp = GetParam();
+  FHT fht(exp);
+  VectorFHT vector_fht(exp);
+
+  std::vector<float> expected = MakeSignal(fht.size(), 3);
+  std::vector<float> actual = expected;
+  fht.power2(expected.data());
+  vector_fht.power2(actual.data());
+  ExpectNear(expected, actual, fht.size() / 2, 1e-4);
+}
+
+TEST_P(VectorFHTTest, LogSpectrumMatchesFHT) {
+  const int exp = GetParam();
+  FHT fht(exp);
+  VectorFHT vector_fht(exp);
+
+  // Run twice to exercise the cached log index map.
+  for (int seed = 4; seed < 6; ++seed) {
+    std::vector<float> input = MakeSignal(fht.size(), seed);
+    std::vector<float> fht_input = input;
+    std::vector<float> expected(fht.size() / 2);
+    std::vector<float> actual(fht.size() / 2);
+    fht.logSpectrum(expected.data(), fht_input.data());
+    vector_fht.logSpectrum(actual.data(), input.data());
+    ExpectNear(expected, actual, fht.size() / 2, 1e-3);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(Sizes, VectorFHTTest,
+                        ::testing::Values(3, 4, 7, 9, 11));
+
+TEST(VectorFHTTest, SilenceGivesZeroDecibels) {
+  VectorFHT vector_fht(9);
+  std::vector<float> input(vector_fht.size(), 0.0f);
+  std::vector<float> out(vector_fht.size() / 2, -1.0f);
+  vector_fht.logSpectrum(out.data(), input.data());
+  for (float value : out) EXPECT_EQ(0.0f, value);
+}
+
+TEST(VectorFHTTest, ScaleAndEwmaTouchHalfTheValues) {
+  VectorFHT vector_fht(4);
+  std::vector<float> d(16, 2.0f);
+  std::vector<float> s(16, 4.0f);
+  vector_fht.scale(d.data(), 0.5f);
+  vector_fht.ewma(d.data(), s.data(), 0.25f);
+  for (int i = 0; i < 8; ++i) EXPECT_FLOAT_EQ(3.25f, d[i]);
+  for (int i = 8; i < 16; ++i) EXPECT_FLOAT_EQ(2.0f, d[i]);
+}
+
+// Microbenchmark.  Disabled by default; run it with
+//   ./vectorfht_test --gtest_also_run_disabled_tests
+//       --gtest_filter='*Benchmark*'
+template <typename T>
+double MicrosecondsPerCall(T* fht, bool log_spectrum) {
+  const int kIterations = 20000;
+  const std::vector<float> signal = MakeSignal(fht->size());
+  std::vector<float> scratch(fht->size());
+  std::vector<float> out(fht->size() / 2);
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    scratch = signal;
+    if (log_spectrum) {
+      fht->logSpectrum(out.data(), scratch.data());
+    } else {
+      fht->spectrum(scratch.data());
+    }
+  }
+  const std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / kIterations;
+}
+
+TEST(VectorFHTTest, DISABLED_Benchmark) {
+  printf("VectorFHT kernels: %s\n", VectorFHT::InstructionSet());
+  for (int exp : {7, 9, 11}) {
+    FHT fht(exp);
+    VectorFHT vector_fht(exp);
+    for (bool log_spectrum : {false, true}) {
+      const double scalar = MicrosecondsPerCall(&fht, log_spectrum);
+      const double vector = MicrosecondsPerCall(&vector_fht, log_spectrum);
+      printf("%5d points %-12s FHT %8.2f us  VectorFHT %8.2f us  (%.1fx)\n",
+             1 << exp, log_spectrum ? "logSpectrum" : "spectrum", scalar,
+             vector, scalar / vector);
+    }
+  }
+}
+
+}  // namespace